@@ -13,7 +13,9 @@ extern "C" {
 #include "avl_tree.h"
 #include "blocks_db.h"
 #include "utxoes_db.h"
+#include "utxoes_cache.h"
 #include "transactions_db.h"
+#include "block_files.h"
 #include "chains.h"
 
 typedef struct bitcoin_blockchain
@@ -27,7 +29,9 @@ typedef struct bitcoin_blockchain
 	db_engine_t * engine;
 	blocks_db_t block_db[1];
 	utxoes_db_t utxo_db[1];
+	utxoes_cache_t utxo_cache[1];	// write-back cache in front of utxo_db
 	transactions_db_t tx_db[1];
+	block_file_store_t block_store[1];	// block data (blk*.dat), used to connect blocks that are not passed to add_block()
 	
 	// mempool
 	avl_tree_t mem_db[1];
@@ -40,12 +44,28 @@ typedef struct bitcoin_blockchain
 	
 	// callbacks
 	int (* on_add_block)(blockchain_t * bchain, const uint256_t * block_hash, int height, void * user_data);
+	int (* on_add_blocks)(blockchain_t * bchain, const uint256_t block_hashes[], int start_height, ssize_t count, void * user_data);	// add_batch()
 	int (* on_remove_block)(blockchain_t * bchain, const uint256_t * block_hash, int height, void * user_data);
 
 	// public functions
 	int (* load_config)(struct bitcoin_blockchain * bitcoin, json_object * jconfig);
 	int (* run)(struct bitcoin_blockchain * bitcoin, int async_mode);
 	int (* stop)(struct bitcoin_blockchain * bitcoin);
+	
+	/**
+	 * prefetch_block(): call as soon as a block is parsed (before the script validation),
+	 * 	the prevouts are loaded into utxo_cache by the prefetch workers, 
+	 * 	on_add_block() waits for them, so the coins are in memory when the block is connected.
+	 */
+	ssize_t (* prefetch_block)(struct bitcoin_blockchain * bitcoin, const satoshi_block_t * block);
+	
+	/**
+	 * add_block(): prefetch_block() + main_chain->add(), 
+	 * 	the block's coins are connected to utxo_cache once its header is on the main chain.
+	 * 	Blocks added by header only (e.g. add_batch()) are connected later, 
+	 * 	when their data can be loaded from block_store, the utxoes stay behind until then.
+	 */
+	enum blockchain_error (* add_block)(struct bitcoin_blockchain * bitcoin, const satoshi_block_t * block);
 
 }bitcoin_blockchain_t;
 bitcoin_blockchain_t * bitcoin_blockchain_init(bitcoin_blockchain_t * bitcoin, void * user_data);
@@ -0,0 +1,109 @@
+#ifndef _BLOCK_FILES_H_
+#define _BLOCK_FILES_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "satoshi-types.h"
+#include "blocks_db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * block files (blk(nnnnn).dat):
+ * 	a sequence of records: [magic(uint32)][block_size(uint32)][block_data(block_size)],
+ * 	the tail of a file may be zero-filled (preallocated space).
+ */
+struct block_file_record_header
+{
+	uint32_t magic;
+	uint32_t length;
+}__attribute__((packed));
+
+typedef struct block_file_entry
+{
+	uint256_t hash;
+	struct satoshi_block_header hdr;
+	int64_t file_index;
+	int64_t start_pos;		// offset of the block_data (just after the record header)
+	uint32_t block_size;
+}block_file_entry_t;
+
+/**
+ * block_file_scan_callback:
+ * @return 0 to continue, non-zero to stop scanning.
+ */
+typedef int (* block_file_scan_callback)(const block_file_entry_t * entry, void * user_data);
+
+int64_t block_file_get_index(const char * block_file);	// "blk00012.dat" ==> 12, -1 on error
+
+/**
+ * block_file_scan:
+ * 	read the 80-byte header of each record (one pread per block) and skip the block body.
+ * 	Headers are hashed in batches (sha256d80_batch).
+ * 	On error, the valid records before the bad one are still passed to the callback.
+ * 
+ * @return the number of blocks found, or -1 on error (bad magic, truncated record or io error).
+ */
+ssize_t block_file_scan(const char * block_file, uint32_t magic, int64_t file_index, 
+	block_file_scan_callback callback, void * user_data);
+	
+/**
+ * block_files_scan_dir:
+ * 	scan blk00000.dat, blk00001.dat, ... in order, until a file is missing.
+ */
+ssize_t block_files_scan_dir(const char * blocks_dir, uint32_t magic, 
+	block_file_scan_callback callback, void * user_data);
+
+/**
+ * block_file_entry_to_record:
+ * 	fill a db record for blocks_db->add(), the height is unknown (-1) until the block is connected.
+ */
+void block_file_entry_to_record(const block_file_entry_t * entry, uint32_t magic, db_record_block_t * record);
+
+/**
+ * block_file_store:
+ * 	read-only mmap of the block files, blocks are returned as {pointer, length} into the mapping.
+ * 	The files are mapped on first use and remapped when they grow.
+ * 	Returned pointers stay valid until block_file_store_cleanup().
+ */
+struct satoshi_block_view;
+typedef struct block_file_store
+{
+	void * priv;
+	void * user_data;
+	blocks_db_t * db;
+	uint32_t magic;
+	
+	/**
+	 * get:
+	 * 	locate a block by its file position (db_record_block.file_index / start_pos).
+	 * @return the block size, or -1 if not found or the record header mismatched.
+	 */
+	ssize_t (* get)(struct block_file_store * store, int64_t file_index, int64_t start_pos, 
+		const unsigned char ** p_data);
+	
+	/**
+	 * find: look up the file position by blocks_db->find(), then get()
+	 */
+	ssize_t (* find)(struct block_file_store * store, db_engine_txn_t * txn, const uint256_t * hash, 
+		const unsigned char ** p_data);
+	
+	/**
+	 * find_view: find() + satoshi_block_view_parse() on the mapped data
+	 */
+	ssize_t (* find_view)(struct block_file_store * store, db_engine_txn_t * txn, const uint256_t * hash, 
+		struct satoshi_block_view * view);
+}block_file_store_t;
+block_file_store_t * block_file_store_init(block_file_store_t * store, 
+	const char * blocks_dir, uint32_t magic, 
+	blocks_db_t * db, 
+	void * user_data);
+void block_file_store_cleanup(block_file_store_t * store);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -10,6 +10,36 @@ extern "C" {
 
 struct block_info;
 
+/**
+ * struct block_hash_index
+ * @details
+ *   open-addressing (linear probing) hash table, used to find a block by its hash.
+ *   Block hashes are already uniformly distributed, so the first 8 bytes are used 
+ *   as the key directly and kept in the slot, the full hash is only compared on a key hit.
+ * 
+ *   slot.value: 0 means an empty slot,
+ *     blockchain stores (height + 1), active_chain_list stores (block_info_t *)
+ */
+struct block_hash_slot
+{
+	uint64_t key;
+	intptr_t value;
+};
+typedef struct block_hash_index
+{
+	struct block_hash_slot * slots;
+	size_t mask;	// (num_slots - 1), num_slots is always a power of 2
+	ssize_t count;
+	
+	void * user_data;
+	// returns the full hash of the item which the 'value' refers to
+	const uint256_t * (* get_hash)(struct block_hash_index * index, intptr_t value);
+}block_hash_index_t;
+block_hash_index_t * block_hash_index_init(block_hash_index_t * index, ssize_t size,
+	const uint256_t * (* get_hash)(struct block_hash_index * index, intptr_t value), 
+	void * user_data);
+void block_hash_index_cleanup(block_hash_index_t * index);
+
 /**
  * struct active_chain 
  * struct active_chain_list
@@ -52,7 +82,7 @@ typedef struct block_info
 	int height;		// the index in the blockchain, -1 means not attached to any chains
 //	double cumulative_difficulty;
 
-	compact_uint256_t cumulative_difficulty;	// use compact_uint256 to represent cumulative difficulty.
+	uint256_int_t cumulative_difficulty;	// the exact chainwork, sum of 2^256 / (target + 1)
 	
 	struct block_info * parent;	// there can be only one parent for each block
 	struct block_info * first_child;	// the first child will belong to the longest-chain
@@ -80,7 +110,7 @@ typedef struct active_chain
 	 * In order to simplify the implementation, we defined the following sub-rules:
 	 * 
 		- Define 'head' as the currently unknown parent that orphan-nodes of the chain are looking for;
-		- The 'head->hash' will also need to be added to the chains-list's search-root.
+		- The 'head->hash' will also need to be added to the chains-list's search-index.
 		- Except for the 'head', any nodes on the chain must have a non-null parent pointer,
 		  This also means that if the parent of a node is NULL, the node must be the 'head'
 		
@@ -96,16 +126,16 @@ typedef struct active_chain
 	struct block_info * longest_end; // used to quickly find the longest-chain within current branch
 	
 	/**
-	 * A pointer to the search-root of chains-list, 
-	 * used to update the search-tree when adding or deleting a child-node.
+	 * A pointer to the search-index of chains-list, 
+	 * used to update the search-index when adding or deleting a child-node.
 	 */
-	void ** p_search_root;
+	struct block_hash_index * p_search_index;
 	
 	// add child to 'head'
 	int (* add_child)(struct active_chain * chain, struct block_info * child);
 	
 }active_chain_t;
-active_chain_t * active_chain_new(block_info_t * orphan, void ** p_search_root);
+active_chain_t * active_chain_new(block_info_t * orphan, struct block_hash_index * p_search_index);
 void active_chain_free(active_chain_t * chain);
 
 typedef struct active_chain_list
@@ -114,12 +144,12 @@ typedef struct active_chain_list
 	ssize_t count;
 	active_chain_t ** chains;
 	
-	void * search_root;	// tsearch root, used to find if a block is already in the list.
+	struct block_hash_index search_index[1];	// used to find if a block is already in the list.
 	void * user_data;
 	
 	block_info_t * (* find_node)(struct active_chain_list * list, const uint256_t * hash, active_chain_t ** p_chain);
 	
-	// add or remove the node from the 'search-tree' 
+	// add or remove the node from the 'search-index' 
 	int (* search_tree_add)(struct active_chain_list * list, block_info_t * node); 
 	int (* search_tree_remove)(struct active_chain_list * list, block_info_t * node); 
 	
@@ -134,8 +164,9 @@ void active_chain_list_cleanup(active_chain_list_t * list);
  * struct blockchain_heir
  * @details
  * 
- * Individuals on the verified chain, since it need to be stored in memory.
- * the size of the struct needs to be limited as small as possible.
+ * Individuals on the verified chain. 
+ * The chain itself keeps them column by column (struct blockchain_heirs), 
+ * this struct is only a copy of one row, returned by blockchain->find() / blockchain->get().
  * 
  * Unlike 'satoshi_block_header', this structure cannot prove the genuineness of itself by itself.
  * so do not add it directly to the BLOCKCHAIN, only appending block_header is allowed.
@@ -146,9 +177,26 @@ typedef struct blockchain_heir
 	uint64_t timestamp;	// add support for BIP0113 (Median time-past as endpoint for lock-time calculations)
 	
 	uint32_t bits;		// current target
-	compact_uint256_t cumulative_difficulty;
+	uint256_int_t cumulative_difficulty;	// chainwork
 }blockchain_heir_t;
 
+/**
+ * struct blockchain_heirs
+ * @details
+ * 
+ * Heirs on the verified chain, stored as parallel arrays (indexed by height), 
+ * since they need to be stored in memory. 
+ * Scans such as median-time-past, difficulty retarget or cumulative-difficulty 
+ * only touch the columns they need.
+ */
+struct blockchain_heirs
+{
+	uint256_t * hashes;
+	uint64_t * timestamps;
+	uint32_t * bits;
+	uint256_int_t * cumulative_difficulties;	// chainwork
+};
+
 
 
 enum blockchain_error
@@ -157,6 +205,7 @@ enum blockchain_error
 	blockchain_error_no_error = 0,
 	blockchain_error_duplicated_block = 1,
 	blockchain_error_duplicated_tx = 2,
+	blockchain_error_invalid_pow = 3,
 };
 
 /**
@@ -167,31 +216,57 @@ enum blockchain_error
  */ 
 typedef struct blockchain
 {
-	blockchain_heir_t * heirs;
-	ssize_t max_size;
+	struct blockchain_heirs heirs[1];
+	ssize_t max_size;	// capacity of the heirs' columns, grows geometrically
 	ssize_t height;
 	
-	void * search_root;
+	struct block_hash_index search_index[1];	// hash ==> height
 	void * user_data;
 	struct active_chain_list candidates_list[1];
 	
 	// public functions
-	const blockchain_heir_t * (*find)(struct blockchain * chain, const uint256_t * hash);
+	/**
+	 * find(), get(): 
+	 *   copy the heir's data to 'p_heir' if it is not NULL.
+	 *   find() returns the height of the heir, or -1 if not found;
+	 *   get() returns 0 on success, or -1 if the height is out of range.
+	 */
+	ssize_t (*find)(struct blockchain * chain, const uint256_t * hash, blockchain_heir_t * p_heir);
 	ssize_t (* get_height)(struct blockchain * chain, const uint256_t * hash);
-	const blockchain_heir_t * (* get)(struct blockchain * chain, ssize_t height);
+	int (* get)(struct blockchain * chain, ssize_t height, blockchain_heir_t * p_heir);
 	
 	/**
 	 * add(): only increments are allowed, any reorganization must be done by internal.
 	 */
 	enum blockchain_error (* add)(struct blockchain * chain, const uint256_t * hash, const struct satoshi_block_header * hdr);
 	
+	/**
+	 * add_batch(): headers-first ingestion.
+	 *   All headers are hashed in one batch (sha256d80_batch), 
+	 *   runs of headers that link to the current tip with a valid proof-of-work are appended in bulk
+	 *   and reported by a single on_add_blocks() call, others (forks, orphans) go through add().
+	 * 
+	 * @return the number of headers consumed (the headers before it stay on the chain),
+	 *   less than count if it stopped at a header with an invalid proof-of-work (*p_err = blockchain_error_invalid_pow) 
+	 *   or at a run whose callback failed (*p_err = blockchain_error_failed, the run was rolled back).
+	 *   p_err can be NULL.
+	 */
+	ssize_t (* add_batch)(struct blockchain * chain, ssize_t count, const struct satoshi_block_header headers[], 
+		enum blockchain_error * p_err);
+	
 	/**
 	 * virtual functions: 
 	 *     callbacks for updating utxoes_db
 	 *     would be executed when adding/removing heirs if these callbacks are not set to NULL.
+	 * 
+	 * on_add_blocks(): [start_height, start_height + count) were appended by add_batch(),
+	 *     all or nothing: on failure the whole range is dropped, so it must undo its own work first.
+	 *     if it is NULL, on_add_block() will be called for each of them, 
+	 *     and if one of them fails, on_remove_block() is called for the reported ones in reverse order.
 	 */ 
 	int (* on_remove_block)(struct blockchain * chain, const uint256_t * block_hash, const int height, void * user_data);
 	int (* on_add_block)(struct blockchain * chain, const uint256_t * block_hash, const int height, void * user_data);
+	int (* on_add_blocks)(struct blockchain * chain, const uint256_t block_hashes[], const int start_height, ssize_t count, void * user_data);
 }blockchain_t;
 
 blockchain_t * blockchain_init(blockchain_t * chain, 
@@ -205,22 +280,6 @@ block_info_t * block_info_new(const uint256_t * hash, struct satoshi_block_heade
 int block_info_add_child(block_info_t * parent, block_info_t * child);
 void block_info_free(block_info_t * info);
 
-/**
- * define the 'addition' and 'complement(~, 1's complement)' operation of compact_uint256 as below:
- * 
- * compact_uint256_t a , b;
- *  - compact_uint256_add(a, b):  c = (a + b)
- *      make the exponent of a and b same ==> exp;
- *      c.mantissa = (a.mantissa + b.mantissa); 
- *      c.exp = exp;
- * 
- * - compact_uint256_complement(a): c = ~a
- * 	    c.mantissa = ~a.mantissa;
- *      c.exp = 32 - a.exp;
- */ 
-compact_uint256_t compact_uint256_add(const compact_uint256_t a, const compact_uint256_t b);
-compact_uint256_t compact_uint256_complement(const compact_uint256_t target);
-
 #ifdef __cplusplus
 }
 #endif
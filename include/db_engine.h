@@ -14,10 +14,22 @@ extern "C" {
 #endif
 struct db_handle;
 struct db_engine;
+
+enum db_engine_txn_flags
+{
+	/**
+	 * read-only txn on the last committed snapshot, set before begin().
+	 * On a multiversion engine (db_engine_config_t::multiversion) it takes no read locks,
+	 * so it neither blocks nor waits for the writers.
+	 */
+	db_engine_txn_flags_snapshot = 0x01,
+};
+
 typedef struct db_engine_txn
 {
 	void * priv;
 	struct db_engine * engine;
+	int flags;	// enum db_engine_txn_flags
 	
 // public methods:
 	int (* begin)(struct db_engine_txn * txn, struct db_engine_txn * parent_txn);
@@ -58,6 +70,7 @@ typedef ssize_t (* db_associate_callback)(struct db_handle * sdb,
 enum db_flags
 {
 	db_flags_dup_sort = 1, // if want to support duplicate keys
+	db_flags_int32_keys = 2, // the keys are native-endian int32_t, sorted numerically
 };
 
 enum db_format_type
@@ -100,20 +113,73 @@ typedef struct db_handle
 		const db_record_data_t * skey,		// the key of secondary database
 		db_record_data_t ** p_keys,			// if need return the key(s) of the primary database
 		db_record_data_t ** p_values);
+
+	/**
+	 * get(): 				point lookup without allocation (the first record if duplicated keys)
+	 * get_secondary(): 	the same as get(), but by the key of the secondary database
+	 *   The results are borrowed (flags == 0): they point into a per-thread buffer owned by the db handle,
+	 *   and stay valid until the next get()/get_secondary() on the same handle by the same thread.
+	 *   @return 1 if found, 0 if not found, -1 on error
+	 */
+	int (* get)(struct db_handle * db, db_engine_txn_t * txn,
+		const db_record_data_t * key,
+		db_record_data_t * value);
+	int (* get_secondary)(struct db_handle * secondary_db, db_engine_txn_t * txn,
+		const db_record_data_t * skey,
+		db_record_data_t * key,		// nullable
+		db_record_data_t * value);
+
+	/**
+	 * find_many(): batched lookups in a db without duplicate keys.
+	 *   The keys are sorted and probed by a single cursor, 
+	 *   results[i] corresponds to keys[i] ( {NULL, 0} if not found ).
+	 * 
+	 *   @param buffer: [optional] the values are copied into this buffer (8-byte aligned), 
+	 *     if the buffer is NULL or full, the remaining values are malloc'ed (results[i].flags == 1).
+	 *     call db_record_data_cleanup() on each result in either case.
+	 *   @return the number of keys found, -1 on error
+	 */
+	ssize_t (* find_many)(struct db_handle * db, db_engine_txn_t * txn, 
+		ssize_t count, const db_record_data_t keys[],
+		db_record_data_t results[], 
+		void * buffer, size_t buffer_size);
 	
 	int (* insert)(struct db_handle * db, db_engine_txn_t * txn, const db_record_data_t * key, const db_record_data_t * value);
 	int (* update)(struct db_handle * db, db_engine_txn_t * txn, const db_record_data_t * key, const db_record_data_t * value);
 	int (* del)(struct db_handle * db, db_engine_txn_t * txn, const db_record_data_t * key);
+	
+	/**
+	 * insert_many(), del_many(): bulk writes
+	 *   the records are packed into DB_MULTIPLE_KEY (DB_MULTIPLE for del) buffers, 
+	 *   and each buffer is written by a single call.
+	 *   del_many() ignores the keys which are not found.
+	 *   @return 0 on success
+	 */
+	int (* insert_many)(struct db_handle * db, db_engine_txn_t * txn, 
+		ssize_t count, const db_record_data_t keys[], const db_record_data_t values[]);
+	int (* del_many)(struct db_handle * db, db_engine_txn_t * txn, 
+		ssize_t count, const db_record_data_t keys[]);
 
 }db_handle_t;
 db_handle_t * db_handle_init(db_handle_t * db, struct db_engine * engine, void * user_data);
 void db_handle_cleanup(db_handle_t * db);
 
+enum db_cursor_flags
+{
+	db_cursor_flags_snapshot = 0x01,	// read-only cursor on the last committed snapshot (see db_engine_txn_flags_snapshot)
+};
+
+/**
+ * db_cursor:
+ *   preset skey/key/value {data, size} to receive the records into the caller's buffers,
+ *   otherwise they are borrowed from the cursor (flags == 0)
+ *   and stay valid until the next operation or db_cursor_cleanup().
+ */
 typedef struct db_cursor
 {
 	void * priv;
 	db_handle_t * db;
-	
+
 	db_record_data_t skey[1];
 	db_record_data_t key[1];
 	db_record_data_t value[1];
@@ -130,15 +196,70 @@ typedef struct db_cursor
 	int (* set)(struct db_cursor * cursor);
 	int (* del)(struct db_cursor * cursor);
 }db_cursor_t;
-db_cursor_t * db_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, int flags);
+db_cursor_t * db_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, 
+	int flags);	// enum db_cursor_flags
 void db_cursor_cleanup(db_cursor_t * cursor);
 
+/**
+ * db_engine_config:
+ *   tuning of the storage environment, zero values keep the backend's defaults.
+ *   The sizes are applied when the environment is opened (db_engine_init_with_config()), 
+ *   the durability can be changed at any time by engine->set_durability().
+ *
+ *   bdb:    cache_size, cache_regions, log_buffer_size, page sizes, durability, multiversion
+ *   lmdb:   map_size, durability (MDB_NOMETASYNC / MDB_NOSYNC), always multiversion
+ *   memory: ignored
+ *
+ *   multiversion: keep the old versions of the pages (MVCC), 
+ *     reads outside a txn and snapshot txns/cursors then see the last committed data without read locks.
+ */
+enum db_engine_durability
+{
+	db_engine_durability_sync = 0,		// flush the log to disk on every commit
+	db_engine_durability_write_nosync,	// write the log but do not flush it, committed txns survive a process crash
+	db_engine_durability_nosync,		// do not write the log on commit, committed txns can be lost on any crash
+};
+
+#define DB_ENGINE_MAX_PAGE_SIZES	(16)
+typedef struct db_engine_config
+{
+	size_t cache_size;			// bytes
+	int cache_regions;
+	size_t log_buffer_size;		// bytes
+	size_t map_size;			// bytes
+	enum db_engine_durability durability;
+	int multiversion;
+	
+	unsigned int page_size;		// default page size of the databases, (512 ~ 65536, power of 2)
+	int num_page_sizes;
+	struct {
+		char name[64];			// db_filename passed to open_db()
+		unsigned int page_size;
+	}page_sizes[DB_ENGINE_MAX_PAGE_SIZES];
+}db_engine_config_t;
+
+/**
+ * db_engine_config_load_profile():
+ *   "default":  backend defaults, sync on every commit
+ *   "fast_ibd": large cache and log buffer, no log writes on commit.
+ *               The caller should call engine->set_durability(engine, db_engine_durability_sync) 
+ *               once the initial block download reaches the tip.
+ *   @return 0 on success, -1 if the profile is unknown
+ */
+int db_engine_config_load_profile(db_engine_config_t * config, const char * profile);
+unsigned int db_engine_config_get_page_size(const db_engine_config_t * config, const char * db_name);
+int db_engine_config_set_page_size(db_engine_config_t * config, const char * db_name, unsigned int page_size);
+
+struct db_engine_backend;
 typedef struct db_engine
 {
 	void * priv;
 	void * user_data;
 	unsigned int err_code;
 	
+	const struct db_engine_backend * backend;
+	long refs_count;
+	
 	int (* set_home)(struct db_engine * engine, const char * home_dir);
 	
 	db_handle_t * (* open_db)(struct db_engine * engine, 
@@ -153,11 +274,52 @@ typedef struct db_engine
 	
 	db_engine_txn_t * (* txn_new)(struct db_engine * engine, struct db_engine_txn * parent_txn);
 	void (* txn_free)(struct db_engine * engine, db_engine_txn_t * txn);
+	
+	int (* set_config)(struct db_engine * engine, const db_engine_config_t * config); // before set_home()
+	int (* set_durability)(struct db_engine * engine, enum db_engine_durability durability);
 }db_engine_t;
 db_engine_t * db_engine_init(db_engine_t * engine, const char * home_dir, void * user_data);
 void db_engine_cleanup(db_engine_t * engine);
 db_engine_t * db_engine_get();
 
+/**
+ * db_engine_backend:
+ *   the storage implementation behind db_engine_t, db_handle_t and db_cursor_t.
+ *   engine_init() creates engine->priv and sets the engine methods,
+ *   db_handle_init(), db_cursor_init() and db_engine_txn_init() dispatch to the backend of the engine.
+ */
+typedef struct db_engine_backend
+{
+	const char * name;
+	
+	int (* engine_init)(db_engine_t * engine);
+	void (* engine_cleanup)(db_engine_t * engine);
+	
+	db_engine_txn_t * (* txn_init)(db_engine_txn_t * txn, db_engine_t * engine);
+	void (* txn_cleanup)(db_engine_txn_t * txn);
+	
+	db_handle_t * (* handle_init)(db_handle_t * db, db_engine_t * engine, void * user_data);
+	void (* handle_cleanup)(db_handle_t * db);
+	
+	db_cursor_t * (* cursor_init)(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, int flags);
+	void (* cursor_cleanup)(db_cursor_t * cursor);
+}db_engine_backend_t;
+
+extern const db_engine_backend_t db_engine_backend_bdb[1];		// BerkeleyDB (default)
+extern const db_engine_backend_t db_engine_backend_mem[1];		// in-memory, see db_engine_mem.c
+#ifdef _USE_LMDB
+extern const db_engine_backend_t db_engine_backend_lmdb[1];	// LMDB, see db_engine_lmdb.c
+#endif
+
+const db_engine_backend_t * db_engine_backend_find(const char * name); // "bdb", "memory" or "lmdb", NULL if not built in
+db_engine_t * db_engine_init_with_backend(db_engine_t * engine, 
+	const db_engine_backend_t * backend,	// NULL: db_engine_backend_bdb
+	const char * home_dir, void * user_data);
+db_engine_t * db_engine_init_with_config(db_engine_t * engine, 
+	const db_engine_backend_t * backend,	// NULL: db_engine_backend_bdb
+	const db_engine_config_t * config,		// nullable
+	const char * home_dir, void * user_data);
+
 
 #define db_private_close_db(_db) do {				\
 		db_handle_t * db = priv->_db;				\
@@ -0,0 +1,107 @@
+#ifndef _SATOSHI_BLOCK_VIEW_H_
+#define _SATOSHI_BLOCK_VIEW_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "satoshi-types.h"
+
+/**
+ * satoshi_block_view:
+ * 	a read-only (zero-copy) view of a serialized block.
+ *
+ * 	The payload is validated once (header difficulty, tx layout, merkle-root),
+ * 	and every variable-length field is returned as a span {offset, length}
+ * 	which points into the caller's buffer.
+ * 	No per-item allocation is made, all tx/txin/txout/witness entries are stored
+ * 	in flat arrays owned by the view, and these arrays can be reused across blocks.
+ *
+ *  The caller MUST keep the payload alive while accessing the view.
+ */
+
+typedef struct satoshi_data_span
+{
+	uint32_t offset;	// offset from the beginning of the block payload
+	uint32_t length;
+}satoshi_data_span_t;
+
+typedef struct satoshi_txin_view
+{
+	uint32_t outpoint_offset;		// offset of (struct satoshi_outpoint)
+	int is_coinbase;
+	satoshi_data_span_t scripts;	// sig_scripts data (without the varint prefix)
+	uint32_t sequence;
+
+	ssize_t witness_start;			// index in view->witness_items
+	ssize_t num_witness_items;
+}satoshi_txin_view_t;
+
+typedef struct satoshi_txout_view
+{
+	int64_t value;
+	satoshi_data_span_t scripts;	// pk_scripts data (without the varint prefix)
+}satoshi_txout_view_t;
+
+typedef struct satoshi_tx_view
+{
+	satoshi_data_span_t span;		// the entire serialized tx (with witness data if has)
+	int32_t version;
+	int has_flag;
+	uint32_t lock_time;
+
+	ssize_t txin_start;				// index in view->txins
+	ssize_t txin_count;
+	ssize_t txout_start;			// index in view->txouts
+	ssize_t txout_count;
+
+	satoshi_data_span_t witnesses;	// serialized witnesses data, {0, 0} if no witness
+
+	uint256_t txid[1];
+	uint256_t wtxid[1];				// (BIP141) equals to txid if the tx has no witness data
+}satoshi_tx_view_t;
+
+typedef struct satoshi_block_view
+{
+	const unsigned char * payload;
+	ssize_t length;
+
+	const struct satoshi_block_header * hdr;	// points to payload
+	uint256_t hash;
+
+	ssize_t txn_count;
+	satoshi_tx_view_t * txns;
+
+	ssize_t txins_count;
+	satoshi_txin_view_t * txins;
+
+	ssize_t txouts_count;
+	satoshi_txout_view_t * txouts;
+
+	ssize_t witness_items_count;
+	satoshi_data_span_t * witness_items;
+
+	uint256_merkle_tree_t * mtree;	// txids, (reused across blocks)
+	
+	// allocated sizes (reused across blocks)
+	ssize_t max_txns;
+	ssize_t max_txins;
+	ssize_t max_txouts;
+	ssize_t max_witness_items;
+}satoshi_block_view_t;
+
+ssize_t satoshi_block_view_parse(satoshi_block_view_t * view, ssize_t length, const void * payload);
+void satoshi_block_view_reset(satoshi_block_view_t * view);
+void satoshi_block_view_cleanup(satoshi_block_view_t * view);
+
+#define satoshi_block_view_get_data(view, span) ((view)->payload + (span).offset)
+#define satoshi_block_view_get_outpoint(view, txin) \
+	((const satoshi_outpoint_t *)((view)->payload + (txin)->outpoint_offset))
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -194,6 +194,45 @@ int uint256_compare_with_compact(const uint256_t * restrict hash, const compact_
  * @}
  */
 
+/**
+ * @defgroup uint256_int
+ *  Fixed-width 256-bit unsigned integer arithmetic,
+ *  used to accumulate the chainwork exactly.
+ *
+ * @details
+ *  limbs[0] holds the least significant 64 bits
+ *  (the same byte order as uint256_t on little-endian hosts).
+ *  add() and sub() wrap around modulo 2^256.
+ * @{
+ */
+typedef struct uint256_int
+{
+	uint64_t limbs[4];
+}uint256_int_t;
+#define uint256_int_zero	((uint256_int_t){ .limbs = { 0 } })
+
+uint256_int_t uint256_int_from_uint256(const uint256_t * u256);
+uint256_int_t uint256_int_from_compact(const compact_uint256_t bits);	// zero if negative or overflowed
+uint256_t uint256_int_to_uint256(const uint256_int_t * a);
+double uint256_int_to_double(const uint256_int_t * a);
+
+uint256_int_t uint256_int_add(const uint256_int_t a, const uint256_int_t b);
+uint256_int_t uint256_int_sub(const uint256_int_t a, const uint256_int_t b);
+int uint256_int_compare(const uint256_int_t * restrict a, const uint256_int_t * restrict b);
+uint256_int_t uint256_int_shift_left(const uint256_int_t a, unsigned int bits);
+uint256_int_t uint256_int_shift_right(const uint256_int_t a, unsigned int bits);
+uint256_int_t uint256_int_div(const uint256_int_t n, const uint256_int_t d);	// d must not be zero
+
+/**
+ * uint256_int_get_work():
+ *   the expected number of hashes to find a block below the target, 2^256 / (target + 1)
+ * @return zero if 'bits' is negative, overflowed or represents a zero target.
+ */
+uint256_int_t uint256_int_get_work(const compact_uint256_t bits);
+/**
+ * @}
+ */
+
 /**
  * @defgroup merkle_tree
  * @{
@@ -219,7 +258,110 @@ typedef struct uint256_merkle_tree
 }uint256_merkle_tree_t;
 uint256_merkle_tree_t * uint256_merkle_tree_new(ssize_t max_size, void * user_data);
 void uint256_merkle_tree_free(uint256_merkle_tree_t * mtree);
+void uint256_merkle_tree_reset(uint256_merkle_tree_t * mtree);	// remove all items, keep the allocated memory for reuse
 
+/**
+ * uint256_merkle_tree_set_threads:
+ * 	hash the wide layers with a thread pool (owned by the tree).
+ * @param num_threads: 0: number of online cpus, 1: serial mode
+ * @param serial_threshold: layers with fewer pairs are hashed serially, 0: default
+ */
+#define UINT256_MERKLE_TREE_PARALLEL_THRESHOLD (2048)
+int uint256_merkle_tree_set_threads(uint256_merkle_tree_t * mtree, int num_threads, ssize_t serial_threshold);
+
+/**
+ * uint256_merkle_tree_thread_pool:
+ * 	a persistent pool which can be shared by many trees, 
+ * 	to avoid creating threads for every tree (e.g. one tree per block).
+ * 	The pool must outlive the trees using it.
+ * 
+ * uint256_merkle_tree_set_thread_pool():
+ * @param max_threads: threads used per layer (including the calling thread), 0: all workers of the pool
+ */
+typedef struct merkle_tree_thread_pool uint256_merkle_tree_thread_pool_t;
+uint256_merkle_tree_thread_pool_t * uint256_merkle_tree_thread_pool_new(int num_threads, ssize_t serial_threshold);
+void uint256_merkle_tree_thread_pool_free(uint256_merkle_tree_thread_pool_t * pool);
+int uint256_merkle_tree_set_thread_pool(uint256_merkle_tree_t * mtree, uint256_merkle_tree_thread_pool_t * pool, int max_threads);
+
+/**
+ * merkle branch (SPV proof):
+ * 	branch[i] is the sibling of the node on the path from the leaf to the root at layer i.
+ */
+#define UINT256_MERKLE_BRANCH_MAX_SIZE (32)
+ssize_t uint256_merkle_tree_get_branch(uint256_merkle_tree_t * mtree, int index, 
+	uint256_t branch[static UINT256_MERKLE_BRANCH_MAX_SIZE]);
+void uint256_merkle_branch_compute_root(const uint256_t * leaf, uint32_t index, 
+	int branch_size, const uint256_t branch[], uint256_t * merkle_root);
+
+typedef struct uint256_merkle_proof
+{
+	uint256_t leaf;
+	uint32_t index;				// leaf index in the tree
+	int branch_size;
+	const uint256_t * branch;
+}uint256_merkle_proof_t;
+int uint256_merkle_proof_verify(const uint256_merkle_proof_t * proof, const uint256_t * merkle_root);
+
+/**
+ * uint256_merkle_proofs_verify_batch:
+ * 	verify all proofs against the same root, the nodes of each layer are hashed in one batch.
+ * @param results: [optional] results[i] = 1 if proofs[i] is valid
+ * @return the number of valid proofs
+ */
+ssize_t uint256_merkle_proofs_verify_batch(ssize_t count, const uint256_merkle_proof_t proofs[], 
+	const uint256_t * merkle_root, int * results);
+
+/**
+ * partial merkle tree (BIP37):
+ * 	serialized as [total_txns(uint32)][varint(hashes_count)][hashes][varint(flag_bytes)][flags]
+ */
+typedef struct uint256_partial_merkle_tree
+{
+	uint32_t total_txns;
+	ssize_t hashes_count;
+	uint256_t * hashes;
+	ssize_t bits_count;			// number of flag bits
+	uint8_t * flags;			// (bits_count + 7) / 8 bytes, LSB first
+}uint256_partial_merkle_tree_t;
+int uint256_merkle_tree_get_partial(uint256_merkle_tree_t * mtree, 
+	ssize_t num_matches, const int match_indexes[], 
+	uint256_partial_merkle_tree_t * pmt);
+ssize_t uint256_partial_merkle_tree_extract(const uint256_partial_merkle_tree_t * pmt, 
+	uint256_t * merkle_root,
+	ssize_t max_matches, uint256_t matches[], int indexes[]);
+ssize_t uint256_partial_merkle_tree_serialize(const uint256_partial_merkle_tree_t * pmt, unsigned char ** p_data);
+ssize_t uint256_partial_merkle_tree_parse(uint256_partial_merkle_tree_t * pmt, ssize_t length, const void * payload);
+void uint256_partial_merkle_tree_cleanup(uint256_partial_merkle_tree_t * pmt);
+
+
+/**
+ * @defgroup satoshi_arena
+ * 
+ * satoshi_arena: an optional per-block memory pool.
+ * 	Set 'block->arena' (or 'tx->arena') before calling satoshi_block_parse() (or satoshi_tx_parse()),
+ * 	then all txins, txouts, scripts and witnesses will be allocated from the arena.
+ * 	satoshi_block_cleanup() will NOT free these objects one by one, 
+ * 	they are released together by satoshi_arena_reset().
+ * 	
+ * 	The arena keeps its memory after reset, and can be reused for the next block.
+ * 
+ * 	satoshi_arena_init(NULL, ...) allocates the arena itself, release it with satoshi_arena_free().
+ * @{
+ */
+struct satoshi_arena_chunk;
+typedef struct satoshi_arena
+{
+	size_t chunk_size;
+	struct satoshi_arena_chunk * chunks;	// the current chunk is always the first one
+}satoshi_arena_t;
+satoshi_arena_t * satoshi_arena_init(satoshi_arena_t * arena, size_t chunk_size);
+void * satoshi_arena_alloc(satoshi_arena_t * arena, size_t size);	// returns zero-filled memory
+void satoshi_arena_reset(satoshi_arena_t * arena);
+void satoshi_arena_cleanup(satoshi_arena_t * arena);
+void satoshi_arena_free(satoshi_arena_t * arena);	// cleanup + free(), only for arenas returned by satoshi_arena_init(NULL, ...)
+/**
+ * @}
+ */
 
 /**
  * @ingroup satoshi_tx
@@ -328,6 +470,8 @@ typedef struct satoshi_tx
 	 * [nVersion][marker][flag][txins][txouts][witness][nLockTime]
 	 */
 	uint256_t wtxid[1];
+	
+	satoshi_arena_t * arena;	// (optional) if set, the tx data is allocated from the arena
 }satoshi_tx_t;
 ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload);
 void satoshi_tx_cleanup(satoshi_tx_t * tx);
@@ -344,6 +488,11 @@ struct satoshi_block_header
 	uint8_t txn_count[0];	// place-holder
 }__attribute__((packed));
 
+enum satoshi_block_parse_flags
+{
+	satoshi_block_parse_flags_verify_witness_commitment = 1,	// (BIP141) verify the wtxid merkle-root committed in the coinbase
+};
+
 typedef struct satoshi_block
 {
 	struct satoshi_block_header hdr;
@@ -351,11 +500,21 @@ typedef struct satoshi_block
 	satoshi_tx_t * txns;
 	
 	uint256_t hash;
+	
+	satoshi_arena_t * arena;	// (optional) if set, all txns are allocated from the arena
+	uint32_t parse_flags;		// (optional) enum satoshi_block_parse_flags, set before calling satoshi_block_parse()
 }satoshi_block_t;
 ssize_t satoshi_block_parse(satoshi_block_t * block, ssize_t length, const void * payload);
+ssize_t satoshi_block_parse_mt(satoshi_block_t * block, ssize_t length, const void * payload, int num_threads);
 void satoshi_block_cleanup(satoshi_block_t * block);
 ssize_t satoshi_block_serialize(const satoshi_block_t * block, unsigned char ** p_data);
 
+/**
+ * In debug builds (_DEBUG), the parsers call abort() on invalid payloads by default.
+ * Set it to 0 to make them return -1 as in release builds (e.g. when testing the error paths).
+ */
+extern int satoshi_parser_abort_on_error;
+
 
 #define BITCOIN_MESSAGE_MAGIC_MAINNET 	0xD9B4BEF9
 #define BITCOIN_MESSAGE_MAGIC_TESTNET 	0xDAB5BFFA
@@ -19,6 +19,33 @@ void sha256_init(sha256_ctx_t * sha);
 void sha256_update(sha256_ctx_t * sha, const unsigned char * data, size_t len);
 void sha256_final(sha256_ctx_t * sha, unsigned char hash[static 32]);
 
+/**
+ * double-SHA256 of a fixed-size message (64-byte merkle node or 80-byte block header)
+ */
+void sha256d64(unsigned char out[static 32], const unsigned char in[static 64]);
+void sha256d80(unsigned char out[static 32], const unsigned char in[static 80]);
+
+/**
+ * batched double-SHA256:
+ * 	hash256 of (count) independent 64-byte (or 80-byte) messages, 
+ * 	in: (count * 64) or (count * 80) bytes, out: (count * 32) bytes.
+ * 	
+ * 	The kernels (SHA-NI, 8-way avx2, 4-way sse4.1, or scalar) are selected at runtime by cpuid.
+ */
+void sha256d64_batch(unsigned char * out, const unsigned char * in, size_t count);
+void sha256d80_batch(unsigned char * out, const unsigned char * in, size_t count);
+
+enum sha256_impl
+{
+	sha256_impl_auto = -1,
+	sha256_impl_scalar = 0,
+	sha256_impl_sse41,
+	sha256_impl_avx2,
+	sha256_impl_shani,
+};
+int sha256_set_impl(enum sha256_impl impl);
+const char * sha256_get_impl_name(void);
+
 
 
 typedef struct sha512_ctx
@@ -15,6 +15,8 @@ void dump2(FILE * fp, const void * data, ssize_t length);
 #define dump_line(prefix, data, length) do { printf("%s", prefix); dump(data, length); printf("\n"); } while(0)
 
 void hash256(const void * data, size_t length, uint8_t hash[static 32]);
+void hash256_64(const void * data, uint8_t hash[static 32]);	// data[64]: merkle-tree node
+void hash256_80(const void * data, uint8_t hash[static 32]);	// data[80]: block header
 void hash160(const void * data, size_t length, uint8_t hash[static 20]);
 
 int make_nonblock(int fd);
@@ -0,0 +1,89 @@
+#ifndef _UTXOES_CACHE_H_
+#define _UTXOES_CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "db_engine.h"
+#include "satoshi-types.h"
+#include "utxoes_db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * utxoes_cache: write-back coins cache in front of utxoes_db
+ * 
+ * Each cached coin has the following flags:
+ * 	dirty: differs from the db, needs to be written on flush.
+ * 	fresh: the db doesn't have this coin, if it's spent before flush, it's simply dropped.
+ * 	spent: the coin has been spent, and will be removed from the db on flush.
+ * 
+ * All changes are written to the db in a single transaction by flush(),
+ * call check_flush() at block boundaries to flush when the memory usage exceeds the ceiling.
+ */
+enum utxoes_cache_entry_flags
+{
+	utxoes_cache_entry_flags_dirty = 1,
+	utxoes_cache_entry_flags_fresh = 2,
+	utxoes_cache_entry_flags_spent = 4,
+};
+
+#define UTXOES_CACHE_DEFAULT_MAX_MEMORY	(450 * 1024 * 1024)
+typedef struct utxoes_cache
+{
+	void * priv;
+	void * user_data;
+	
+	utxoes_db_t * db;			// the backing store
+	db_engine_t * engine;		// nullable, (flush without a transaction if NULL)
+	size_t max_memory;			// memory ceiling (in bytes)
+	
+	int (* add)(struct utxoes_cache * cache, 
+		const satoshi_outpoint_t * outpoint,
+		const satoshi_txout_t * txout,
+		int32_t height,
+		int is_coinbase);
+	
+	/**
+	 * remove: spend a coin
+	 * @param spent: [optional] returns the spent coin (for undo data or script verification),
+	 * 	spent->scripts is owned by the caller, call db_record_utxo_cleanup() to release.
+	 * @return 0 on success, -1 if the coin was not found.
+	 */
+	int (* remove)(struct utxoes_cache * cache, const satoshi_outpoint_t * outpoint, db_record_utxo_t * spent);
+	
+	/* find: *p_utxo owns its scripts, (see remove) */
+	ssize_t (* find)(struct utxoes_cache * cache, const satoshi_outpoint_t * outpoint, db_record_utxo_t ** p_utxo);
+	
+	/**
+	 * prefetch(): load the coins of outpoints[] from the db into the cache (e.g. all prevouts of a block, 
+	 * 	as soon as it is parsed), so that the following find()/remove() don't wait for the db.
+	 * 	The lookups run on the prefetch workers (see utxoes_cache_set_prefetch_threads()) without holding the cache lock, 
+	 * 	outpoints[] is copied and the call returns immediately.
+	 * 	Without workers, the coins are loaded by the calling thread.
+	 * @return the number of outpoints queued (or coins loaded if no workers)
+	 * 
+	 * prefetch_wait(): wait until all queued prefetches are done.
+	 */
+	ssize_t (* prefetch)(struct utxoes_cache * cache, ssize_t count, const satoshi_outpoint_t outpoints[]);
+	void (* prefetch_wait)(struct utxoes_cache * cache);
+	
+	int (* flush)(struct utxoes_cache * cache);
+	int (* check_flush)(struct utxoes_cache * cache);	///< flush if memory usage > max_memory, @return 1 if flushed
+	size_t (* get_memory_usage)(struct utxoes_cache * cache);
+	ssize_t (* get_count)(struct utxoes_cache * cache);
+}utxoes_cache_t;
+utxoes_cache_t * utxoes_cache_init(utxoes_cache_t * cache, utxoes_db_t * db, db_engine_t * engine, 
+	size_t max_memory, // 0: UTXOES_CACHE_DEFAULT_MAX_MEMORY
+	void * user_data);
+void utxoes_cache_cleanup(utxoes_cache_t * cache);
+
+int utxoes_cache_set_prefetch_threads(utxoes_cache_t * cache, int num_threads); // 0: no workers
+ssize_t utxoes_cache_prefetch_block(utxoes_cache_t * cache, const satoshi_block_t * block); // prefetch the prevouts of all txins
+
+#ifdef __cplusplus
+}
+#endif
+#endif
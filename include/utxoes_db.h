@@ -11,16 +11,54 @@
 extern "C" {
 #endif
 
-#define UTXOES_DB_MAX_SCRIPT_LENGTH	(80)	// only scripts with a length less than 80 bytes are included in the db
+/**
+ * db_record_utxo: (decoded) coin
+ * 
+ * In the db, a coin is stored in a compressed variable-length format:
+ * 	[height(uint32, big-endian)][flags(uint8)][VARINT(compressed amount)][compressed script]
+ * 
+ * 	compressed script: 
+ * 	  0x00 + hash160:	P2PKH
+ * 	  0x01 + hash160:	P2SH
+ * 	  0x02 + hash160:	P2WPKH
+ * 	  0x03 + sha256:	P2WSH
+ * 	  0x04 + x-only pubkey: P2TR
+ * 	  VARINT(length + 6) + script data:	other scripts (0x05 is reserved)
+ * 	VARINT: MSB base-128 encoding (the same as bitcoin-core's VARINT)
+ * 
+ * 	The record is NOT compatible with bitcoin-core's coins db:
+ * 	only the VARINT and the amount compression are the same.
+ * 	The height is stored as a fixed-size prefix (for the heights index),
+ * 	and the script types 0x02..0x04 (P2WPKH / P2WSH / P2TR) 
+ * 	collide with bitcoin-core's compressed pubkey types (0x02..0x05).
+ * 
+ * 	UTXOES_DB_FORMAT_VERSION is stored in <name>_meta.db, 
+ * 	utxoes_db_init() fails if the db was written in another format.
+ * 	(version 1: the fixed-size record, which was not marked)
+ */
+#define UTXOES_DB_FORMAT_VERSION	(2)
+#define UTXOES_DB_MAX_SCRIPT_LENGTH	(10000)	// consensus MAX_SCRIPT_SIZE
+enum db_record_utxo_flags
+{
+	db_record_utxo_flags_coinbase = 1,
+};
+
 typedef struct db_record_utxo db_record_utxo_t;
 struct db_record_utxo
 {
 	int64_t value;
-	uint8_t scripts[UTXOES_DB_MAX_SCRIPT_LENGTH];
-	uint256_t block_hash;
-	uint16_t is_witness;
-	uint16_t p2sh_flags;	// p2sh to p2wpkh or p2wsh
-}__attribute__((packed));
+	int32_t height;
+	uint8_t is_coinbase;
+	uint8_t is_witness;		// witness program (bip141)
+	varstr_t * scripts;		// owned by the record
+};
+void db_record_utxo_cleanup(db_record_utxo_t * utxo);
+ssize_t db_record_utxo_serialize(const db_record_utxo_t * utxo, unsigned char ** p_data);
+ssize_t db_record_utxo_parse(db_record_utxo_t * utxo, ssize_t length, const void * data);
+
+uint64_t utxo_compress_amount(uint64_t amount);
+uint64_t utxo_decompress_amount(uint64_t value);
+int utxo_script_is_witness(const unsigned char * script, size_t length);
 
 typedef struct utxoes_db
 {
@@ -30,18 +68,44 @@ typedef struct utxoes_db
 	int (* add)(struct utxoes_db * db, db_engine_txn_t * txn, 
 		const satoshi_outpoint_t * outpoint,
 		const satoshi_txout_t * txout,
-		const uint256_t * block_hash
+		int32_t height,
+		int is_coinbase
 	);
 	
+	/**
+	 * add_many(), remove_many(): apply a batch of changes (e.g. a whole block) with bulk writes,
+	 * 	remove_many() skips the outpoints which are not found.
+	 */
+	int (* add_many)(struct utxoes_db * db, db_engine_txn_t * txn, 
+		ssize_t count,
+		const satoshi_outpoint_t outpoints[],
+		const db_record_utxo_t utxoes[]);
+	int (* remove_many)(struct utxoes_db * db, db_engine_txn_t * txn, 
+		ssize_t count,
+		const satoshi_outpoint_t outpoints[]);
+		
 	int (* remove)(struct utxoes_db * db, db_engine_txn_t * txn, const satoshi_outpoint_t * outpoint);
-	int (* remove_block)(struct utxoes_db * db, db_engine_txn_t * txn, const uint256_t * block_hash); 
+	int (* remove_at_height)(struct utxoes_db * db, db_engine_txn_t * txn, int32_t height); 
 	
+	/**
+	 * find(), find_at_height(): 
+	 * 	the returned records own their scripts, call db_record_utxo_cleanup() to release.
+	 */
 	ssize_t (* find)(struct utxoes_db * db, db_engine_txn_t * txn, 
 		const satoshi_outpoint_t * outpoint,
 		db_record_utxo_t ** p_utxo);
 		
-	ssize_t (* find_in_block)(struct utxoes_db * db, db_engine_txn_t * txn, 
-		const uint256_t * block_hash, 
+	/**
+	 * find_many(): look up a batch of outpoints (e.g. all prevouts of a block), 
+	 * 	utxoes[] is overwritten, utxoes[i] is zeroed if outpoints[i] was not found.
+	 * 	@return the number of outpoints found, -1 on error
+	 */
+	ssize_t (* find_many)(struct utxoes_db * db, db_engine_txn_t * txn, 
+		ssize_t count, const satoshi_outpoint_t outpoints[],
+		db_record_utxo_t utxoes[]);
+	
+	ssize_t (* find_at_height)(struct utxoes_db * db, db_engine_txn_t * txn, 
+		int32_t height, 
 		satoshi_outpoint_t ** p_outpoints,
 		db_record_utxo_t ** p_utxoes);
 		
@@ -51,7 +115,7 @@ typedef struct utxoes_db
 		db_record_utxo_t ** p_utxoes);
 
 }utxoes_db_t;
-utxoes_db_t * utxoes_db_init(utxoes_db_t * db, db_engine_t * engine, const char * db_name, void * user_data);
+utxoes_db_t * utxoes_db_init(utxoes_db_t * db, db_engine_t * engine, const char * db_name, void * user_data); // NULL if the format is not supported
 void utxoes_db_cleanup(utxoes_db_t * db);
 
 #ifdef __cplusplus
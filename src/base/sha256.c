@@ -44,6 +44,20 @@
 #include "common.h"
 #include "sha.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define SHA256_X86_KERNELS
+
+// multi-way kernels (sha256_sse41.c, sha256_avx2.c) and SHA-NI kernels (sha256_shani.c)
+void sha256d64_sse41(unsigned char * out, const unsigned char * in);
+void sha256d80_sse41(unsigned char * out, const unsigned char * in);
+void sha256d64_avx2(unsigned char * out, const unsigned char * in);
+void sha256d80_avx2(unsigned char * out, const unsigned char * in);
+void sha256_transform_shani(uint32_t * s, const unsigned char * chunk, size_t blocks);
+void sha256d64_shani(unsigned char * out, const unsigned char * in);
+void sha256d80_shani(unsigned char * out, const unsigned char * in);
+#endif
+
 uint32_t static inline Ch(uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); }
 uint32_t static inline Maj(uint32_t x, uint32_t y, uint32_t z) { return (x & y) | (z & (x | y)); }
 uint32_t static inline Sigma0(uint32_t x) { return (x >> 2 | x << 30) ^ (x >> 13 | x << 19) ^ (x >> 22 | x << 10); }
@@ -76,29 +90,32 @@ static void inline Initialize(uint32_t* s)
     s[7] = 0x5be0cd19ul;
 }
 
-/** Perform one SHA-256 transformation, processing a 64-byte chunk. */
-static void Transform(uint32_t* s, const unsigned char* chunk)
+/** 
+ * Perform one SHA-256 transformation with the message words w[16]. 
+ * (always inlined, so that the constant words of a padding block can be folded by the compiler)
+ */
+static inline __attribute__((always_inline)) void TransformW(uint32_t* s, const uint32_t w[16])
 {
     uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
     uint32_t w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15;
 
 
-    Round(a, b, c, &d, e, f, g, &h, 0x428a2f98, w0 = ReadBE32(chunk + 0));
-    Round(h, a, b, &c, d, e, f, &g, 0x71374491, w1 = ReadBE32(chunk + 4));
-    Round(g, h, a, &b, c, d, e, &f, 0xb5c0fbcf, w2 = ReadBE32(chunk + 8));
-    Round(f, g, h, &a, b, c, d, &e, 0xe9b5dba5, w3 = ReadBE32(chunk + 12));
-    Round(e, f, g, &h, a, b, c, &d, 0x3956c25b, w4 = ReadBE32(chunk + 16));
-    Round(d, e, f, &g, h, a, b, &c, 0x59f111f1, w5 = ReadBE32(chunk + 20));
-    Round(c, d, e, &f, g, h, a, &b, 0x923f82a4, w6 = ReadBE32(chunk + 24));
-    Round(b, c, d, &e, f, g, h, &a, 0xab1c5ed5, w7 = ReadBE32(chunk + 28));
-    Round(a, b, c, &d, e, f, g, &h, 0xd807aa98, w8 = ReadBE32(chunk + 32));
-    Round(h, a, b, &c, d, e, f, &g, 0x12835b01, w9 = ReadBE32(chunk + 36));
-    Round(g, h, a, &b, c, d, e, &f, 0x243185be, w10 = ReadBE32(chunk + 40));
-    Round(f, g, h, &a, b, c, d, &e, 0x550c7dc3, w11 = ReadBE32(chunk + 44));
-    Round(e, f, g, &h, a, b, c, &d, 0x72be5d74, w12 = ReadBE32(chunk + 48));
-    Round(d, e, f, &g, h, a, b, &c, 0x80deb1fe, w13 = ReadBE32(chunk + 52));
-    Round(c, d, e, &f, g, h, a, &b, 0x9bdc06a7, w14 = ReadBE32(chunk + 56));
-    Round(b, c, d, &e, f, g, h, &a, 0xc19bf174, w15 = ReadBE32(chunk + 60));
+    Round(a, b, c, &d, e, f, g, &h, 0x428a2f98, w0 = w[0]);
+    Round(h, a, b, &c, d, e, f, &g, 0x71374491, w1 = w[1]);
+    Round(g, h, a, &b, c, d, e, &f, 0xb5c0fbcf, w2 = w[2]);
+    Round(f, g, h, &a, b, c, d, &e, 0xe9b5dba5, w3 = w[3]);
+    Round(e, f, g, &h, a, b, c, &d, 0x3956c25b, w4 = w[4]);
+    Round(d, e, f, &g, h, a, b, &c, 0x59f111f1, w5 = w[5]);
+    Round(c, d, e, &f, g, h, a, &b, 0x923f82a4, w6 = w[6]);
+    Round(b, c, d, &e, f, g, h, &a, 0xab1c5ed5, w7 = w[7]);
+    Round(a, b, c, &d, e, f, g, &h, 0xd807aa98, w8 = w[8]);
+    Round(h, a, b, &c, d, e, f, &g, 0x12835b01, w9 = w[9]);
+    Round(g, h, a, &b, c, d, e, &f, 0x243185be, w10 = w[10]);
+    Round(f, g, h, &a, b, c, d, &e, 0x550c7dc3, w11 = w[11]);
+    Round(e, f, g, &h, a, b, c, &d, 0x72be5d74, w12 = w[12]);
+    Round(d, e, f, &g, h, a, b, &c, 0x80deb1fe, w13 = w[13]);
+    Round(c, d, e, &f, g, h, a, &b, 0x9bdc06a7, w14 = w[14]);
+    Round(b, c, d, &e, f, g, h, &a, 0xc19bf174, w15 = w[15]);
 
     Round(a, b, c, &d, e, f, g, &h, 0xe49b69c1, w0 += sigma1(w14) + w9 + sigma0(w1));
     Round(h, a, b, &c, d, e, f, &g, 0xefbe4786, w1 += sigma1(w15) + w10 + sigma0(w2));
@@ -161,6 +178,249 @@ static void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+/** Perform one SHA-256 transformation, processing a 64-byte chunk. */
+static void Transform(uint32_t* s, const unsigned char* chunk)
+{
+	uint32_t w[16];
+	for(int i = 0; i < 16; ++i) w[i] = ReadBE32(chunk + i * 4);
+	TransformW(s, w);
+}
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/**
+ * The padding block of a 64-byte message is a constant, 
+ * so (K[i] + W[i]) of all 64 rounds can be precomputed.
+ */
+static uint32_t s_padding64_kw[64];
+static void __attribute__((constructor)) precompute_padding64(void)
+{
+	uint32_t w[64] = { [0] = 0x80000000, [15] = 512 };
+	for(int i = 16; i < 64; ++i) w[i] = sigma1(w[i - 2]) + w[i - 7] + sigma0(w[i - 15]) + w[i - 16];
+	for(int i = 0; i < 64; ++i) s_padding64_kw[i] = K256[i] + w[i];
+}
+
+/** Perform one SHA-256 transformation with precomputed (K[i] + W[i]) */
+static void TransformKW(uint32_t* s, const uint32_t kw[64])
+{
+	uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+	for(int i = 0; i < 64; i += 8)
+	{
+		Round(a, b, c, &d, e, f, g, &h, kw[i + 0], 0);
+		Round(h, a, b, &c, d, e, f, &g, kw[i + 1], 0);
+		Round(g, h, a, &b, c, d, e, &f, kw[i + 2], 0);
+		Round(f, g, h, &a, b, c, d, &e, kw[i + 3], 0);
+		Round(e, f, g, &h, a, b, c, &d, kw[i + 4], 0);
+		Round(d, e, f, &g, h, a, b, &c, kw[i + 5], 0);
+		Round(c, d, e, &f, g, h, a, &b, kw[i + 6], 0);
+		Round(b, c, d, &e, f, g, h, &a, kw[i + 7], 0);
+	}
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+	s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+/** 
+ * The second round of double-SHA256: hash a 32-byte digest. 
+ * w[8..15] are the fixed padding words (0x80000000, 0, ..., 256).
+ */
+static void Transform32(uint32_t* s)
+{
+	uint32_t w[16] = {
+		s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], 
+		0x80000000, 0, 0, 0, 0, 0, 0, 256
+	};
+	Initialize(s);
+	TransformW(s, w);
+}
+
+static void transform_scalar(uint32_t * s, const unsigned char * chunk, size_t blocks)
+{
+	for(; blocks > 0; --blocks, chunk += 64) Transform(s, chunk);
+}
+
+/* hash256(in[64]) */
+static void sha256d64_scalar(unsigned char * out, const unsigned char * in)
+{
+	uint32_t s[8];
+	Initialize(s);
+	Transform(s, in);
+	TransformKW(s, s_padding64_kw);
+	Transform32(s);
+	for(int i = 0; i < 8; ++i) WriteBE32(out + i * 4, s[i]);
+}
+
+/* hash256(in[80]) */
+static void sha256d80_scalar(unsigned char * out, const unsigned char * in)
+{
+	uint32_t s[8];
+	const uint32_t w[16] = {	// the last 16 bytes and padding (640 bits)
+		ReadBE32(in + 64), ReadBE32(in + 68), ReadBE32(in + 72), ReadBE32(in + 76),
+		0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 640
+	};
+	Initialize(s);
+	Transform(s, in);
+	TransformW(s, w);
+	Transform32(s);
+	for(int i = 0; i < 8; ++i) WriteBE32(out + i * 4, s[i]);
+}
+
+/**
+ * runtime dispatch:
+ * 	select the fastest kernels supported by the cpu (cpuid), 
+ * 	the scalar code is always available as fallback.
+ */
+static struct
+{
+	enum sha256_impl impl;
+	void (* transform)(uint32_t * s, const unsigned char * chunk, size_t blocks);
+	void (* d64)(unsigned char * out, const unsigned char * in);	// 1-way
+	void (* d80)(unsigned char * out, const unsigned char * in);
+	int use_sse41;	// 4-way
+	int use_avx2;	// 8-way
+}s_sha256 = {
+	.impl = sha256_impl_scalar,
+	.transform = transform_scalar,
+	.d64 = sha256d64_scalar,
+	.d80 = sha256d80_scalar,
+};
+
+static int cpu_supports(enum sha256_impl impl)
+{
+	switch(impl)
+	{
+	case sha256_impl_scalar: return 1;
+#ifdef SHA256_X86_KERNELS
+	case sha256_impl_sse41: 
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.1");
+	case sha256_impl_avx2: 
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	case sha256_impl_shani:
+	{
+		unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+		__builtin_cpu_init();
+		if(!__builtin_cpu_supports("sse4.1")) return 0;
+		if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+		return (ebx >> 29) & 1;	// CPUID.(EAX=7,ECX=0):EBX.SHA[bit 29]
+	}
+#endif
+	default: break;
+	}
+	return 0;
+}
+
+/**
+ * sha256_set_impl:
+ * 	@param impl: sha256_impl_auto to select the fastest one.
+ * 	@return 0 on success, -1 if not supported by the cpu.
+ */
+int sha256_set_impl(enum sha256_impl impl)
+{
+	if(impl == sha256_impl_auto)
+	{
+		static const enum sha256_impl preferred[] = { 
+			sha256_impl_shani, sha256_impl_avx2, sha256_impl_sse41, sha256_impl_scalar 
+		};
+		for(size_t i = 0; i < (sizeof(preferred) / sizeof(preferred[0])); ++i) {
+			if(0 == sha256_set_impl(preferred[i])) return 0;
+		}
+		return -1;
+	}
+	if(!cpu_supports(impl)) return -1;
+	
+	s_sha256.impl = impl;
+	s_sha256.transform = transform_scalar;
+	s_sha256.d64 = sha256d64_scalar;
+	s_sha256.d80 = sha256d80_scalar;
+	s_sha256.use_sse41 = 0;
+	s_sha256.use_avx2 = 0;
+	
+#ifdef SHA256_X86_KERNELS
+	switch(impl)
+	{
+	case sha256_impl_shani:
+		s_sha256.transform = sha256_transform_shani;
+		s_sha256.d64 = sha256d64_shani;
+		s_sha256.d80 = sha256d80_shani;
+		break;
+	case sha256_impl_avx2:
+		s_sha256.use_avx2 = 1;
+		s_sha256.use_sse41 = cpu_supports(sha256_impl_sse41);
+		break;
+	case sha256_impl_sse41:
+		s_sha256.use_sse41 = 1;
+		break;
+	default:
+		break;
+	}
+#endif
+	return 0;
+}
+
+const char * sha256_get_impl_name(void)
+{
+	switch(s_sha256.impl)
+	{
+	case sha256_impl_sse41: return "sse4.1(4-way)";
+	case sha256_impl_avx2: return "avx2(8-way)";
+	case sha256_impl_shani: return "shani";
+	default: break;
+	}
+	return "scalar";
+}
+
+static void __attribute__((constructor)) sha256_impl_init(void)
+{
+	sha256_set_impl(sha256_impl_auto);
+}
+
+void sha256d64(unsigned char out[static 32], const unsigned char in[static 64])
+{
+	s_sha256.d64(out, in);
+}
+
+void sha256d80(unsigned char out[static 32], const unsigned char in[static 80])
+{
+	s_sha256.d80(out, in);
+}
+
+void sha256d64_batch(unsigned char * out, const unsigned char * in, size_t count)
+{
+	size_t i = 0;
+#ifdef SHA256_X86_KERNELS
+	if(s_sha256.use_avx2) {
+		for(; (i + 8) <= count; i += 8) sha256d64_avx2(out + i * 32, in + i * 64);
+	}
+	if(s_sha256.use_sse41) {
+		for(; (i + 4) <= count; i += 4) sha256d64_sse41(out + i * 32, in + i * 64);
+	}
+#endif
+	for(; i < count; ++i) s_sha256.d64(out + i * 32, in + i * 64);
+}
+
+void sha256d80_batch(unsigned char * out, const unsigned char * in, size_t count)
+{
+	size_t i = 0;
+#ifdef SHA256_X86_KERNELS
+	if(s_sha256.use_avx2) {
+		for(; (i + 8) <= count; i += 8) sha256d80_avx2(out + i * 32, in + i * 80);
+	}
+	if(s_sha256.use_sse41) {
+		for(; (i + 4) <= count; i += 4) sha256d80_sse41(out + i * 32, in + i * 80);
+	}
+#endif
+	for(; i < count; ++i) s_sha256.d80(out + i * 32, in + i * 80);
+}
 
 void sha256_init(sha256_ctx_t * sha)
 {
@@ -176,14 +436,15 @@ void sha256_update(sha256_ctx_t * sha, const unsigned char * data, size_t len)
         memcpy(sha->buf + bufsize, data, 64 - bufsize);
         sha->bytes += 64 - bufsize;
         data += 64 - bufsize;
-        Transform(sha->s, sha->buf);
+        s_sha256.transform(sha->s, sha->buf, 1);
         bufsize = 0;
     }
-    while (end >= data + 64) {
+    if (end >= data + 64) {
         // Process full chunks directly from the source.
-        Transform(sha->s, data);
-        sha->bytes += 64;
-        data += 64;
+        size_t blocks = (end - data) / 64;
+        s_sha256.transform(sha->s, data, blocks);
+        sha->bytes += 64 * blocks;
+        data += 64 * blocks;
     }
     if (end > data) {
         // Fill the buffer with what remains.
@@ -210,4 +471,79 @@ void sha256_final(sha256_ctx_t * sha, unsigned char hash[32])
 }
 
 
+#if defined(_TEST_SHA256) && defined(_STAND_ALONE)
+#include <assert.h>
+static void hash256_ref(const unsigned char * data, size_t length, unsigned char hash[32])
+{
+	sha256_ctx_t sha[1];
+	sha256_init(sha);
+	sha256_update(sha, data, length);
+	sha256_final(sha, hash);
+	sha256_init(sha);
+	sha256_update(sha, hash, 32);
+	sha256_final(sha, hash);
+}
 
+int main(int argc, char ** argv)
+{
+	#define NUM_MESSAGES (29)
+	static unsigned char msg64[NUM_MESSAGES * 64];
+	static unsigned char msg80[NUM_MESSAGES * 80];
+	static unsigned char ref64[NUM_MESSAGES * 32], ref80[NUM_MESSAGES * 32];
+	static unsigned char out[NUM_MESSAGES * 32];
+	
+	for(size_t i = 0; i < sizeof(msg64); ++i) msg64[i] = (unsigned char)(i * 7 + 3);
+	for(size_t i = 0; i < sizeof(msg80); ++i) msg80[i] = (unsigned char)(i * 13 + 1);
+	
+	// reference results: generic sha256 with the scalar transform
+	assert(0 == sha256_set_impl(sha256_impl_scalar));
+	for(int i = 0; i < NUM_MESSAGES; ++i) {
+		hash256_ref(msg64 + i * 64, 64, ref64 + i * 32);
+		hash256_ref(msg80 + i * 80, 80, ref80 + i * 32);
+	}
+	
+	static const unsigned char sha256_abc[32] = {
+		0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+		0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+	};
+	
+	for(int impl = sha256_impl_scalar; impl <= sha256_impl_shani; ++impl)
+	{
+		if(sha256_set_impl(impl)) continue;
+		printf("== test %s ...\n", sha256_get_impl_name());
+		
+		unsigned char hash[32];
+		sha256_ctx_t sha[1];
+		sha256_init(sha);
+		sha256_update(sha, (unsigned char *)"abc", 3);
+		sha256_final(sha, hash);
+		assert(0 == memcmp(hash, sha256_abc, 32));
+		
+		for(int i = 0; i < NUM_MESSAGES; ++i) {
+			sha256d64(hash, msg64 + i * 64);
+			assert(0 == memcmp(hash, ref64 + i * 32, 32));
+			sha256d80(hash, msg80 + i * 80);
+			assert(0 == memcmp(hash, ref80 + i * 32, 32));
+		}
+		
+		for(int count = 0; count <= NUM_MESSAGES; ++count) {
+			memset(out, 0, sizeof(out));
+			sha256d64_batch(out, msg64, count);
+			assert(0 == memcmp(out, ref64, count * 32));
+			
+			memset(out, 0, sizeof(out));
+			sha256d80_batch(out, msg80, count);
+			assert(0 == memcmp(out, ref80, count * 32));
+		}
+		
+		// multi-block update
+		unsigned char hash2[32];
+		hash256_ref(msg80, sizeof(msg80), hash);
+		sha256_set_impl(sha256_impl_scalar);
+		hash256_ref(msg80, sizeof(msg80), hash2);
+		assert(0 == memcmp(hash, hash2, 32));
+	}
+	#undef NUM_MESSAGES
+	return 0;
+}
+#endif
@@ -0,0 +1,163 @@
+/*
+ * sha256_multiway.h
+ *
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * sha256_multiway.h:
+ * 	N-way SHA-256 kernels (double-hash of 64-byte or 80-byte messages),
+ * 	one message per vector lane, written with gcc vector extensions.
+ * 
+ * This file is a template, it should be included by a kernel file with:
+ * 	SHA256_LANES:	number of lanes (4 for sse4.1, 8 for avx2)
+ * 	SHA256_KERNEL(name): the exported function name
+ * and with the target instruction set enabled by '#pragma GCC target'.
+ */
+
+#if !defined(SHA256_LANES) || !defined(SHA256_KERNEL)
+#error "SHA256_LANES and SHA256_KERNEL must be defined."
+#endif
+
+#include <stdint.h>
+#include "common.h"
+
+typedef uint32_t vec_t __attribute__((vector_size(SHA256_LANES * 4)));
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t H256[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline vec_t K(uint32_t x) { return (vec_t){0} + x; }
+static inline vec_t Ror(vec_t x, int n) { return (x >> n) | (x << (32 - n)); }
+static inline vec_t Ch(vec_t x, vec_t y, vec_t z) { return z ^ (x & (y ^ z)); }
+static inline vec_t Maj(vec_t x, vec_t y, vec_t z) { return (x & y) | (z & (x | y)); }
+static inline vec_t Sigma0(vec_t x) { return Ror(x, 2) ^ Ror(x, 13) ^ Ror(x, 22); }
+static inline vec_t Sigma1(vec_t x) { return Ror(x, 6) ^ Ror(x, 11) ^ Ror(x, 25); }
+static inline vec_t sigma0(vec_t x) { return Ror(x, 7) ^ Ror(x, 18) ^ (x >> 3); }
+static inline vec_t sigma1(vec_t x) { return Ror(x, 17) ^ Ror(x, 19) ^ (x >> 10); }
+
+static inline void Initialize(vec_t s[8])
+{
+	for(int i = 0; i < 8; ++i) s[i] = K(H256[i]);
+}
+
+static inline void Transform(vec_t s[8], vec_t w[16])
+{
+	vec_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+	
+#pragma GCC unroll 64
+	for(int i = 0; i < 64; ++i)
+	{
+		vec_t wi = w[i & 15];
+		if(i >= 16) {
+			wi += sigma1(w[(i + 14) & 15]) + w[(i + 9) & 15] + sigma0(w[(i + 1) & 15]);
+			w[i & 15] = wi;
+		}
+		vec_t t1 = h + Sigma1(e) + Ch(e, f, g) + K(K256[i]) + wi;
+		vec_t t2 = Sigma0(a) + Maj(a, b, c);
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+	s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+static inline void load_words(vec_t * w, int num_words, const unsigned char * in, size_t stride)
+{
+	for(int i = 0; i < num_words; ++i)
+	{
+		for(int lane = 0; lane < SHA256_LANES; ++lane)
+		{
+			w[i][lane] = ReadBE32(in + lane * stride + i * 4);
+		}
+	}
+}
+
+/* hash the 32-byte digest (second round of double-SHA256) and write the results */
+static inline void finalize_hash256(vec_t s[8], unsigned char * out)
+{
+	vec_t w[16];
+	for(int i = 0; i < 8; ++i) w[i] = s[i];
+	w[8] = K(0x80000000);
+	for(int i = 9; i < 15; ++i) w[i] = K(0);
+	w[15] = K(256);
+	
+	Initialize(s);
+	Transform(s, w);
+	
+	for(int lane = 0; lane < SHA256_LANES; ++lane)
+	{
+		for(int i = 0; i < 8; ++i) WriteBE32(out + lane * 32 + i * 4, s[i][lane]);
+	}
+}
+
+/* (SHA256_LANES) x hash256(in[64]) */
+void SHA256_KERNEL(sha256d64)(unsigned char * out, const unsigned char * in)
+{
+	vec_t s[8], w[16];
+	
+	Initialize(s);
+	load_words(w, 16, in, 64);
+	Transform(s, w);
+	
+	// padding block of a 64-byte message
+	w[0] = K(0x80000000);
+	for(int i = 1; i < 15; ++i) w[i] = K(0);
+	w[15] = K(512);
+	Transform(s, w);
+	
+	finalize_hash256(s, out);
+}
+
+/* (SHA256_LANES) x hash256(in[80]) */
+void SHA256_KERNEL(sha256d80)(unsigned char * out, const unsigned char * in)
+{
+	vec_t s[8], w[16];
+	
+	Initialize(s);
+	load_words(w, 16, in, 80);
+	Transform(s, w);
+	
+	load_words(w, 4, in + 64, 80);
+	w[4] = K(0x80000000);
+	for(int i = 5; i < 15; ++i) w[i] = K(0);
+	w[15] = K(640);
+	Transform(s, w);
+	
+	finalize_hash256(s, out);
+}
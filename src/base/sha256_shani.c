@@ -0,0 +1,173 @@
+/*
+ * sha256_shani.c
+ *
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * SHA-256 with the Intel SHA extensions (SHA-NI)
+ * 	based on the public domain code by Sean Gulley (Intel) and Jeffrey Walton.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC target("sha,sse4.1")
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "common.h"
+
+static const uint32_t K256[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t H256[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define K4(i) _mm_load_si128((const __m128i *)&K256[i])
+
+/* 4 rounds with message schedule: m0 is used for the rounds, m1 and m3 are updated */
+#define QROUND(i, m0, m1, m2, m3) do { \
+		msg = _mm_add_epi32(m0, K4(i)); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+		tmp = _mm_alignr_epi8(m0, m3, 4); \
+		m1 = _mm_add_epi32(m1, tmp); \
+		m1 = _mm_sha256msg2_epu32(m1, m0); \
+		msg = _mm_shuffle_epi32(msg, 0x0E); \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+		m3 = _mm_sha256msg1_epu32(m3, m0); \
+	} while(0)
+
+/* 4 rounds without message schedule */
+#define ROUND4(i, m0) do { \
+		msg = _mm_add_epi32(m0, K4(i)); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+		msg = _mm_shuffle_epi32(msg, 0x0E); \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+	} while(0)
+
+void sha256_transform_shani(uint32_t * s, const unsigned char * chunk, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, msg, tmp;
+	__m128i msg0, msg1, msg2, msg3;
+	__m128i abef_save, cdgh_save;
+	
+	tmp = _mm_loadu_si128((const __m128i *)&s[0]);
+	state1 = _mm_loadu_si128((const __m128i *)&s[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);				// CDAB
+	state1 = _mm_shuffle_epi32(state1, 0x1B);		// EFGH
+	state0 = _mm_alignr_epi8(tmp, state1, 8);		// ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);	// CDGH
+	
+	for(; blocks > 0; --blocks, chunk += 64)
+	{
+		abef_save = state0;
+		cdgh_save = state1;
+		
+		msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(chunk + 0)), mask);
+		msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(chunk + 16)), mask);
+		msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(chunk + 32)), mask);
+		msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(chunk + 48)), mask);
+		
+		ROUND4(0, msg0);
+		ROUND4(4, msg1);
+		msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+		ROUND4(8, msg2);
+		msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+		
+		QROUND(12, msg3, msg0, msg1, msg2);
+		QROUND(16, msg0, msg1, msg2, msg3);
+		QROUND(20, msg1, msg2, msg3, msg0);
+		QROUND(24, msg2, msg3, msg0, msg1);
+		QROUND(28, msg3, msg0, msg1, msg2);
+		QROUND(32, msg0, msg1, msg2, msg3);
+		QROUND(36, msg1, msg2, msg3, msg0);
+		QROUND(40, msg2, msg3, msg0, msg1);
+		QROUND(44, msg3, msg0, msg1, msg2);
+		QROUND(48, msg0, msg1, msg2, msg3);
+		QROUND(52, msg1, msg2, msg3, msg0);
+		QROUND(56, msg2, msg3, msg0, msg1);
+		ROUND4(60, msg3);
+		
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+	
+	tmp = _mm_shuffle_epi32(state0, 0x1B);			// FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xB1);		// DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);	// DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8);		// HGFE
+	
+	_mm_storeu_si128((__m128i *)&s[0], state0);
+	_mm_storeu_si128((__m128i *)&s[4], state1);
+}
+#undef QROUND
+#undef ROUND4
+#undef K4
+
+static inline void finalize_hash256(uint32_t s[8], unsigned char * out)
+{
+	unsigned char buf[64] = { [32] = 0x80, [62] = 0x01 };	// 256 bits
+	for(int i = 0; i < 8; ++i) WriteBE32(buf + i * 4, s[i]);
+	
+	memcpy(s, H256, sizeof(H256));
+	sha256_transform_shani(s, buf, 1);
+	for(int i = 0; i < 8; ++i) WriteBE32(out + i * 4, s[i]);
+}
+
+/* hash256(in[64]) */
+void sha256d64_shani(unsigned char * out, const unsigned char * in)
+{
+	static const unsigned char padding[64] = { [0] = 0x80, [62] = 0x02 };	// 512 bits
+	uint32_t s[8];
+	memcpy(s, H256, sizeof(H256));
+	sha256_transform_shani(s, in, 1);
+	sha256_transform_shani(s, padding, 1);
+	finalize_hash256(s, out);
+}
+
+/* hash256(in[80]) */
+void sha256d80_shani(unsigned char * out, const unsigned char * in)
+{
+	unsigned char buf[64] = { [16] = 0x80, [62] = 0x02, [63] = 0x80 };	// 640 bits
+	uint32_t s[8];
+	memcpy(buf, in + 64, 16);
+	memcpy(s, H256, sizeof(H256));
+	sha256_transform_shani(s, in, 1);
+	sha256_transform_shani(s, buf, 1);
+	finalize_hash256(s, out);
+}
+
+#endif
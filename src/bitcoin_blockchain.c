@@ -49,6 +49,29 @@
 #include "utils.h"
 
 #include <libgen.h>
+#include <time.h>
+
+/**
+ * block_undo: the coins added / spent by a block, in order,
+ * 	reverting them in reverse order disconnects the block.
+ */
+struct utxo_change
+{
+	satoshi_outpoint_t outpoint;
+	int is_spent;			// 0: added by the block, 1: spent by the block
+	db_record_utxo_t utxo;	// the spent coin (owns its scripts)
+};
+
+typedef struct block_undo
+{
+	int height;
+	ssize_t count;
+	ssize_t max_size;
+	struct utxo_change * changes;
+}block_undo_t;
+static void block_undo_cleanup(block_undo_t * undo);
+
+#define BITCOIN_MAX_UNDO_BLOCKS (100)	// the deepest reorg that the utxoes can be disconnected for
 
 typedef struct bitcoin_blockchain_private
 {
@@ -60,6 +83,7 @@ typedef struct bitcoin_blockchain_private
 	
 	const char * blocks_data_path;
 	const char * db_home;
+	const char * db_backend;	// "bdb" (default), "memory" or "lmdb"
 	
 	char root_path[PATH_MAX];
 	
@@ -67,6 +91,16 @@ typedef struct bitcoin_blockchain_private
 	struct satoshi_block_header * genesis_block_hdr;
 	
 	uint32_t magic;		// network magic
+	int utxo_cache_size;	// (in MB)
+	int utxo_prefetch_threads;	// < 0: number of online cpus
+	
+	db_engine_config_t db_config[1];
+	int fast_ibd;	// the db_engine runs without durability until the chain tip is reached
+	
+	// the coins of main_chain[0 .. utxo_height] are connected to utxo_cache
+	int utxo_height;
+	const satoshi_block_t * current_block;	// the block passed to add_block()
+	block_undo_t undo[BITCOIN_MAX_UNDO_BLOCKS];	// of the last connected blocks, indexed by (height % BITCOIN_MAX_UNDO_BLOCKS)
 	
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
@@ -127,6 +161,7 @@ static bitcoin_blockchain_private_t * bitcoin_blockchain_private_new(bitcoin_blo
 	priv->node_port = "28333";
 	priv->db_home = "data";
 	priv->blocks_data_path = "blocks";
+	priv->magic = BITCOIN_MESSAGE_MAGIC_MAINNET;
 	
 	int rc = pthread_mutex_init(&priv->mutex, 
 	//	&s_mutexattr_recursive
@@ -155,6 +190,8 @@ static void bitcoin_blockchain_private_free(bitcoin_blockchain_private_t * priv)
 	pthread_mutex_destroy(&priv->mutex);
 	pthread_cond_destroy(&priv->cond);
 	
+	for(int i = 0; i < BITCOIN_MAX_UNDO_BLOCKS; ++i) block_undo_cleanup(&priv->undo[i]);
+	
 	if(priv->jconfig) {
 		json_object_put(priv->jconfig);
 		priv->jconfig = NULL;
@@ -163,8 +200,63 @@ static void bitcoin_blockchain_private_free(bitcoin_blockchain_private_t * priv)
 	return;
 }
 
+/**
+ * "db_config": {
+ *     "profile": "default" | "fast_ibd",
+ *     "cache_size": (MB), "cache_regions": n, "log_buffer_size": (KB), "map_size": (MB),
+ *     "durability": "sync" | "write_nosync" | "nosync",
+ *     "page_size": bytes, "page_sizes": { "<db_filename>": bytes, ... }
+ * }
+ * The profile is applied first, the other fields override it.
+ */
+static int load_db_config(bitcoin_blockchain_private_t * priv, json_object * jdb_config)
+{
+	db_engine_config_t * config = priv->db_config;
+	
+	const char * profile = json_get_value(jdb_config, string, profile);
+	if(db_engine_config_load_profile(config, profile)) {
+		fprintf(stderr, "[ERROR]::%s(): unknown db profile '%s'.\n", __FUNCTION__, profile);
+		return -1;
+	}
+	priv->fast_ibd = (profile && 0 == strcasecmp(profile, "fast_ibd"));
+	
+	int cache_size = json_get_value(jdb_config, int, cache_size);
+	if(cache_size > 0) config->cache_size = (size_t)cache_size << 20;
+	config->cache_regions = json_get_value_default(jdb_config, int, cache_regions, config->cache_regions);
+	int log_buffer_size = json_get_value(jdb_config, int, log_buffer_size);
+	if(log_buffer_size > 0) config->log_buffer_size = (size_t)log_buffer_size << 10;
+	int map_size = json_get_value(jdb_config, int, map_size);
+	if(map_size > 0) config->map_size = (size_t)map_size << 20;
+	
+	const char * durability = json_get_value(jdb_config, string, durability);
+	if(durability) {
+		if(0 == strcasecmp(durability, "sync")) config->durability = db_engine_durability_sync;
+		else if(0 == strcasecmp(durability, "write_nosync")) config->durability = db_engine_durability_write_nosync;
+		else if(0 == strcasecmp(durability, "nosync")) config->durability = db_engine_durability_nosync;
+		else {
+			fprintf(stderr, "[ERROR]::%s(): unknown durability '%s'.\n", __FUNCTION__, durability);
+			return -1;
+		}
+	}
+	
+	int rc = db_engine_config_set_page_size(config, NULL, json_get_value(jdb_config, int, page_size));
+	json_object * jpage_sizes = NULL;
+	if(0 == rc && json_object_object_get_ex(jdb_config, "page_sizes", &jpage_sizes) && jpage_sizes) {
+		json_object_object_foreach(jpage_sizes, db_name, jpage_size) {
+			rc = db_engine_config_set_page_size(config, db_name, json_object_get_int(jpage_size));
+			if(rc) break;
+		}
+	}
+	if(rc) {
+		fprintf(stderr, "[ERROR]::%s(): invalid page_size(s).\n", __FUNCTION__);
+		return -1;
+	}
+	return 0;
+}
+
 static int bitcoin_load_config(struct bitcoin_blockchain * bitcoin, json_object * jconfig)
 {
+	int rc = 0;
 	assert(bitcoin && bitcoin->priv);
 	bitcoin_blockchain_private_t * priv = bitcoin->priv;
 	
@@ -174,10 +266,23 @@ static int bitcoin_load_config(struct bitcoin_blockchain * bitcoin, json_object
 	
 	const char * db_home = json_get_value(jconfig, string, db_home);
 	if(db_home) priv->db_home = db_home;
+	priv->db_backend = json_get_value(jconfig, string, db_backend);
+	if(NULL == db_engine_backend_find(priv->db_backend)) {
+		fprintf(stderr, "[ERROR]::%s(): db_backend '%s' is not available.\n", __FUNCTION__, priv->db_backend);
+		return -1;
+	}
 	
 	const char * blocks_data_path = json_get_value(jconfig, string, blocks);
 	if(blocks_data_path) priv->blocks_data_path = blocks_data_path;
 	
+	priv->utxo_cache_size = json_get_value_default(jconfig, int, utxo_cache_size, 0);
+	priv->utxo_prefetch_threads = json_get_value_default(jconfig, int, utxo_prefetch_threads, -1);
+	
+	json_object * jdb_config = NULL;
+	if(json_object_object_get_ex(jconfig, "db_config", &jdb_config) && jdb_config) {
+		rc = load_db_config(priv, jdb_config);
+		if(rc) return rc;
+	}
 	
 	return 0;
 }
@@ -254,17 +359,30 @@ static int bitcoin_run(struct bitcoin_blockchain * bitcoin, int async_mode)
 	assert(cb > 0 && cb < sizeof(path_name));
 	
 	// init dbs
-	db_engine_t * engine =  db_engine_init(NULL, path_name, bitcoin);
+	const db_engine_backend_t * backend = db_engine_backend_find(priv->db_backend);
+	assert(backend);
+	db_engine_t * engine =  db_engine_init_with_config(NULL, backend, priv->db_config, path_name, bitcoin);
 	assert(engine);
 	bitcoin->engine = engine;
 	
 	blocks_db_t * blocks = blocks_db_init(bitcoin->block_db, engine, NULL, bitcoin);
 	utxoes_db_t * utxoes = utxoes_db_init(bitcoin->utxo_db, engine, NULL, bitcoin);
 	transactions_db_t * txes = transactions_db_init(bitcoin->tx_db, engine, NULL, bitcoin);
+	if(NULL == utxoes) return -1;	// the utxoes db was written in another format
 	assert(blocks && blocks == bitcoin->block_db);
 	assert(utxoes && utxoes == bitcoin->utxo_db);
 	assert(txes && txes == bitcoin->tx_db);
 	
+	cb = get_fullname(priv->root_path, priv->blocks_data_path, path_name, sizeof(path_name));
+	block_file_store_t * block_store = block_file_store_init(bitcoin->block_store, path_name, priv->magic, blocks, bitcoin);
+	assert(block_store && block_store == bitcoin->block_store);
+	
+	size_t utxo_cache_size = (priv->utxo_cache_size > 0)?((size_t)priv->utxo_cache_size << 20):0;
+	utxoes_cache_t * utxo_cache = utxoes_cache_init(bitcoin->utxo_cache, utxoes, engine, utxo_cache_size, bitcoin);
+	assert(utxo_cache && utxo_cache == bitcoin->utxo_cache);
+	rc = utxoes_cache_set_prefetch_threads(utxo_cache, priv->utxo_prefetch_threads);
+	assert(0 == rc);
+	
 	// init mem db
 	avl_tree_t * mem_db = avl_tree_init(bitcoin->mem_db, bitcoin);
 	assert(mem_db && mem_db == bitcoin->mem_db);
@@ -273,6 +391,7 @@ static int bitcoin_run(struct bitcoin_blockchain * bitcoin, int async_mode)
 	blockchain_t * main_chain = blockchain_init(bitcoin->main_chain, priv->genesis_block_hash, priv->genesis_block_hdr, bitcoin);
 	assert(main_chain && main_chain == bitcoin->main_chain);
 	main_chain->on_add_block = bitcoin->on_add_block;
+	main_chain->on_add_blocks = bitcoin->on_add_blocks;
 	main_chain->on_remove_block = bitcoin->on_remove_block;
 	
 	// run
@@ -318,7 +437,30 @@ static int bitcoin_stop(struct bitcoin_blockchain * bitcoin)
 }
 
 static int bitcoin_on_add_block(blockchain_t * bchain, const uint256_t * block_hash, int height, void * user_data);
+static int bitcoin_on_add_blocks(blockchain_t * bchain, const uint256_t block_hashes[], int start_height, ssize_t count, void * user_data);
 static int bitcoin_on_remove_block(blockchain_t * bchain, const uint256_t * block_hash, int height, void * user_data);
+
+static ssize_t bitcoin_prefetch_block(struct bitcoin_blockchain * bitcoin, const satoshi_block_t * block)
+{
+	assert(bitcoin && block);
+	if(NULL == bitcoin->utxo_cache->priv) return 0;
+	return utxoes_cache_prefetch_block(bitcoin->utxo_cache, block);
+}
+
+static enum blockchain_error bitcoin_add_block(struct bitcoin_blockchain * bitcoin, const satoshi_block_t * block)
+{
+	assert(bitcoin && bitcoin->priv && block);
+	bitcoin_blockchain_private_t * priv = bitcoin->priv;
+	
+	bitcoin_prefetch_block(bitcoin, block);
+	
+	// on_add_block() connects it without loading it from the block_store
+	priv->current_block = block;
+	enum blockchain_error err = bitcoin->main_chain->add(bitcoin->main_chain, &block->hash, &block->hdr);
+	priv->current_block = NULL;
+	return err;
+}
+
 bitcoin_blockchain_t * bitcoin_blockchain_init(bitcoin_blockchain_t * bitcoin, void * user_data)
 {
 	int rc = -1;
@@ -333,8 +475,11 @@ bitcoin_blockchain_t * bitcoin_blockchain_init(bitcoin_blockchain_t * bitcoin, v
 	bitcoin->load_config = bitcoin_load_config;
 	bitcoin->run = bitcoin_run;
 	bitcoin->stop = bitcoin_stop;
+	bitcoin->prefetch_block = bitcoin_prefetch_block;
+	bitcoin->add_block = bitcoin_add_block;
 	
 	bitcoin->on_add_block = bitcoin_on_add_block;
+	bitcoin->on_add_blocks = bitcoin_on_add_blocks;
 	bitcoin->on_remove_block = bitcoin_on_remove_block;
 	
 	bitcoin_blockchain_private_t * priv = bitcoin_blockchain_private_new(bitcoin);
@@ -350,6 +495,12 @@ void bitcoin_blockchain_cleanup(bitcoin_blockchain_t * bitcoin)
 	bitcoin_blockchain_private_free(bitcoin->priv);
 	bitcoin->priv = NULL;
 	
+	if(bitcoin->utxo_cache->priv) {
+		bitcoin->utxo_cache->flush(bitcoin->utxo_cache);
+		utxoes_cache_cleanup(bitcoin->utxo_cache);
+	}
+	
+	block_file_store_cleanup(bitcoin->block_store);
 	blocks_db_cleanup(bitcoin->block_db);
 	utxoes_db_cleanup(bitcoin->utxo_db);
 	transactions_db_cleanup(bitcoin->tx_db);
@@ -362,6 +513,199 @@ void bitcoin_blockchain_cleanup(bitcoin_blockchain_t * bitcoin)
 /**********************************************************
  * on add/remove block
 **********************************************************/
+#define FAST_IBD_TIP_AGE	(24 * 3600)	// a block newer than this is considered to be near the tip
+
+// restore the durability once the initial block download has caught up with the network
+static void check_fast_ibd_tip(bitcoin_blockchain_t * bitcoin, int64_t timestamp, int height)
+{
+	bitcoin_blockchain_private_t * priv = bitcoin->priv;
+	if(priv->fast_ibd && bitcoin->engine 
+		&& timestamp >= (int64_t)time(NULL) - FAST_IBD_TIP_AGE)
+	{
+		int rc = bitcoin->engine->set_durability(bitcoin->engine, db_engine_durability_sync);
+		if(0 == rc) {
+			priv->fast_ibd = 0;
+			fprintf(stderr, "%s(): reached the tip at height %d, db durability restored.\n", __FUNCTION__, height);
+		}
+	}
+}
+
+static void block_undo_cleanup(block_undo_t * undo)
+{
+	for(ssize_t i = 0; i < undo->count; ++i) {
+		if(undo->changes[i].is_spent) db_record_utxo_cleanup(&undo->changes[i].utxo);
+	}
+	free(undo->changes);
+	memset(undo, 0, sizeof(*undo));
+}
+
+static struct utxo_change * block_undo_append(block_undo_t * undo)
+{
+	if(undo->count >= undo->max_size) {
+		ssize_t new_size = undo->max_size?(undo->max_size * 2):256;
+		undo->changes = realloc(undo->changes, new_size * sizeof(*undo->changes));
+		assert(undo->changes);
+		undo->max_size = new_size;
+	}
+	struct utxo_change * change = &undo->changes[undo->count++];
+	memset(change, 0, sizeof(*change));
+	return change;
+}
+
+static int revert_changes(utxoes_cache_t * cache, block_undo_t * undo)
+{
+	int rc = 0;
+	for(ssize_t i = undo->count - 1; i >= 0 && 0 == rc; --i) {
+		struct utxo_change * change = &undo->changes[i];
+		if(change->is_spent) {
+			satoshi_txout_t txout = { .value = change->utxo.value, .scripts = change->utxo.scripts };
+			rc = cache->add(cache, &change->outpoint, &txout, change->utxo.height, change->utxo.is_coinbase);
+		}else {
+			rc = cache->remove(cache, &change->outpoint, NULL);
+		}
+	}
+	if(rc) fprintf(stderr, "[ERROR]::%s(): failed to revert the coins of block %d.\n", __FUNCTION__, undo->height);
+	return rc;
+}
+
+// OP_RETURN outputs and oversized scripts can never be spent, they are not added to the utxoes
+static inline int txout_is_unspendable(const satoshi_txout_t * txout)
+{
+	size_t length = varstr_length(txout->scripts);
+	if(length > UTXOES_DB_MAX_SCRIPT_LENGTH) return 1;
+	return (length > 0 && varstr_getdata_ptr(txout->scripts)[0] == 0x6a);
+}
+
+// spend the prevouts and add the outputs of each tx, the changes are recorded into undo
+static int connect_block(bitcoin_blockchain_t * bitcoin, const satoshi_block_t * block, int height, block_undo_t * undo)
+{
+	int rc = 0;
+	utxoes_cache_t * cache = bitcoin->utxo_cache;
+	
+	for(ssize_t i = 0; i < block->txn_count; ++i) {
+		const satoshi_tx_t * tx = &block->txns[i];
+		if(i > 0) { // the coinbase has no prevouts
+			for(ssize_t ii = 0; ii < tx->txin_count; ++ii) {
+				struct utxo_change * change = block_undo_append(undo);
+				change->outpoint = tx->txins[ii].outpoint;
+				change->is_spent = 1;
+				rc = cache->remove(cache, &change->outpoint, &change->utxo);
+				if(rc) {
+					--undo->count;
+					fprintf(stderr, "[ERROR]::%s(): block %d, tx %ld: txin %ld spends a missing coin.\n", 
+						__FUNCTION__, height, (long)i, (long)ii);
+					return -1;
+				}
+			}
+		}
+		
+		for(ssize_t ii = 0; ii < tx->txout_count; ++ii) {
+			if(txout_is_unspendable(&tx->txouts[ii])) continue;
+			
+			satoshi_outpoint_t outpoint = { .index = (uint32_t)ii };
+			memcpy(outpoint.prev_hash, tx->txid, sizeof(outpoint.prev_hash));
+			rc = cache->add(cache, &outpoint, &tx->txouts[ii], height, (0 == i));
+			if(rc) return -1;
+			
+			struct utxo_change * change = block_undo_append(undo);
+			change->outpoint = outpoint;
+		}
+	}
+	return 0;
+}
+
+// the block passed to add_block(), or load it from the block_store
+static const satoshi_block_t * load_block(bitcoin_blockchain_t * bitcoin, const uint256_t * hash, satoshi_block_t * buffer)
+{
+	bitcoin_blockchain_private_t * priv = bitcoin->priv;
+	if(priv->current_block && 0 == memcmp(&priv->current_block->hash, hash, sizeof(*hash))) return priv->current_block;
+	
+	block_file_store_t * store = bitcoin->block_store;
+	if(NULL == store->priv) return NULL;
+	
+	const unsigned char * data = NULL;
+	ssize_t length = store->find(store, NULL, hash, &data);
+	if(length <= 0) return NULL;
+	
+	memset(buffer, 0, sizeof(*buffer));
+	ssize_t cb = satoshi_block_parse(buffer, length, data);
+	if(cb != length) {
+		satoshi_block_cleanup(buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+/**
+ * connect_blocks(): 
+ * 	connect main_chain[utxo_height + 1 .. height] to the utxoes in order, 
+ * 	stops at the first block whose data is not available yet (headers-first), 
+ * 	the caller must hold priv->mutex
+ */
+static int connect_blocks(bitcoin_blockchain_t * bitcoin, blockchain_t * bchain, int height)
+{
+	bitcoin_blockchain_private_t * priv = bitcoin->priv;
+	utxoes_cache_t * cache = bitcoin->utxo_cache;
+	if(NULL == cache->priv) return 0;
+	
+	// the prevouts queued by prefetch_block()
+	cache->prefetch_wait(cache);
+	
+	while(priv->utxo_height < height) {
+		int next_height = priv->utxo_height + 1;
+		satoshi_block_t buffer[1];
+		const satoshi_block_t * block = load_block(bitcoin, &bchain->heirs->hashes[next_height], buffer);
+		if(NULL == block) break;
+		
+		// keep the undo data for disconnect_block()
+		block_undo_t * undo = &priv->undo[next_height % BITCOIN_MAX_UNDO_BLOCKS];
+		block_undo_cleanup(undo);
+		undo->height = next_height;
+		
+		int rc = connect_block(bitcoin, block, next_height, undo);
+		if(block == buffer) satoshi_block_cleanup(buffer);
+		if(rc) {
+			revert_changes(cache, undo);
+			block_undo_cleanup(undo);
+			return rc;
+		}
+		priv->utxo_height = next_height;
+		
+		// flush at block boundaries only, the db never sees a partially connected block
+		rc = cache->check_flush(cache);
+		if(rc < 0) return rc;
+	}
+	return 0;
+}
+
+/**
+ * disconnect_block(): 
+ * 	revert the coins of the block at utxo_height with its undo data, 
+ * 	blocks above utxo_height were never connected (headers-first) and are ignored.
+ * 	the caller must hold priv->mutex
+ */
+static int disconnect_block(bitcoin_blockchain_t * bitcoin, int height)
+{
+	bitcoin_blockchain_private_t * priv = bitcoin->priv;
+	utxoes_cache_t * cache = bitcoin->utxo_cache;
+	if(NULL == cache->priv || height > priv->utxo_height) return 0;
+	
+	block_undo_t * undo = &priv->undo[height % BITCOIN_MAX_UNDO_BLOCKS];
+	if(height != priv->utxo_height || undo->height != height) {
+		fprintf(stderr, "[ERROR]::%s(): no undo data for block %d (utxo_height=%d).\n", 
+			__FUNCTION__, height, priv->utxo_height);
+		return -1;
+	}
+	
+	int rc = revert_changes(cache, undo);
+	block_undo_cleanup(undo);
+	if(rc) return rc;
+	
+	priv->utxo_height = height - 1;
+	rc = cache->check_flush(cache);
+	return (rc < 0)?rc:0;
+}
+
 static int bitcoin_on_add_block(blockchain_t * bchain, const uint256_t * block_hash, int height, void * user_data)
 {
 	debug_printf("%s(height=%d)...\n", __FUNCTION__, height);
@@ -371,12 +715,40 @@ static int bitcoin_on_add_block(blockchain_t * bchain, const uint256_t * block_h
 	bitcoin_blockchain_private_t * priv = bitcoin->priv;
 	pthread_mutex_lock(&priv->mutex);
 	
-	// todo
-	// ...
+	check_fast_ibd_tip(bitcoin, (int64_t)bchain->heirs->timestamps[height], height);
+	int rc = connect_blocks(bitcoin, bchain, height);
 	
 	pthread_mutex_unlock(&priv->mutex);
-	return 0;
+	return rc;
+}
+static int bitcoin_on_add_blocks(blockchain_t * bchain, const uint256_t block_hashes[], int start_height, ssize_t count, void * user_data)
+{
+	debug_printf("%s(height=%d, count=%ld)...\n", __FUNCTION__, start_height, (long)count);
+	bitcoin_blockchain_t * bitcoin = user_data;
+	assert(bitcoin && bitcoin->priv && count > 0);
+	
+	bitcoin_blockchain_private_t * priv = bitcoin->priv;
+	pthread_mutex_lock(&priv->mutex);
+	
+	// the timestamps are not monotonic (only above the median-time-past), use the newest one in the range
+	int max_height = start_height;
+	for(int height = start_height + 1; height < start_height + (int)count; ++height) {
+		if(bchain->heirs->timestamps[height] > bchain->heirs->timestamps[max_height]) max_height = height;
+	}
+	check_fast_ibd_tip(bitcoin, (int64_t)bchain->heirs->timestamps[max_height], max_height);
+	
+	int utxo_height = priv->utxo_height;
+	int rc = connect_blocks(bitcoin, bchain, start_height + (int)count - 1);
+	if(rc) { // add_batch() drops the whole range, undo the connected ones
+		while(priv->utxo_height > utxo_height) {
+			if(disconnect_block(bitcoin, priv->utxo_height)) break;
+		}
+	}
+	
+	pthread_mutex_unlock(&priv->mutex);
+	return rc;
 }
+
 static int bitcoin_on_remove_block(blockchain_t * bchain, const uint256_t * block_hash, int height, void * user_data)
 {
 	debug_printf("%s(height=%d)...\n", __FUNCTION__, height);
@@ -386,11 +758,10 @@ static int bitcoin_on_remove_block(blockchain_t * bchain, const uint256_t * bloc
 	bitcoin_blockchain_private_t * priv = bitcoin->priv;
 	pthread_mutex_lock(&priv->mutex);
 	
-	// todo
-	// ...
+	int rc = disconnect_block(bitcoin, height);
 	
 	pthread_mutex_unlock(&priv->mutex);
-	return 0;
+	return rc;
 }
 
 
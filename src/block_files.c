@@ -0,0 +1,602 @@
+/*
+ * block_files.c
+ * 
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ * 
+ * The MIT License (MIT)
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, 
+ * publish, distribute, sublicense, and/or sell copies of the Software, 
+ * and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <libgen.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sha.h"
+#include "utils.h"
+#include "satoshi-types.h"
+#include "bitcoin-consensus.h"
+#include "satoshi-block-view.h"
+#include "block_files.h"
+
+#define BLOCK_FILE_SCAN_BATCH_SIZE (64)
+
+int64_t block_file_get_index(const char * block_file)
+{
+	if(NULL == block_file) return -1;
+	char path_name[PATH_MAX] = "";
+	strncpy(path_name, block_file, sizeof(path_name) - 1);
+	
+	const char * filename = basename(path_name);
+	if(NULL == filename || strncmp(filename, "blk", 3) != 0) return -1;
+	
+	char * p_end = NULL;
+	long index = strtol(filename + 3, &p_end, 10);
+	if(p_end == (filename + 3) || index < 0) return -1;
+	if(strcmp(p_end, ".dat") != 0) return -1;
+	return index;
+}
+
+void block_file_entry_to_record(const block_file_entry_t * entry, uint32_t magic, db_record_block_t * record)
+{
+	assert(entry && record);
+	memset(record, 0, sizeof(*record));
+	record->hdr = entry->hdr;
+	record->height = -1;
+	record->file_index = entry->file_index;
+	record->start_pos = entry->start_pos;
+	record->magic = magic;
+	record->block_size = entry->block_size;
+}
+
+/* hash the pending headers in one batch, then emit them in file order */
+static int block_file_scan_flush(block_file_entry_t * entries, int count, 
+	unsigned char * headers, unsigned char * hashes,
+	block_file_scan_callback callback, void * user_data)
+{
+	if(count <= 0) return 0;
+	sha256d80_batch(hashes, headers, count);
+	
+	for(int i = 0; i < count; ++i)
+	{
+		memcpy(&entries[i].hash, hashes + i * 32, 32);
+		if(callback && callback(&entries[i], user_data)) return 1;
+	}
+	return 0;
+}
+
+ssize_t block_file_scan(const char * block_file, uint32_t magic, int64_t file_index, 
+	block_file_scan_callback callback, void * user_data)
+{
+	assert(block_file);
+	if(file_index < 0) file_index = block_file_get_index(block_file);
+	
+	int fd = open(block_file, O_RDONLY);
+	if(fd < 0) {
+		perror("block_file_scan::open()");
+		return -1;
+	}
+	
+	struct stat st[1];
+	memset(st, 0, sizeof(st));
+	if(fstat(fd, st) != 0) {
+		perror("block_file_scan::fstat()");
+		close(fd);
+		return -1;
+	}
+	int64_t file_size = st->st_size;
+	
+	// only the headers are read, readahead would load the block bodies
+	posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+	
+	block_file_entry_t entries[BLOCK_FILE_SCAN_BATCH_SIZE];
+	unsigned char headers[BLOCK_FILE_SCAN_BATCH_SIZE * 80];
+	unsigned char hashes[BLOCK_FILE_SCAN_BATCH_SIZE * 32];
+	int count = 0;
+	
+	ssize_t blocks_count = 0;
+	int64_t offset = 0;
+	int stopped = 0;
+	
+	unsigned char buf[sizeof(struct block_file_record_header) + sizeof(struct satoshi_block_header)];
+	while(!stopped && (offset + (int64_t)sizeof(buf)) <= file_size)
+	{
+		ssize_t cb = pread(fd, buf, sizeof(buf), offset);
+		if(cb != sizeof(buf)) {
+			perror("block_file_scan::pread()");
+			blocks_count = -1;
+			break;
+		}
+		
+		struct block_file_record_header file_hdr;
+		memcpy(&file_hdr, buf, sizeof(file_hdr));
+		if(file_hdr.magic == 0) break;	// zero-filled tail
+		if(file_hdr.magic != magic) {
+			fprintf(stderr, "[ERROR]::%s(): invalid magic 0x%.8x at %s:%ld\n", 
+				__FUNCTION__, file_hdr.magic, block_file, (long)offset);
+			blocks_count = -1;
+			break;
+		}
+		
+		if(file_hdr.length < sizeof(struct satoshi_block_header) 
+			|| file_hdr.length > MAX_BLOCK_SERIALIZED_SIZE) {
+			fprintf(stderr, "[ERROR]::%s(): invalid block size %u at %s:%ld\n", 
+				__FUNCTION__, file_hdr.length, block_file, (long)offset);
+			blocks_count = -1;
+			break;
+		}
+		
+		int64_t start_pos = offset + sizeof(file_hdr);
+		if((start_pos + file_hdr.length) > file_size) break;	// truncated (partially written) record
+		
+		block_file_entry_t * entry = &entries[count];
+		memset(entry, 0, sizeof(*entry));
+		memcpy(&entry->hdr, buf + sizeof(file_hdr), sizeof(struct satoshi_block_header));
+		memcpy(&headers[count * 80], buf + sizeof(file_hdr), 80);
+		entry->file_index = file_index;
+		entry->start_pos = start_pos;
+		entry->block_size = file_hdr.length;
+		++count;
+		++blocks_count;
+		
+		offset = start_pos + file_hdr.length;	// skip the block body
+		
+		if(count == BLOCK_FILE_SCAN_BATCH_SIZE) {
+			stopped = block_file_scan_flush(entries, count, headers, hashes, callback, user_data);
+			count = 0;
+		}
+	}
+	
+	// emit the pending batch even on error, the records before the bad one are valid
+	if(!stopped) block_file_scan_flush(entries, count, headers, hashes, callback, user_data);
+	close(fd);
+	return blocks_count;
+}
+
+ssize_t block_files_scan_dir(const char * blocks_dir, uint32_t magic, 
+	block_file_scan_callback callback, void * user_data)
+{
+	assert(blocks_dir);
+	ssize_t total = 0;
+	char path_name[PATH_MAX] = "";
+	
+	for(int64_t file_index = 0; ; ++file_index)
+	{
+		int cb = snprintf(path_name, sizeof(path_name), "%s/blk%.5d.dat", blocks_dir, (int)file_index);
+		assert(cb > 0 && cb < sizeof(path_name));
+		
+		if(access(path_name, R_OK) != 0) break;
+		
+		ssize_t count = block_file_scan(path_name, magic, file_index, callback, user_data);
+		if(count < 0) return -1;
+		total += count;
+	}
+	return total;
+}
+
+/**********************************************************************
+ * block_file_store
+**********************************************************************/
+struct block_file_mapping
+{
+	unsigned char * addr;
+	size_t size;
+	struct block_file_mapping * retired;	// smaller mappings of the same file (before it grew)
+};
+
+typedef struct block_file_store_private
+{
+	block_file_store_t * store;
+	char blocks_dir[PATH_MAX];
+	
+	pthread_rwlock_t rwlock;
+	ssize_t max_files;
+	struct block_file_mapping * files;	// indexed by file_index
+}block_file_store_private_t;
+
+#define BLOCK_FILE_STORE_ALLOC_SIZE (64)
+static int block_file_store_map(block_file_store_private_t * priv, int64_t file_index)
+{
+	if(file_index >= priv->max_files) {
+		ssize_t new_size = (file_index + BLOCK_FILE_STORE_ALLOC_SIZE) / BLOCK_FILE_STORE_ALLOC_SIZE * BLOCK_FILE_STORE_ALLOC_SIZE;
+		struct block_file_mapping * files = realloc(priv->files, new_size * sizeof(*files));
+		assert(files);
+		memset(&files[priv->max_files], 0, (new_size - priv->max_files) * sizeof(*files));
+		priv->files = files;
+		priv->max_files = new_size;
+	}
+	
+	char path_name[PATH_MAX] = "";
+	int cb = snprintf(path_name, sizeof(path_name), "%s/blk%.5d.dat", priv->blocks_dir, (int)file_index);
+	if(cb <= 0 || cb >= sizeof(path_name)) return -1;
+	
+	int fd = open(path_name, O_RDONLY);
+	if(fd < 0) return -1;
+	
+	struct stat st[1];
+	memset(st, 0, sizeof(st));
+	if(fstat(fd, st) != 0 || st->st_size <= 0) {
+		close(fd);
+		return -1;
+	}
+	
+	struct block_file_mapping * mapping = &priv->files[file_index];
+	if(mapping->addr && mapping->size >= st->st_size) {	// not changed
+		close(fd);
+		return 0;
+	}
+	
+	void * addr = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED) {
+		perror("block_file_store::mmap()");
+		return -1;
+	}
+	
+	if(mapping->addr) {
+		// the file has grown, keep the old mapping alive for the pointers already returned
+		struct block_file_mapping * retired = malloc(sizeof(*retired));
+		assert(retired);
+		*retired = *mapping;
+		mapping->retired = retired;
+	}
+	mapping->addr = addr;
+	mapping->size = st->st_size;
+	return 0;
+}
+#undef BLOCK_FILE_STORE_ALLOC_SIZE
+
+/* @return the block size, 0 if the block is beyond the mapped range, -1 on error */
+static ssize_t block_file_store_locate(block_file_store_t * store, int64_t file_index, int64_t start_pos,
+	const unsigned char ** p_data)
+{
+	block_file_store_private_t * priv = store->priv;
+	if(file_index >= priv->max_files) return 0;
+	
+	const struct block_file_mapping * mapping = &priv->files[file_index];
+	if(NULL == mapping->addr) return 0;
+	if(start_pos > mapping->size) return 0;
+	
+	struct block_file_record_header file_hdr;
+	memcpy(&file_hdr, mapping->addr + start_pos - sizeof(file_hdr), sizeof(file_hdr));
+	if(file_hdr.magic != store->magic 
+		|| file_hdr.length < sizeof(struct satoshi_block_header) 
+		|| file_hdr.length > MAX_BLOCK_SERIALIZED_SIZE) return -1;
+	if((start_pos + file_hdr.length) > mapping->size) return 0;
+	
+	*p_data = mapping->addr + start_pos;
+	return file_hdr.length;
+}
+
+static ssize_t block_file_store_get(struct block_file_store * store, int64_t file_index, int64_t start_pos, 
+	const unsigned char ** p_data)
+{
+	assert(store && store->priv && p_data);
+	block_file_store_private_t * priv = store->priv;
+	if(file_index < 0 || start_pos < (int64_t)sizeof(struct block_file_record_header)) return -1;
+	
+	pthread_rwlock_rdlock(&priv->rwlock);
+	ssize_t length = block_file_store_locate(store, file_index, start_pos, p_data);
+	pthread_rwlock_unlock(&priv->rwlock);
+	if(length != 0) return length;
+	
+	// (re)map the file
+	pthread_rwlock_wrlock(&priv->rwlock);
+	length = block_file_store_locate(store, file_index, start_pos, p_data);
+	if(length == 0) {
+		if(0 == block_file_store_map(priv, file_index)) {
+			length = block_file_store_locate(store, file_index, start_pos, p_data);
+		}
+		if(length == 0) length = -1;
+	}
+	pthread_rwlock_unlock(&priv->rwlock);
+	return length;
+}
+
+static ssize_t block_file_store_find(struct block_file_store * store, db_engine_txn_t * txn, const uint256_t * hash, 
+	const unsigned char ** p_data)
+{
+	assert(store && store->db && hash && p_data);
+	db_record_block_t record[1];
+	db_record_block_t * p_record = record;
+	memset(record, 0, sizeof(record));
+	
+	ssize_t count = store->db->find(store->db, txn, hash, &p_record);
+	if(count <= 0) return -1;
+	
+	return block_file_store_get(store, record->file_index, record->start_pos, p_data);
+}
+
+static ssize_t block_file_store_find_view(struct block_file_store * store, db_engine_txn_t * txn, const uint256_t * hash, 
+	struct satoshi_block_view * view)
+{
+	assert(view);
+	const unsigned char * data = NULL;
+	ssize_t length = block_file_store_find(store, txn, hash, &data);
+	if(length <= 0) return -1;
+	
+	ssize_t cb = satoshi_block_view_parse(view, length, data);
+	if(cb != length) return -1;
+	return cb;
+}
+
+block_file_store_t * block_file_store_init(block_file_store_t * store, 
+	const char * blocks_dir, uint32_t magic, 
+	blocks_db_t * db, 
+	void * user_data)
+{
+	assert(blocks_dir);
+	if(NULL == store) store = calloc(1, sizeof(*store));
+	assert(store);
+	
+	store->user_data = user_data;
+	store->db = db;
+	store->magic = magic;
+	store->get = block_file_store_get;
+	store->find = block_file_store_find;
+	store->find_view = block_file_store_find_view;
+	
+	block_file_store_private_t * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->store = store;
+	strncpy(priv->blocks_dir, blocks_dir, sizeof(priv->blocks_dir) - 1);
+	pthread_rwlock_init(&priv->rwlock, NULL);
+	store->priv = priv;
+	
+	return store;
+}
+
+void block_file_store_cleanup(block_file_store_t * store)
+{
+	if(NULL == store) return;
+	block_file_store_private_t * priv = store->priv;
+	if(priv) {
+		for(ssize_t i = 0; i < priv->max_files; ++i)
+		{
+			struct block_file_mapping * mapping = &priv->files[i];
+			if(mapping->addr) munmap(mapping->addr, mapping->size);
+			
+			struct block_file_mapping * retired = mapping->retired;
+			while(retired) {
+				struct block_file_mapping * next = retired->retired;
+				munmap(retired->addr, retired->size);
+				free(retired);
+				retired = next;
+			}
+		}
+		free(priv->files);
+		pthread_rwlock_destroy(&priv->rwlock);
+		free(priv);
+		store->priv = NULL;
+	}
+}
+
+#if defined(_TEST_BLOCK_FILES) && defined(_STAND_ALONE)
+#define TEST_MAGIC (0xD9B4BEF9)
+
+struct test_context
+{
+	ssize_t count;
+	int64_t file_index;
+	int64_t offset;		// expected start_pos of the next block
+	uint32_t first_nonce;
+	
+	block_file_entry_t entries[200];
+};
+
+static int on_block_found(const block_file_entry_t * entry, void * user_data)
+{
+	struct test_context * ctx = user_data;
+	if(entry->file_index != ctx->file_index) {
+		ctx->file_index = entry->file_index;
+		ctx->offset = 0;
+	}
+	
+	ctx->offset += sizeof(struct block_file_record_header);
+	assert(entry->start_pos == ctx->offset);
+	ctx->offset += entry->block_size;
+	
+	uint256_t hash;
+	hash256(&entry->hdr, 80, (unsigned char *)&hash);
+	assert(0 == memcmp(&hash, &entry->hash, 32));
+	assert(entry->hdr.nonce == ctx->first_nonce + (uint32_t)ctx->count);
+	
+	db_record_block_t record[1];
+	block_file_entry_to_record(entry, TEST_MAGIC, record);
+	assert(record->block_size == entry->block_size && record->start_pos == entry->start_pos);
+	
+	assert(ctx->count < 200);
+	ctx->entries[ctx->count] = *entry;
+	++ctx->count;
+	return 0;
+}
+
+static int on_block_found_stop(const block_file_entry_t * entry, void * user_data)
+{
+	ssize_t * count = user_data;
+	return (++*count == 10);
+}
+
+static ssize_t test_blocks_db_find(struct blocks_db * db, db_engine_txn_t * txn, const uint256_t * hash, db_record_block_t ** p_block)
+{
+	struct test_context * ctx = db->user_data;
+	for(ssize_t i = 0; i < ctx->count; ++i)
+	{
+		if(0 == memcmp(&ctx->entries[i].hash, hash, 32)) {
+			block_file_entry_to_record(&ctx->entries[i], TEST_MAGIC, *p_block);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void write_block_file(const char * path_name, int num_blocks, uint32_t * nonce, int append)
+{
+	FILE * fp = fopen(path_name, append?"ab":"wb");
+	assert(fp);
+	
+	unsigned char body[1000];
+	for(int i = 0; i < num_blocks; ++i)
+	{
+		struct satoshi_block_header hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.version = 1;
+		hdr.nonce = (*nonce)++;
+		
+		ssize_t body_size = 1 + (rand() % sizeof(body));
+		memset(body, i & 0xff, body_size);
+		
+		struct block_file_record_header file_hdr = {
+			.magic = TEST_MAGIC,
+			.length = sizeof(hdr) + body_size,
+		};
+		fwrite(&file_hdr, sizeof(file_hdr), 1, fp);
+		fwrite(&hdr, sizeof(hdr), 1, fp);
+		fwrite(body, 1, body_size, fp);
+	}
+	
+	if(!append) { // preallocated space
+		memset(body, 0, sizeof(body));
+		fwrite(body, 1, sizeof(body), fp);
+	}
+	fclose(fp);
+}
+
+int main(int argc, char ** argv)
+{
+	char blocks_dir[100] = "/tmp/test_block_files.XXXXXX";
+	char path_name[PATH_MAX] = "";
+	char * tmp_dir = mkdtemp(blocks_dir);
+	assert(tmp_dir);
+	
+	assert(12 == block_file_get_index("/path/to/blk00012.dat"));
+	assert(-1 == block_file_get_index("/path/to/rev00012.dat"));
+	
+	uint32_t nonce = 0;
+	snprintf(path_name, sizeof(path_name), "%s/blk00000.dat", blocks_dir);
+	write_block_file(path_name, 150, &nonce, 0);
+	snprintf(path_name, sizeof(path_name), "%s/blk00001.dat", blocks_dir);
+	write_block_file(path_name, 3, &nonce, 1);
+	
+	struct test_context ctx[1];
+	memset(ctx, 0, sizeof(ctx));
+	ssize_t count = block_files_scan_dir(blocks_dir, TEST_MAGIC, on_block_found, ctx);
+	assert(count == 153 && ctx->count == 153);
+	
+	ssize_t num_emitted = 0;
+	snprintf(path_name, sizeof(path_name), "%s/blk00000.dat", blocks_dir);
+	block_file_scan(path_name, TEST_MAGIC, -1, on_block_found_stop, &num_emitted);
+	assert(num_emitted == 10);
+	
+	// wrong network
+	count = block_file_scan(path_name, 0x0709110B, -1, NULL, NULL);
+	assert(-1 == count);
+	
+	// a corrupt record after a few valid ones: the valid records are still emitted
+	snprintf(path_name, sizeof(path_name), "%s/corrupt.dat", blocks_dir);
+	uint32_t corrupt_nonce = 1000;
+	write_block_file(path_name, 5, &corrupt_nonce, 1);
+	FILE * fp = fopen(path_name, "ab");
+	assert(fp);
+	struct block_file_record_header bad_hdr = { .magic = 0x0709110B, .length = 80 };
+	unsigned char bad_body[80] = { 0 };
+	fwrite(&bad_hdr, sizeof(bad_hdr), 1, fp);
+	fwrite(bad_body, sizeof(bad_body), 1, fp);
+	fclose(fp);
+	
+	struct test_context corrupt_ctx[1];
+	memset(corrupt_ctx, 0, sizeof(corrupt_ctx));
+	corrupt_ctx->file_index = -1;
+	corrupt_ctx->first_nonce = 1000;
+	count = block_file_scan(path_name, TEST_MAGIC, -1, on_block_found, corrupt_ctx);
+	assert(-1 == count);
+	assert(corrupt_ctx->count == 5);
+	
+	int rc = unlink(path_name);
+	assert(0 == rc);
+	snprintf(path_name, sizeof(path_name), "%s/blk00000.dat", blocks_dir);
+	
+	// block_file_store
+	blocks_db_t db[1] = {{ .user_data = ctx, .find = test_blocks_db_find }};
+	block_file_store_t * store = block_file_store_init(NULL, blocks_dir, TEST_MAGIC, db, NULL);
+	assert(store);
+	for(ssize_t i = 0; i < ctx->count; ++i)
+	{
+		const unsigned char * data = NULL;
+		ssize_t length = store->find(store, NULL, &ctx->entries[i].hash, &data);
+		assert(length == ctx->entries[i].block_size && data);
+		assert(0 == memcmp(data, &ctx->entries[i].hdr, 80));
+	}
+	
+	// the last file grows after being mapped
+	const unsigned char * old_data = NULL;
+	block_file_entry_t last = ctx->entries[ctx->count - 1];
+	ssize_t old_length = store->get(store, last.file_index, last.start_pos, &old_data);
+	assert(old_length > 0);
+	
+	snprintf(path_name, sizeof(path_name), "%s/blk00001.dat", blocks_dir);
+	write_block_file(path_name, 2, &nonce, 1);
+	
+	memset(ctx, 0, sizeof(ctx));
+	ctx->file_index = 1;
+	ctx->first_nonce = 150;
+	count = block_file_scan(path_name, TEST_MAGIC, -1, on_block_found, ctx);
+	assert(count == 5);
+	const unsigned char * data = NULL;
+	ssize_t length = store->get(store, 1, ctx->entries[4].start_pos, &data);
+	assert(length == ctx->entries[4].block_size);
+	assert(0 == memcmp(data, &ctx->entries[4].hdr, 80));
+	assert(0 == memcmp(old_data, &last.hdr, 80));	// still valid
+	
+	// unknown position
+	length = store->get(store, 1, ctx->entries[4].start_pos + 1, &data);
+	assert(-1 == length);
+	length = store->get(store, 2, 8, &data);
+	assert(-1 == length);
+	
+	block_file_store_cleanup(store);
+	free(store);
+	
+	snprintf(path_name, sizeof(path_name), "%s/blk00000.dat", blocks_dir);
+	rc = unlink(path_name);
+	assert(0 == rc);
+	snprintf(path_name, sizeof(path_name), "%s/blk00001.dat", blocks_dir);
+	rc = unlink(path_name);
+	assert(0 == rc);
+	rc = rmdir(blocks_dir);
+	assert(0 == rc);
+	
+	printf("%s: all tests passed.\n", argv[0]);
+	return 0;
+}
+#endif
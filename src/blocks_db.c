@@ -37,7 +37,6 @@
 #include <unistd.h>
 #include <limits.h>
 #include <stdint.h>
-#include <db.h>
 #include <endian.h>
 
 
@@ -106,29 +105,6 @@ static ssize_t associate_blocks_is_orphan(db_handle_t * db,
 }
 
 
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-static int compare_little_endian_int32(DB * db, const DBT * dbt1, const DBT * dbt2)
-{
-	int32_t a = *(int32_t *)dbt1->data;
-	int32_t b = *(int32_t *)dbt2->data;
-	return a - b;
-}
-
-//~ static int compare_height_and_orphan(DB * db, const DBT * dbt1, const DBT * dbt2)
-//~ {
-	//~ const struct {
-		//~ int32_t height;
-		//~ int32_t is_orphan;
-	//~ } *a = dbt1->data, *b = dbt2->data;
-	
-	//~ if(a->height == b->height) {
-		//~ if(dbt1->size == sizeof(uint64_t) && dbt2->size == sizeof(uint64_t)) 
-			//~ return a->is_orphan - b->is_orphan;
-		//~ return 0;
-	//~ }
-	//~ return a->height - b->height;
-//~ }
-#endif
 
 blocks_db_private_t * blocks_db_private_new(blocks_db_t * db, db_engine_t * engine, const char * db_name)
 {
@@ -168,21 +144,13 @@ blocks_db_private_t * blocks_db_private_new(blocks_db_t * db, db_engine_t * engi
 	assert(heights_db && orphan_blocks);
 	priv->heights_db = heights_db;
 	priv->orphan_blocks = orphan_blocks;
-	
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-	// do not use memcmp to compare an (LE)interger value.
-	DB * sdbp = *(DB **)heights_db->priv;
-	sdbp->set_bt_compare(sdbp, compare_little_endian_int32); // sorted by { is_orphan, height }
-	
-	sdbp = *(DB **)orphan_blocks->priv;
-	sdbp->set_bt_compare(sdbp, compare_little_endian_int32);
-#endif
 
-	rc = heights_db->open(heights_db, NULL, priv->heights_db_name, db_format_type_btree, db_flags_dup_sort);
+	// do not use memcmp to compare an (LE)interger value.
+	rc = heights_db->open(heights_db, NULL, priv->heights_db_name, db_format_type_btree, db_flags_dup_sort | db_flags_int32_keys);
 	assert(0 == rc);
 	engine->list_add(engine, heights_db);
 	
-	rc = orphan_blocks->open(orphan_blocks, NULL, priv->orphans_db_name, db_format_type_btree, db_flags_dup_sort);
+	rc = orphan_blocks->open(orphan_blocks, NULL, priv->orphans_db_name, db_format_type_btree, db_flags_dup_sort | db_flags_int32_keys);
 	assert(0 == rc);
 	engine->list_add(engine, orphan_blocks);
 	
@@ -270,38 +238,23 @@ static ssize_t blocks_db_find(struct blocks_db * db, db_engine_txn_t * txn,
 	db_handle_t * blocks = priv->blocks;
 	assert(blocks);
 	
-	db_record_data_t * value = NULL;
+	db_record_data_t value[1];
+	memset(value, 0, sizeof(value));
 	
-	ssize_t count = blocks->find(blocks, txn, 
+	ssize_t count = blocks->get(blocks, txn, 
 		&(db_record_data_t){.data = (void *)hash, .size = sizeof(uint256_t)},
-		&value);
+		value);
 	if(count > 0)
 	{
-		assert(count == 1);
 		assert(value->size == sizeof(db_record_block_t));
 		
 		db_record_block_t * block = *p_block;
 		if(NULL == block) {
-			if(value->flags == 1)	// dynamically allocated memory by calloc
-			{
-				*p_block = value->data;
-				value->data = NULL;
-				value->flags = 0;
-			}else
-			{
-				block = calloc(1, sizeof(*block));
-				assert(block);
-				*p_block = block;
-			}
+			block = calloc(1, sizeof(*block));
+			assert(block);
+			*p_block = block;
 		}
-		if(value->data) memcpy(block, value->data, value->size);
-	}
-
-// cleanup
-	if(value)
-	{
-		db_record_data_cleanup(value);
-		free(value);
+		memcpy(block, value->data, value->size);
 	}
 	return count;
 }
@@ -447,7 +400,7 @@ void blocks_db_cleanup(blocks_db_t * db)
 
 
 #if defined(_TEST_BLOCKS_DB) && defined(_STAND_ALONE)
-
+#include <db.h>
 
 static void dump_records(db_handle_t * db)
 {
@@ -506,7 +459,7 @@ static void dump_records(db_handle_t * db)
 int main(int argc, char **argv)
 {
 	system("mkdir -p data1");
-	db_engine_t * engine = db_engine_init("data1", NULL);
+	db_engine_t * engine = db_engine_init(NULL, "data1", NULL);
 	assert(engine);
 	
 	blocks_db_t * db = blocks_db_init(NULL, engine, "blocks.db", NULL);
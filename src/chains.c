@@ -30,10 +30,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <search.h>
 
 #include "satoshi-types.h"
 #include "utils.h"
+#include "sha.h"
 
 #include "chains.h"
 
@@ -102,7 +102,7 @@
  */
 int block_info_update_cumulative_difficulty(
 	block_info_t * node, // current node
-	compact_uint256_t cumulative_difficulty,	// parent's cumulative_difficulty
+	uint256_int_t cumulative_difficulty,	// parent's cumulative_difficulty
 	block_info_t ** p_longest_offspring			// the child who currently at the end of the longest-chain  
 );
 int block_info_declare_inheritance(block_info_t * heir);
@@ -115,7 +115,7 @@ enum traverse_action_type
 	traverse_action_type_remove,
 	traverse_action_types_count
 };
-static int search_tree_traverse_BFS(void ** p_search_root, enum traverse_action_type type, block_info_t * node);
+static int search_tree_traverse_BFS(block_hash_index_t * index, enum traverse_action_type type, block_info_t * node);
 
 #define MAX_FUTURE_BLOCK_TIME	(2 * 60 * 60)
 const uint256_t g_genesis_block_hash[1] = {{
@@ -154,33 +154,209 @@ const struct satoshi_block_header g_genesis_block_hdr[1] = {{
 	.nonce = 0x7c2bac1d,
 }};
 
-#define BLOCKCHAIN_DEFAULT_ALLOC_SIZE (6 * 24 * 365 * 100)	// (6 blocks per hour) * 24hours * 365days * 100years
+#define BLOCKCHAIN_MIN_ALLOC_SIZE (4096)	// the heirs' columns grow geometrically from this size
+
+/***********************************************************************
+ * block_hash_index
+ **********************************************************************/
+#define BLOCK_HASH_INDEX_MIN_SIZE	(1024)
+
+static inline uint64_t block_hash_key(const uint256_t * hash)
+{
+	uint64_t key;
+	memcpy(&key, hash, sizeof(key));
+	return key;
+}
+
+static int block_hash_index_resize(block_hash_index_t * index, ssize_t count)
+{
+	// keep the load factor below 0.75
+	size_t num_slots = BLOCK_HASH_INDEX_MIN_SIZE;
+	while((size_t)count * 4 >= num_slots * 3) num_slots <<= 1;
+	if(index->slots && num_slots <= (index->mask + 1)) return 0;
+	
+	struct block_hash_slot * slots = calloc(num_slots, sizeof(*slots));
+	if(NULL == slots) return -1;
+	
+	size_t mask = num_slots - 1;
+	if(index->slots) {	// rehash, all keys are unique, no need to compare the full hash
+		for(size_t i = 0; i <= index->mask; ++i) {
+			struct block_hash_slot * slot = &index->slots[i];
+			if(0 == slot->value) continue;
+			
+			size_t pos = slot->key & mask;
+			while(slots[pos].value) pos = (pos + 1) & mask;
+			slots[pos] = *slot;
+		}
+		free(index->slots);
+	}
+	index->slots = slots;
+	index->mask = mask;
+	return 0;
+}
+
+block_hash_index_t * block_hash_index_init(block_hash_index_t * index, ssize_t size,
+	const uint256_t * (* get_hash)(struct block_hash_index * index, intptr_t value), 
+	void * user_data)
+{
+	assert(get_hash);
+	if(NULL == index) index = calloc(1, sizeof(*index));
+	assert(index);
+	
+	index->get_hash = get_hash;
+	index->user_data = user_data;
+	
+	int rc = block_hash_index_resize(index, size);
+	assert(0 == rc);
+	return index;
+}
+
+void block_hash_index_cleanup(block_hash_index_t * index)
+{
+	if(NULL == index) return;
+	free(index->slots);
+	index->slots = NULL;
+	index->mask = 0;
+	index->count = 0;
+	return;
+}
+
+static void block_hash_index_clear(block_hash_index_t * index)
+{
+	if(index->slots) memset(index->slots, 0, (index->mask + 1) * sizeof(*index->slots));
+	index->count = 0;
+}
+
+static inline struct block_hash_slot * block_hash_index_lookup(block_hash_index_t * index, const uint256_t * hash)
+{
+	uint64_t key = block_hash_key(hash);
+	size_t mask = index->mask;
+	size_t pos = key & mask;
+	
+	struct block_hash_slot * slot;
+	while((slot = &index->slots[pos])->value)
+	{
+		if(slot->key == key 
+			&& 0 == memcmp(index->get_hash(index, slot->value), hash, sizeof(uint256_t))) return slot;
+		pos = (pos + 1) & mask;
+	}
+	return slot; // the empty slot where the hash should be inserted
+}
+
+/**
+ * block_hash_index_find():
+ * @return the value of the matched slot, or 0 if not found
+ */
+static inline intptr_t block_hash_index_find(block_hash_index_t * index, const uint256_t * hash)
+{
+	if(NULL == index || NULL == index->slots) return 0;
+	return block_hash_index_lookup(index, hash)->value;
+}
+
+/**
+ * block_hash_index_add(): 
+ *   same semantics as tsearch(), do nothing if the hash is already in the index.
+ * @return the value stored in the index.
+ */
+static intptr_t block_hash_index_add(block_hash_index_t * index, const uint256_t * hash, intptr_t value)
+{
+	assert(index && value);
+	if((index->count + 1) * 4 >= (ssize_t)(index->mask + 1) * 3) {
+		int rc = block_hash_index_resize(index, index->count + 1);
+		assert(0 == rc);
+	}
+	
+	struct block_hash_slot * slot = block_hash_index_lookup(index, hash);
+	if(slot->value) return slot->value;
+	
+	slot->key = block_hash_key(hash);
+	slot->value = value;
+	++index->count;
+	return value;
+}
+
+/**
+ * block_hash_index_remove():
+ *   remove by backward-shifting the following slots of the same cluster, 
+ *   so no tombstones are left behind.
+ * @return the value of the removed slot, or 0 if not found
+ */
+static intptr_t block_hash_index_remove(block_hash_index_t * index, const uint256_t * hash)
+{
+	if(NULL == index || NULL == index->slots) return 0;
+	
+	struct block_hash_slot * slot = block_hash_index_lookup(index, hash);
+	intptr_t value = slot->value;
+	if(0 == value) return 0;
+	
+	size_t mask = index->mask;
+	size_t hole = slot - index->slots;
+	size_t pos = hole;
+	while(1)
+	{
+		pos = (pos + 1) & mask;
+		slot = &index->slots[pos];
+		if(0 == slot->value) break;
+		
+		// move the slot to the hole if its home position is not within (hole, pos]
+		size_t home = slot->key & mask;
+		if(((pos - home) & mask) >= ((pos - hole) & mask)) {
+			index->slots[hole] = *slot;
+			hole = pos;
+		}
+	}
+	index->slots[hole].key = 0;
+	index->slots[hole].value = 0;
+	--index->count;
+	return value;
+}
 
 /***********************************************************************
  * blockchain
  **********************************************************************/
-typedef int (* blockchain_heir_compare_func)(const void *, const void *);
-static blockchain_heir_compare_func blockchain_heir_compare = (blockchain_heir_compare_func)uint256_compare; 
+static const uint256_t * blockchain_heir_get_hash(block_hash_index_t * index, intptr_t value)
+{
+	blockchain_t * chain = index->user_data;
+	assert(chain && value > 0);
+	return &chain->heirs->hashes[value - 1];
+}
+
+static const uint256_t * block_info_get_hash(block_hash_index_t * index, intptr_t value)
+{
+	return &((block_info_t *)value)->hash;
+}
 
+#define blockchain_heirs_realloc_column(column, size, old_size) do { \
+		void * p = realloc(column, (size) * sizeof(*(column))); \
+		if(NULL == p) return -1; \
+		column = p; \
+		memset((column) + (old_size), 0, ((size) - (old_size)) * sizeof(*(column))); \
+	} while(0)
 static int blockchain_resize(blockchain_t * chain, ssize_t size)
 {
-	if(size <= 0) size = BLOCKCHAIN_DEFAULT_ALLOC_SIZE;
-	else size = (size + BLOCKCHAIN_DEFAULT_ALLOC_SIZE - 1) / BLOCKCHAIN_DEFAULT_ALLOC_SIZE * BLOCKCHAIN_DEFAULT_ALLOC_SIZE;
+	if(size <= chain->max_size && chain->max_size > 0) return 0;
 	
-	if(size <= chain->max_size) return 0;
+	ssize_t new_size = chain->max_size;
+	if(new_size < BLOCKCHAIN_MIN_ALLOC_SIZE) new_size = BLOCKCHAIN_MIN_ALLOC_SIZE;
+	while(new_size < size) new_size *= 2;
+	if(new_size <= chain->max_size) return 0;
 	
-	blockchain_heir_t * heirs = realloc(chain->heirs, size * sizeof(*heirs));
-	assert(heirs);
+	struct blockchain_heirs * heirs = chain->heirs;
+	blockchain_heirs_realloc_column(heirs->hashes, new_size, chain->max_size);
+	blockchain_heirs_realloc_column(heirs->timestamps, new_size, chain->max_size);
+	blockchain_heirs_realloc_column(heirs->bits, new_size, chain->max_size);
+	blockchain_heirs_realloc_column(heirs->cumulative_difficulties, new_size, chain->max_size);
 	
-	memset(heirs, 0, (size - chain->max_size) * sizeof(*heirs));
-	chain->heirs = heirs;
-	chain->max_size = size;
+	chain->max_size = new_size;
 	return 0;
 }
+#undef blockchain_heirs_realloc_column
 
 static int blockchain_add(blockchain_t * chain, const uint256_t * hash, const struct satoshi_block_header * hdr);
-static const blockchain_heir_t * blockchain_find(blockchain_t * chain, const uint256_t * hash);
-static const blockchain_heir_t * blockchain_get(blockchain_t * chain, ssize_t height);
+static ssize_t blockchain_add_batch(blockchain_t * chain, ssize_t count, const struct satoshi_block_header headers[], 
+	enum blockchain_error * p_err);
+static ssize_t blockchain_find(blockchain_t * chain, const uint256_t * hash, blockchain_heir_t * p_heir);
+static int blockchain_get(blockchain_t * chain, ssize_t height, blockchain_heir_t * p_heir);
 static ssize_t blockchain_get_height(blockchain_t * chain, const uint256_t * hash);
 
 
@@ -188,61 +364,62 @@ static ssize_t blockchain_get_height(blockchain_t * chain, const uint256_t * has
  * abandon_child():
  *  export heir's data to a block_info object and return the pointer.
  */
-static inline block_info_t * abandon_child(
-	blockchain_t * chain,
-	const blockchain_heir_t * parent, 
-	const blockchain_heir_t * heir)
+static inline block_info_t * abandon_child(blockchain_t * chain, ssize_t height)
 {
-	assert(parent && heir);
+	assert(height > 0 && height <= chain->height);
+	struct blockchain_heirs * heirs = chain->heirs;
 	
-	block_info_t * orphan = block_info_new(heir->hash, NULL);
+	block_info_t * orphan = block_info_new(&heirs->hashes[height], NULL);
 	assert(orphan);
 
-	memcpy(&orphan->hdr->prev_hash, parent->hash, sizeof(uint256_t));
-	orphan->hdr->bits = heir->bits;
-	orphan->hdr->timestamp = (uint32_t)heir->timestamp;
-	orphan->cumulative_difficulty = heir->cumulative_difficulty;
+	memcpy(&orphan->hdr->prev_hash, &heirs->hashes[height - 1], sizeof(uint256_t));
+	orphan->hdr->bits = heirs->bits[height];
+	orphan->hdr->timestamp = (uint32_t)heirs->timestamps[height];
+	orphan->cumulative_difficulty = heirs->cumulative_difficulties[height];
 	
-	debug_printf("\t del heir: timestamp=%d", (int)heir->timestamp);
-	tdelete(heir, &chain->search_root, blockchain_heir_compare);
+	debug_printf("\t del heir: timestamp=%d", (int)heirs->timestamps[height]);
+	block_hash_index_remove(chain->search_index, &heirs->hashes[height]);
 	return orphan;
 }
 
-static inline blockchain_heir_t * add_heir(blockchain_t * chain,
-	blockchain_heir_t * parent, 
-	const block_info_t * child)
+/**
+ * add_heir():
+ * @return the height of the new heir
+ */
+static inline ssize_t add_heir(blockchain_t * chain, ssize_t parent, const block_info_t * child)
 {
-	assert(parent && child && child);
-	assert(0 == memcmp(parent->hash, &child->hdr->prev_hash, sizeof(uint256_t)));
+	assert(parent >= 0 && child);
+	int rc = blockchain_resize(chain, parent + 2);
+	assert(0 == rc);
 	
-	blockchain_resize(chain, (1 + chain->height) + 1);
-	blockchain_heir_t * heir = parent + 1;
+	struct blockchain_heirs * heirs = chain->heirs;
+	assert(0 == memcmp(&heirs->hashes[parent], &child->hdr->prev_hash, sizeof(uint256_t)));
 	
-	memcpy(heir->hash, &child->hash, sizeof(uint256_t));
-	heir->bits = child->hdr->bits;
-	heir->timestamp = child->hdr->timestamp;
-	compact_uint256_t difficulty = compact_uint256_complement(*(compact_uint256_t *)&heir->bits);
-	heir->cumulative_difficulty = compact_uint256_add(difficulty, parent->cumulative_difficulty);
+	ssize_t height = parent + 1;
+	memcpy(&heirs->hashes[height], &child->hash, sizeof(uint256_t));
+	heirs->bits[height] = child->hdr->bits;
+	heirs->timestamps[height] = child->hdr->timestamp;
+	uint256_int_t work = uint256_int_get_work((compact_uint256_t){ .bits = heirs->bits[height] });
+	heirs->cumulative_difficulties[height] = uint256_int_add(work, heirs->cumulative_difficulties[parent]);
 	
 	// verify difficulty
-	assert(0 == compact_uint256_compare(
-		&heir->cumulative_difficulty, 
+	assert(0 == uint256_int_compare(
+		&heirs->cumulative_difficulties[height], 
 		&child->cumulative_difficulty));
 		
-	blockchain_heir_t ** p_node = tsearch(heir, &chain->search_root, blockchain_heir_compare);
-	assert(p_node && *p_node == heir);
+	intptr_t value = block_hash_index_add(chain->search_index, &heirs->hashes[height], height + 1);
+	assert(value == height + 1);
 	
 	debug_printf("\t add heir: timestamp=%d", 
-		(int)heir->timestamp);
-	return heir;
+		(int)heirs->timestamps[height]);
+	return height;
 }
 
 #ifndef _DEBUG
 static  
 #endif
-block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, blockchain_heir_t * parent)
+block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, ssize_t height)
 {
-	ssize_t height = parent - chain->heirs;
 	assert(height >= 0 && height <= chain->height);
 	
 	if(height == chain->height) { // no children that need to be remove
@@ -250,16 +427,16 @@ block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, blockchain_
 	}
 	
 	// abandon in reverse order (from the last-child to the parent)
-	blockchain_heir_t * last_offspring = &chain->heirs[chain->height];
+	ssize_t last_offspring = chain->height;
 	struct block_info * orphans = NULL;
 	
-	while(last_offspring > parent)
+	while(last_offspring > height)
 	{
-		struct block_info * current = abandon_child(chain, last_offspring - 1, last_offspring);
+		struct block_info * current = abandon_child(chain, last_offspring);
 		
 		if(chain->on_remove_block) chain->on_remove_block(chain, 
-			last_offspring->hash,
-			last_offspring - chain->heirs,
+			&chain->heirs->hashes[last_offspring],
+			last_offspring,
 			chain->user_data); 
 		
 		current->first_child = orphans;
@@ -276,27 +453,25 @@ block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, blockchain_
 }
 
 static int blockchain_add_inheritances(blockchain_t * chain, 
-	blockchain_heir_t * parent,
+	ssize_t height,	// parent's height
 	block_info_t * child,
 	block_info_t ** p_orphans
 	)
 {
-	assert(chain && parent && child && p_orphans);
-	ssize_t height = parent - chain->heirs;
+	assert(chain && child && p_orphans);
 	
-	block_info_t * orphans = blockchain_abandon_inheritances(chain, parent);
+	block_info_t * orphans = blockchain_abandon_inheritances(chain, height);
 	*p_orphans = orphans;
 	
 	int rc = 0;
 	while(child)
 	{
-		parent = add_heir(chain, parent, child);
-		assert(parent);
+		height = add_heir(chain, height, child);
 		
 		if(chain->on_add_block) {
 			rc = chain->on_add_block(chain, 
 				&child->hash, 
-				parent - chain->heirs,
+				height,
 				chain->user_data);
 			if(rc) {
 				block_info_free(orphans);
@@ -304,7 +479,6 @@ static int blockchain_add_inheritances(blockchain_t * chain,
 			}
 		}
 		
-		++height;
 		child = child->first_child;
 	}
 	
@@ -324,6 +498,7 @@ blockchain_t * blockchain_init(blockchain_t * chain,
 	assert(chain);
 	chain->user_data = user_data;
 	chain->add = blockchain_add;
+	chain->add_batch = blockchain_add_batch;
 	
 	chain->find = blockchain_find;
 	chain->get = blockchain_get;
@@ -332,19 +507,18 @@ blockchain_t * blockchain_init(blockchain_t * chain,
 	int rc = blockchain_resize(chain, 0);
 	assert(0 == rc);
 	
-	memcpy(chain->heirs[0].hash, genesis_block_hash, sizeof(uint256_t));
+	struct blockchain_heirs * heirs = chain->heirs;
+	memcpy(&heirs->hashes[0], genesis_block_hash, sizeof(uint256_t));
 	
 	if(genesis_block_hdr) {
-		chain->heirs[0].timestamp = genesis_block_hdr->timestamp;
-		chain->heirs[0].bits = genesis_block_hdr->bits;
-		chain->heirs[0].cumulative_difficulty = 
-			compact_uint256_complement(*(compact_uint256_t *)&genesis_block_hdr->bits);
+		heirs->timestamps[0] = genesis_block_hdr->timestamp;
+		heirs->bits[0] = genesis_block_hdr->bits;
+		heirs->cumulative_difficulties[0] = 
+			uint256_int_get_work((compact_uint256_t){ .bits = genesis_block_hdr->bits });
 	}
 	
-	tsearch(&chain->heirs[0], // add genesis block to the search-tree
-		&chain->search_root, 
-		blockchain_heir_compare
-	);
+	block_hash_index_init(chain->search_index, 0, blockchain_heir_get_hash, chain);
+	block_hash_index_add(chain->search_index, &heirs->hashes[0], 1); // add genesis block to the search-index
 	
 	active_chain_list_init(chain->candidates_list, 0, chain);
 	return chain;
@@ -352,48 +526,44 @@ blockchain_t * blockchain_init(blockchain_t * chain,
 
 void blockchain_reset(blockchain_t * chain)
 {
-	if(NULL == chain || NULL == chain->heirs) return;
+	if(NULL == chain || NULL == chain->heirs->hashes) return;
 	active_chain_list_cleanup(chain->candidates_list);
 	
-	for(ssize_t i = 0; i < (chain->height + 1); ++i) {
-		tdelete(&chain->heirs[i], &chain->search_root, blockchain_heir_compare);
-	}
+	block_hash_index_clear(chain->search_index);
 	chain->height = -1;
 	return;
 }
 
-static void no_free(void *p) 
-{
-}
 void blockchain_cleanup(blockchain_t * chain)
 {
 	if(NULL == chain) return;
 	
 	active_chain_list_cleanup(chain->candidates_list);
-	free(chain->heirs);
 	
-	tdestroy(chain->search_root, no_free);
+	struct blockchain_heirs * heirs = chain->heirs;
+	free(heirs->hashes);
+	free(heirs->timestamps);
+	free(heirs->bits);
+	free(heirs->cumulative_difficulties);
+	memset(heirs, 0, sizeof(*heirs));
+	
+	block_hash_index_cleanup(chain->search_index);
 	
-	chain->heirs = NULL;
 	chain->max_size = 0;
 	chain->height = -1;
 	return;
 }
 
-static const blockchain_heir_t * blockchain_find(blockchain_t * chain, const uint256_t * hash)
+static ssize_t blockchain_find(blockchain_t * chain, const uint256_t * hash, blockchain_heir_t * p_heir)
 {
-	void ** p_node = tfind(hash, &chain->search_root, blockchain_heir_compare);
-	if(p_node) return *p_node;
-	
-	return NULL;
+	ssize_t height = blockchain_get_height(chain, hash);
+	if(height >= 0 && p_heir) blockchain_get(chain, height, p_heir);
+	return height;
 }
 
 static block_info_t * active_chain_list_find(active_chain_list_t * list, const uint256_t * hash)
 {
-	void ** p_node = tfind(hash, &list->search_root, blockchain_heir_compare);
-	if(p_node) return *p_node;
-	
-	return NULL;
+	return (block_info_t *)block_hash_index_find(list->search_index, hash);
 }
 
 static inline active_chain_t * get_current_chain(block_info_t * parent)
@@ -407,12 +577,12 @@ static inline active_chain_t * get_current_chain(block_info_t * parent)
 
 static int abandon_siblings(block_info_t * successor, active_chain_list_t * list);
 
-static void update_first_child_cumulative_difficulty(block_info_t * child, compact_uint256_t cumulative_difficulty)
+static void update_first_child_cumulative_difficulty(block_info_t * child, uint256_int_t cumulative_difficulty)
 {
 	while(child)
 	{
-		compact_uint256_t difficulty = compact_uint256_complement(*(compact_uint256_t *)&child->hdr->bits);
-		cumulative_difficulty = compact_uint256_add(difficulty, cumulative_difficulty);
+		uint256_int_t work = uint256_int_get_work((compact_uint256_t){ .bits = child->hdr->bits });
+		cumulative_difficulty = uint256_int_add(work, cumulative_difficulty);
 		child->cumulative_difficulty = cumulative_difficulty;
 		
 		child = child->first_child;
@@ -426,18 +596,16 @@ static enum blockchain_error blockchain_add(blockchain_t * block_chain,
 {
 	assert(block_hash && hdr);
 	unsigned char hash[32];
-	hash256(hdr, sizeof(*hdr), hash);
+	hash256_80(hdr, hash);
 	assert(0 == memcmp(hash, block_hash, sizeof(uint256_t)));
 	
 	active_chain_list_t * list = block_chain->candidates_list;
-	const blockchain_heir_t * heir = NULL;
 	block_info_t * orphan = NULL;
 	active_chain_t * chain = NULL;
 	block_info_t * longest_end = NULL;
 	
 	// Rule 0. check if it is already on the chain
-	heir = block_chain->find(block_chain, block_hash);
-	if(heir) return blockchain_error_duplicated_block;	// already on the BLOCKCHAIN
+	if(block_chain->get_height(block_chain, block_hash) >= 0) return blockchain_error_duplicated_block;	// already on the BLOCKCHAIN
 	
 	orphan = active_chain_list_find(list, block_hash);
 	if(orphan){
@@ -469,7 +637,7 @@ static enum blockchain_error blockchain_add(blockchain_t * block_chain,
 			child = child->next_sibling;
 		}
 		
-		block_info_update_cumulative_difficulty(orphan, compact_uint256_zero, NULL);
+		block_info_update_cumulative_difficulty(orphan, uint256_int_zero, NULL);
 		
 		// delete the chain from the list.
 		chain->head->first_child = NULL;
@@ -510,7 +678,7 @@ static enum blockchain_error blockchain_add(blockchain_t * block_chain,
 		
 		chain = active_chain_new(orphan, NULL);
 		assert(chain);
-		chain->p_search_root = &list->search_root;
+		chain->p_search_index = list->search_index;
 		
 		list->search_tree_add(list, chain->head);
 		list->add(list, chain);
@@ -519,7 +687,7 @@ static enum blockchain_error blockchain_add(blockchain_t * block_chain,
 		
 		// find the longest-end
 		block_info_update_cumulative_difficulty(orphan, 
-			compact_uint256_zero,
+			uint256_int_zero,
 			&chain->longest_end);
 	}
 	
@@ -528,28 +696,28 @@ static enum blockchain_error blockchain_add(blockchain_t * block_chain,
 	longest_end = chain->longest_end;
 	
 	// Rule IV. find parent in the BLOCKCHAIN
-	heir = block_chain->find(block_chain, &chain->head->hash);
-	if(NULL == heir) return blockchain_error_no_error;
+	ssize_t height = block_chain->get_height(block_chain, &chain->head->hash);
+	if(height < 0) return blockchain_error_no_error;
 
 	printf("\e[32m" "--> [%s]: " "\e[39m" "\n", "Rule IV");
 	// update longest_end's cumulative_difficulty 
-	update_first_child_cumulative_difficulty(chain->head->first_child, heir->cumulative_difficulty);
-	blockchain_heir_t * current = &block_chain->heirs[block_chain->height];
+	const uint256_int_t * cumulative_difficulties = block_chain->heirs->cumulative_difficulties;
+	update_first_child_cumulative_difficulty(chain->head->first_child, cumulative_difficulties[height]);
+	const uint256_int_t * current = &cumulative_difficulties[block_chain->height];
 	
-	printf("chain->difficulty: 0x%.8x\n", chain->longest_end->cumulative_difficulty.bits);
-	printf("current->max_diff: 0x%.8x\n", current->cumulative_difficulty.bits);
+	printf("chain->difficulty: %.0f\n", uint256_int_to_double(&chain->longest_end->cumulative_difficulty));
+	printf("current->max_diff: %.0f\n", uint256_int_to_double(current));
 		
 	
-	if(compact_uint256_compare(
+	if(uint256_int_compare(
 		&chain->longest_end->cumulative_difficulty, 
-		&current->cumulative_difficulty) > 0 ) // win the round. 
+		current) > 0 ) // win the round. 
 	{
 		// replace the current one
-	//	block_info_t * orphans = blockchain_abandon_inheritances(block_chain, (blockchain_heir_t *)heir);
 		block_info_t * successor = chain->head->first_child;
 		block_info_t * orphans = NULL;
 		
-		int rc = blockchain_add_inheritances(block_chain, (blockchain_heir_t *)heir, successor, &orphans);
+		int rc = blockchain_add_inheritances(block_chain, height, successor, &orphans);
 		if(rc) {
 			if(orphans) block_info_free(orphans);
 			if(successor) block_info_free(successor);
@@ -576,7 +744,7 @@ static enum blockchain_error blockchain_add(blockchain_t * block_chain,
 		// leave the current chain (swap positions with the orphan or the next_sibling)
 		if(orphans) {
 			// join the orphan's family to the search-tree
-			search_tree_traverse_BFS(&list->search_root, traverse_action_type_add, orphans);
+			search_tree_traverse_BFS(list->search_index, traverse_action_type_add, orphans);
 			
 			// claim siblings
 			orphans->next_sibling = successor->next_sibling;
@@ -589,7 +757,7 @@ static enum blockchain_error blockchain_add(blockchain_t * block_chain,
 		abandon_siblings(successor->first_child, list);
 		
 		// destroy old identities
-		tdelete(successor, &list->search_root, blockchain_heir_compare);
+		block_hash_index_remove(list->search_index, &successor->hash);
 		block_info_free(successor);
 		
 		if(NULL == chain->head->first_child) { // all children have left home
@@ -611,17 +779,17 @@ static int abandon_siblings(block_info_t * successor, active_chain_list_t * list
 	
 	/**
 	 * his next_sibling will lead all other brothers to a new chain.
-	 * do not set new chain's search-root pointer when creating,
-	 * all nodes are already in the search-tree,
+	 * do not set new chain's search-index pointer when creating,
+	 * all nodes are already in the search-index,
 	 * just add the new chain's 'head' only.
 	 */
 	if(sibling)
 	{
 		active_chain_t * chain = active_chain_new(sibling, NULL);
 		assert(chain);
-		tsearch(chain->head, &list->search_root, blockchain_heir_compare); 
+		block_hash_index_add(list->search_index, &chain->head->hash, (intptr_t)chain->head); 
 		
-		chain->p_search_root = &list->search_root;
+		chain->p_search_index = list->search_index;
 		list->add(list, chain);
 	}
 	
@@ -633,14 +801,144 @@ static int abandon_siblings(block_info_t * successor, active_chain_list_t * list
 }
 
 
-static const blockchain_heir_t * blockchain_get(blockchain_t * chain, ssize_t height)
+/**
+ * check_pow():
+ *   the block hash (little-endian) must not be greater than the target.
+ */
+static inline int check_pow(const uint256_t * hash, uint32_t bits)
 {
-	return NULL;
+	uint256_int_t target = uint256_int_from_compact((compact_uint256_t){ .bits = bits });
+	if(0 == uint256_int_compare(&target, &uint256_int_zero)) return 0; // negative, zero or overflowed
+	
+	uint256_int_t value = uint256_int_from_uint256(hash);
+	return (uint256_int_compare(&value, &target) <= 0);
+}
+
+/**
+ * blockchain_extend():
+ *   append the leading run of headers which extends the current tip, 
+ *   stops at the first header that does not link to the previous one, has an invalid proof-of-work,
+ *   or is already known by the candidates_list (it needs the fork rules of add()).
+ * @return the number of headers appended, or -1 if the callback failed.
+ */
+static ssize_t blockchain_extend(blockchain_t * chain, ssize_t count, 
+	const struct satoshi_block_header headers[], const uint256_t hashes[])
+{
+	struct blockchain_heirs * heirs = chain->heirs;
+	block_hash_index_t * candidates_index = chain->candidates_list->search_index;
+	
+	const ssize_t start_height = chain->height + 1;
+	const uint256_t * tip = &heirs->hashes[chain->height];
+	
+	ssize_t n = 0;
+	for(; n < count; ++n) {
+		const struct satoshi_block_header * hdr = &headers[n];
+		if(0 != memcmp(hdr->prev_hash, tip, sizeof(uint256_t))) break;
+		if(!check_pow(&hashes[n], hdr->bits)) break;
+		if(candidates_index->count > 0 && block_hash_index_find(candidates_index, &hashes[n])) break;
+		tip = &hashes[n];
+	}
+	if(0 == n) return 0;
+	
+	int rc = blockchain_resize(chain, start_height + n);
+	assert(0 == rc);
+	
+	// the bits only change every 2016 blocks, reuse the work of the previous header
+	uint32_t bits = heirs->bits[chain->height];
+	uint256_int_t work = uint256_int_get_work((compact_uint256_t){ .bits = bits });
+	uint256_int_t cumulative_difficulty = heirs->cumulative_difficulties[chain->height];
+	
+	for(ssize_t i = 0; i < n; ++i) {
+		ssize_t height = start_height + i;
+		if(headers[i].bits != bits) {
+			bits = headers[i].bits;
+			work = uint256_int_get_work((compact_uint256_t){ .bits = bits });
+		}
+		cumulative_difficulty = uint256_int_add(work, cumulative_difficulty);
+		
+		memcpy(&heirs->hashes[height], &hashes[i], sizeof(uint256_t));
+		heirs->timestamps[height] = headers[i].timestamp;
+		heirs->bits[height] = bits;
+		heirs->cumulative_difficulties[height] = cumulative_difficulty;
+		
+		intptr_t value = block_hash_index_add(chain->search_index, &hashes[i], height + 1);
+		assert(value == height + 1);
+	}
+	chain->height = start_height + n - 1;
+	
+	rc = 0;
+	if(chain->on_add_blocks) {
+		rc = chain->on_add_blocks(chain, hashes, (int)start_height, n, chain->user_data);
+	}else if(chain->on_add_block) {
+		ssize_t reported = 0;
+		for(; reported < n; ++reported) {
+			rc = chain->on_add_block(chain, &hashes[reported], (int)(start_height + reported), chain->user_data);
+			if(rc) break;
+		}
+		if(rc && chain->on_remove_block) { // undo the reported ones, the same order as abandon_inheritances()
+			for(ssize_t i = reported - 1; i >= 0; --i) {
+				chain->on_remove_block(chain, &hashes[i], (int)(start_height + i), chain->user_data);
+			}
+		}
+	}
+	if(rc) { // rollback
+		for(ssize_t i = 0; i < n; ++i) block_hash_index_remove(chain->search_index, &hashes[i]);
+		chain->height = start_height - 1;
+		return -1;
+	}
+	return n;
+}
+
+static ssize_t blockchain_add_batch(blockchain_t * chain, ssize_t count, const struct satoshi_block_header headers[], 
+	enum blockchain_error * p_err)
+{
+	assert(chain && chain->height >= 0);
+	assert(sizeof(headers[0]) == 80);
+	enum blockchain_error err = blockchain_error_no_error;
+	if(p_err) *p_err = err;
+	if(count <= 0) return 0;
+	
+	uint256_t * hashes = malloc(count * sizeof(*hashes));
+	assert(hashes);
+	sha256d80_batch((unsigned char *)hashes, (const unsigned char *)headers, count);
+	
+	ssize_t i = 0;
+	while(i < count)
+	{
+		ssize_t n = blockchain_extend(chain, count - i, &headers[i], &hashes[i]);
+		if(n < 0) { err = blockchain_error_failed; break; }
+		
+		i += n;
+		if(i >= count) break;
+		
+		// not a linear extension of the tip: apply the fork rules
+		if(!check_pow(&hashes[i], headers[i].bits)) { err = blockchain_error_invalid_pow; break; }
+		if(chain->add(chain, &hashes[i], &headers[i]) == blockchain_error_failed) { err = blockchain_error_failed; break; }
+		++i;
+	}
+	
+	free(hashes);
+	if(p_err) *p_err = err;
+	return i;
+}
+
+static int blockchain_get(blockchain_t * chain, ssize_t height, blockchain_heir_t * p_heir)
+{
+	if(height < 0 || height > chain->height) return -1;
+	if(NULL == p_heir) return 0;
+	
+	struct blockchain_heirs * heirs = chain->heirs;
+	memcpy(p_heir->hash, &heirs->hashes[height], sizeof(uint256_t));
+	p_heir->timestamp = heirs->timestamps[height];
+	p_heir->bits = heirs->bits[height];
+	p_heir->cumulative_difficulty = heirs->cumulative_difficulties[height];
+	return 0;
 }
 
 static ssize_t blockchain_get_height(blockchain_t * chain, const uint256_t * hash)
 {
-	return -1;
+	intptr_t value = block_hash_index_find(chain->search_index, hash);
+	return value - 1;	// -1 if not found
 }
 
 
@@ -786,21 +1084,21 @@ void clib_queue_cleanup(struct clib_queue * queue)
 
 int block_info_update_cumulative_difficulty(
 	block_info_t * node, // current node
-	compact_uint256_t cumulative_difficulty,	// parent's cumulative_difficulty
+	uint256_int_t cumulative_difficulty,	// parent's cumulative_difficulty
 	block_info_t ** p_longest_offspring			// the child who currently at the end of the longest-chain  
 )
 {
 	if(NULL == node) return -1;
 	
 	// update current node's cumulative_difficulty
-	compact_uint256_t difficulty = compact_uint256_complement(*(compact_uint256_t *)&node->hdr->bits);
-	node->cumulative_difficulty = compact_uint256_add(difficulty, cumulative_difficulty);
+	uint256_int_t work = uint256_int_get_work((compact_uint256_t){ .bits = node->hdr->bits });
+	node->cumulative_difficulty = uint256_int_add(work, cumulative_difficulty);
 	
 	if(p_longest_offspring)	// if need to declare the winner at the same time 
 	{
 		block_info_t * heir = *p_longest_offspring;
 		if(NULL == heir 
-			|| compact_uint256_compare(
+			|| uint256_int_compare(
 					&node->cumulative_difficulty, 
 					&heir->cumulative_difficulty) > 0
 			)
@@ -846,13 +1144,13 @@ int block_info_declare_inheritance(block_info_t * heir)
 }
 
 
-active_chain_t * active_chain_new(block_info_t * orphan, void ** p_search_root)
+active_chain_t * active_chain_new(block_info_t * orphan, block_hash_index_t * p_search_index)
 {
 	assert(orphan && orphan->hdr);
 
 	active_chain_t * chain = calloc(1, sizeof(*chain));
 	assert(chain);
-	chain->p_search_root = p_search_root;
+	chain->p_search_index = p_search_index;
 
 	block_info_t * head = chain->head;
 
@@ -865,26 +1163,24 @@ active_chain_t * active_chain_new(block_info_t * orphan, void ** p_search_root)
 	while(longest_end->first_child) longest_end	= longest_end->first_child;
 	chain->longest_end = longest_end;
 	
-	// add the new orphan and 'head->hash' to the search-root
-	if(p_search_root)
+	// add the new orphan and 'head->hash' to the search-index
+	if(p_search_index)
 	{
-		search_tree_traverse_BFS(p_search_root, traverse_action_type_add, head);
-		//~ tsearch(orphan, p_search_root, blockchain_heir_compare);
-		//~ tsearch(head, p_search_root, blockchain_heir_compare);
+		search_tree_traverse_BFS(p_search_index, traverse_action_type_add, head);
 	}
 	
 	return chain;
 }
 
-static void active_chain_remove_child(block_info_t * parent, void ** p_search_root)
+static void active_chain_remove_child(block_info_t * parent, block_hash_index_t * p_search_index)
 {
 	if(NULL == parent) return;
 	
 	block_info_t * child = parent->first_child;
 	while(child)
 	{
-		tdelete(child, p_search_root, blockchain_heir_compare);
-		active_chain_remove_child(child, p_search_root);
+		block_hash_index_remove(p_search_index, &child->hash);
+		active_chain_remove_child(child, p_search_index);
 		child = child->next_sibling;
 	}
 	return;
@@ -894,17 +1190,13 @@ void active_chain_free(active_chain_t * chain)
 {
 	if(NULL == chain) return;
 	
-	// remove all children from the tsearch-tree first. 
-	active_chain_remove_child(chain->head, chain->p_search_root);
-	tdelete(chain->head, chain->p_search_root, blockchain_heir_compare);
+	// remove all children from the search-index first. 
+	active_chain_remove_child(chain->head, chain->p_search_index);
+	block_hash_index_remove(chain->p_search_index, &chain->head->hash);
 	
-	// free all nodes except the 'head'
-	block_info_t * child = chain->head->first_child;
-	while(child)
-	{
-		block_info_free(child);
-		child = child->next_sibling;
-	}
+	// free all nodes except the 'head', (block_info_free() also frees all siblings)
+	block_info_free(chain->head->first_child);
+	chain->head->first_child = NULL;
 	free(chain);
 }
 
@@ -915,15 +1207,23 @@ void active_chain_free(active_chain_t * chain)
 static int active_chain_list_resize(active_chain_list_t * list, ssize_t max_size);
 
 // use a queue to remove recursion. (breadth first)
-typedef void * (*traverse_action_callback)(const void *, void **, int (*)(const void *, const void *));
+static intptr_t traverse_action_add(block_hash_index_t * index, block_info_t * node)
+{
+	return block_hash_index_add(index, &node->hash, (intptr_t)node);
+}
+static intptr_t traverse_action_remove(block_hash_index_t * index, block_info_t * node)
+{
+	return block_hash_index_remove(index, &node->hash);
+}
+typedef intptr_t (*traverse_action_callback)(block_hash_index_t *, block_info_t *);
 
-static int search_tree_traverse_BFS(void ** p_search_root, enum traverse_action_type type, block_info_t * node)
+static int search_tree_traverse_BFS(block_hash_index_t * index, enum traverse_action_type type, block_info_t * node)
 {
 	assert(node);
 	
 	static traverse_action_callback actions[traverse_action_types_count] = {
-		[traverse_action_type_add] = tsearch,
-		[traverse_action_type_remove] = tdelete,
+		[traverse_action_type_add] = traverse_action_add,
+		[traverse_action_type_remove] = traverse_action_remove,
 	};
 	
 	assert(type >= 0 && type < traverse_action_types_count);
@@ -938,8 +1238,8 @@ static int search_tree_traverse_BFS(void ** p_search_root, enum traverse_action_
 	
 	while((node = queue->leave(queue)))
 	{
-		// add or remove node from the search-tree
-		action(node, p_search_root, blockchain_heir_compare);
+		// add or remove node from the search-index
+		action(index, node);
 		
 		// enqueue all siblings
 		block_info_t * sibling = node->next_sibling;
@@ -961,17 +1261,17 @@ static int search_tree_traverse_BFS(void ** p_search_root, enum traverse_action_
 
 static int list_add(active_chain_list_t * list, active_chain_t * chain)
 {
-	assert( (NULL == chain->p_search_root) || (chain->p_search_root == &list->search_root) );
+	assert( (NULL == chain->p_search_index) || (chain->p_search_index == list->search_index) );
 	
 	int rc = active_chain_list_resize(list, list->count + 1);
 	assert(0 == rc);
 
 	list->chains[list->count++] = chain;
 	
-	if(NULL == chain->p_search_root)
+	if(NULL == chain->p_search_index)
 	{
-		chain->p_search_root = &list->search_root;
-		search_tree_traverse_BFS(&list->search_root, traverse_action_type_add, chain->head);
+		chain->p_search_index = list->search_index;
+		search_tree_traverse_BFS(list->search_index, traverse_action_type_add, chain->head);
 	}
 	return 0;
 }
@@ -1014,19 +1314,26 @@ static int active_chain_list_resize(active_chain_list_t * list, ssize_t max_size
 static int list_search_tree_remove(struct active_chain_list * list, block_info_t * node)
 {
 	debug_printf("node->hash: (0x%.8x...)", htobe32(*(uint32_t *)&node->hash));
-	void * p_parent_node = tdelete(node, &list->search_root, blockchain_heir_compare);
-	assert(p_parent_node);
+	intptr_t value = block_hash_index_remove(list->search_index, &node->hash);
+	assert(value);
 	return 0;
 }
 
 static int list_search_tree_add(struct active_chain_list * list, block_info_t * node)
 {
 	debug_printf("node->hash: (0x%.8x...)", htobe32(*(uint32_t *)&node->hash));
-	block_info_t ** p_node = tsearch(node, &list->search_root, blockchain_heir_compare);
-	assert(p_node && *p_node == node);
+	intptr_t value = block_hash_index_add(list->search_index, &node->hash, (intptr_t)node);
+	assert(value == (intptr_t)node);
 	return 0;
 }
 
+static block_info_t * list_find_node(struct active_chain_list * list, const uint256_t * hash, active_chain_t ** p_chain)
+{
+	block_info_t * node = active_chain_list_find(list, hash);
+	if(node && p_chain) *p_chain = get_current_chain(node);
+	return node;
+}
+
 active_chain_list_t * active_chain_list_init(active_chain_list_t * list, ssize_t max_size, void * user_data)
 {
 	if(NULL == list) list = calloc(1, sizeof(*list));
@@ -1036,12 +1343,15 @@ active_chain_list_t * active_chain_list_init(active_chain_list_t * list, ssize_t
 	list->add = list_add;
 	list->remove = list_remove;
 	
+	list->find_node = list_find_node;
 	list->search_tree_add = list_search_tree_add;
 	list->search_tree_remove = list_search_tree_remove;
 	
 	int rc = active_chain_list_resize(list, max_size);
 	assert(0 == rc);
 	
+	block_hash_index_init(list->search_index, 0, block_info_get_hash, list);
+	
 	return list;
 }
 
@@ -1067,87 +1377,12 @@ void active_chain_list_cleanup(active_chain_list_t * list)
 	free(list->chains);
 	list->chains = NULL;
 	list->max_size = 0;
-	return;
-}
-
-
-/**
- * Difficulty is a measure of how difficult it is to find a hash below a given target.
- * Each block stores a packed representation (called 'Bits') for its actual target(uint256). 
- * The Bitcoin network uses the following formula to define difficulty:
- * 
- * difficulty_1_target: (compact_int)0x1d00FFFF
- *                      (uint256)0x00000000 FFFF0000 00000000 00000000 00000000 00000000 00000000 00000000
- * current_target:      (compact_int)block_hdr.bits
- *                      (uint256) (convert block_hdr.bits to uint256)
- * 
- * difficulty = difficulty_1_target / current_target
- * 
- * 
- * In order to avoid a large number of floating-point division operations, 
- * we try to use another way (using compact_int) to represent the difficulty, 
- * and made the following definition:
- * 
- * compact_int:        compact_uint256
- * cint_max:    { .bits = 0x20FFFFFF,  .exp = 32, .mantissa = {0xff, 0xff, 0xff} }
- * current_target:      block_hdr.bits
- * 
- * difficulty_cint = compact_int_max - (compact_int)target
- * 
- * To improve precision, we try to keep as many valid bits as possible in mantissa,
- * we define difficulty_cint.mantissa as an unsigned integer,
- * so the highest bit is allowed to be '1'.
- * 
- * DO NOT use 'compact_uint256_compare()' function to 
- * compare (unsigned type)'difficulty' and (signed type)'target' directly,
- * this should not happen within the system, 
- * there are no relevant implementations, the result is undefined.
- * 
- * The 'addition' and 'complement(~, 1's complement)' operation of compact_uint256 are defined as below:
- */
-compact_uint256_t compact_uint256_add(const compact_uint256_t a, const compact_uint256_t b)
-{
-	compact_uint256_t c;	// c = a + b
-	
-	int val_a = a.bits & 0x0FFFFFF;
-	int val_b = b.bits & 0x0FFFFFF;
-	
-	// make a and b same exponent
-	int exp_diff = (int)a.exp - (int)b.exp; 
-	int exp = a.exp;
-	if(exp_diff > 0) {
-		val_b >>= exp_diff * 8;	// bytes to bits
-	}else if(exp_diff < 0) {
-		exp = b.exp;
-		val_a >>= (-exp_diff) * 8;
-	}
-	
-	/*
-	 * Since A and B can only have 24 valid bits at most, and C has 32 bits, 
-	 * it is safe to assign A+B directly to C.
-	 */
-	c.bits = val_a + val_b;
-	
-	// make sure c's mantissa is equal or less than 24 bits
-	if(c.bits & 0xFF000000) { c.bits >>= 8; exp++; }
-	
-	c.exp = exp;
-	return c;
-} 
-
-compact_uint256_t compact_uint256_complement(const compact_uint256_t target)
-{
-	// cint_max:    { .bits = 0x20FFFFFF,  .exp = 32, .mantissa = {0xff, 0xff, 0xff} }
-	compact_uint256_t c;	// c = ~target;
-	uint32_t mantissa = target.bits & 0x0FFFFFF;
-	c.bits = ~mantissa;
-	c.exp = (unsigned char)32 - target.exp; //  target.exp should less than 32 <== sizeof(uint256).
 	
-	return c;
+	block_hash_index_cleanup(list->search_index);
+	return;
 }
 
 
-
 /************************************
  * utils
  ***********************************/
@@ -1168,9 +1403,9 @@ void block_info_dump_BFS(block_info_t * root)
 	while(queue->length > 0)
 	{
 		block_info_t * node = queue->leave(queue);
-		printf("\t info.id = %p, parent=%p, cumulative_difficulty = 0x%.8x\n", 
+		printf("\t info.id = %p, parent=%p, cumulative_difficulty = %.0f\n", 
 			node, node->parent,
-			node->cumulative_difficulty.bits);
+			uint256_int_to_double(&node->cumulative_difficulty));
 		dump_line("hash: ", &node->hash, 32);
 		if(node->hdr) {
 			dump_line("    prev-hash: ", &node->hdr->prev_hash, 32);
@@ -1198,39 +1433,197 @@ void block_info_dump_BFS(block_info_t * root)
 
 
 #if defined(_TEST_CHAINS) && defined(_STAND_ALONE)
-void test_compact_int_arithmetic_operations(void)
+void test_chainwork_arithmetic_operations(void)
 {
-	compact_uint256_t a = {.bits = 0x1d00ffff};
-	compact_uint256_t b = {.bits = 0x1cffff00};
-	
-	int rc = compact_uint256_compare(&a, &b);
-	assert(0 == rc);
-	
-	compact_uint256_t target = { .bits = 0x1b0404cb };
-	
-	compact_uint256_t difficulty = compact_uint256_complement(target);
-	
-	compact_uint256_t difficulty_accum = compact_uint256_add(difficulty, difficulty);
-	
-	printf("difficulty: 0x%.8x\n"
-		"\texp = 0x%.2x, mantissa = 0x%.8x\n",
-		difficulty.bits,
-		difficulty.exp,
-		difficulty.bits & 0x0FFFFFF
-		);
-		
-	printf("difficulty: 0x%.8x\n"
-		"\texp = 0x%.2x, mantissa = 0x%.8x\n",
-		difficulty_accum.bits,
-		difficulty_accum.exp,
-		difficulty_accum.bits & 0x0FFFFFF
-		);
+	// difficulty one: 2^256 / (0xffff * 2^208 + 1) = 0x100010001
+	uint256_int_t work = uint256_int_get_work(compact_uint256_difficulty_one);
+	assert(work.limbs[0] == 0x100010001ULL && 0 == work.limbs[1]);
+	
+	uint256_int_t a = uint256_int_get_work((compact_uint256_t){ .bits = 0x1b0404cb });
+	uint256_int_t b = uint256_int_get_work((compact_uint256_t){ .bits = 0x1b0404ca });
+	assert(uint256_int_compare(&b, &a) > 0);	// a lower target means more work
+	
+	// fork choice must be exact, the sum of two heavier blocks wins by a single unit of work
+	uint256_int_t chain_a = uint256_int_add(a, a);
+	uint256_int_t chain_b = uint256_int_add(a, b);
+	assert(uint256_int_compare(&chain_b, &chain_a) > 0);
+	
+	uint256_int_t diff = uint256_int_sub(chain_b, chain_a);
+	uint256_int_t expected = uint256_int_sub(b, a);
+	assert(0 == uint256_int_compare(&diff, &expected));
+	
+	printf("work(0x1b0404cb): %.0f, chainwork: %.0f\n", 
+		uint256_int_to_double(&a),
+		uint256_int_to_double(&chain_a));
 	return ;
 }
 
+static struct
+{
+	int add_blocks_calls;
+	ssize_t blocks_added;
+	const uint256_t * fail_hash;	// on_add_block() fails at this block
+	int removed_heights[16];
+	int num_removed;
+}s_batch;
+
+static int test_on_add_blocks(blockchain_t * chain, const uint256_t block_hashes[], const int start_height, ssize_t count, void * user_data)
+{
+	for(ssize_t i = 0; i < count; ++i) {
+		assert(0 == memcmp(&chain->heirs->hashes[start_height + i], &block_hashes[i], sizeof(uint256_t)));
+	}
+	++s_batch.add_blocks_calls;
+	s_batch.blocks_added += count;
+	return 0;
+}
+
+static int test_on_add_block(blockchain_t * chain, const uint256_t * block_hash, const int height, void * user_data)
+{
+	if(s_batch.fail_hash && 0 == memcmp(block_hash, s_batch.fail_hash, sizeof(uint256_t))) return -1;
+	++s_batch.blocks_added;
+	return 0;
+}
+
+static int test_on_remove_block(blockchain_t * chain, const uint256_t * block_hash, const int height, void * user_data)
+{
+	assert(s_batch.num_removed < 16);
+	s_batch.removed_heights[s_batch.num_removed++] = height;
+	--s_batch.blocks_added;
+	return 0;
+}
+
+// build a header on top of 'prev' and grind the nonce until it meets the (regtest) target
+static void test_mine_header(struct satoshi_block_header * hdr, uint256_t * hash, const uint256_t * prev, uint32_t id)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->version = 1;
+	memcpy(hdr->prev_hash, prev, sizeof(uint256_t));
+	memcpy(hdr->merkle_root, &id, sizeof(id));	// make each header unique
+	hdr->timestamp = 1000000 + id;
+	hdr->bits = 0x207fffff;
+	
+	for(;; ++hdr->nonce) {
+		sha256d80((unsigned char *)hash, (const unsigned char *)hdr);
+		if(check_pow(hash, hdr->bits)) break;
+	}
+	return;
+}
+
+void test_add_batch(void)
+{
+	enum { NUM_HEADERS = 200 };
+	static struct satoshi_block_header hdrs[NUM_HEADERS];
+	static uint256_t hashes[NUM_HEADERS];
+	enum blockchain_error err = blockchain_error_failed;
+	ssize_t count = 0;
+	
+	struct satoshi_block_header genesis_hdr[1];
+	uint256_t genesis_hash[1];
+	test_mine_header(genesis_hdr, genesis_hash, uint256_zero, 0);
+	
+	uint256_t * prev = genesis_hash;
+	for(int i = 0; i < NUM_HEADERS; ++i) {
+		test_mine_header(&hdrs[i], &hashes[i], prev, i + 1);
+		prev = &hashes[i];
+	}
+	
+	// 1. a linear run extending the tip is appended in bulk
+	blockchain_t chain[1];
+	memset(chain, 0, sizeof(chain));
+	blockchain_init(chain, genesis_hash, genesis_hdr, NULL);
+	chain->on_add_blocks = test_on_add_blocks;
+	
+	count = chain->add_batch(chain, NUM_HEADERS, hdrs, &err);
+	assert(count == NUM_HEADERS && err == blockchain_error_no_error);
+	assert(chain->height == NUM_HEADERS);
+	assert(s_batch.add_blocks_calls == 1 && s_batch.blocks_added == NUM_HEADERS);
+	for(int i = 0; i < NUM_HEADERS; ++i) assert(chain->get_height(chain, &hashes[i]) == i + 1);
+	
+	// the chainwork must match the one-by-one path
+	blockchain_t ref[1];
+	memset(ref, 0, sizeof(ref));
+	blockchain_init(ref, genesis_hash, genesis_hdr, NULL);
+	for(int i = 0; i < NUM_HEADERS; ++i) assert(0 == ref->add(ref, &hashes[i], &hdrs[i]));
+	assert(0 == uint256_int_compare(&chain->heirs->cumulative_difficulties[NUM_HEADERS], 
+		&ref->heirs->cumulative_difficulties[NUM_HEADERS]));
+	blockchain_cleanup(ref);
+	
+	// 2. a lighter fork breaks the run, it goes through add(), then the run resumes on the tip
+	struct satoshi_block_header blocks[5];
+	uint256_t block_hashes[5];
+	test_mine_header(&blocks[0], &block_hashes[0], &hashes[NUM_HEADERS - 10], 1001);
+	test_mine_header(&blocks[1], &block_hashes[1], &block_hashes[0], 1002);
+	test_mine_header(&blocks[2], &block_hashes[2], &hashes[NUM_HEADERS - 1], 1003);
+	test_mine_header(&blocks[3], &block_hashes[3], &block_hashes[2], 1004);
+	test_mine_header(&blocks[4], &block_hashes[4], &block_hashes[3], 1005);
+	
+	s_batch.add_blocks_calls = 0;
+	count = chain->add_batch(chain, 5, blocks, &err);
+	assert(count == 5 && err == blockchain_error_no_error);
+	assert(chain->height == NUM_HEADERS + 3);
+	assert(s_batch.add_blocks_calls == 1);
+	assert(chain->get_height(chain, &block_hashes[0]) == -1);
+	assert(chain->get_height(chain, &block_hashes[4]) == NUM_HEADERS + 3);
+	assert(chain->candidates_list->count == 1);
+	
+	// 3. an invalid proof-of-work stops the batch
+	const uint256_t * tip = &block_hashes[4];
+	struct satoshi_block_header bad[3];
+	uint256_t bad_hashes[3];
+	test_mine_header(&bad[0], &bad_hashes[0], tip, 2001);
+	test_mine_header(&bad[1], &bad_hashes[1], &bad_hashes[0], 2002);
+	test_mine_header(&bad[2], &bad_hashes[2], &bad_hashes[1], 2003);
+	bad[1].bits = 0x1d00ffff;	// the hash no longer meets the target
+	
+	count = chain->add_batch(chain, 3, bad, &err);
+	assert(count == 1 && err == blockchain_error_invalid_pow);
+	assert(chain->height == NUM_HEADERS + 4);
+	assert(chain->get_height(chain, &bad_hashes[0]) == NUM_HEADERS + 4);
+	assert(chain->get_height(chain, &bad_hashes[2]) == -1);
+	tip = &bad_hashes[0];
+	
+	// 4. on_add_block() fails in the second run: 
+	//    the run is rolled back in reverse order, the first run and the fork header stay consumed
+	chain->on_add_blocks = NULL;
+	chain->on_add_block = test_on_add_block;
+	chain->on_remove_block = test_on_remove_block;
+	
+	struct satoshi_block_header more[6];
+	uint256_t more_hashes[6];
+	test_mine_header(&more[0], &more_hashes[0], tip, 3001);
+	test_mine_header(&more[1], &more_hashes[1], &more_hashes[0], 3002);
+	test_mine_header(&more[2], &more_hashes[2], &hashes[NUM_HEADERS - 20], 3003);	// a lighter fork
+	test_mine_header(&more[3], &more_hashes[3], &more_hashes[1], 3004);
+	test_mine_header(&more[4], &more_hashes[4], &more_hashes[3], 3005);
+	test_mine_header(&more[5], &more_hashes[5], &more_hashes[4], 3006);
+	
+	const ssize_t height = chain->height;
+	s_batch.blocks_added = 0;
+	s_batch.fail_hash = &more_hashes[5];
+	count = chain->add_batch(chain, 6, more, &err);
+	assert(count == 3 && err == blockchain_error_failed);
+	assert(chain->height == height + 2);
+	assert(s_batch.num_removed == 2);
+	assert(s_batch.removed_heights[0] == height + 4 && s_batch.removed_heights[1] == height + 3);
+	assert(s_batch.blocks_added == 2);	// only more[0] and more[1] are still reported
+	for(int i = 3; i < 6; ++i) assert(chain->get_height(chain, &more_hashes[i]) == -1);
+	
+	// retry the failed run
+	s_batch.fail_hash = NULL;
+	count = chain->add_batch(chain, 3, &more[3], NULL);
+	assert(count == 3);
+	assert(chain->height == height + 5);
+	assert(chain->get_height(chain, &more_hashes[5]) == height + 5);
+	
+	blockchain_cleanup(chain);
+	printf("%s(): passed\n", __FUNCTION__);
+	return;
+}
+
 int main(int argc, char **argv)
 {
-	test_compact_int_arithmetic_operations();
+	test_chainwork_arithmetic_operations();
+	test_add_batch();
 	exit(0);
 	
 	const char * block_file = "blocks/blk00000.dat";
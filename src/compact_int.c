@@ -194,6 +194,174 @@ int uint256_compare_with_compact(const uint256_t * restrict hash, const compact_
 }
 
 
+/***********************************************************************
+ * uint256_int: 4 x 64-bit limbs, (limbs[0] is the least significant)
+ **********************************************************************/
+uint256_int_t uint256_int_from_uint256(const uint256_t * u256)
+{
+	uint256_int_t a;
+	for(int i = 0; i < 4; ++i) {
+		const uint8_t * p = u256->val + i * 8;
+		uint64_t limb = 0;
+		for(int j = 7; j >= 0; --j) limb = (limb << 8) | p[j];
+		a.limbs[i] = limb;
+	}
+	return a;
+}
+
+uint256_t uint256_int_to_uint256(const uint256_int_t * a)
+{
+	uint256_t u256;
+	for(int i = 0; i < 4; ++i) {
+		uint64_t limb = a->limbs[i];
+		for(int j = 0; j < 8; ++j, limb >>= 8) u256.val[i * 8 + j] = (uint8_t)limb;
+	}
+	return u256;
+}
+
+double uint256_int_to_double(const uint256_int_t * a)
+{
+	double value = 0.0;
+	for(int i = 3; i >= 0; --i) value = value * 18446744073709551616.0 + (double)a->limbs[i];	// * 2^64
+	return value;
+}
+
+uint256_int_t uint256_int_add(const uint256_int_t a, const uint256_int_t b)
+{
+	uint256_int_t c;
+	unsigned __int128 sum = 0;
+	for(int i = 0; i < 4; ++i) {
+		sum += (unsigned __int128)a.limbs[i] + b.limbs[i];
+		c.limbs[i] = (uint64_t)sum;
+		sum >>= 64;	// carry
+	}
+	return c;
+}
+
+uint256_int_t uint256_int_sub(const uint256_int_t a, const uint256_int_t b)
+{
+	uint256_int_t c;
+	uint64_t borrow = 0;
+	for(int i = 0; i < 4; ++i) {
+		unsigned __int128 diff = (unsigned __int128)a.limbs[i] - b.limbs[i] - borrow;
+		c.limbs[i] = (uint64_t)diff;
+		borrow = (uint64_t)(diff >> 64) & 1;
+	}
+	return c;
+}
+
+int uint256_int_compare(const uint256_int_t * restrict a, const uint256_int_t * restrict b)
+{
+	for(int i = 3; i >= 0; --i) {
+		if(a->limbs[i] == b->limbs[i]) continue;
+		return (a->limbs[i] > b->limbs[i])?1:-1;
+	}
+	return 0;
+}
+
+uint256_int_t uint256_int_shift_left(const uint256_int_t a, unsigned int bits)
+{
+	uint256_int_t c = uint256_int_zero;
+	if(bits >= 256) return c;
+
+	int limb_shift = bits / 64;
+	int bit_shift = bits % 64;
+	for(int i = 3; i >= limb_shift; --i) {
+		c.limbs[i] = a.limbs[i - limb_shift] << bit_shift;
+		if(bit_shift && (i - limb_shift) > 0) c.limbs[i] |= a.limbs[i - limb_shift - 1] >> (64 - bit_shift);
+	}
+	return c;
+}
+
+uint256_int_t uint256_int_shift_right(const uint256_int_t a, unsigned int bits)
+{
+	uint256_int_t c = uint256_int_zero;
+	if(bits >= 256) return c;
+
+	int limb_shift = bits / 64;
+	int bit_shift = bits % 64;
+	for(int i = 0; i < 4 - limb_shift; ++i) {
+		c.limbs[i] = a.limbs[i + limb_shift] >> bit_shift;
+		if(bit_shift && (i + limb_shift) < 3) c.limbs[i] |= a.limbs[i + limb_shift + 1] << (64 - bit_shift);
+	}
+	return c;
+}
+
+static inline int uint256_int_bits(const uint256_int_t * a)
+{
+	for(int i = 3; i >= 0; --i) {
+		if(a->limbs[i]) return i * 64 + 64 - __builtin_clzll(a->limbs[i]);
+	}
+	return 0;
+}
+
+uint256_int_t uint256_int_div(const uint256_int_t n, const uint256_int_t d)
+{
+	uint256_int_t q = uint256_int_zero;
+	int d_bits = uint256_int_bits(&d);
+	assert(d_bits > 0);
+
+	if(d_bits <= 64) {	// short division, one limb at a time
+		unsigned __int128 rem = 0;
+		for(int i = 3; i >= 0; --i) {
+			rem = (rem << 64) | n.limbs[i];
+			q.limbs[i] = (uint64_t)(rem / d.limbs[0]);
+			rem %= d.limbs[0];
+		}
+		return q;
+	}
+
+	// shift-subtract, only (n_bits - d_bits + 1) rounds are needed
+	int shift = uint256_int_bits(&n) - d_bits;
+	if(shift < 0) return q;
+
+	uint256_int_t rem = n;
+	uint256_int_t divisor = uint256_int_shift_left(d, shift);
+	for(; shift >= 0; --shift) {
+		if(uint256_int_compare(&rem, &divisor) >= 0) {
+			rem = uint256_int_sub(rem, divisor);
+			q.limbs[shift / 64] |= (uint64_t)1 << (shift % 64);
+		}
+		divisor = uint256_int_shift_right(divisor, 1);
+	}
+	return q;
+}
+
+uint256_int_t uint256_int_from_compact(const compact_uint256_t bits)
+{
+	uint32_t mantissa = bits.bits & 0x007fffff;
+	int exp = bits.exp;
+
+	if(0 == mantissa) return uint256_int_zero;
+	if(bits.bits & 0x00800000) return uint256_int_zero;	// negative
+	if(exp > 34 || (mantissa > 0xff && exp > 33) || (mantissa > 0xffff && exp > 32)) return uint256_int_zero;	// overflow
+
+	uint256_int_t target = { .limbs = { mantissa } };
+	if(exp <= 3) target.limbs[0] >>= 8 * (3 - exp);
+	else target = uint256_int_shift_left(target, 8 * (exp - 3));
+	return target;
+}
+
+uint256_int_t uint256_int_get_work(const compact_uint256_t bits)
+{
+	uint256_int_t target = uint256_int_from_compact(bits);
+	if(0 == uint256_int_bits(&target)) return uint256_int_zero;
+
+	/*
+	 * 2^256 can not be represented by uint256,
+	 * use (~target / (target + 1)) + 1 instead, which is equal to 2^256 / (target + 1).
+	 */
+	uint256_int_t one = { .limbs = { 1 } };
+	uint256_int_t divisor = uint256_int_add(target, one);
+	if(0 == uint256_int_bits(&divisor)) return one;	// target == 2^256 - 1
+
+	uint256_int_t complement;
+	for(int i = 0; i < 4; ++i) complement.limbs[i] = ~target.limbs[i];
+
+	return uint256_int_add(uint256_int_div(complement, divisor), one);
+}
+
+
 #if defined(_TEST_COMPACT_INT) && defined(_STAND_ALONE)
 
 #ifndef dump_line
@@ -438,7 +606,50 @@ int main(int argc, char **argv)
 	diff = compact_uint256_compare(&compact_uint256_difficulty_one, &compact_uint256_NaN);
 	printf("diff = %d\n", diff);
 	assert(diff < 0);
-	
+
+
+	printf("==== uint256_int_get_work(bits): \n");
+	static const struct {
+		uint32_t bits;
+		uint64_t work[2];
+	} works[] = {
+		{ 0x1d00ffff, { 0x100010001ULL, 0 } },	// difficulty one
+		{ 0x1b0404cb, { 0x3fb3ab764c00ULL, 0 } },
+		{ 0x207fffff, { 2, 0 } },				// regtest
+		{ 0x170331db, { 0xab2578ee9fc3005eULL, 0x5021 } },
+		{ 0x1d80ffff, { 0, 0 } },				// negative
+		{ 0x00000000, { 0, 0 } },
+	};
+	for(size_t i = 0; i < sizeof(works) / sizeof(works[0]); ++i) {
+		uint256_int_t work = uint256_int_get_work((compact_uint256_t){ .bits = works[i].bits });
+		printf("\tbits=0x%.8x, work=%.0f\n", works[i].bits, uint256_int_to_double(&work));
+		assert(work.limbs[0] == works[i].work[0] && work.limbs[1] == works[i].work[1]);
+		assert(0 == work.limbs[2] && 0 == work.limbs[3]);
+	}
+
+	printf("==== uint256_int arithmetic: \n");
+	uint256_int_t one = { .limbs = { 1 } };
+	uint256_int_t max = { .limbs = { UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX } };
+	uint256_int_t c = uint256_int_add(max, one);
+	assert(0 == uint256_int_compare(&c, &uint256_int_zero));
+	c = uint256_int_sub(uint256_int_zero, one);
+	assert(0 == uint256_int_compare(&c, &max));
+
+	c = uint256_int_shift_left(one, 200);
+	assert(c.limbs[3] == ((uint64_t)1 << 8));
+	c = uint256_int_shift_right(c, 200);
+	assert(0 == uint256_int_compare(&c, &one));
+
+	c = uint256_int_from_compact((compact_uint256_t){ .bits = 0x207fffff });	// regtest
+	assert(c.limbs[3] == 0x7fffff0000000000ULL && 0 == c.limbs[2]);
+	c = uint256_int_from_compact(compact_uint256_NaN);
+	assert(0 == uint256_int_compare(&c, &uint256_int_zero));
+
+	uint256_t u256 = uint256_int_to_uint256(&max);
+	assert(0 == memcmp(&u256, &uint256_NaN, 32));
+	c = uint256_int_from_uint256(&uint256_difficulty_one);
+	assert(c.limbs[3] == 0x00000000ffffffffULL && c.limbs[0] == UINT64_MAX);
+
 	return 0;
 }
 #endif
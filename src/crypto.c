@@ -56,6 +56,21 @@ void hash256(const void * data, size_t length, uint8_t hash[32])
 	sha256_final(sha, hash);
 }
 
+/**
+ * hash256_64 / hash256_80: 
+ * 	fixed-size double-SHA256, use the precomputed padding blocks 
+ * 	instead of the generic sha256_update() / sha256_final() path.
+ */
+void hash256_64(const void * data, uint8_t hash[32])
+{
+	sha256d64(hash, data);
+}
+
+void hash256_80(const void * data, uint8_t hash[32])
+{
+	sha256d80(hash, data);
+}
+
 void hash160(const void * data, size_t length, uint8_t hash[20])
 {
 	sha256_ctx_t sha[1];
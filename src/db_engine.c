@@ -40,18 +40,15 @@
 
 #include "db_engine.h"
 
-static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define global_lock() 		pthread_mutex_lock(&g_mutex)
-#define global_unlock()		pthread_mutex_unlock(&g_mutex)
 
 static inline DB_ENV * db_engine_get_env(db_engine_t * engine) { return *(DB_ENV **)engine->priv; }
 
+/* DB_NOTFOUND is a normal result (a miss), not an error */
 #define db_check_error(ret_code, fmt, ...) do {				\
-		if(ret_code) {										\
-			db_engine_t * engine = db_engine_get();			\
-			DB_ENV * env = db_engine_get_env(engine);		\
-			assert(env);									\
-			env->err(env, ret_code, fmt, ##__VA_ARGS__);	\
+		if(ret_code && ret_code != DB_NOTFOUND) {			\
+			fprintf(stderr, "[ERROR]::%s@%d::%s(): " fmt "%s\n",	\
+				__FILE__, __LINE__, __FUNCTION__,			\
+				##__VA_ARGS__, db_strerror(ret_code));		\
 		}													\
 	}while(0)
 
@@ -63,6 +60,7 @@ typedef struct db_engine_private
 
 	char home_dir[PATH_MAX];
 	u_int32_t env_flags;
+	db_engine_config_t config[1];
 	
 	ssize_t max_size;
 	ssize_t count;
@@ -71,7 +69,6 @@ typedef struct db_engine_private
 	db_handle_t * log_db;
 	char error_desc[4096];	//  last error description
 	
-	long refs_count;
 }db_engine_private_t;
 
 
@@ -95,7 +92,10 @@ static int txn_begin(struct db_engine_txn * txn, struct db_engine_txn * parent_t
 	assert(env);
 	
 	DB_TXN * parent = parent_txn?parent_txn->priv:NULL;
-	int rc = env->txn_begin(env, parent, (DB_TXN **)&txn->priv, DB_READ_COMMITTED | DB_TXN_SYNC);
+	u_int32_t flags = (txn->flags & db_engine_txn_flags_snapshot)?DB_TXN_SNAPSHOT:DB_READ_COMMITTED;
+	
+	// the sync behavior on commit follows the durability of the environment (engine->set_durability())
+	int rc = env->txn_begin(env, parent, (DB_TXN **)&txn->priv, flags);
 	if(rc) {
 		env->err(env, rc, "%s() failed: ", __FUNCTION__);
 	}
@@ -170,7 +170,7 @@ static const char * txn_get_name(struct db_engine_txn * txn)
 	return name;
 }
 
-db_engine_txn_t * db_engine_txn_init(db_engine_txn_t * txn, struct db_engine * engine)
+static db_engine_txn_t * bdb_txn_init(db_engine_txn_t * txn, struct db_engine * engine)
 {
 	if(NULL == txn) txn = calloc(1, sizeof(*txn));
 	txn->engine = engine;
@@ -185,7 +185,7 @@ db_engine_txn_t * db_engine_txn_init(db_engine_txn_t * txn, struct db_engine * e
 	
 	return txn;
 }
-void db_engine_txn_cleanup(db_engine_txn_t * txn)
+static void bdb_txn_cleanup(db_engine_txn_t * txn)
 {
 	DB_TXN * db_txn = txn->priv;
 	if(db_txn) {
@@ -198,16 +198,36 @@ void db_engine_txn_cleanup(db_engine_txn_t * txn)
 /****************************************************************
  * struct db_handle
 ****************************************************************/
+struct db_private;
+
+/**
+ * db_scratch: 
+ *   per-thread DB_DBT_REALLOC buffers for db->get(), 
+ *   they grow to the largest record and are reused by the following lookups.
+ *   The list only grows (lock-free push), the buffers of an exited thread are taken over by the next new thread.
+ */
+typedef struct db_scratch
+{
+	DBT key;
+	DBT value;
+	
+	struct db_private * priv;
+	struct db_scratch * next;
+	int in_use;	// owned by a running thread
+}db_scratch_t;
+
 typedef struct db_private
 {
 	DB * dbp;
 	struct db_handle * db;
 	int db_type;
 	
-	pthread_mutex_t mutex;
 	char name[PATH_MAX];
 	
 	db_associate_callback associate_func;
+	
+	pthread_key_t scratch_key;
+	db_scratch_t * scratches;	// all per-thread buffers
 }db_private_t;
 static inline DB * db_get_handle(struct db_handle * db) 
 { 
@@ -217,8 +237,50 @@ static inline DB * db_get_handle(struct db_handle * db)
 	return dbp;
 }
 
-#define db_lock(db)			pthread_mutex_lock(&((db_private_t *)db->priv)->mutex)
-#define db_unlock(db)		pthread_mutex_unlock(&((db_private_t *)db->`priv)->mutex)
+static void db_scratch_free(db_scratch_t * scratch)
+{
+	free(scratch->key.data);
+	free(scratch->value.data);
+	free(scratch);
+}
+
+/* called on thread exit */
+static void db_scratch_destroy(void * _scratch)
+{
+	db_scratch_t * scratch = _scratch;
+	__sync_lock_release(&scratch->in_use);
+}
+
+static db_scratch_t * db_scratch_get(db_private_t * priv)
+{
+	db_scratch_t * scratch = pthread_getspecific(priv->scratch_key);
+	if(scratch) return scratch;
+	
+	// reuse the buffers of an exited thread
+	scratch = __atomic_load_n(&priv->scratches, __ATOMIC_ACQUIRE);
+	for(; scratch; scratch = scratch->next) {
+		if(__sync_bool_compare_and_swap(&scratch->in_use, 0, 1)) break;
+	}
+	
+	if(NULL == scratch) {
+		scratch = calloc(1, sizeof(*scratch));
+		assert(scratch);
+		scratch->key.flags = DB_DBT_REALLOC;
+		scratch->value.flags = DB_DBT_REALLOC;
+		scratch->priv = priv;
+		scratch->in_use = 1;
+		
+		db_scratch_t * head = NULL;
+		do {
+			head = __atomic_load_n(&priv->scratches, __ATOMIC_ACQUIRE);
+			scratch->next = head;
+		}while(!__sync_bool_compare_and_swap(&priv->scratches, head, scratch));
+	}
+	
+	int rc = pthread_setspecific(priv->scratch_key, scratch);
+	assert(0 == rc);
+	return scratch;
+}
 
 db_private_t * db_private_new(db_handle_t * db)
 {
@@ -235,7 +297,8 @@ db_private_t * db_private_new(db_handle_t * db)
 	assert(priv);
 	priv->db = db;
 	priv->dbp = dbp;
-	rc = pthread_mutex_init(&priv->mutex, NULL);
+	dbp->app_private = db;
+	rc = pthread_key_create(&priv->scratch_key, db_scratch_destroy);
 	assert(0 == rc);
 	
 	db->priv = priv;
@@ -250,11 +313,61 @@ void db_private_free(db_private_t * priv)
 		priv->dbp->close(priv->dbp, 0);
 	}
 	
-	pthread_mutex_destroy(&priv->mutex);
+	// the destructor will not be called once the key is deleted, release the buffers of all threads here
+	pthread_key_delete(priv->scratch_key);
+	db_scratch_t * scratch = priv->scratches;
+	while(scratch) {
+		db_scratch_t * next = scratch->next;
+		db_scratch_free(scratch);
+		scratch = next;
+	}
+	priv->scratches = NULL;
+	
 	free(priv);
 	return;
 }
 
+/**
+ * db_read_flags():
+ *   the isolation of the read paths. 
+ *   Outside a txn, a multiversion engine reads through a DB_TXN_SNAPSHOT cursor: 
+ *   the last committed versions of the pages are read without read locks, so the readers never wait for a writer.
+ */
+static inline u_int32_t db_read_flags(db_handle_t * db, db_engine_txn_t * txn)
+{
+	if(txn) return (txn->flags & db_engine_txn_flags_snapshot)?0:DB_READ_COMMITTED;
+	
+	db_engine_private_t * engine_priv = db->engine->priv;
+	return engine_priv->config->multiversion?DB_TXN_SNAPSHOT:DB_READ_COMMITTED;
+}
+
+/* point lookup: DB->get() (or DB->pget() if skey) with the flags returned by db_read_flags() */
+static int db_read(DB * dbp, DB_TXN * txn, u_int32_t read_flags, DBT * skey, DBT * key, DBT * value)
+{
+	if(read_flags != DB_TXN_SNAPSHOT) {
+		if(skey) return dbp->pget(dbp, txn, skey, key, value, read_flags);
+		return dbp->get(dbp, txn, key, value, read_flags);
+	}
+	
+	// DB->get() does not accept DB_TXN_SNAPSHOT
+	DBC * cursor = NULL;
+	int rc = dbp->cursor(dbp, txn, &cursor, DB_TXN_SNAPSHOT);
+	if(rc) return rc;
+	if(skey) rc = cursor->pget(cursor, skey, key, value, DB_SET);
+	else rc = cursor->get(cursor, key, value, DB_SET);
+	cursor->close(cursor);
+	return rc;
+}
+
+static int db_compare_int32(DB * dbp, const DBT * dbt1, const DBT * dbt2)
+{
+	int32_t a, b;
+	assert(dbt1->size == sizeof(int32_t) && dbt2->size == sizeof(int32_t));
+	memcpy(&a, dbt1->data, sizeof(a));
+	memcpy(&b, dbt2->data, sizeof(b));
+	return (a > b) - (a < b);
+}
+
 static int db_open(struct db_handle * db, db_engine_txn_t * txn, const char * name, int db_type, enum db_flags flags)
 {
 	assert(db && db->priv && name);
@@ -278,6 +391,16 @@ static int db_open(struct db_handle * db, db_engine_txn_t * txn, const char * na
 		dbp->set_flags(dbp, DB_DUPSORT);
 		db->record_flags |= db_record_flags_multiple;
 	}
+	if(flags & db_flags_int32_keys) {
+		dbp->set_bt_compare(dbp, db_compare_int32);
+	}
+	
+	db_engine_private_t * engine_priv = db->engine->priv;
+	unsigned int page_size = db_engine_config_get_page_size(engine_priv->config, name);
+	if(page_size) {
+		rc = dbp->set_pagesize(dbp, page_size);
+		db_check_error(rc, "set_pagesize(%u) failed: ", page_size);
+	}
 	
 	rc = dbp->open(dbp, db_txn_get_handle(txn), name, NULL, priv->db_type, 
 		DB_CREATE | DB_AUTO_COMMIT, 0660);
@@ -285,27 +408,11 @@ static int db_open(struct db_handle * db, db_engine_txn_t * txn, const char * na
 	return rc;
 }
 
-static inline db_handle_t * db_engine_find_db(db_engine_t * engine, DB * dbp)
-{
-	assert(engine && engine->priv && dbp);
-	db_engine_private_t * priv = engine->priv;
-	
-	for(int i = 0; i < priv->count; ++i)
-	{
-		if(dbp == db_get_handle(priv->databases[i])) return priv->databases[i];
-	}
-	return NULL;
-}
-
-
 static int secondary_db_get_key(DB * secondary, 
 	const DBT * key, const DBT * value, 
 	DBT * result)
 {
-	db_engine_t * engine = db_engine_get();
-	assert(engine);
-	
-	db_handle_t * db = db_engine_find_db(engine, secondary);
+	db_handle_t * db = secondary->app_private;
 	assert(db && db->priv);
 	
 	db_private_t * priv = db->priv;
@@ -444,7 +551,7 @@ static ssize_t db_find(struct db_handle * db, db_engine_txn_t * _txn,
 		if(NULL == p_values) return 1;
 		
 		value.flags = DB_DBT_MALLOC;
-		rc = dbp->get(dbp, txn, &key, &value, DB_READ_COMMITTED);
+		rc = db_read(dbp, txn, db_read_flags(db, _txn), NULL, &key, &value);
 		db_check_error(rc, "dbp->get():");
 		if(0 == rc) {
 			*p_values = db_record_data_set(*p_values, &value);
@@ -453,14 +560,14 @@ static ssize_t db_find(struct db_handle * db, db_engine_txn_t * _txn,
 		return 1;
 	}
 
-#define MAX_RECORDS (1024)
+#define MAX_RECORDS (16)	// initial size, doubled on demand
 
 	assert(p_values);
 	ssize_t max_size = MAX_RECORDS;
 	db_record_data_t * results = calloc(max_size, sizeof(*results));
 	// find the first record
 	DBC * cursor = NULL;
-	rc = dbp->cursor(dbp, txn, &cursor, DB_READ_COMMITTED);
+	rc = dbp->cursor(dbp, txn, &cursor, db_read_flags(db, _txn));
 	assert(0 == rc && cursor);
 
 	rc = cursor->get(cursor, &key, &value, DB_SET);
@@ -518,7 +625,7 @@ static ssize_t db_find_secondary(struct db_handle * db, db_engine_txn_t * _txn,
 		if(NULL == p_values) return 1;
 		
 		count = 0;
-		rc = dbp->pget(dbp, txn, &skey, &key, &value, DB_READ_COMMITTED);
+		rc = db_read(dbp, txn, db_read_flags(db, _txn), &skey, &key, &value);
 		db_check_error(rc, "dbp->pget(): ");
 		if(0 == rc) {
 			if(p_keys) {
@@ -533,7 +640,7 @@ static ssize_t db_find_secondary(struct db_handle * db, db_engine_txn_t * _txn,
 		return count;
 	}
 
-#define MAX_RECORDS (1024)
+#define MAX_RECORDS (16)	// initial size, doubled on demand
 
 	assert(p_values);
 	ssize_t max_size = MAX_RECORDS;
@@ -544,7 +651,7 @@ static ssize_t db_find_secondary(struct db_handle * db, db_engine_txn_t * _txn,
 	
 	// find the first record
 	DBC * cursor = NULL;
-	rc = dbp->cursor(dbp, txn, &cursor, DB_READ_COMMITTED);
+	rc = dbp->cursor(dbp, txn, &cursor, db_read_flags(db, _txn));
 	assert(0 == rc && cursor);
 	
 	rc = cursor->pget(cursor, &skey, &key, &value, DB_SET);
@@ -589,7 +696,172 @@ static ssize_t db_find_secondary(struct db_handle * db, db_engine_txn_t * _txn,
 	
 	return 0;
 }
+
+static int db_get(struct db_handle * db, db_engine_txn_t * _txn, 
+	const db_record_data_t * _key, 
+	db_record_data_t * value)
+{
+	assert(db && _key && value);
+	DB * dbp = db_get_handle(db);
+	DB_TXN * txn = db_txn_get_handle(_txn);
+	db_scratch_t * scratch = db_scratch_get(db->priv);
+	
+	DBT key;
+	memset(&key, 0, sizeof(key));
+	key.data = (void *)_key->data;
+	key.size = _key->size;
+	
+	int rc = db_read(dbp, txn, db_read_flags(db, _txn), NULL, &key, &scratch->value);
+	if(rc == DB_NOTFOUND) return 0;
+	db_check_error(rc, "dbp->get(): ");
+	if(rc) return -1;
+	
+	value->data = scratch->value.data;
+	value->size = scratch->value.size;
+	value->flags = 0;
+	return 1;
+}
+
+static int db_get_secondary(struct db_handle * db, db_engine_txn_t * _txn, 
+	const db_record_data_t * _skey, 
+	db_record_data_t * key,
+	db_record_data_t * value)
+{
+	assert(db && _skey && value);
+	DB * dbp = db_get_handle(db);
+	DB_TXN * txn = db_txn_get_handle(_txn);
+	db_scratch_t * scratch = db_scratch_get(db->priv);
+	
+	DBT skey;
+	memset(&skey, 0, sizeof(skey));
+	skey.data = (void *)_skey->data;
+	skey.size = _skey->size;
+	
+	int rc = db_read(dbp, txn, db_read_flags(db, _txn), &skey, &scratch->key, &scratch->value);
+	if(rc == DB_NOTFOUND) return 0;
+	db_check_error(rc, "dbp->pget(): ");
+	if(rc) return -1;
+	
+	if(key) {
+		key->data = scratch->key.data;
+		key->size = scratch->key.size;
+		key->flags = 0;
+	}
+	value->data = scratch->value.data;
+	value->size = scratch->value.size;
+	value->flags = 0;
+	return 1;
+}
+	
+
+/**
+ * find_many: 
+ *   probe all keys with a single cursor.
+ *   on a btree the keys are probed in the key order first, 
+ *   so that random lookups become a forward sweep over the leaf pages.
+ *   a hash db has no key order to exploit, the keys are probed as given.
+ */
+struct find_many_key
+{
+	ssize_t index;	// index in the original keys array
+	const db_record_data_t * key;
+};
+
+static int find_many_key_compare(const void * _a, const void * _b)
+{
+	// the same order as the default btree comparison function (lexicographical)
+	const db_record_data_t * a = ((const struct find_many_key *)_a)->key;
+	const db_record_data_t * b = ((const struct find_many_key *)_b)->key;
+	size_t size = (a->size < b->size)?a->size:b->size;
+	int rc = memcmp(a->data, b->data, size);
+	if(rc) return rc;
+	if(a->size == b->size) return 0;
+	return (a->size < b->size)?-1:1;
+}
+
+#define DB_FIND_MANY_ALIGN(size) (((size) + 7) & ~(size_t)7)
+static ssize_t db_find_many(struct db_handle * db, db_engine_txn_t * _txn, 
+	ssize_t count, const db_record_data_t keys[],
+	db_record_data_t results[],
+	void * buffer, size_t buffer_size)
+{
+	int rc = -1;
+	assert(db && (count >= 0) && results);
+	if(count <= 0) return 0;
+	assert(keys);
+	
+	DB * dbp = db_get_handle(db);
+	DB_TXN * txn = db_txn_get_handle(_txn);
+	
+	struct find_many_key * sorted = malloc(count * sizeof(*sorted));
+	assert(sorted);
+	for(ssize_t i = 0; i < count; ++i) {
+		sorted[i].index = i;
+		sorted[i].key = &keys[i];
+	}
+	if(((db_private_t *)db->priv)->db_type == DB_BTREE) {
+		qsort(sorted, count, sizeof(*sorted), find_many_key_compare);
+	}
+	memset(results, 0, count * sizeof(*results));
+	
+	DBC * cursor = NULL;
+	rc = dbp->cursor(dbp, txn, &cursor, db_read_flags(db, _txn));
+	db_check_error(rc, "dbp->cursor(): ");
+	if(rc) {
+		free(sorted);
+		return -1;
+	}
+	
+	unsigned char * p_buf = buffer;
+	size_t buf_used = 0;
+	ssize_t num_found = 0;
 	
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		db_record_data_t * result = &results[sorted[i].index];
+		DBT key, value;
+		memset(&key, 0, sizeof(key));
+		memset(&value, 0, sizeof(value));
+		key.data = (void *)sorted[i].key->data;
+		key.size = sorted[i].key->size;
+		
+		// copy the value into the caller-supplied buffer
+		value.flags = DB_DBT_USERMEM;
+		value.data = p_buf?(p_buf + buf_used):NULL;
+		value.ulen = p_buf?(buffer_size - buf_used):0;
+		
+		rc = cursor->get(cursor, &key, &value, DB_SET);
+		if(rc == DB_BUFFER_SMALL) {	
+			// the buffer is full, fallback to malloc (value.size was set to the required size)
+			value.data = malloc(value.size);
+			assert(value.data);
+			value.ulen = value.size;
+			rc = cursor->get(cursor, &key, &value, DB_SET);
+			if(0 == rc) result->flags = 1;	// owned by the result
+			else free(value.data);
+		}else if(0 == rc) {
+			buf_used += DB_FIND_MANY_ALIGN(value.size);
+			if(buf_used > buffer_size) buf_used = buffer_size;
+		}
+		
+		if(rc == DB_NOTFOUND) continue;
+		db_check_error(rc, "cursor->get(): ");
+		if(rc) break;
+		
+		result->data = value.data;
+		result->size = value.size;
+		++num_found;
+	}
+	cursor->close(cursor);
+	free(sorted);
+	
+	if(rc && rc != DB_NOTFOUND) {
+		for(ssize_t i = 0; i < count; ++i) db_record_data_cleanup(&results[i]);
+		return -1;
+	}
+	return num_found;
+}
+#undef DB_FIND_MANY_ALIGN
 
 static int db_insert(struct db_handle * db, db_engine_txn_t * _txn, 
 	const db_record_data_t * _key, 
@@ -669,7 +941,151 @@ static int db_del(struct db_handle * db, db_engine_txn_t * _txn, const db_record
 }
 
 
-db_handle_t * db_handle_init(db_handle_t * db, db_engine_t * engine, void * user_data)
+/**
+ * insert_many / del_many: 
+ *   pack the records into a DB_MULTIPLE_KEY (or DB_MULTIPLE) bulk buffer,
+ *   and write each full buffer with a single put() / del().
+ */
+#define DB_BULK_BUFFER_MIN_SIZE	(64 * 1024)
+#define DB_BULK_BUFFER_MAX_SIZE	(4 * 1024 * 1024)
+static void * db_bulk_buffer_new(DBT * bulk, ssize_t count, const db_record_data_t keys[], const db_record_data_t values[])
+{
+	// data + offsets (4 x u_int32_t per pair) + terminator
+	size_t size = sizeof(u_int32_t);
+	for(ssize_t i = 0; i < count && size < DB_BULK_BUFFER_MAX_SIZE; ++i) {
+		size += keys[i].size + (values?values[i].size:0) + 4 * sizeof(u_int32_t);
+	}
+	if(size < DB_BULK_BUFFER_MIN_SIZE) size = DB_BULK_BUFFER_MIN_SIZE;
+	if(size > DB_BULK_BUFFER_MAX_SIZE) size = DB_BULK_BUFFER_MAX_SIZE;
+	size = (size + 1023) & ~(size_t)1023;	// a multiple of 1024
+	
+	memset(bulk, 0, sizeof(*bulk));
+	bulk->data = malloc(size);
+	assert(bulk->data);
+	bulk->ulen = size;
+	bulk->flags = DB_DBT_USERMEM;
+	return bulk->data;
+}
+
+static int db_insert_many(struct db_handle * db, db_engine_txn_t * _txn, 
+	ssize_t count, const db_record_data_t keys[], const db_record_data_t values[])
+{
+	int rc = 0;
+	assert(db && (count >= 0));
+	if(count <= 0) return 0;
+	assert(keys && values);
+	
+	// bulk put does not support DB_NOOVERWRITE
+	if(db->record_flags & db_record_flags_no_overwrite) {
+		for(ssize_t i = 0; (0 == rc) && i < count; ++i) rc = db->insert(db, _txn, &keys[i], &values[i]);
+		return rc;
+	}
+	
+	DB * dbp = db_get_handle(db);
+	DB_TXN * txn = db_txn_get_handle(_txn);
+	
+	DBT bulk, empty;
+	memset(&empty, 0, sizeof(empty));
+	db_bulk_buffer_new(&bulk, count, keys, values);
+	
+	void * p = NULL;
+	ssize_t num_packed = 0;
+	DB_MULTIPLE_WRITE_INIT(p, &bulk);
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		DB_MULTIPLE_KEY_WRITE_NEXT(p, &bulk, keys[i].data, keys[i].size, values[i].data, values[i].size);
+		if(p) { ++num_packed; continue; }
+		
+		// the buffer is full
+		if(num_packed > 0) {
+			rc = dbp->put(dbp, txn, &bulk, &empty, DB_MULTIPLE_KEY);
+			db_check_error(rc, "%s()::put(DB_MULTIPLE_KEY): ", __FUNCTION__);
+			if(rc) break;
+		}
+		
+		num_packed = 0;
+		DB_MULTIPLE_WRITE_INIT(p, &bulk);
+		DB_MULTIPLE_KEY_WRITE_NEXT(p, &bulk, keys[i].data, keys[i].size, values[i].data, values[i].size);
+		if(NULL == p) {	// a single record larger than the buffer
+			rc = db->insert(db, _txn, &keys[i], &values[i]);
+			if(rc) break;
+			DB_MULTIPLE_WRITE_INIT(p, &bulk);
+			continue;
+		}
+		++num_packed;
+	}
+	
+	if(0 == rc && num_packed > 0) {
+		rc = dbp->put(dbp, txn, &bulk, &empty, DB_MULTIPLE_KEY);
+		db_check_error(rc, "%s()::put(DB_MULTIPLE_KEY): ", __FUNCTION__);
+	}
+	free(bulk.data);
+	return rc;
+}
+
+/* bulk del stops at the first missing key, retry the chunk key by key */
+static int db_del_bulk(struct db_handle * db, DB_TXN * txn, DBT * bulk, 
+	ssize_t num_keys, const db_record_data_t keys[])
+{
+	DB * dbp = db_get_handle(db);
+	int rc = dbp->del(dbp, txn, bulk, DB_MULTIPLE);
+	if(rc != DB_NOTFOUND) {
+		db_check_error(rc, "%s()::del(DB_MULTIPLE): ", __FUNCTION__);
+		return rc;
+	}
+	
+	for(ssize_t i = 0; i < num_keys; ++i) {
+		DBT key;
+		memset(&key, 0, sizeof(key));
+		key.data = (void *)keys[i].data;
+		key.size = keys[i].size;
+		rc = dbp->del(dbp, txn, &key, 0);
+		if(rc == DB_NOTFOUND) rc = 0;
+		db_check_error(rc, "%s()::del(): ", __FUNCTION__);
+		if(rc) break;
+	}
+	return rc;
+}
+
+static int db_del_many(struct db_handle * db, db_engine_txn_t * _txn, 
+	ssize_t count, const db_record_data_t keys[])
+{
+	int rc = 0;
+	assert(db && (count >= 0));
+	if(count <= 0) return 0;
+	assert(keys);
+	
+	DB_TXN * txn = db_txn_get_handle(_txn);
+	DBT bulk;
+	db_bulk_buffer_new(&bulk, count, keys, NULL);
+	
+	void * p = NULL;
+	ssize_t first = 0;	// the first key in the current buffer
+	DB_MULTIPLE_WRITE_INIT(p, &bulk);
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		DB_MULTIPLE_WRITE_NEXT(p, &bulk, keys[i].data, keys[i].size);
+		if(p) continue;
+		
+		// the buffer is full
+		assert(i > first);	// the buffer can always hold one key
+		rc = db_del_bulk(db, txn, &bulk, i - first, &keys[first]);
+		if(rc) break;
+		
+		first = i;
+		DB_MULTIPLE_WRITE_INIT(p, &bulk);
+		DB_MULTIPLE_WRITE_NEXT(p, &bulk, keys[i].data, keys[i].size);
+		assert(p);
+	}
+	
+	if(0 == rc && count > first) rc = db_del_bulk(db, txn, &bulk, count - first, &keys[first]);
+	free(bulk.data);
+	return rc;
+}
+#undef DB_BULK_BUFFER_MIN_SIZE
+#undef DB_BULK_BUFFER_MAX_SIZE
+
+static db_handle_t * bdb_handle_init(db_handle_t * db, db_engine_t * engine, void * user_data)
 {
 	if(NULL == db) db = calloc(1, sizeof(*db));
 	assert(db);
@@ -681,25 +1097,47 @@ db_handle_t * db_handle_init(db_handle_t * db, db_engine_t * engine, void * user
 	db->close = db_close;
 	db->find = db_find;
 	db->find_secondary = db_find_secondary;
+	db->get = db_get;
+	db->get_secondary = db_get_secondary;
+	db->find_many = db_find_many;
 	db->insert = db_insert;
 	db->update = db_update;
 	db->del = db_del;
+	db->insert_many = db_insert_many;
+	db->del_many = db_del_many;
 	
 	db_private_t * priv = db_private_new(db);
 	assert(priv && db->priv == priv);
 	
 	return db;
 }
-void db_handle_cleanup(db_handle_t * db)
+static void bdb_handle_cleanup(db_handle_t * db)
 {
 	if(NULL == db) return;
 	db_private_free(db->priv);
+	db->priv = NULL;
 	return;
 }
 
 /***************************************************************
  * struct db_cursor
 ****************************************************************/
+typedef struct db_cursor_private
+{
+	DBC * cursorp;
+	
+	// DB_DBT_REALLOC buffers owned by the cursor, reused by every operation
+	DBT skey;
+	DBT key;
+	DBT value;
+}db_cursor_private_t;
+
+static inline DBC * db_cursor_get_handle(struct db_cursor * cursor)
+{
+	assert(cursor && cursor->priv);
+	return ((db_cursor_private_t *)cursor->priv)->cursorp;
+}
+
 static inline void db_cursor_clear_data(struct db_cursor * cursor)
 {
 	assert(cursor);
@@ -708,58 +1146,53 @@ static inline void db_cursor_clear_data(struct db_cursor * cursor)
 	db_record_data_cleanup(cursor->value);
 }
 
+/* receive into the caller's buffer if it was preset, otherwise into the cursor-owned buffer */
+static inline DBT * db_cursor_dbt(DBT * dbt, DBT * owned, const db_record_data_t * record)
+{
+	if(NULL == record->data || record->size <= 0 || record->data == owned->data) return owned;
+	
+	memset(dbt, 0, sizeof(*dbt));
+	dbt->flags = DB_DBT_USERMEM;
+	dbt->data = record->data;
+	dbt->ulen = record->size;
+	return dbt;
+}
+
+static inline void db_cursor_borrow(db_record_data_t * record, const DBT * dbt, const DBT * owned)
+{
+	if(dbt != owned) return;
+	record->data = owned->data;
+	record->size = owned->size;
+	record->flags = 0;
+}
+
 static inline int db_cursor_op(struct db_cursor * cursor, u_int32_t flags)
 {
 	int rc = -1;
+	db_cursor_private_t * priv = cursor->priv;
+	DBC * cursorp = priv->cursorp;
 	
-	DBC * cursorp = cursor->priv;
-	DBT skey, key, value;
-	memset(&skey, 0, sizeof(skey));
-	memset(&key, 0, sizeof(key));
-	memset(&value, 0, sizeof(value));
+	DBT skey_buf, key_buf, value_buf;
+	DBT * key = db_cursor_dbt(&key_buf, &priv->key, cursor->key);
+	DBT * value = db_cursor_dbt(&value_buf, &priv->value, cursor->value);
+	DBT * skey = NULL;
 	
 	int duplicate_flags = cursor->db->record_flags & db_record_flags_multiple;
-	
-	key.flags = DB_DBT_MALLOC;
-	value.flags = DB_DBT_MALLOC;
-	
-	
-	if(cursor->key->data && cursor->key->size > 0) {
-		key.flags = DB_DBT_USERMEM;
-		key.data = cursor->key->data;
-		key.ulen = cursor->key->size;
-	}
-
-	
-	if(cursor->value->data && cursor->value->size > 0) {
-		value.flags = DB_DBT_USERMEM;
-		value.data = cursor->value->data;
-		value.ulen = cursor->value->size;
-	}
-
 	if(duplicate_flags) {
-		skey.flags = DB_DBT_MALLOC;
-		if(cursor->skey->data && cursor->skey->size > 0) {
-			skey.flags = DB_DBT_USERMEM;
-			skey.data = cursor->skey->data;
-			skey.ulen = cursor->skey->size;
-		}
-		rc = cursorp->pget(cursorp, &skey, &key, &value, flags);
+		skey = db_cursor_dbt(&skey_buf, &priv->skey, cursor->skey);
+		rc = cursorp->pget(cursorp, skey, key, value, flags);
 	}else {
-		rc = cursorp->get(cursorp, &key, &value, flags);
+		rc = cursorp->get(cursorp, key, value, flags);
 	}
 	
+	if(rc == DB_NOTFOUND) return rc;
 	db_check_error(rc, "cursorp->get()=%d: ", rc);
 	
 	if(0 == rc) {
-		if(duplicate_flags && skey.flags & DB_DBT_MALLOC) db_record_data_set(cursor->skey, &skey);
-		if(key.flags & DB_DBT_MALLOC) 		db_record_data_set(cursor->key, &key);
-		if(value.flags & DB_DBT_MALLOC) 	db_record_data_set(cursor->value, &value);
+		if(duplicate_flags) db_cursor_borrow(cursor->skey, skey, &priv->skey);
+		db_cursor_borrow(cursor->key, key, &priv->key);
+		db_cursor_borrow(cursor->value, value, &priv->value);
 	}
-	
-	if(key.flags & DB_DBT_MALLOC) 	free(key.data);
-	if(skey.flags & DB_DBT_MALLOC) 	free(skey.data);
-	if(value.flags & DB_DBT_MALLOC) free(value.data);
 	return rc;
 }
 
@@ -789,15 +1222,27 @@ static int db_cursor_prev_dup(struct db_cursor * cursor)
 }
 static int db_cursor_move_to(struct db_cursor * cursor, const db_record_data_t * key)
 {
-	db_record_data_t * dst = (cursor->db->record_flags & db_record_flags_multiple)?
-		cursor->skey:cursor->key;
+	assert(cursor && cursor->priv && key && key->data && key->size > 0);
+	db_cursor_private_t * priv = cursor->priv;
+	int duplicate_flags = cursor->db->record_flags & db_record_flags_multiple;
+	db_record_data_t * dst = duplicate_flags?cursor->skey:cursor->key;
+	DBT * owned = duplicate_flags?&priv->skey:&priv->key;
 	
-	db_record_data_set(dst, &(DBT){.data = (void *)key->data, .size = key->size, });
+	if(dst->data && dst->size > 0 && dst->data != owned->data) {	// the caller's buffer
+		assert(dst->size == key->size);
+		memcpy(dst->data, key->data, key->size);
+	}else {
+		// BDB treats DBT.size as the capacity of a DB_DBT_REALLOC buffer
+		owned->data = realloc(owned->data, key->size);
+		assert(owned->data);
+		owned->size = key->size;
+		memcpy(owned->data, key->data, key->size);
+		db_cursor_borrow(dst, owned, owned);
+	}
 	return db_cursor_op(cursor, DB_SET);
 }
 static int db_cursor_set(struct db_cursor * cursor)
 {
-	assert(cursor && cursor->priv);
 	/*
 	 * Overwrite the data of the key/data pair to which the cursor currently refers.
 	 * The key parameter is ignored.
@@ -809,30 +1254,41 @@ static int db_cursor_set(struct db_cursor * cursor)
 	value.data = cursor->value->data;
 	value.size = cursor->value->size;
 	
-	DBC * cursorp = cursor->priv;
+	DBC * cursorp = db_cursor_get_handle(cursor);
 	return cursorp->put(cursorp, &key, &value, DB_CURRENT);
 }
 static int db_cursor_del(struct db_cursor * cursor) 
 {
-	assert(cursor && cursor->priv);
-	DBC * cursorp = cursor->priv;
+	DBC * cursorp = db_cursor_get_handle(cursor);
 	return cursorp->del(cursorp, 0);
 }
 
-db_cursor_t * db_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, int flags)
+static db_cursor_t * bdb_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, int flags)
 {
 	assert(db);
 	DB * dbp = db_get_handle(db);
 	assert(dbp);
 	
+	// a snapshot cursor is read-only, the others can update the records
+	u_int32_t cursor_flags = db_read_flags(db, txn);
+	if(cursor_flags == DB_TXN_SNAPSHOT && !(flags & db_cursor_flags_snapshot)) cursor_flags = DB_READ_COMMITTED;
+	
 	DBC * cursorp = NULL;
-	int rc = dbp->cursor(dbp, db_txn_get_handle(txn), &cursorp, DB_READ_COMMITTED);
+	int rc = dbp->cursor(dbp, db_txn_get_handle(txn), &cursorp, cursor_flags);
+	db_check_error(rc, "dbp->cursor(): ");
 	if(rc) return NULL;
 	
 	if(NULL == cursor) cursor = calloc(1, sizeof(*cursor));
 	assert(cursor);
 	
-	cursor->priv = cursorp;
+	db_cursor_private_t * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->cursorp = cursorp;
+	priv->skey.flags = DB_DBT_REALLOC;
+	priv->key.flags = DB_DBT_REALLOC;
+	priv->value.flags = DB_DBT_REALLOC;
+	
+	cursor->priv = priv;
 	cursor->db = db;
 	
 	cursor->first = db_cursor_first;
@@ -848,14 +1304,25 @@ db_cursor_t * db_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_t
 	return cursor;
 }
 
-void db_cursor_cleanup(db_cursor_t * cursor)
+static void bdb_cursor_cleanup(db_cursor_t * cursor)
 {
 	if(NULL == cursor || NULL == cursor->priv) return;
 	
-	DBC * cursorp = cursor->priv;
-	cursorp->close(cursorp);
+	db_cursor_private_t * priv = cursor->priv;
+	priv->cursorp->close(priv->cursorp);
 	
 	db_cursor_clear_data(cursor);
+	
+	// drop the borrowed references
+	if(cursor->skey->data == priv->skey.data) memset(cursor->skey, 0, sizeof(cursor->skey));
+	if(cursor->key->data == priv->key.data) memset(cursor->key, 0, sizeof(cursor->key));
+	if(cursor->value->data == priv->value.data) memset(cursor->value, 0, sizeof(cursor->value));
+	
+	free(priv->skey.data);
+	free(priv->key.data);
+	free(priv->value.data);
+	free(priv);
+	cursor->priv = NULL;
 	return;
 }
 
@@ -958,14 +1425,77 @@ static int engine_set_home(struct db_engine * engine, const char * home_dir)
 		env = priv->env;
 	}
 	
+	db_engine_config_t * config = priv->config;
+	if(config->cache_size) {
+		rc = env->set_cachesize(env, 
+			(u_int32_t)(config->cache_size >> 30),
+			(u_int32_t)(config->cache_size & ((1UL << 30) - 1)),
+			config->cache_regions);
+		db_check_error(rc, "set_cachesize(%lu) failed.", (unsigned long)config->cache_size);
+	}
+	if(config->log_buffer_size) {
+		rc = env->set_lg_bsize(env, (u_int32_t)config->log_buffer_size);
+		db_check_error(rc, "set_lg_bsize(%lu) failed.", (unsigned long)config->log_buffer_size);
+	}
+	if(config->multiversion) {
+		rc = env->set_flags(env, DB_MULTIVERSION, 1);	// all databases in the environment are opened with DB_MULTIVERSION
+		db_check_error(rc, "set_flags(DB_MULTIVERSION) failed.");
+	}
+	
 	rc = env->open(env, home_dir, priv->env_flags, 0);
 	db_check_error(rc, "%s() failed.", __FUNCTION__);
 	assert(0 == rc);
 	
 	strncpy(priv->home_dir, home_dir, sizeof(priv->home_dir));
+	
+	rc = engine->set_durability(engine, config->durability);
+	assert(0 == rc);
 	return 0;
 }
 
+static int engine_set_config(struct db_engine * engine, const db_engine_config_t * config)
+{
+	assert(engine && engine->priv && config);
+	db_engine_private_t * priv = engine->priv;
+	if(priv->home_dir[0]) {
+		fprintf(stderr, "[ERROR]::%s(): the environment has already been opened.\n", __FUNCTION__);
+		return -1;
+	}
+	
+	*priv->config = *config;
+	return 0;
+}
+
+static int engine_set_durability(struct db_engine * engine, enum db_engine_durability durability)
+{
+	assert(engine && engine->priv);
+	db_engine_private_t * priv = engine->priv;
+	DB_ENV * env = priv->env;
+	assert(env);
+	
+	int rc = 0;
+	switch(durability)
+	{
+	case db_engine_durability_sync: 
+		rc = env->set_flags(env, DB_TXN_NOSYNC | DB_TXN_WRITE_NOSYNC, 0);
+		if(0 == rc && priv->home_dir[0]) rc = env->log_flush(env, NULL); // make the previous commits durable
+		break;
+	case db_engine_durability_write_nosync:
+		rc = env->set_flags(env, DB_TXN_NOSYNC, 0);
+		if(0 == rc) rc = env->set_flags(env, DB_TXN_WRITE_NOSYNC, 1);
+		break;
+	case db_engine_durability_nosync:
+		rc = env->set_flags(env, DB_TXN_WRITE_NOSYNC, 0);
+		if(0 == rc) rc = env->set_flags(env, DB_TXN_NOSYNC, 1);
+		break;
+	default:
+		return -1;
+	}
+	db_check_error(rc, "%s(%d) failed.", __FUNCTION__, (int)durability);
+	if(0 == rc) priv->config->durability = durability;
+	return rc;
+}
+
 static inline int list_find(db_engine_private_t * priv, db_handle_t * db)
 {
 	assert(priv);
@@ -982,14 +1512,14 @@ static int engine_list_add(db_engine_t * engine, db_handle_t * db)
 	int rc = -1;
 	assert(engine && engine->priv);
 	
-	global_lock();
 	db_engine_private_t * priv = engine->priv;
+	pthread_mutex_lock(&priv->mutex);
 	int index = list_find(priv, db);
 	if(index < 0) {
 		rc = db_engine_resize(engine, priv->count + 1);
 		if(0 == rc) priv->databases[priv->count++] = db;
 	}
-	global_unlock();
+	pthread_mutex_unlock(&priv->mutex);
 	return rc;
 }
 
@@ -998,8 +1528,8 @@ static int engine_list_remove(db_engine_t * engine, db_handle_t * db)
 	int rc = -1;
 	assert(engine && engine->priv);
 	
-	global_lock();
 	db_engine_private_t * priv = engine->priv;
+	pthread_mutex_lock(&priv->mutex);
 	
 	int index = list_find(priv, db);
 	if(index >= 0 && index < priv->count)
@@ -1008,7 +1538,7 @@ static int engine_list_remove(db_engine_t * engine, db_handle_t * db)
 		priv->databases[priv->count] = NULL;
 		rc = 0;
 	}
-	global_unlock();
+	pthread_mutex_unlock(&priv->mutex);
 	return rc;
 }
 
@@ -1066,78 +1596,220 @@ static void engine_txn_free(struct db_engine * engine, db_engine_txn_t * txn)
 	return;
 }
 
-static db_engine_t g_db_engine[1] = {{
-	.set_home = engine_set_home,
-	.open_db = engine_open_db,
-	.close_db = engine_close_db,
+static int bdb_engine_init(db_engine_t * engine)
+{
+	engine->set_home = engine_set_home;
+	engine->open_db = engine_open_db;
+	engine->close_db = engine_close_db;
 	
-	.list_add = engine_list_add,
-	.list_remove = engine_list_remove,
+	engine->list_add = engine_list_add;
+	engine->list_remove = engine_list_remove;
+	engine->txn_new = engine_txn_new;
+	engine->txn_free = engine_txn_free;
 	
-	.txn_new = engine_txn_new,
-	.txn_free = engine_txn_free,
+	engine->set_config = engine_set_config;
+	engine->set_durability = engine_set_durability;
+	
+	db_engine_private_t * priv = db_engine_private_new(engine);
+	assert(priv && engine->priv == priv);
+	return 0;
+}
+
+static void bdb_engine_cleanup(db_engine_t * engine)
+{
+	db_engine_private_free(engine->priv);
+	engine->priv = NULL;
+}
+
+const db_engine_backend_t db_engine_backend_bdb[1] = {{
+	.name = "bdb",
+	.engine_init = bdb_engine_init,
+	.engine_cleanup = bdb_engine_cleanup,
+	.txn_init = bdb_txn_init,
+	.txn_cleanup = bdb_txn_cleanup,
+	.handle_init = bdb_handle_init,
+	.handle_cleanup = bdb_handle_cleanup,
+	.cursor_init = bdb_cursor_init,
+	.cursor_cleanup = bdb_cursor_cleanup,
 }};
 
+const db_engine_backend_t * db_engine_backend_find(const char * name)
+{
+	static const db_engine_backend_t * backends[] = {
+		db_engine_backend_bdb,
+		db_engine_backend_mem,
+	#ifdef _USE_LMDB
+		db_engine_backend_lmdb,
+	#endif
+	};
+	if(NULL == name) return db_engine_backend_bdb;
+	
+	for(size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+		if(0 == strcasecmp(backends[i]->name, name)) return backends[i];
+	}
+	return NULL;
+}
+
+/*****************************************************************
+ * db_engine_config
+****************************************************************/
+int db_engine_config_load_profile(db_engine_config_t * config, const char * profile)
+{
+	assert(config);
+	if(NULL == profile || 0 == strcasecmp(profile, "default")) {
+		config->durability = db_engine_durability_sync;
+		return 0;
+	}
+	
+	if(0 == strcasecmp(profile, "fast_ibd")) {
+		if(config->cache_size < (1UL << 30)) config->cache_size = (1UL << 30);
+		if(config->log_buffer_size < (64UL << 20)) config->log_buffer_size = (64UL << 20);
+		config->durability = db_engine_durability_nosync;
+		return 0;
+	}
+	return -1;
+}
+
+unsigned int db_engine_config_get_page_size(const db_engine_config_t * config, const char * db_name)
+{
+	if(NULL == config) return 0;
+	if(db_name) {
+		for(int i = 0; i < config->num_page_sizes; ++i) {
+			if(0 == strcmp(config->page_sizes[i].name, db_name)) return config->page_sizes[i].page_size;
+		}
+	}
+	return config->page_size;
+}
+
+int db_engine_config_set_page_size(db_engine_config_t * config, const char * db_name, unsigned int page_size)
+{
+	assert(config);
+	if(page_size && (page_size < 512 || page_size > 65536 || (page_size & (page_size - 1)))) return -1;
+	
+	if(NULL == db_name) {
+		config->page_size = page_size;
+		return 0;
+	}
+	if(strlen(db_name) >= sizeof(config->page_sizes[0].name)) return -1;
+	
+	int i = 0;
+	for(; i < config->num_page_sizes; ++i) {
+		if(0 == strcmp(config->page_sizes[i].name, db_name)) break;
+	}
+	if(i == config->num_page_sizes) {
+		if(i >= DB_ENGINE_MAX_PAGE_SIZES) return -1;
+		strcpy(config->page_sizes[i].name, db_name);
+		++config->num_page_sizes;
+	}
+	config->page_sizes[i].page_size = page_size;
+	return 0;
+}
+
+/*****************************************************************
+ * dispatch to the backend
+****************************************************************/
+db_engine_txn_t * db_engine_txn_init(db_engine_txn_t * txn, struct db_engine * engine)
+{
+	assert(engine && engine->backend);
+	return engine->backend->txn_init(txn, engine);
+}
+void db_engine_txn_cleanup(db_engine_txn_t * txn)
+{
+	if(NULL == txn || NULL == txn->engine) return;
+	txn->engine->backend->txn_cleanup(txn);
+}
+
+db_handle_t * db_handle_init(db_handle_t * db, db_engine_t * engine, void * user_data)
+{
+	assert(engine && engine->backend);
+	return engine->backend->handle_init(db, engine, user_data);
+}
+void db_handle_cleanup(db_handle_t * db)
+{
+	if(NULL == db || NULL == db->engine) return;
+	db->engine->backend->handle_cleanup(db);
+}
+
+db_cursor_t * db_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, int flags)
+{
+	assert(db && db->engine && db->engine->backend);
+	return db->engine->backend->cursor_init(cursor, db, txn, flags);
+}
+void db_cursor_cleanup(db_cursor_t * cursor)
+{
+	if(NULL == cursor || NULL == cursor->db) return;
+	cursor->db->engine->backend->cursor_cleanup(cursor);
+}
+
+static db_engine_t g_db_engine[1] = {{
+	.backend = db_engine_backend_bdb,
+}};
 
 db_engine_t * db_engine_get() { return g_db_engine; }
 static inline db_engine_t * db_engine_add_ref(db_engine_t * engine)  { 
 	assert(engine);
 	
-	global_lock();
-	db_engine_private_t * priv = engine->priv;
-	if(NULL == priv) // the engine has already been destroyed
-	{
-		global_unlock();
-		return NULL;
+	long refs_count = engine->refs_count;
+	while(refs_count > 0) { // 0: the engine has already been destroyed
+		long old = __sync_val_compare_and_swap(&engine->refs_count, refs_count, refs_count + 1);
+		if(old == refs_count) return engine;
+		refs_count = old;
 	}
-
-	++priv->refs_count; 
-	global_unlock();
-	return engine;
+	return NULL;
 } 
 #define db_engine_unref(engine)		db_engine_cleanup(engine)
 
-db_engine_t * db_engine_init(db_engine_t * engine, const char * home_dir, void * user_data)
+db_engine_t * db_engine_init_with_backend(db_engine_t * engine, 
+	const db_engine_backend_t * backend,
+	const char * home_dir, void * user_data)
+{
+	return db_engine_init_with_config(engine, backend, NULL, home_dir, user_data);
+}
+
+db_engine_t * db_engine_init_with_config(db_engine_t * engine, 
+	const db_engine_backend_t * backend,
+	const db_engine_config_t * config,
+	const char * home_dir, void * user_data)
 {
 	if(NULL == engine) engine = g_db_engine;
-	else {
-		engine->set_home = engine_set_home;
-		engine->open_db = engine_open_db;
-		engine->close_db = engine_close_db;
-		
-		engine->list_add = engine_list_add;
-		engine->list_remove = engine_list_remove;
-		engine->txn_new = engine_txn_new;
-		engine->txn_free = engine_txn_free;
-	}
-	
+	if(NULL == backend) backend = db_engine_backend_bdb;
 	
+	engine->backend = backend;
 	engine->user_data = user_data;
-	db_engine_private_t * priv = db_engine_private_new(engine);
-	assert(priv && engine->priv == priv);
+	engine->refs_count = 0;
+	int rc = backend->engine_init(engine);
+	assert(0 == rc && engine->priv);
+	if(config) {
+		rc = engine->set_config(engine, config);
+		assert(0 == rc);
+	}
 	engine->set_home(engine, home_dir);
 	
-	db_engine_add_ref(engine);
+	engine->refs_count = 1;
 	return engine;
 }
 
+db_engine_t * db_engine_init(db_engine_t * engine, const char * home_dir, void * user_data)
+{
+	return db_engine_init_with_backend(engine, db_engine_backend_bdb, home_dir, user_data);
+}
+
 void db_engine_cleanup(db_engine_t * engine)
 {
 	if(NULL == engine || NULL == engine->priv) return;
 	
-	global_lock();
-	db_engine_private_t * priv = engine->priv;
-	if(NULL == priv || 0 == priv->refs_count) {
-		global_unlock();
-		return;
+	long refs_count = engine->refs_count;
+	while(refs_count > 0) {
+		long old = __sync_val_compare_and_swap(&engine->refs_count, refs_count, refs_count - 1);
+		if(old == refs_count) break;
+		refs_count = old;
 	}
 	
-	if(--priv->refs_count == 0)
+	if(refs_count == 1) // the last reference
 	{
-		db_engine_private_free(engine->priv);
+		engine->backend->engine_cleanup(engine);
 		engine->priv = NULL;
 	}
-	global_unlock();
 	return;
 }
 
@@ -1230,8 +1902,22 @@ int main(int argc, char **argv)
 	char * home_dir = "data";
 	if(argc > 1) home_dir = argv[1];
 	
-	db_engine_t * engine = db_engine_init(home_dir, NULL);
+	// relaxed durability during the bulk inserts, see db_engine_config_load_profile()
+	db_engine_config_t config[1];
+	memset(config, 0, sizeof(config));
+	int rc = db_engine_config_load_profile(config, "fast_ibd");
+	assert(0 == rc && config->durability == db_engine_durability_nosync);
+	assert(-1 == db_engine_config_load_profile(config, "no_such_profile"));
+	assert(-1 == db_engine_config_set_page_size(config, "blocks.db", 3000));
+	rc = db_engine_config_set_page_size(config, "blocks.db", 8192);
+	assert(0 == rc);
+	assert(8192 == db_engine_config_get_page_size(config, "blocks.db"));
+	assert(0 == db_engine_config_get_page_size(config, "blocks_height.db"));
+	config->multiversion = 1;	// reads outside a txn use snapshot cursors
+	
+	db_engine_t * engine = db_engine_init_with_config(NULL, NULL, config, home_dir, NULL);
 	assert(engine);
+	assert(-1 == engine->set_config(engine, config));	// the environment has already been opened
 
 	
 	// create primary_db and secondary_db
@@ -1239,7 +1925,7 @@ int main(int argc, char **argv)
 	
 	db_handle_t * db = engine->open_db(engine, "blocks.db", db_format_type_btree, 0);
 	assert(sdb && db);
-	int rc = db->associate(db, NULL, sdb, associate_blocks_height);
+	rc = db->associate(db, NULL, sdb, associate_blocks_height);
 	assert(0 == rc);
 	
 	// add records 
@@ -1343,9 +2029,66 @@ int main(int argc, char **argv)
 	values = NULL;
 	
 	
+	// test find_many: unsorted keys, with a missing key and a small buffer
+	printf("==== TEST find_many ====\n");
+	unsigned char many_keys[4][32];
+	memset(many_keys, 0, sizeof(many_keys));
+	static const int many_ids[4] = { 1007, 9999, 1002, 2004 };
+	db_record_data_t many[4];
+	db_record_data_t many_results[4];
+	for(int i = 0; i < 4; ++i) {
+		*(int *)many_keys[i] = many_ids[i];
+		many[i].data = many_keys[i];
+		many[i].size = 32;
+	}
+	uint64_t many_buf[(sizeof(struct db_record_block_data) * 2 + 7) / 8];
+	count = db->find_many(db, NULL, 4, many, many_results, many_buf, sizeof(many_buf));
+	assert(count == 3);
+	assert(NULL == many_results[1].data);
+	for(int i = 0; i < 4; ++i) {
+		if(i == 1) continue;
+		struct db_record_block_data * data = many_results[i].data;
+		assert(data && many_results[i].size == sizeof(*data));
+		assert(data->hdr.timestamp == 1000 + ((many_ids[i] - 1) % 1000));
+		printf("key: %d, value: height=%d, timestamp=%d, flags=%d\n", 
+			many_ids[i], data->height, data->hdr.timestamp, many_results[i].flags);
+		db_record_data_cleanup(&many_results[i]);
+	}
+	
+	// test insert_many / del_many (with a missing key)
+	printf("==== TEST insert_many / del_many ====\n");
+	unsigned char bulk_hashes[100][32];
+	struct db_record_block_data bulk_blocks[100];
+	db_record_data_t bulk_keys[100], bulk_values[100], bulk_results[100];
+	memset(bulk_hashes, 0, sizeof(bulk_hashes));
+	memset(bulk_blocks, 0, sizeof(bulk_blocks));
+	for(int i = 0; i < 100; ++i) {
+		*(int *)bulk_hashes[i] = 3000 + i;
+		bulk_blocks[i].height = 100 + i;
+		bulk_keys[i] = (db_record_data_t){ .data = bulk_hashes[i], .size = 32 };
+		bulk_values[i] = (db_record_data_t){ .data = &bulk_blocks[i], .size = sizeof(bulk_blocks[i]) };
+	}
+	db->record_flags &= ~db_record_flags_no_overwrite;
+	rc = db->insert_many(db, NULL, 100, bulk_keys, bulk_values);
+	assert(0 == rc);
+	count = db->find_many(db, NULL, 100, bulk_keys, bulk_results, NULL, 0);
+	assert(count == 100);
+	for(int i = 0; i < 100; ++i) {
+		assert(((struct db_record_block_data *)bulk_results[i].data)->height == 100 + i);
+		db_record_data_cleanup(&bulk_results[i]);
+	}
+	
+	*(int *)bulk_hashes[50] = 9999;	// not found
+	rc = db->del_many(db, NULL, 100, bulk_keys);
+	assert(0 == rc);
+	*(int *)bulk_hashes[50] = 3050;
+	count = db->find_many(db, NULL, 100, bulk_keys, bulk_results, NULL, 0);
+	assert(count == 1 && bulk_results[50].data);
+	db_record_data_cleanup(&bulk_results[50]);
+	
 	// test db_cursor
 	printf("==== TEST db_cursor ====\n");
-	db_cursor_t * cursor = db_cursor_init(NULL, db, NULL, DB_READ_COMMITTED);
+	db_cursor_t * cursor = db_cursor_init(NULL, db, NULL, 0);
 	assert(cursor);
 	
 	rc = cursor->first(cursor);
@@ -1362,7 +2105,62 @@ int main(int argc, char **argv)
 	
 	db_cursor_cleanup(cursor);
 	free(cursor);
+
+	// test get / get_secondary (borrowed results)
+	printf("==== TEST get / get_secondary ====\n");
+	db_record_data_t value[1], key[1];
+	*(int *)hash = 1005;
+	rc = db->get(db, NULL, &(db_record_data_t){.data = hash, .size = sizeof(hash)}, value);
+	assert(1 == rc && value->flags == 0 && value->size == sizeof(struct db_record_block_data));
+	assert(((struct db_record_block_data *)value->data)->height == 4);
+
+	*(int *)hash = 9999;
+	rc = db->get(db, NULL, &(db_record_data_t){.data = hash, .size = sizeof(hash)}, value);
+	assert(0 == rc);
+
+	height = 7;
+	rc = sdb->get_secondary(sdb, NULL, &(db_record_data_t){.data = &height, .size = sizeof(height)}, key, value);
+	assert(1 == rc && key->size == 32 && *(int *)key->data == 1008);
+	assert(((struct db_record_block_data *)value->data)->height == 7);
+
+	// test db_cursor::move_to with the cursor-owned buffers
+	db_cursor_t sdb_cursor[1];
+	memset(sdb_cursor, 0, sizeof(sdb_cursor));
+	cursor = db_cursor_init(sdb_cursor, sdb, NULL, 0);
+	assert(cursor == sdb_cursor);
+	height = 3;
+	count = 0;
+	rc = cursor->move_to(cursor, &(db_record_data_t){.data = &height, .size = sizeof(height)});
+	while(0 == rc) {
+		assert(*(int32_t *)cursor->skey->data == 3 && cursor->skey->flags == 0);
+		assert(((struct db_record_block_data *)cursor->value->data)->height == 3);
+		++count;
+		rc = cursor->next_dup(cursor);
+	}
+	assert(count == 2);
+	db_cursor_cleanup(cursor);
+	assert(NULL == cursor->value->data);
+	
+	// test snapshot reads
+	db_engine_txn_t * snapshot = db_engine_txn_init(NULL, engine);
+	snapshot->flags = db_engine_txn_flags_snapshot;
+	rc = snapshot->begin(snapshot, NULL);
+	assert(0 == rc);
+	*(int *)hash = 1006;
+	rc = db->get(db, snapshot, &(db_record_data_t){.data = hash, .size = sizeof(hash)}, value);
+	assert(1 == rc && ((struct db_record_block_data *)value->data)->height == 5);
+	cursor = db_cursor_init(sdb_cursor, sdb, snapshot, db_cursor_flags_snapshot);
+	assert(cursor);
+	rc = cursor->first(cursor);
+	assert(0 == rc && *(int32_t *)cursor->skey->data == 0);
+	db_cursor_cleanup(cursor);
+	snapshot->commit(snapshot, 0);
+	engine->txn_free(engine, snapshot);
 	
+	// at the tip
+	rc = engine->set_durability(engine, db_engine_durability_sync);
+	assert(0 == rc);
+
 	// test add_ref / unref
 	db_engine_add_ref(engine);
 	db_engine_cleanup(engine);
@@ -0,0 +1,1537 @@
+/*
+ * db_engine_lmdb.c
+ *
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * LMDB backend of db_engine_t (build with -D_USE_LMDB and link with -llmdb).
+ *
+ *   All databases live in one memory-mapped environment (one named dbi per db_handle_t).
+ *   Readers use MDB_RDONLY transactions and never take a lock.
+ *
+ *   LMDB has no secondary indexes, associate() is emulated:
+ *     a secondary db is a dbi of {skey -> primary key} pairs (MDB_DUPSORT if opened with db_flags_dup_sort),
+ *     and it is maintained by the writes to the primary db.
+ *   The primary db must not have duplicate keys.
+ *
+ *   A write with a NULL txn runs in its own (auto-commit) write transaction,
+ *   LMDB allows only one write transaction at a time, so do not pass a NULL txn
+ *   while the calling thread holds another write txn of the same engine.
+ */
+
+#ifdef _USE_LMDB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <lmdb.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "db_engine.h"
+
+#define LMDB_MAX_DBS			(256)
+#define LMDB_MAX_READERS		(1024)
+#define LMDB_MAX_SECONDARIES	(8)
+#define LMDB_DEFAULT_MAP_SIZE	((size_t)1 << 40)		// reserves address space only
+
+/* MDB_NOTFOUND is a normal result (a miss), not an error */
+#define lmdb_check_error(ret_code, fmt, ...) do {			\
+		if(ret_code && ret_code != MDB_NOTFOUND) {			\
+			fprintf(stderr, "[ERROR]::%s@%d::%s(): " fmt "%s\n",	\
+				__FILE__, __LINE__, __FUNCTION__,			\
+				##__VA_ARGS__, mdb_strerror(ret_code));		\
+		}													\
+	}while(0)
+
+typedef struct lmdb_engine_private
+{
+	MDB_env * env;
+	pthread_mutex_t mutex;
+	db_engine_t * engine;
+
+	char home_dir[PATH_MAX];
+	unsigned int env_flags;
+	size_t map_size;
+	enum db_engine_durability durability;
+
+	ssize_t max_size;
+	ssize_t count;
+	db_handle_t ** databases;
+
+	unsigned long temp_db_id;	// name generator of the databases opened without a filename
+}lmdb_engine_private_t;
+
+static inline MDB_env * lmdb_engine_get_env(db_engine_t * engine)
+{
+	assert(engine && engine->priv);
+	return ((lmdb_engine_private_t *)engine->priv)->env;
+}
+
+/**************************************************
+ * struct db_engine_txn
+ **************************************************/
+static int lmdb_txn_begin(struct db_engine_txn * txn, struct db_engine_txn * parent_txn)
+{
+	assert(txn && txn->engine);
+	assert(NULL == txn->priv);
+
+	MDB_txn * parent = parent_txn?parent_txn->priv:NULL;
+	unsigned int flags = (txn->flags & db_engine_txn_flags_snapshot)?MDB_RDONLY:0;	// lmdb readers are always snapshots
+	int rc = mdb_txn_begin(lmdb_engine_get_env(txn->engine), parent, flags, (MDB_txn **)&txn->priv);
+	lmdb_check_error(rc, "mdb_txn_begin(): ");
+	return rc;
+}
+
+static int lmdb_txn_commit(struct db_engine_txn * txn, int flags)
+{
+	int rc = -1;
+	MDB_txn * mdb_txn = txn->priv;
+	if(mdb_txn) {
+		rc = mdb_txn_commit(mdb_txn);
+		txn->priv = NULL;
+		lmdb_check_error(rc, "mdb_txn_commit(): ");
+	}
+	return rc;
+}
+
+static int lmdb_txn_abort(struct db_engine_txn * txn)
+{
+	MDB_txn * mdb_txn = txn->priv;
+	if(NULL == mdb_txn) return -1;
+	mdb_txn_abort(mdb_txn);
+	txn->priv = NULL;
+	return 0;
+}
+
+static int lmdb_txn_prepare(struct db_engine_txn * txn, unsigned char gid[])
+{
+	return -1;	// not supported
+}
+
+static int lmdb_txn_set_name(struct db_engine_txn * txn, const char * name)
+{
+	return -1;	// not supported
+}
+static const char * lmdb_txn_get_name(struct db_engine_txn * txn)
+{
+	return NULL;
+}
+
+static db_engine_txn_t * lmdb_txn_init(db_engine_txn_t * txn, struct db_engine * engine)
+{
+	if(NULL == txn) txn = calloc(1, sizeof(*txn));
+	assert(txn);
+	txn->engine = engine;
+
+	txn->begin = lmdb_txn_begin;
+	txn->commit = lmdb_txn_commit;
+	txn->abort = lmdb_txn_abort;
+	txn->prepare = lmdb_txn_prepare;
+	txn->discard = lmdb_txn_abort;
+	txn->set_name = lmdb_txn_set_name;
+	txn->get_name = lmdb_txn_get_name;
+	return txn;
+}
+
+static void lmdb_txn_cleanup(db_engine_txn_t * txn)
+{
+	if(txn->priv) mdb_txn_abort(txn->priv);
+	txn->priv = NULL;
+}
+
+/****************************************************************
+ * struct db_handle
+****************************************************************/
+struct lmdb_private;
+
+typedef struct lmdb_buffer
+{
+	void * data;
+	size_t size;
+	size_t max_size;
+}lmdb_buffer_t;
+
+static void * lmdb_buffer_set(lmdb_buffer_t * buf, const void * data, size_t size)
+{
+	if(size > buf->max_size) {
+		size_t new_size = (size + 255) & ~(size_t)255;
+		void * p = realloc(buf->data, new_size);
+		assert(p);
+		buf->data = p;
+		buf->max_size = new_size;
+	}
+	if(size > 0) memcpy(buf->data, data, size);
+	buf->size = size;
+	return buf->data;
+}
+
+/**
+ * lmdb_scratch:
+ *   per-thread state of a db handle,
+ *   a reusable read-only txn (reset / renewed, so the reader slot is acquired only once),
+ *   the buffers which hold the borrowed results of db->get(),
+ *   and a copy of the record being overwritten or deleted (to update the secondary keys).
+ */
+typedef struct lmdb_scratch
+{
+	MDB_txn * read_txn;
+	lmdb_buffer_t key;
+	lmdb_buffer_t value;
+	lmdb_buffer_t old_value;
+
+	struct lmdb_private * priv;
+	struct lmdb_scratch * next;
+}lmdb_scratch_t;
+
+typedef struct lmdb_private
+{
+	struct db_handle * db;
+	MDB_env * env;
+	MDB_dbi dbi;
+	int is_open;
+	int is_temp;		// opened without a filename, dropped on cleanup
+	char name[PATH_MAX];
+
+	pthread_mutex_t mutex;
+
+	// secondary index emulation
+	struct db_handle * primary;						// set if this is a secondary db
+	db_associate_callback associate_func;
+	int num_secondaries;
+	struct db_handle * secondaries[LMDB_MAX_SECONDARIES];
+
+	pthread_key_t scratch_key;
+	lmdb_scratch_t * scratches;	// all per-thread states, guarded by the mutex
+}lmdb_private_t;
+
+static inline lmdb_private_t * lmdb_get_private(struct db_handle * db)
+{
+	assert(db && db->priv);
+	lmdb_private_t * priv = db->priv;
+	assert(priv->is_open);
+	return priv;
+}
+
+static void lmdb_scratch_free(lmdb_scratch_t * scratch)
+{
+	if(scratch->read_txn) mdb_txn_abort(scratch->read_txn);
+	free(scratch->key.data);
+	free(scratch->value.data);
+	free(scratch->old_value.data);
+	free(scratch);
+}
+
+/* called on thread exit */
+static void lmdb_scratch_destroy(void * _scratch)
+{
+	lmdb_scratch_t * scratch = _scratch;
+	lmdb_private_t * priv = scratch->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	lmdb_scratch_t ** p_node = &priv->scratches;
+	while(*p_node && *p_node != scratch) p_node = &(*p_node)->next;
+	if(*p_node) *p_node = scratch->next;
+	pthread_mutex_unlock(&priv->mutex);
+
+	lmdb_scratch_free(scratch);
+}
+
+static lmdb_scratch_t * lmdb_scratch_get(lmdb_private_t * priv)
+{
+	lmdb_scratch_t * scratch = pthread_getspecific(priv->scratch_key);
+	if(scratch) return scratch;
+
+	scratch = calloc(1, sizeof(*scratch));
+	assert(scratch);
+	scratch->priv = priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	scratch->next = priv->scratches;
+	priv->scratches = scratch;
+	pthread_mutex_unlock(&priv->mutex);
+
+	int rc = pthread_setspecific(priv->scratch_key, scratch);
+	assert(0 == rc);
+	return scratch;
+}
+
+/**
+ * lmdb_read_begin / lmdb_read_end:
+ *   use the caller's txn if any, otherwise renew the per-thread read-only txn.
+ */
+static int lmdb_read_begin(lmdb_private_t * priv, db_engine_txn_t * txn, MDB_txn ** p_txn)
+{
+	if(txn && txn->priv) {
+		*p_txn = txn->priv;
+		return 0;
+	}
+
+	int rc = 0;
+	lmdb_scratch_t * scratch = lmdb_scratch_get(priv);
+	if(NULL == scratch->read_txn) rc = mdb_txn_begin(priv->env, NULL, MDB_RDONLY, &scratch->read_txn);
+	else rc = mdb_txn_renew(scratch->read_txn);
+	lmdb_check_error(rc, "mdb_txn_begin(MDB_RDONLY): ");
+
+	*p_txn = rc?NULL:scratch->read_txn;
+	return rc;
+}
+static void lmdb_read_end(lmdb_private_t * priv, db_engine_txn_t * txn, MDB_txn * mdb_txn)
+{
+	if(txn && txn->priv == mdb_txn) return;
+	mdb_txn_reset(mdb_txn);
+}
+
+/**
+ * lmdb_write_begin / lmdb_write_end:
+ *   use the caller's txn if any, otherwise run in an auto-commit txn.
+ */
+static int lmdb_write_begin(lmdb_private_t * priv, db_engine_txn_t * txn, MDB_txn ** p_txn)
+{
+	if(txn && txn->priv) {
+		*p_txn = txn->priv;
+		return 0;
+	}
+	int rc = mdb_txn_begin(priv->env, NULL, 0, p_txn);
+	lmdb_check_error(rc, "mdb_txn_begin(): ");
+	return rc;
+}
+static int lmdb_write_end(lmdb_private_t * priv, db_engine_txn_t * txn, MDB_txn * mdb_txn, int rc)
+{
+	if(txn && txn->priv == mdb_txn) return rc;
+	if(rc) {
+		mdb_txn_abort(mdb_txn);
+		return rc;
+	}
+	rc = mdb_txn_commit(mdb_txn);
+	lmdb_check_error(rc, "mdb_txn_commit(): ");
+	return rc;
+}
+
+static int lmdb_compare_int32(const MDB_val * a, const MDB_val * b)
+{
+	int32_t x, y;
+	assert(a->mv_size == sizeof(int32_t) && b->mv_size == sizeof(int32_t));
+	memcpy(&x, a->mv_data, sizeof(x));
+	memcpy(&y, b->mv_data, sizeof(y));
+	return (x > y) - (x < y);
+}
+
+static int lmdb_open(struct db_handle * db, db_engine_txn_t * _txn, const char * name, int db_type, enum db_flags flags)
+{
+	assert(db && db->priv);
+	lmdb_private_t * priv = db->priv;
+	lmdb_engine_private_t * engine_priv = db->engine->priv;
+	assert(!priv->is_open);
+
+	// LMDB has only the B+tree format, db_type is ignored
+	if(NULL == name) {
+		pthread_mutex_lock(&engine_priv->mutex);
+		snprintf(priv->name, sizeof(priv->name), "__temp_db_%lu", ++engine_priv->temp_db_id);
+		pthread_mutex_unlock(&engine_priv->mutex);
+		priv->is_temp = 1;
+	}else {
+		strncpy(priv->name, name, sizeof(priv->name) - 1);
+	}
+
+	unsigned int dbi_flags = MDB_CREATE;
+	if(flags & db_flags_dup_sort) {
+		dbi_flags |= MDB_DUPSORT;
+		db->record_flags |= db_record_flags_multiple;
+	}
+
+	MDB_txn * txn = NULL;
+	int rc = lmdb_write_begin(priv, _txn, &txn);
+	if(rc) return rc;
+
+	rc = mdb_dbi_open(txn, priv->name, dbi_flags, &priv->dbi);
+	lmdb_check_error(rc, "mdb_dbi_open(%s): ", priv->name);
+	if(0 == rc && (flags & db_flags_int32_keys)) rc = mdb_set_compare(txn, priv->dbi, lmdb_compare_int32);
+
+	rc = lmdb_write_end(priv, _txn, txn, rc);
+	if(0 == rc) priv->is_open = 1;
+	return rc;
+}
+
+static int lmdb_close(struct db_handle * db)
+{
+	lmdb_private_t * priv = db->priv;
+	if(NULL == priv || !priv->is_open) return 0;
+
+	// the cached read txns hold reader slots, release them before the env could be closed
+	pthread_mutex_lock(&priv->mutex);
+	for(lmdb_scratch_t * scratch = priv->scratches; scratch; scratch = scratch->next) {
+		if(scratch->read_txn) mdb_txn_abort(scratch->read_txn);
+		scratch->read_txn = NULL;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+
+	if(priv->primary) {
+		lmdb_private_t * ppriv = priv->primary->priv;
+		for(int i = 0; ppriv && i < ppriv->num_secondaries; ++i) {
+			if(ppriv->secondaries[i] != db) continue;
+			ppriv->secondaries[i] = ppriv->secondaries[--ppriv->num_secondaries];
+			break;
+		}
+		priv->primary = NULL;
+	}
+
+	int rc = 0;
+	if(priv->is_temp) {
+		MDB_txn * txn = NULL;
+		rc = mdb_txn_begin(priv->env, NULL, 0, &txn);
+		if(0 == rc) rc = mdb_drop(txn, priv->dbi, 1);
+		if(0 == rc) rc = mdb_txn_commit(txn);
+		else if(txn) mdb_txn_abort(txn);
+		lmdb_check_error(rc, "mdb_drop(%s): ", priv->name);
+	}
+	priv->is_open = 0;
+	return rc;
+}
+
+/**
+ * secondary index emulation
+ */
+static int lmdb_index_update(struct db_handle * db, MDB_txn * txn,
+	const MDB_val * key, const MDB_val * value,
+	int is_del,
+	struct db_handle * only_sdb)	// NULL: all secondaries
+{
+	lmdb_private_t * priv = db->priv;
+
+	for(int i = 0; i < priv->num_secondaries; ++i)
+	{
+		struct db_handle * sdb = priv->secondaries[i];
+		if(only_sdb && sdb != only_sdb) continue;
+		lmdb_private_t * spriv = sdb->priv;
+
+		db_record_data_t * skeys = NULL;
+		ssize_t num_keys = spriv->associate_func(sdb,
+			&(db_record_data_t){ .data = key->mv_data, .size = key->mv_size},
+			&(db_record_data_t){ .data = value->mv_data, .size = value->mv_size},
+			&skeys);
+		if(num_keys < 1 || NULL == skeys) return -1;
+
+		int rc = 0;
+		int dup_sort = (sdb->record_flags & db_record_flags_multiple);
+		for(ssize_t ii = 0; ii < num_keys; ++ii)
+		{
+			MDB_val skey = { .mv_size = skeys[ii].size, .mv_data = skeys[ii].data };
+			MDB_val pkey = *key;
+			if(is_del) {
+				rc = mdb_del(txn, spriv->dbi, &skey, dup_sort?&pkey:NULL);
+				if(rc == MDB_NOTFOUND) rc = 0;
+			}else {
+				rc = mdb_put(txn, spriv->dbi, &skey, &pkey, 0);
+			}
+			lmdb_check_error(rc, "%s(%s): ", is_del?"mdb_del":"mdb_put", spriv->name);
+			if(rc) break;
+		}
+		free(skeys);
+		if(rc) return rc;
+	}
+	return 0;
+}
+
+/* delete a record of the primary db and its secondary keys */
+static int lmdb_primary_del(struct db_handle * db, MDB_txn * txn, MDB_val * key)
+{
+	lmdb_private_t * priv = db->priv;
+	if(priv->num_secondaries > 0) {
+		lmdb_buffer_t * old_value = &lmdb_scratch_get(priv)->old_value;
+		MDB_val value;
+		int rc = mdb_get(txn, priv->dbi, key, &value);
+		if(rc) return rc;
+
+		// copy the old value, the pointer is not valid after any update
+		lmdb_buffer_set(old_value, value.mv_data, value.mv_size);
+		value.mv_data = old_value->data;
+		rc = lmdb_index_update(db, txn, key, &value, 1, NULL);
+		if(rc) return rc;
+	}
+	return mdb_del(txn, priv->dbi, key, NULL);
+}
+
+static int lmdb_put(struct db_handle * db, MDB_txn * txn, MDB_val * key, MDB_val * value, int is_update)
+{
+	int rc = 0;
+	lmdb_private_t * priv = db->priv;
+	unsigned int flags = 0;
+	if(db->record_flags & db_record_flags_no_overwrite) flags |= MDB_NOOVERWRITE;
+	if(db->record_flags & db_record_flags_no_dup) flags |= MDB_NODUPDATA;
+
+	if(priv->num_secondaries > 0 || is_update) {
+		MDB_val old_value;
+		rc = mdb_get(txn, priv->dbi, key, &old_value);
+		if(is_update && rc) return rc;	// update an existing record only
+		if(0 == rc && (flags & MDB_NOOVERWRITE)) return MDB_KEYEXIST;
+
+		if(0 == rc) {
+			if(db->record_flags & db_record_flags_multiple) {	// replace the first record
+				rc = mdb_del(txn, priv->dbi, key, &old_value);
+			}else if(priv->num_secondaries > 0) {
+				lmdb_buffer_t * buf = &lmdb_scratch_get(priv)->old_value;
+				lmdb_buffer_set(buf, old_value.mv_data, old_value.mv_size);
+				old_value.mv_data = buf->data;
+				rc = lmdb_index_update(db, txn, key, &old_value, 1, NULL);
+			}
+		}else if(rc == MDB_NOTFOUND) rc = 0;
+		if(rc) return rc;
+	}
+
+	rc = mdb_put(txn, priv->dbi, key, value, flags);
+	if(0 == rc && priv->num_secondaries > 0) rc = lmdb_index_update(db, txn, key, value, 0, NULL);
+	return rc;
+}
+
+static int lmdb_associate(struct db_handle * primary, db_engine_txn_t * _txn,
+	struct db_handle * secondary, db_associate_callback associated_by)
+{
+	lmdb_private_t * priv = lmdb_get_private(primary);
+	lmdb_private_t * spriv = lmdb_get_private(secondary);
+	assert(NULL == spriv->primary);
+	if(priv->num_secondaries >= LMDB_MAX_SECONDARIES) return -1;
+
+	spriv->associate_func = associated_by;
+	spriv->primary = primary;
+	priv->secondaries[priv->num_secondaries++] = secondary;
+
+	// (DB_CREATE) build the index if the secondary db is empty
+	MDB_txn * txn = NULL;
+	int rc = lmdb_write_begin(priv, _txn, &txn);
+	if(rc) return rc;
+
+	MDB_stat stat;
+	rc = mdb_stat(txn, spriv->dbi, &stat);
+	if(0 == rc && 0 == stat.ms_entries) {
+		MDB_cursor * cursor = NULL;
+		rc = mdb_cursor_open(txn, priv->dbi, &cursor);
+		if(0 == rc) {
+			MDB_val key, value;
+			rc = mdb_cursor_get(cursor, &key, &value, MDB_FIRST);
+			while(0 == rc) {
+				rc = lmdb_index_update(primary, txn, &key, &value, 0, secondary);
+				if(rc) break;
+				rc = mdb_cursor_get(cursor, &key, &value, MDB_NEXT);
+			}
+			if(rc == MDB_NOTFOUND) rc = 0;
+			mdb_cursor_close(cursor);
+		}
+	}
+	lmdb_check_error(rc, "build index(%s): ", spriv->name);
+	return lmdb_write_end(priv, _txn, txn, rc);
+}
+
+/* copy an MDB_val to the result, the same rules as the BDB backend */
+static db_record_data_t * lmdb_record_data_set(db_record_data_t * result, const MDB_val * value)
+{
+	if(NULL == result) result = calloc(1, sizeof(*result));
+	assert(result);
+
+	if(0 == result->size) result->size = value->mv_size;
+	assert(result->size == (ssize_t)value->mv_size);
+
+	if(NULL == result->data) {
+		result->data = malloc(value->mv_size?value->mv_size:1);
+		assert(result->data);
+		result->flags = 1;
+	}
+	memcpy(result->data, value->mv_data, value->mv_size);
+	return result;
+}
+
+/* resolve a {skey -> pkey} pair to the primary record */
+static inline int lmdb_primary_get(lmdb_private_t * spriv, MDB_txn * txn, MDB_val * pkey, MDB_val * value)
+{
+	lmdb_private_t * priv = spriv->primary->priv;
+	int rc = mdb_get(txn, priv->dbi, pkey, value);
+	lmdb_check_error(rc, "index(%s) is out of sync: ", spriv->name);
+	return rc;
+}
+
+/**
+ * find_records:
+ *   the duplicated records of the key,
+ *   for a secondary db, the keys and values of the primary db are returned (the same as BDB).
+ */
+static ssize_t lmdb_find_records(struct db_handle * db, MDB_txn * txn,
+	const db_record_data_t * _key,
+	db_record_data_t ** p_keys,
+	db_record_data_t ** p_values)
+{
+	lmdb_private_t * priv = db->priv;
+	MDB_val key = { .mv_size = _key->size, .mv_data = (void *)_key->data };
+	MDB_val value;
+
+	if(0 == (db->record_flags & db_record_flags_multiple)) // no duplicate keys
+	{
+		int rc = mdb_get(txn, priv->dbi, &key, &value);
+		if(0 == rc && priv->primary) {
+			MDB_val pkey = value;
+			rc = lmdb_primary_get(priv, txn, &pkey, &value);
+			if(0 == rc && p_keys) *p_keys = lmdb_record_data_set(*p_keys, &pkey);
+		}
+		if(rc == MDB_NOTFOUND) return 0;
+		lmdb_check_error(rc, "mdb_get(%s): ", priv->name);
+		if(rc) return -1;
+
+		*p_values = lmdb_record_data_set(*p_values, &value);
+		return 1;
+	}
+
+	MDB_cursor * cursor = NULL;
+	int rc = mdb_cursor_open(txn, priv->dbi, &cursor);
+	lmdb_check_error(rc, "mdb_cursor_open(%s): ", priv->name);
+	if(rc) return -1;
+
+	ssize_t count = 0;
+	ssize_t max_size = 0;
+	db_record_data_t * keys = NULL;
+	db_record_data_t * results = NULL;
+
+	rc = mdb_cursor_get(cursor, &key, &value, MDB_SET_KEY);
+	while(0 == rc)
+	{
+		if(count >= max_size) {
+			ssize_t new_size = max_size?(max_size * 2):16;
+			results = realloc(results, new_size * sizeof(*results));
+			assert(results);
+			memset(results + max_size, 0, (new_size - max_size) * sizeof(*results));
+			if(p_keys) {
+				keys = realloc(keys, new_size * sizeof(*keys));
+				assert(keys);
+				memset(keys + max_size, 0, (new_size - max_size) * sizeof(*keys));
+			}
+			max_size = new_size;
+		}
+
+		MDB_val pkey = value;
+		if(priv->primary) {
+			rc = lmdb_primary_get(priv, txn, &pkey, &value);
+			if(rc) break;
+		}
+		if(keys) lmdb_record_data_set(&keys[count], &pkey);
+		lmdb_record_data_set(&results[count], &value);
+		++count;
+
+		rc = mdb_cursor_get(cursor, &key, &value, MDB_NEXT_DUP);
+	}
+	mdb_cursor_close(cursor);
+
+	if(rc != MDB_NOTFOUND) {
+		lmdb_check_error(rc, "mdb_cursor_get(%s): ", priv->name);
+		for(ssize_t i = 0; i < count; ++i) {
+			if(keys) db_record_data_cleanup(&keys[i]);
+			db_record_data_cleanup(&results[i]);
+		}
+		free(keys);
+		free(results);
+		return -1;
+	}
+
+	if(0 == count) return 0;
+	if(p_keys) *p_keys = keys;
+	*p_values = results;
+	return count;
+}
+
+static ssize_t lmdb_find(struct db_handle * db, db_engine_txn_t * _txn,
+	const db_record_data_t * key,
+	db_record_data_t ** p_values)
+{
+	assert(db && key);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	if(NULL == p_values) return 1;
+
+	MDB_txn * txn = NULL;
+	if(lmdb_read_begin(priv, _txn, &txn)) return -1;
+	ssize_t count = lmdb_find_records(db, txn, key, NULL, p_values);
+	lmdb_read_end(priv, _txn, txn);
+	return count;
+}
+
+static ssize_t lmdb_find_secondary(struct db_handle * db, db_engine_txn_t * _txn,
+	const db_record_data_t * skey,
+	db_record_data_t ** p_keys,
+	db_record_data_t ** p_values)
+{
+	assert(db && skey);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	if(NULL == priv->primary) return -1;
+	if(NULL == p_values) return 1;
+
+	MDB_txn * txn = NULL;
+	if(lmdb_read_begin(priv, _txn, &txn)) return -1;
+	ssize_t count = lmdb_find_records(db, txn, skey, p_keys, p_values);
+	lmdb_read_end(priv, _txn, txn);
+	return count;
+}
+
+static int lmdb_get_record(struct db_handle * db, db_engine_txn_t * _txn,
+	const db_record_data_t * _key,
+	db_record_data_t * key,		// nullable, the key of the primary db
+	db_record_data_t * value)
+{
+	lmdb_private_t * priv = db->priv;
+	lmdb_scratch_t * scratch = lmdb_scratch_get(priv);
+
+	MDB_txn * txn = NULL;
+	if(lmdb_read_begin(priv, _txn, &txn)) return -1;
+
+	MDB_val mkey = { .mv_size = _key->size, .mv_data = (void *)_key->data };
+	MDB_val mvalue, pkey;
+	int rc = mdb_get(txn, priv->dbi, &mkey, &mvalue);
+	if(0 == rc && priv->primary) {
+		pkey = mvalue;
+		rc = lmdb_primary_get(priv, txn, &pkey, &mvalue);
+		if(0 == rc && key) {
+			lmdb_buffer_set(&scratch->key, pkey.mv_data, pkey.mv_size);
+			*key = (db_record_data_t){ .data = scratch->key.data, .size = pkey.mv_size };
+		}
+	}
+	if(0 == rc) {
+		// the map may be remapped or the pages may be reused once the txn ends, keep a copy
+		lmdb_buffer_set(&scratch->value, mvalue.mv_data, mvalue.mv_size);
+		*value = (db_record_data_t){ .data = scratch->value.data, .size = mvalue.mv_size };
+	}
+	lmdb_read_end(priv, _txn, txn);
+
+	if(rc == MDB_NOTFOUND) return 0;
+	lmdb_check_error(rc, "mdb_get(%s): ", priv->name);
+	return rc?-1:1;
+}
+
+static int lmdb_get(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * key,
+	db_record_data_t * value)
+{
+	assert(db && key && value);
+	lmdb_get_private(db);
+	return lmdb_get_record(db, txn, key, NULL, value);
+}
+
+static int lmdb_get_secondary(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * skey,
+	db_record_data_t * key,
+	db_record_data_t * value)
+{
+	assert(db && skey && value);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	if(NULL == priv->primary) return -1;
+	return lmdb_get_record(db, txn, skey, key, value);
+}
+
+#define LMDB_FIND_MANY_ALIGN(size) (((size) + 7) & ~(size_t)7)
+static ssize_t lmdb_find_many(struct db_handle * db, db_engine_txn_t * _txn,
+	ssize_t count, const db_record_data_t keys[],
+	db_record_data_t results[],
+	void * buffer, size_t buffer_size)
+{
+	assert(db && (count >= 0) && results);
+	if(count <= 0) return 0;
+	assert(keys);
+	lmdb_private_t * priv = lmdb_get_private(db);
+
+	memset(results, 0, count * sizeof(*results));
+
+	// all lookups see the same snapshot
+	MDB_txn * txn = NULL;
+	if(lmdb_read_begin(priv, _txn, &txn)) return -1;
+
+	int rc = 0;
+	unsigned char * p_buf = buffer;
+	size_t buf_used = 0;
+	ssize_t num_found = 0;
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		MDB_val key = { .mv_size = keys[i].size, .mv_data = (void *)keys[i].data };
+		MDB_val value;
+		rc = mdb_get(txn, priv->dbi, &key, &value);
+		if(rc == MDB_NOTFOUND) { rc = 0; continue; }
+		lmdb_check_error(rc, "mdb_get(%s): ", priv->name);
+		if(rc) break;
+
+		db_record_data_t * result = &results[i];
+		if(p_buf && (buf_used + value.mv_size) <= buffer_size) {
+			result->data = p_buf + buf_used;
+			memcpy(result->data, value.mv_data, value.mv_size);
+			buf_used += LMDB_FIND_MANY_ALIGN(value.mv_size);
+			if(buf_used > buffer_size) buf_used = buffer_size;
+			result->size = value.mv_size;
+		}else {
+			lmdb_record_data_set(result, &value);
+		}
+		++num_found;
+	}
+	lmdb_read_end(priv, _txn, txn);
+
+	if(rc) {
+		for(ssize_t i = 0; i < count; ++i) db_record_data_cleanup(&results[i]);
+		return -1;
+	}
+	return num_found;
+}
+#undef LMDB_FIND_MANY_ALIGN
+
+static int lmdb_insert(struct db_handle * db, db_engine_txn_t * _txn,
+	const db_record_data_t * _key,
+	const db_record_data_t * _value)
+{
+	assert(db && _key && _value);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	assert(NULL == priv->primary);	// a secondary db is updated by its primary db
+
+	MDB_txn * txn = NULL;
+	int rc = lmdb_write_begin(priv, _txn, &txn);
+	if(rc) return rc;
+
+	MDB_val key = { .mv_size = _key->size, .mv_data = (void *)_key->data };
+	MDB_val value = { .mv_size = _value->size, .mv_data = (void *)_value->data };
+	rc = lmdb_put(db, txn, &key, &value, 0);
+	if(rc != MDB_KEYEXIST) lmdb_check_error(rc, "lmdb_put(%s): ", priv->name);
+	return lmdb_write_end(priv, _txn, txn, rc);
+}
+
+static int lmdb_update(struct db_handle * db, db_engine_txn_t * _txn,
+	const db_record_data_t * _key,
+	const db_record_data_t * _value)
+{
+	assert(db && _key && _value);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	MDB_txn * txn = NULL;
+	int rc = lmdb_write_begin(priv, _txn, &txn);
+	if(rc) return rc;
+
+	MDB_val key = { .mv_size = _key->size, .mv_data = (void *)_key->data };
+	MDB_val value = { .mv_size = _value->size, .mv_data = (void *)_value->data };
+	rc = lmdb_put(db, txn, &key, &value, 1);
+	return lmdb_write_end(priv, _txn, txn, rc);
+}
+
+static int lmdb_del(struct db_handle * db, db_engine_txn_t * _txn, const db_record_data_t * _key)
+{
+	assert(db && _key);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	MDB_txn * txn = NULL;
+	int rc = lmdb_write_begin(priv, _txn, &txn);
+	if(rc) return rc;
+
+	MDB_val key = { .mv_size = _key->size, .mv_data = (void *)_key->data };
+	rc = lmdb_primary_del(db, txn, &key);
+	lmdb_check_error(rc, "lmdb_del(%s): ", priv->name);
+	return lmdb_write_end(priv, _txn, txn, rc);
+}
+
+/**
+ * insert_many / del_many:
+ *   LMDB has no bulk buffer format,
+ *   the gain comes from writing all records in a single txn (one commit, one fsync).
+ */
+static int lmdb_insert_many(struct db_handle * db, db_engine_txn_t * _txn,
+	ssize_t count, const db_record_data_t keys[], const db_record_data_t values[])
+{
+	assert(db && (count >= 0));
+	if(count <= 0) return 0;
+	assert(keys && values);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	MDB_txn * txn = NULL;
+	int rc = lmdb_write_begin(priv, _txn, &txn);
+	if(rc) return rc;
+
+	for(ssize_t i = 0; (0 == rc) && i < count; ++i) {
+		MDB_val key = { .mv_size = keys[i].size, .mv_data = keys[i].data };
+		MDB_val value = { .mv_size = values[i].size, .mv_data = values[i].data };
+		rc = lmdb_put(db, txn, &key, &value, 0);
+	}
+	lmdb_check_error(rc, "lmdb_put(%s): ", priv->name);
+	return lmdb_write_end(priv, _txn, txn, rc);
+}
+
+static int lmdb_del_many(struct db_handle * db, db_engine_txn_t * _txn,
+	ssize_t count, const db_record_data_t keys[])
+{
+	assert(db && (count >= 0));
+	if(count <= 0) return 0;
+	assert(keys);
+	lmdb_private_t * priv = lmdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	MDB_txn * txn = NULL;
+	int rc = lmdb_write_begin(priv, _txn, &txn);
+	if(rc) return rc;
+
+	for(ssize_t i = 0; (0 == rc) && i < count; ++i) {
+		MDB_val key = { .mv_size = keys[i].size, .mv_data = keys[i].data };
+		rc = lmdb_primary_del(db, txn, &key);
+		if(rc == MDB_NOTFOUND) rc = 0;
+	}
+	lmdb_check_error(rc, "lmdb_del(%s): ", priv->name);
+	return lmdb_write_end(priv, _txn, txn, rc);
+}
+
+static lmdb_private_t * lmdb_private_new(db_handle_t * db)
+{
+	lmdb_private_t * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->db = db;
+	priv->env = lmdb_engine_get_env(db->engine);
+
+	int rc = pthread_mutex_init(&priv->mutex, NULL);
+	assert(0 == rc);
+	rc = pthread_key_create(&priv->scratch_key, lmdb_scratch_destroy);
+	assert(0 == rc);
+
+	db->priv = priv;
+	return priv;
+}
+
+static void lmdb_private_free(lmdb_private_t * priv)
+{
+	if(NULL == priv) return;
+	lmdb_close(priv->db);
+
+	// the destructor will not be called once the key is deleted, release the states of all threads here
+	pthread_key_delete(priv->scratch_key);
+	lmdb_scratch_t * scratch = priv->scratches;
+	while(scratch) {
+		lmdb_scratch_t * next = scratch->next;
+		lmdb_scratch_free(scratch);
+		scratch = next;
+	}
+	priv->scratches = NULL;
+
+	pthread_mutex_destroy(&priv->mutex);
+	free(priv);
+}
+
+static db_handle_t * lmdb_handle_init(db_handle_t * db, db_engine_t * engine, void * user_data)
+{
+	if(NULL == db) db = calloc(1, sizeof(*db));
+	assert(db);
+	db->user_data = user_data;
+	db->engine = engine;
+
+	db->open = lmdb_open;
+	db->associate = lmdb_associate;
+	db->close = lmdb_close;
+	db->find = lmdb_find;
+	db->find_secondary = lmdb_find_secondary;
+	db->get = lmdb_get;
+	db->get_secondary = lmdb_get_secondary;
+	db->find_many = lmdb_find_many;
+	db->insert = lmdb_insert;
+	db->update = lmdb_update;
+	db->del = lmdb_del;
+	db->insert_many = lmdb_insert_many;
+	db->del_many = lmdb_del_many;
+
+	lmdb_private_t * priv = lmdb_private_new(db);
+	assert(priv && db->priv == priv);
+	return db;
+}
+
+static void lmdb_handle_cleanup(db_handle_t * db)
+{
+	if(NULL == db) return;
+	lmdb_private_free(db->priv);
+	db->priv = NULL;
+}
+
+/***************************************************************
+ * struct db_cursor
+ *   the records are borrowed from the map (zero-copy),
+ *   unless the caller preset its own buffers.
+****************************************************************/
+typedef struct lmdb_cursor_private
+{
+	MDB_cursor * cursor;
+	MDB_txn * txn;
+	int own_txn;		// a read-only txn started by the cursor
+
+	lmdb_buffer_t key_buf;	// a copy of the current key (or primary key) before writing
+	const void * borrowed[3];	// skey, key, value which point to the map
+}lmdb_cursor_private_t;
+
+/* set a cursor record, copy to the caller's buffer if it was preset */
+static int lmdb_cursor_record_set(db_record_data_t * record, const MDB_val * val, const void ** p_borrowed)
+{
+	if(NULL == record->data || record->size <= 0 || record->data == *p_borrowed) {
+		record->data = val->mv_data;
+		record->size = val->mv_size;
+		record->flags = 0;
+		*p_borrowed = val->mv_data;
+		return 0;
+	}
+	if(record->size < (ssize_t)val->mv_size) return MDB_BAD_VALSIZE;
+	memcpy(record->data, val->mv_data, val->mv_size);
+	return 0;
+}
+
+static int lmdb_cursor_op(struct db_cursor * cursor, MDB_cursor_op op, MDB_val * search_key)
+{
+	lmdb_cursor_private_t * cpriv = cursor->priv;
+	lmdb_private_t * priv = cursor->db->priv;
+
+	MDB_val key, value;
+	if(search_key) key = *search_key;
+	int rc = mdb_cursor_get(cpriv->cursor, &key, &value, op);
+	if(rc) {
+		if(rc != MDB_NOTFOUND) lmdb_check_error(rc, "mdb_cursor_get(%s): ", priv->name);
+		return rc;
+	}
+
+	if(priv->primary) {	// {skey, pkey, primary value}, the same as BDB's pget
+		MDB_val pkey = value;
+		rc = lmdb_primary_get(priv, cpriv->txn, &pkey, &value);
+		if(rc) return rc;
+
+		rc = lmdb_cursor_record_set(cursor->skey, &key, &cpriv->borrowed[0]);
+		if(0 == rc) rc = lmdb_cursor_record_set(cursor->key, &pkey, &cpriv->borrowed[1]);
+	}else {
+		rc = lmdb_cursor_record_set(cursor->key, &key, &cpriv->borrowed[1]);
+	}
+	if(0 == rc) rc = lmdb_cursor_record_set(cursor->value, &value, &cpriv->borrowed[2]);
+	return rc;
+}
+
+static int lmdb_cursor_first(struct db_cursor * cursor)
+{
+	return lmdb_cursor_op(cursor, MDB_FIRST, NULL);
+}
+static int lmdb_cursor_last(struct db_cursor * cursor)
+{
+	return lmdb_cursor_op(cursor, MDB_LAST, NULL);
+}
+static int lmdb_cursor_next(struct db_cursor * cursor)
+{
+	return lmdb_cursor_op(cursor, MDB_NEXT, NULL);
+}
+static int lmdb_cursor_prev(struct db_cursor * cursor)
+{
+	return lmdb_cursor_op(cursor, MDB_PREV, NULL);
+}
+static int lmdb_cursor_next_dup(struct db_cursor * cursor)
+{
+	return lmdb_cursor_op(cursor, MDB_NEXT_DUP, NULL);
+}
+static int lmdb_cursor_prev_dup(struct db_cursor * cursor)
+{
+	return lmdb_cursor_op(cursor, MDB_PREV_DUP, NULL);
+}
+static int lmdb_cursor_move_to(struct db_cursor * cursor, const db_record_data_t * key)
+{
+	assert(cursor && cursor->priv && key && key->data && key->size > 0);
+	MDB_val search_key = { .mv_size = key->size, .mv_data = (void *)key->data };
+	return lmdb_cursor_op(cursor, MDB_SET_KEY, &search_key);
+}
+
+static int lmdb_cursor_set(struct db_cursor * cursor)
+{
+	assert(cursor && cursor->priv);
+	lmdb_cursor_private_t * cpriv = cursor->priv;
+	db_handle_t * db = cursor->db;
+	lmdb_private_t * priv = db->priv;
+	if(priv->primary) return -1;	// a secondary db is read-only
+
+	MDB_val key, value;
+	int rc = mdb_cursor_get(cpriv->cursor, &key, &value, MDB_GET_CURRENT);
+	if(rc) return rc;
+
+	// the key points to the map, keep a copy before writing
+	lmdb_buffer_set(&cpriv->key_buf, key.mv_data, key.mv_size);
+	key.mv_data = cpriv->key_buf.data;
+	value = (MDB_val){ .mv_size = cursor->value->size, .mv_data = cursor->value->data };
+
+	if(db->record_flags & db_record_flags_multiple) {
+		return mdb_cursor_put(cpriv->cursor, &key, &value, MDB_CURRENT);
+	}
+	return lmdb_put(db, cpriv->txn, &key, &value, 1);
+}
+
+static int lmdb_cursor_del(struct db_cursor * cursor)
+{
+	assert(cursor && cursor->priv);
+	lmdb_cursor_private_t * cpriv = cursor->priv;
+	lmdb_private_t * priv = cursor->db->priv;
+
+	MDB_val key, value;
+	int rc = mdb_cursor_get(cpriv->cursor, &key, &value, MDB_GET_CURRENT);
+	if(rc) return rc;
+
+	if(priv->primary) {	// delete the primary record (and all its secondary keys), the same as BDB
+		lmdb_buffer_set(&cpriv->key_buf, value.mv_data, value.mv_size);
+		rc = mdb_cursor_del(cpriv->cursor, 0);
+		if(0 == rc) {
+			MDB_val pkey = { .mv_size = cpriv->key_buf.size, .mv_data = cpriv->key_buf.data };
+			rc = lmdb_primary_del(priv->primary, cpriv->txn, &pkey);
+		}
+		return rc;
+	}
+
+	if(priv->num_secondaries > 0) {
+		lmdb_buffer_t * old_value = &lmdb_scratch_get(priv)->old_value;
+		lmdb_buffer_set(old_value, value.mv_data, value.mv_size);
+		value.mv_data = old_value->data;
+		rc = lmdb_index_update(cursor->db, cpriv->txn, &key, &value, 1, NULL);
+		if(rc) return rc;
+	}
+	return mdb_cursor_del(cpriv->cursor, 0);
+}
+
+static db_cursor_t * lmdb_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, int flags)
+{
+	lmdb_private_t * priv = lmdb_get_private(db);
+	lmdb_cursor_private_t * cpriv = calloc(1, sizeof(*cpriv));
+	assert(cpriv);
+
+	int rc = 0;
+	if(txn && txn->priv) cpriv->txn = txn->priv;
+	else {
+		// without a txn, the cursor is read-only (set() and del() fail with EACCES)
+		rc = mdb_txn_begin(priv->env, NULL, MDB_RDONLY, &cpriv->txn);
+		cpriv->own_txn = 1;
+	}
+	if(0 == rc) rc = mdb_cursor_open(cpriv->txn, priv->dbi, &cpriv->cursor);
+	lmdb_check_error(rc, "%s(%s): ", __FUNCTION__, priv->name);
+	if(rc) {
+		if(cpriv->own_txn && cpriv->txn) mdb_txn_abort(cpriv->txn);
+		free(cpriv);
+		return NULL;
+	}
+
+	if(NULL == cursor) cursor = calloc(1, sizeof(*cursor));
+	assert(cursor);
+
+	cursor->priv = cpriv;
+	cursor->db = db;
+
+	cursor->first = lmdb_cursor_first;
+	cursor->last = lmdb_cursor_last;
+	cursor->next = lmdb_cursor_next;
+	cursor->prev = lmdb_cursor_prev;
+	cursor->next_dup = lmdb_cursor_next_dup;
+	cursor->prev_dup = lmdb_cursor_prev_dup;
+
+	cursor->move_to = lmdb_cursor_move_to;
+	cursor->set = lmdb_cursor_set;
+	cursor->del = lmdb_cursor_del;
+	return cursor;
+}
+
+static void lmdb_cursor_cleanup(db_cursor_t * cursor)
+{
+	if(NULL == cursor || NULL == cursor->priv) return;
+	lmdb_cursor_private_t * cpriv = cursor->priv;
+
+	mdb_cursor_close(cpriv->cursor);
+	if(cpriv->own_txn) mdb_txn_abort(cpriv->txn);
+
+	// drop the references to the map
+	if(cpriv->borrowed[0] && cursor->skey->data == cpriv->borrowed[0]) memset(cursor->skey, 0, sizeof(cursor->skey));
+	if(cpriv->borrowed[1] && cursor->key->data == cpriv->borrowed[1]) memset(cursor->key, 0, sizeof(cursor->key));
+	if(cpriv->borrowed[2] && cursor->value->data == cpriv->borrowed[2]) memset(cursor->value, 0, sizeof(cursor->value));
+
+	free(cpriv->key_buf.data);
+	free(cpriv);
+	cursor->priv = NULL;
+}
+
+/*****************************************************************
+ * struct db_engine
+****************************************************************/
+#define LMDB_ENGINE_ALLOC_SIZE	(64)
+static int lmdb_engine_resize(lmdb_engine_private_t * priv, ssize_t new_size)
+{
+	if(new_size <= 0) new_size = LMDB_ENGINE_ALLOC_SIZE;
+	else new_size = (new_size + LMDB_ENGINE_ALLOC_SIZE - 1) / LMDB_ENGINE_ALLOC_SIZE * LMDB_ENGINE_ALLOC_SIZE;
+	if(new_size <= priv->max_size) return 0;
+
+	db_handle_t ** dbs = realloc(priv->databases, new_size * sizeof(*dbs));
+	assert(dbs);
+	memset(dbs + priv->max_size, 0, (new_size - priv->max_size) * sizeof(*dbs));
+	priv->databases = dbs;
+	priv->max_size = new_size;
+	return 0;
+}
+#undef LMDB_ENGINE_ALLOC_SIZE
+
+static int lmdb_engine_set_home(struct db_engine * engine, const char * home_dir)
+{
+	if(NULL == home_dir) home_dir = "./data";
+	lmdb_engine_private_t * priv = engine->priv;
+	assert(priv && priv->env);
+
+	int rc = mdb_env_open(priv->env, home_dir, priv->env_flags, 0660);
+	lmdb_check_error(rc, "mdb_env_open(%s): ", home_dir);
+	assert(0 == rc);
+
+	strncpy(priv->home_dir, home_dir, sizeof(priv->home_dir) - 1);
+	return 0;
+}
+
+static int lmdb_engine_set_config(struct db_engine * engine, const db_engine_config_t * config)
+{
+	lmdb_engine_private_t * priv = engine->priv;
+	assert(priv && priv->env && config);
+	if(priv->home_dir[0]) return -1;	// the environment has already been opened
+
+	int rc = 0;
+	if(config->map_size) {
+		rc = mdb_env_set_mapsize(priv->env, config->map_size);
+		lmdb_check_error(rc, "mdb_env_set_mapsize(%lu): ", (unsigned long)config->map_size);
+		if(rc) return -1;
+		priv->map_size = config->map_size;
+	}
+	return engine->set_durability(engine, config->durability);
+}
+
+/* write_nosync: skip the fsync of the meta page only (MDB_NOMETASYNC); nosync: no fsync at all (MDB_NOSYNC) */
+static int lmdb_engine_set_durability(struct db_engine * engine, enum db_engine_durability durability)
+{
+	lmdb_engine_private_t * priv = engine->priv;
+	assert(priv && priv->env);
+
+	int rc = 0;
+	switch(durability)
+	{
+	case db_engine_durability_sync:
+		rc = mdb_env_set_flags(priv->env, MDB_NOSYNC | MDB_NOMETASYNC, 0);
+		if(0 == rc && priv->home_dir[0]) rc = mdb_env_sync(priv->env, 1);
+		break;
+	case db_engine_durability_write_nosync:
+		rc = mdb_env_set_flags(priv->env, MDB_NOSYNC, 0);
+		if(0 == rc) rc = mdb_env_set_flags(priv->env, MDB_NOMETASYNC, 1);
+		break;
+	case db_engine_durability_nosync:
+		rc = mdb_env_set_flags(priv->env, MDB_NOSYNC, 1);
+		break;
+	default:
+		return -1;
+	}
+	lmdb_check_error(rc, "%s(%d): ", __FUNCTION__, (int)durability);
+	if(0 == rc) priv->durability = durability;
+	return rc;
+}
+
+static int lmdb_engine_list_add(db_engine_t * engine, db_handle_t * db)
+{
+	int rc = -1;
+	lmdb_engine_private_t * priv = engine->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	ssize_t index = 0;
+	for(; index < priv->count; ++index) if(priv->databases[index] == db) break;
+	if(index == priv->count) {
+		rc = lmdb_engine_resize(priv, priv->count + 1);
+		if(0 == rc) priv->databases[priv->count++] = db;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	return rc;
+}
+
+static int lmdb_engine_list_remove(db_engine_t * engine, db_handle_t * db)
+{
+	int rc = -1;
+	lmdb_engine_private_t * priv = engine->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	for(ssize_t index = 0; index < priv->count; ++index) {
+		if(priv->databases[index] != db) continue;
+		priv->databases[index] = priv->databases[--priv->count];
+		priv->databases[priv->count] = NULL;
+		rc = 0;
+		break;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	return rc;
+}
+
+static db_handle_t * lmdb_engine_open_db(struct db_engine * engine, const char * db_name, enum db_format_type db_type, int flags)
+{
+	db_handle_t * db = lmdb_handle_init(NULL, engine, engine->user_data);
+	assert(db);
+
+	int rc = db->open(db, NULL, db_name, db_type, flags);
+	assert(0 == rc);
+
+	rc = lmdb_engine_list_add(engine, db);
+	assert(0 == rc);
+	return db;
+}
+
+static int lmdb_engine_close_db(db_engine_t * engine, db_handle_t * db)
+{
+	if(NULL == db) return -1;
+	int rc = db->close(db);
+	lmdb_engine_list_remove(engine, db);
+	return rc;
+}
+
+static db_engine_txn_t * lmdb_engine_txn_new(struct db_engine * engine, struct db_engine_txn * parent_txn)
+{
+	db_engine_txn_t * txn = lmdb_txn_init(NULL, engine);
+	assert(txn);
+
+	int rc = txn->begin(txn, parent_txn);
+	if(rc) {
+		lmdb_txn_cleanup(txn);
+		free(txn);
+		txn = NULL;
+	}
+	return txn;
+}
+
+static void lmdb_engine_txn_free(struct db_engine * engine, db_engine_txn_t * txn)
+{
+	if(txn) {
+		lmdb_txn_cleanup(txn);
+		free(txn);
+	}
+}
+
+static int lmdb_engine_init(db_engine_t * engine)
+{
+	lmdb_engine_private_t * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->engine = engine;
+	priv->map_size = LMDB_DEFAULT_MAP_SIZE;
+	priv->env_flags = MDB_NOTLS;	// read txns are not bound to threads (one per thread per db handle)
+
+	int rc = mdb_env_create(&priv->env);
+	assert(0 == rc);
+	mdb_env_set_maxdbs(priv->env, LMDB_MAX_DBS);
+	mdb_env_set_maxreaders(priv->env, LMDB_MAX_READERS);
+	rc = mdb_env_set_mapsize(priv->env, priv->map_size);
+	lmdb_check_error(rc, "mdb_env_set_mapsize(): ");
+
+	rc = pthread_mutex_init(&priv->mutex, NULL);
+	assert(0 == rc);
+	lmdb_engine_resize(priv, 0);
+
+	engine->priv = priv;
+	engine->set_home = lmdb_engine_set_home;
+	engine->open_db = lmdb_engine_open_db;
+	engine->close_db = lmdb_engine_close_db;
+	engine->list_add = lmdb_engine_list_add;
+	engine->list_remove = lmdb_engine_list_remove;
+	engine->txn_new = lmdb_engine_txn_new;
+	engine->txn_free = lmdb_engine_txn_free;
+	engine->set_config = lmdb_engine_set_config;
+	engine->set_durability = lmdb_engine_set_durability;
+	return 0;
+}
+
+static void lmdb_engine_cleanup(db_engine_t * engine)
+{
+	lmdb_engine_private_t * priv = engine->priv;
+	if(NULL == priv) return;
+
+	for(ssize_t i = 0; i < priv->count; ++i) {
+		db_handle_t * db = priv->databases[i];
+		if(db) {
+			lmdb_handle_cleanup(db);
+			free(db);
+			priv->databases[i] = NULL;
+		}
+	}
+	priv->count = 0;
+	free(priv->databases);
+
+	if(priv->env) mdb_env_close(priv->env);
+	pthread_mutex_destroy(&priv->mutex);
+	free(priv);
+	engine->priv = NULL;
+}
+
+const db_engine_backend_t db_engine_backend_lmdb[1] = {{
+	.name = "lmdb",
+	.engine_init = lmdb_engine_init,
+	.engine_cleanup = lmdb_engine_cleanup,
+	.txn_init = lmdb_txn_init,
+	.txn_cleanup = lmdb_txn_cleanup,
+	.handle_init = lmdb_handle_init,
+	.handle_cleanup = lmdb_handle_cleanup,
+	.cursor_init = lmdb_cursor_init,
+	.cursor_cleanup = lmdb_cursor_cleanup,
+}};
+
+#if defined(_TEST_DB_ENGINE_LMDB) && defined(_STAND_ALONE)
+struct test_record
+{
+	int32_t id;
+	int32_t height;		// key of the secondary db
+	char payload[24];
+};
+
+static ssize_t associate_by_height(db_handle_t * sdb, 
+	const db_record_data_t * key, const db_record_data_t * value, 
+	db_record_data_t ** p_result)
+{
+	if(NULL == p_result) return 1;
+	db_record_data_t * result = *p_result;
+	if(NULL == result) {
+		result = calloc(1, sizeof(*result));
+		*p_result = result;
+	}
+	struct test_record * record = value->data;
+	result->data = &record->height;
+	result->size = sizeof(record->height);
+	return 1;
+}
+
+static ssize_t count_by_height(db_handle_t * sdb, int32_t height)
+{
+	db_record_data_t * values = NULL;
+	ssize_t count = sdb->find_secondary(sdb, NULL, 
+		&(db_record_data_t){ .data = &height, .size = sizeof(height) }, 
+		NULL, &values);
+	for(ssize_t i = 0; i < count; ++i) db_record_data_cleanup(&values[i]);
+	free(values);
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	const char * home_dir = "data_lmdb";
+	if(argc > 1) home_dir = argv[1];
+	
+	db_engine_t * engine = db_engine_init_with_backend(NULL, db_engine_backend_find("lmdb"), home_dir, NULL);
+	assert(engine);
+	
+	db_handle_t * db = engine->open_db(engine, "records.db", db_format_type_btree, 0);
+	db_handle_t * sdb = engine->open_db(engine, "records_height.db", db_format_type_btree, db_flags_dup_sort | db_flags_int32_keys);
+	assert(db && sdb);
+	int rc = db->associate(db, NULL, sdb, associate_by_height);
+	assert(0 == rc);
+	
+	// insert
+	struct test_record records[100];
+	memset(records, 0, sizeof(records));
+	for(int i = 0; i < 100; ++i) {
+		records[i].id = i;
+		records[i].height = i % 10;
+		rc = db->insert(db, NULL, 
+			&(db_record_data_t){ .data = &records[i].id, .size = sizeof(int32_t) },
+			&(db_record_data_t){ .data = &records[i], .size = sizeof(records[i]) });
+		assert(0 == rc);
+	}
+	assert(10 == count_by_height(sdb, 3));
+	
+	// get / get_secondary
+	int32_t id = 42;
+	db_record_data_t key = { .data = &id, .size = sizeof(id) };
+	db_record_data_t value = { NULL };
+	rc = db->get(db, NULL, &key, &value);
+	assert(1 == rc && value.size == sizeof(struct test_record) && ((struct test_record *)value.data)->height == 2);
+	
+	int32_t height = 3;
+	rc = sdb->get_secondary(sdb, NULL, &(db_record_data_t){ .data = &height, .size = sizeof(height) }, &key, &value);
+	assert(1 == rc && ((struct test_record *)value.data)->height == 3);
+	
+	// update and del maintain the secondary db
+	records[13].height = 7;
+	id = 13;
+	rc = db->update(db, NULL, &(db_record_data_t){ .data = &id, .size = sizeof(id) }, 
+		&(db_record_data_t){ .data = &records[13], .size = sizeof(records[13]) });
+	assert(0 == rc);
+	assert(9 == count_by_height(sdb, 3));
+	
+	id = 23;
+	rc = db->del(db, NULL, &(db_record_data_t){ .data = &id, .size = sizeof(id) });
+	assert(0 == rc);
+	assert(8 == count_by_height(sdb, 3));
+	
+	// find_many
+	int32_t ids[4] = { 77, 23, 5, 1000 };
+	db_record_data_t keys[4], results[4];
+	char buffer[64];
+	for(int i = 0; i < 4; ++i) keys[i] = (db_record_data_t){ .data = &ids[i], .size = sizeof(int32_t) };
+	ssize_t count = db->find_many(db, NULL, 4, keys, results, buffer, sizeof(buffer));
+	assert(2 == count);
+	assert(NULL == results[1].data && NULL == results[3].data);
+	assert(77 == ((struct test_record *)results[0].data)->id && 5 == ((struct test_record *)results[2].data)->id);
+	for(int i = 0; i < 4; ++i) db_record_data_cleanup(&results[i]);
+	
+	// iterate the secondary db (numeric order of the heights)
+	db_cursor_t cursor[1];
+	memset(cursor, 0, sizeof(cursor));
+	db_cursor_init(cursor, sdb, NULL, 0);
+	int32_t last_height = -1;
+	count = 0;
+	for(rc = cursor->first(cursor); 0 == rc; rc = cursor->next(cursor), ++count) {
+		struct test_record * record = cursor->value->data;
+		assert(*(int32_t *)cursor->skey->data == record->height);
+		assert(*(int32_t *)cursor->key->data == record->id);
+		assert(record->height >= last_height);
+		last_height = record->height;
+	}
+	db_cursor_cleanup(cursor);
+	printf("secondary cursor: %ld records\n", (long)count);
+	assert(99 == count);
+	
+	// delete by a cursor within a txn
+	db_engine_txn_t * txn = engine->txn_new(engine, NULL);
+	assert(txn);
+	memset(cursor, 0, sizeof(cursor));
+	db_cursor_init(cursor, db, txn, 0);
+	for(rc = cursor->first(cursor); 0 == rc; rc = cursor->next(cursor)) {
+		struct test_record * record = cursor->value->data;
+		if(record->height == 0) {
+			rc = cursor->del(cursor);
+			assert(0 == rc);
+		}
+	}
+	db_cursor_cleanup(cursor);
+	rc = txn->commit(txn, 0);
+	assert(0 == rc);
+	engine->txn_free(engine, txn);
+	assert(0 == count_by_height(sdb, 0));
+	
+	engine->close_db(engine, sdb);
+	engine->close_db(engine, db);
+	db_handle_cleanup(sdb); free(sdb);
+	db_handle_cleanup(db); free(db);
+	
+	db_engine_cleanup(engine);
+	printf("all tests passed.\n");
+	return 0;
+}
+#endif
+
+#endif // _USE_LMDB
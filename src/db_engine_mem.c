@@ -0,0 +1,1881 @@
+/*
+ * db_engine_mem.c
+ *
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * In-memory backend of db_engine_t (no files, no logging, no environment setup).
+ *
+ *   Each database is a skip list (the ordered index used by cursors)
+ *   plus a hash table of its distinct keys (point lookups).
+ *   Named databases live until db_engine_cleanup(), so they can be closed and opened again,
+ *   a database opened without a filename is dropped when it is closed.
+ *
+ *   associate() is emulated the same way as the LMDB backend:
+ *     a secondary db holds {skey -> primary key} records, it is maintained by the writes to the primary db
+ *     and shares the rwlock of the primary db. The primary db must not have duplicate keys.
+ *
+ *   Transactions are not isolated (other threads see the uncommitted writes),
+ *   abort() rolls the writes back from an undo log.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <limits.h>
+
+#include "db_engine.h"
+
+#define MEMDB_MAX_LEVEL			(24)
+#define MEMDB_MAX_SECONDARIES	(8)
+
+// the same values as BDB, callers may compare with DB_NOTFOUND / DB_KEYEXIST
+#define MEMDB_NOTFOUND		(-30988)
+#define MEMDB_KEYEXIST		(-30995)
+#define MEMDB_KEYEMPTY		(-30996)
+#define MEMDB_BUFFER_SMALL	(-30999)
+
+#define memdb_check_error(ret_code, fmt, ...) do {			\
+		if(ret_code) {										\
+			fprintf(stderr, "[ERROR]::%s@%d::%s(): " fmt "(rc = %d)\n",	\
+				__FILE__, __LINE__, __FUNCTION__,			\
+				##__VA_ARGS__, (int)(ret_code));			\
+		}													\
+	}while(0)
+
+#define MEMDB_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+/****************************************************************
+ * memdb_store: the records of a database
+****************************************************************/
+enum memdb_node_flags
+{
+	memdb_node_flags_head = 1,		// the first record of its key, linked in the hash table
+	memdb_node_flags_deleted = 2,
+};
+
+typedef struct memdb_node
+{
+	struct memdb_node * hnext;		// hash chain (or the garbage list once deleted)
+	struct memdb_node * prev;		// level 0
+	uint32_t hash;
+	uint16_t level;
+	uint16_t flags;
+	size_t key_size;
+	size_t value_size;
+	unsigned char * key;			// 8-byte aligned, stored after next[]
+	unsigned char * value;
+	struct memdb_node * next[];		// [level]
+}memdb_node_t;
+
+typedef struct memdb_store
+{
+	char * name;
+	int is_temp;
+	int dup_sort;
+	int int32_keys;
+	long refs;		// open handles
+
+	pthread_rwlock_t rwlock;
+	pthread_rwlock_t * lock;	// &rwlock, or the lock of the primary db if associated
+
+	memdb_node_t * head;		// sentinel
+	memdb_node_t * tail;
+	int level;
+	ssize_t count;
+	uint64_t rand_state;
+
+	// hash table of the distinct keys
+	memdb_node_t ** buckets;
+	size_t num_buckets;		// power of 2
+	ssize_t num_keys;
+
+	// the deleted nodes are freed when no cursor could still be positioned on them
+	long cursors_count;
+	memdb_node_t * garbage;
+
+	struct memdb_store * next;	// named stores of the engine
+}memdb_store_t;
+
+static inline uint32_t memdb_hash(const void * data, size_t size)
+{
+	// FNV-1a
+	const unsigned char * p = data;
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < size; ++i) {
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static inline int memdb_compare_bytes(const void * a, size_t a_size, const void * b, size_t b_size)
+{
+	size_t size = (a_size < b_size)?a_size:b_size;
+	int rc = size?memcmp(a, b, size):0;
+	if(rc) return rc;
+	return (a_size > b_size) - (a_size < b_size);
+}
+
+static inline int memdb_compare_keys(const memdb_store_t * store, const void * a, size_t a_size, const void * b, size_t b_size)
+{
+	if(store->int32_keys) {
+		int32_t x, y;
+		assert(a_size == sizeof(int32_t) && b_size == sizeof(int32_t));
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		return (x > y) - (x < y);
+	}
+	return memdb_compare_bytes(a, a_size, b, b_size);
+}
+
+/* compare a node with {key, value}, the value is only used to order duplicated keys */
+static inline int memdb_compare_node(const memdb_store_t * store, const memdb_node_t * node,
+	const void * key, size_t key_size,
+	const void * value, size_t value_size, int with_value)
+{
+	int rc = memdb_compare_keys(store, node->key, node->key_size, key, key_size);
+	if(rc || !store->dup_sort || !with_value) return rc;
+	return memdb_compare_bytes(node->value, node->value_size, value, value_size);
+}
+
+static inline int memdb_same_key(const memdb_store_t * store, const memdb_node_t * a, const memdb_node_t * b)
+{
+	return (a && b) && (0 == memdb_compare_keys(store, a->key, a->key_size, b->key, b->key_size));
+}
+
+static memdb_node_t * memdb_node_new(int level, const void * key, size_t key_size, const void * value, size_t value_size)
+{
+	size_t offset = sizeof(memdb_node_t) + level * sizeof(memdb_node_t *);
+	memdb_node_t * node = malloc(MEMDB_ALIGN(offset) + MEMDB_ALIGN(key_size) + value_size + 1);
+	assert(node);
+	memset(node, 0, offset);
+
+	node->level = level;
+	node->key = (unsigned char *)node + MEMDB_ALIGN(offset);
+	node->value = node->key + MEMDB_ALIGN(key_size);
+	node->key_size = key_size;
+	node->value_size = value_size;
+	if(key_size) memcpy(node->key, key, key_size);
+	if(value_size) memcpy(node->value, value, value_size);
+	return node;
+}
+
+static memdb_store_t * memdb_store_new(const char * name, int dup_sort, int int32_keys)
+{
+	memdb_store_t * store = calloc(1, sizeof(*store));
+	assert(store);
+	if(name) store->name = strdup(name);
+	else store->is_temp = 1;
+	store->dup_sort = dup_sort;
+	store->int32_keys = int32_keys;
+
+	int rc = pthread_rwlock_init(&store->rwlock, NULL);
+	assert(0 == rc);
+	store->lock = &store->rwlock;
+
+	store->head = memdb_node_new(MEMDB_MAX_LEVEL, NULL, 0, NULL, 0);
+	store->level = 1;
+	store->rand_state = 0x9E3779B97F4A7C15ULL ^ (uintptr_t)store;
+
+	store->num_buckets = 1024;
+	store->buckets = calloc(store->num_buckets, sizeof(*store->buckets));
+	assert(store->buckets);
+	return store;
+}
+
+static void memdb_store_free_garbage(memdb_store_t * store)
+{
+	memdb_node_t * node = store->garbage;
+	while(node) {
+		memdb_node_t * next = node->hnext;
+		free(node);
+		node = next;
+	}
+	store->garbage = NULL;
+}
+
+static void memdb_store_free(memdb_store_t * store)
+{
+	if(NULL == store) return;
+	memdb_node_t * node = store->head->next[0];
+	while(node) {
+		memdb_node_t * next = node->next[0];
+		free(node);
+		node = next;
+	}
+	memdb_store_free_garbage(store);
+	free(store->head);
+	free(store->buckets);
+	free(store->name);
+	pthread_rwlock_destroy(&store->rwlock);
+	free(store);
+}
+
+static int memdb_random_level(memdb_store_t * store)
+{
+	// xorshift64*, p = 1/4
+	uint64_t x = store->rand_state;
+	x ^= x >> 12; x ^= x << 25; x ^= x >> 27;
+	store->rand_state = x;
+	x *= 0x2545F4914F6CDD1DULL;
+
+	int level = 1;
+	while(level < MEMDB_MAX_LEVEL && (x & 3) == 0) {
+		++level;
+		x >>= 2;
+	}
+	return level;
+}
+
+/* the first node of the key, NULL if not found */
+static memdb_node_t * memdb_store_lookup(const memdb_store_t * store, const void * key, size_t key_size)
+{
+	uint32_t hash = memdb_hash(key, key_size);
+	memdb_node_t * node = store->buckets[hash & (store->num_buckets - 1)];
+	for(; node; node = node->hnext) {
+		if(node->hash == hash && node->key_size == key_size && 0 == memcmp(node->key, key, key_size)) return node;
+	}
+	return NULL;
+}
+
+static void memdb_hash_resize(memdb_store_t * store, size_t num_buckets)
+{
+	memdb_node_t ** buckets = calloc(num_buckets, sizeof(*buckets));
+	assert(buckets);
+	for(size_t i = 0; i < store->num_buckets; ++i) {
+		memdb_node_t * node = store->buckets[i];
+		while(node) {
+			memdb_node_t * next = node->hnext;
+			memdb_node_t ** p_bucket = &buckets[node->hash & (num_buckets - 1)];
+			node->hnext = *p_bucket;
+			*p_bucket = node;
+			node = next;
+		}
+	}
+	free(store->buckets);
+	store->buckets = buckets;
+	store->num_buckets = num_buckets;
+}
+
+static void memdb_hash_add(memdb_store_t * store, memdb_node_t * node)
+{
+	if((size_t)store->num_keys >= store->num_buckets) memdb_hash_resize(store, store->num_buckets * 2);
+	memdb_node_t ** p_bucket = &store->buckets[node->hash & (store->num_buckets - 1)];
+	node->hnext = *p_bucket;
+	*p_bucket = node;
+	node->flags |= memdb_node_flags_head;
+	++store->num_keys;
+}
+
+/* remove the node from the hash table, or replace it with the next record of the same key */
+static void memdb_hash_remove(memdb_store_t * store, memdb_node_t * node, memdb_node_t * replacement)
+{
+	memdb_node_t ** p_node = &store->buckets[node->hash & (store->num_buckets - 1)];
+	while(*p_node && *p_node != node) p_node = &(*p_node)->hnext;
+	assert(*p_node == node);
+
+	if(replacement) {
+		replacement->hnext = node->hnext;
+		replacement->flags |= memdb_node_flags_head;
+		*p_node = replacement;
+	}else {
+		*p_node = node->hnext;
+		--store->num_keys;
+	}
+	node->hnext = NULL;
+	node->flags &= ~memdb_node_flags_head;
+}
+
+/* find the last node before {key, value} at each level, returns the first node >= {key, value} */
+static memdb_node_t * memdb_store_seek(memdb_store_t * store,
+	const void * key, size_t key_size,
+	const void * value, size_t value_size, int with_value,
+	memdb_node_t * update[])
+{
+	memdb_node_t * node = store->head;
+	for(int i = store->level - 1; i >= 0; --i) {
+		while(node->next[i] && memdb_compare_node(store, node->next[i], key, key_size, value, value_size, with_value) < 0) {
+			node = node->next[i];
+		}
+		if(update) update[i] = node;
+	}
+	return node->next[0];
+}
+
+/* the record {key, value} of a dup_sort db, or the record of the key */
+static memdb_node_t * memdb_store_find_exact(memdb_store_t * store,
+	const void * key, size_t key_size,
+	const void * value, size_t value_size)
+{
+	if(!store->dup_sort) return memdb_store_lookup(store, key, key_size);
+	memdb_node_t * node = memdb_store_seek(store, key, key_size, value, value_size, 1, NULL);
+	if(node && 0 == memdb_compare_node(store, node, key, key_size, value, value_size, 1)) return node;
+	return NULL;
+}
+
+/* the caller has checked that the record does not exist */
+static memdb_node_t * memdb_store_insert(memdb_store_t * store,
+	const void * key, size_t key_size,
+	const void * value, size_t value_size)
+{
+	memdb_node_t * update[MEMDB_MAX_LEVEL];
+	memdb_node_t * next = memdb_store_seek(store, key, key_size, value, value_size, 1, update);
+
+	int level = memdb_random_level(store);
+	if(level > store->level) {
+		for(int i = store->level; i < level; ++i) update[i] = store->head;
+		store->level = level;
+	}
+
+	memdb_node_t * node = memdb_node_new(level, key, key_size, value, value_size);
+	node->hash = memdb_hash(key, key_size);
+	for(int i = 0; i < level; ++i) {
+		node->next[i] = update[i]->next[i];
+		update[i]->next[i] = node;
+	}
+	node->prev = (update[0] == store->head)?NULL:update[0];
+	if(next) next->prev = node;
+	else store->tail = node;
+	++store->count;
+
+	if(!memdb_same_key(store, node->prev, node)) {
+		if(next && (next->flags & memdb_node_flags_head) && memdb_same_key(store, next, node)) {
+			memdb_hash_remove(store, next, node);
+		}else {
+			memdb_hash_add(store, node);
+		}
+	}
+	return node;
+}
+
+static void memdb_store_remove(memdb_store_t * store, memdb_node_t * node)
+{
+	assert(!(node->flags & memdb_node_flags_deleted));
+	memdb_node_t * update[MEMDB_MAX_LEVEL];
+	memdb_store_seek(store, node->key, node->key_size, node->value, node->value_size, 1, update);
+
+	for(int i = 0; i < node->level; ++i) {
+		assert(update[i]->next[i] == node);
+		update[i]->next[i] = node->next[i];
+	}
+	while(store->level > 1 && NULL == store->head->next[store->level - 1]) --store->level;
+
+	memdb_node_t * next = node->next[0];
+	if(next) next->prev = node->prev;
+	else store->tail = node->prev;
+	--store->count;
+
+	if(node->flags & memdb_node_flags_head) {
+		memdb_hash_remove(store, node, memdb_same_key(store, next, node)?next:NULL);
+	}
+
+	// keep next[0] and prev, a cursor positioned on this node can still move on
+	node->flags = memdb_node_flags_deleted;
+	if(store->cursors_count > 0) {
+		node->hnext = store->garbage;
+		store->garbage = node;
+	}else {
+		free(node);
+	}
+}
+
+/**************************************************
+ * struct db_engine_txn
+ *   an undo log of the raw writes (secondary dbs included),
+ *   a nested txn hands its log to the parent on commit.
+ **************************************************/
+typedef struct memdb_undo
+{
+	memdb_store_t * store;
+	int is_insert;		// 1: undo by removing the record, 0: undo by adding it back
+	size_t key_size;
+	size_t value_size;
+	unsigned char data[];	// key + value
+}memdb_undo_t;
+
+typedef struct memdb_txn_private
+{
+	struct memdb_txn_private * parent;
+	ssize_t count;
+	ssize_t max_size;
+	memdb_undo_t ** entries;
+}memdb_txn_private_t;
+
+static void memdb_undo_append(memdb_txn_private_t * log, memdb_store_t * store, int is_insert,
+	const void * key, size_t key_size,
+	const void * value, size_t value_size)
+{
+	if(log->count >= log->max_size) {
+		ssize_t new_size = log->max_size?(log->max_size * 2):64;
+		memdb_undo_t ** entries = realloc(log->entries, new_size * sizeof(*entries));
+		assert(entries);
+		log->entries = entries;
+		log->max_size = new_size;
+	}
+	memdb_undo_t * undo = malloc(sizeof(*undo) + key_size + value_size);
+	assert(undo);
+	undo->store = store;
+	undo->is_insert = is_insert;
+	undo->key_size = key_size;
+	undo->value_size = value_size;
+	if(key_size) memcpy(undo->data, key, key_size);
+	if(value_size) memcpy(undo->data + key_size, value, value_size);
+	log->entries[log->count++] = undo;
+}
+
+static memdb_node_t * memdb_log_insert(memdb_txn_private_t * log, memdb_store_t * store,
+	const void * key, size_t key_size,
+	const void * value, size_t value_size)
+{
+	if(log) memdb_undo_append(log, store, 1, key, key_size, value, value_size);
+	return memdb_store_insert(store, key, key_size, value, value_size);
+}
+
+static void memdb_log_remove(memdb_txn_private_t * log, memdb_store_t * store, memdb_node_t * node)
+{
+	if(log) memdb_undo_append(log, store, 0, node->key, node->key_size, node->value, node->value_size);
+	memdb_store_remove(store, node);
+}
+
+static void memdb_txn_private_free(memdb_txn_private_t * log)
+{
+	if(NULL == log) return;
+	for(ssize_t i = 0; i < log->count; ++i) free(log->entries[i]);
+	free(log->entries);
+	free(log);
+}
+
+static int memdb_txn_begin(struct db_engine_txn * txn, struct db_engine_txn * parent_txn)
+{
+	assert(txn && txn->engine);
+	assert(NULL == txn->priv);
+
+	memdb_txn_private_t * log = calloc(1, sizeof(*log));
+	assert(log);
+	log->parent = parent_txn?parent_txn->priv:NULL;
+	txn->priv = log;
+	return 0;
+}
+
+static int memdb_txn_commit(struct db_engine_txn * txn, int flags)
+{
+	memdb_txn_private_t * log = txn->priv;
+	if(NULL == log) return -1;
+
+	memdb_txn_private_t * parent = log->parent;
+	if(parent) {	// the parent may still abort
+		for(ssize_t i = 0; i < log->count; ++i) {
+			if(parent->count >= parent->max_size) {
+				ssize_t new_size = parent->max_size?(parent->max_size * 2):64;
+				while(new_size < parent->count + log->count) new_size *= 2;
+				memdb_undo_t ** entries = realloc(parent->entries, new_size * sizeof(*entries));
+				assert(entries);
+				parent->entries = entries;
+				parent->max_size = new_size;
+			}
+			parent->entries[parent->count++] = log->entries[i];
+		}
+		log->count = 0;
+	}
+	memdb_txn_private_free(log);
+	txn->priv = NULL;
+	return 0;
+}
+
+static int memdb_txn_abort(struct db_engine_txn * txn)
+{
+	memdb_txn_private_t * log = txn->priv;
+	if(NULL == log) return -1;
+
+	for(ssize_t i = log->count - 1; i >= 0; --i) {
+		memdb_undo_t * undo = log->entries[i];
+		memdb_store_t * store = undo->store;
+		const unsigned char * key = undo->data;
+		const unsigned char * value = undo->data + undo->key_size;
+
+		pthread_rwlock_wrlock(store->lock);
+		if(undo->is_insert) {
+			memdb_node_t * node = memdb_store_find_exact(store, key, undo->key_size, value, undo->value_size);
+			if(node) memdb_store_remove(store, node);
+		}else {
+			memdb_store_insert(store, key, undo->key_size, value, undo->value_size);
+		}
+		pthread_rwlock_unlock(store->lock);
+	}
+	memdb_txn_private_free(log);
+	txn->priv = NULL;
+	return 0;
+}
+
+static int memdb_txn_prepare(struct db_engine_txn * txn, unsigned char gid[])
+{
+	return -1;	// not supported
+}
+
+static int memdb_txn_set_name(struct db_engine_txn * txn, const char * name)
+{
+	return -1;	// not supported
+}
+static const char * memdb_txn_get_name(struct db_engine_txn * txn)
+{
+	return NULL;
+}
+
+static db_engine_txn_t * memdb_txn_init(db_engine_txn_t * txn, struct db_engine * engine)
+{
+	if(NULL == txn) txn = calloc(1, sizeof(*txn));
+	assert(txn);
+	txn->engine = engine;
+
+	txn->begin = memdb_txn_begin;
+	txn->commit = memdb_txn_commit;
+	txn->abort = memdb_txn_abort;
+	txn->prepare = memdb_txn_prepare;
+	txn->discard = memdb_txn_abort;
+	txn->set_name = memdb_txn_set_name;
+	txn->get_name = memdb_txn_get_name;
+	return txn;
+}
+
+static void memdb_txn_cleanup(db_engine_txn_t * txn)
+{
+	if(txn->priv) memdb_txn_abort(txn);
+}
+
+static inline memdb_txn_private_t * memdb_txn_log(db_engine_txn_t * txn)
+{
+	return txn?txn->priv:NULL;
+}
+
+/*****************************************************************
+ * engine private
+****************************************************************/
+typedef struct memdb_engine_private
+{
+	pthread_mutex_t mutex;
+	db_engine_t * engine;
+	char home_dir[PATH_MAX];	// not used, kept for set_home()
+
+	memdb_store_t * stores;		// named databases
+
+	ssize_t max_size;
+	ssize_t count;
+	db_handle_t ** databases;
+}memdb_engine_private_t;
+
+/****************************************************************
+ * struct db_handle
+****************************************************************/
+typedef struct memdb_buffer
+{
+	void * data;
+	size_t size;
+	size_t max_size;
+}memdb_buffer_t;
+
+static void * memdb_buffer_set(memdb_buffer_t * buf, const void * data, size_t size)
+{
+	if(size > buf->max_size) {
+		size_t new_size = (size + 255) & ~(size_t)255;
+		void * p = realloc(buf->data, new_size);
+		assert(p);
+		buf->data = p;
+		buf->max_size = new_size;
+	}
+	if(size > 0) memcpy(buf->data, data, size);
+	buf->size = size;
+	return buf->data;
+}
+
+/**
+ * memdb_scratch:
+ *   per-thread buffers which hold the borrowed results of db->get(),
+ *   the records themselves can be freed by other threads once the lock is released.
+ */
+typedef struct memdb_scratch
+{
+	memdb_buffer_t key;
+	memdb_buffer_t value;
+
+	struct memdb_private * priv;
+	struct memdb_scratch * next;
+}memdb_scratch_t;
+
+typedef struct memdb_private
+{
+	struct db_handle * db;
+	memdb_store_t * store;
+	int is_open;
+
+	pthread_mutex_t mutex;
+
+	// secondary index emulation
+	struct db_handle * primary;		// set if this is a secondary db
+	db_associate_callback associate_func;
+	int num_secondaries;
+	struct db_handle * secondaries[MEMDB_MAX_SECONDARIES];
+
+	pthread_key_t scratch_key;
+	memdb_scratch_t * scratches;	// all per-thread states, guarded by the mutex
+}memdb_private_t;
+
+static inline memdb_private_t * memdb_get_private(struct db_handle * db)
+{
+	assert(db && db->priv);
+	memdb_private_t * priv = db->priv;
+	assert(priv->is_open && priv->store);
+	return priv;
+}
+
+static inline memdb_store_t * memdb_get_store(struct db_handle * db)
+{
+	return ((memdb_private_t *)db->priv)->store;
+}
+
+static void memdb_scratch_free(memdb_scratch_t * scratch)
+{
+	free(scratch->key.data);
+	free(scratch->value.data);
+	free(scratch);
+}
+
+/* called on thread exit */
+static void memdb_scratch_destroy(void * _scratch)
+{
+	memdb_scratch_t * scratch = _scratch;
+	memdb_private_t * priv = scratch->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	memdb_scratch_t ** p_node = &priv->scratches;
+	while(*p_node && *p_node != scratch) p_node = &(*p_node)->next;
+	if(*p_node) *p_node = scratch->next;
+	pthread_mutex_unlock(&priv->mutex);
+
+	memdb_scratch_free(scratch);
+}
+
+static memdb_scratch_t * memdb_scratch_get(memdb_private_t * priv)
+{
+	memdb_scratch_t * scratch = pthread_getspecific(priv->scratch_key);
+	if(scratch) return scratch;
+
+	scratch = calloc(1, sizeof(*scratch));
+	assert(scratch);
+	scratch->priv = priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	scratch->next = priv->scratches;
+	priv->scratches = scratch;
+	pthread_mutex_unlock(&priv->mutex);
+
+	int rc = pthread_setspecific(priv->scratch_key, scratch);
+	assert(0 == rc);
+	return scratch;
+}
+
+static int memdb_open(struct db_handle * db, db_engine_txn_t * txn, const char * name, int db_type, enum db_flags flags)
+{
+	assert(db && db->priv);
+	memdb_private_t * priv = db->priv;
+	memdb_engine_private_t * engine_priv = db->engine->priv;
+	assert(!priv->is_open);
+
+	// the format is always ordered, db_type is ignored
+	int dup_sort = (flags & db_flags_dup_sort)?1:0;
+	int int32_keys = (flags & db_flags_int32_keys)?1:0;
+	if(dup_sort) db->record_flags |= db_record_flags_multiple;
+
+	memdb_store_t * store = NULL;
+	pthread_mutex_lock(&engine_priv->mutex);
+	if(name) {
+		for(store = engine_priv->stores; store; store = store->next) {
+			if(0 == strcmp(store->name, name)) break;
+		}
+	}
+	if(NULL == store) {
+		store = memdb_store_new(name, dup_sort, int32_keys);
+		if(name) {
+			store->next = engine_priv->stores;
+			engine_priv->stores = store;
+		}
+	}
+	++store->refs;
+	pthread_mutex_unlock(&engine_priv->mutex);
+
+	if(store->dup_sort != dup_sort || store->int32_keys != int32_keys) {
+		fprintf(stderr, "[ERROR]::%s(): db '%s' was opened with different flags.\n", __FUNCTION__, name);
+		pthread_mutex_lock(&engine_priv->mutex);
+		--store->refs;
+		pthread_mutex_unlock(&engine_priv->mutex);
+		return -1;
+	}
+
+	priv->store = store;
+	priv->is_open = 1;
+	return 0;
+}
+
+static int memdb_close(struct db_handle * db)
+{
+	memdb_private_t * priv = db->priv;
+	if(NULL == priv || !priv->is_open) return 0;
+	memdb_engine_private_t * engine_priv = db->engine->priv;
+	memdb_store_t * store = priv->store;
+
+	if(priv->primary) {
+		memdb_private_t * ppriv = priv->primary->priv;
+		pthread_rwlock_wrlock(store->lock);
+		for(int i = 0; ppriv && i < ppriv->num_secondaries; ++i) {
+			if(ppriv->secondaries[i] != db) continue;
+			ppriv->secondaries[i] = ppriv->secondaries[--ppriv->num_secondaries];
+			break;
+		}
+		pthread_rwlock_unlock(store->lock);
+		store->lock = &store->rwlock;
+		priv->primary = NULL;
+	}
+
+	pthread_mutex_lock(&engine_priv->mutex);
+	int is_dropped = (0 == --store->refs) && store->is_temp;
+	pthread_mutex_unlock(&engine_priv->mutex);
+	if(is_dropped) memdb_store_free(store);
+
+	priv->store = NULL;
+	priv->is_open = 0;
+	return 0;
+}
+
+/**
+ * secondary index emulation, the caller holds the write lock
+ */
+static int memdb_index_update(struct db_handle * db, memdb_txn_private_t * log,
+	const memdb_node_t * record,
+	int is_del,
+	struct db_handle * only_sdb)	// NULL: all secondaries
+{
+	memdb_private_t * priv = db->priv;
+
+	for(int i = 0; i < priv->num_secondaries; ++i)
+	{
+		struct db_handle * sdb = priv->secondaries[i];
+		if(only_sdb && sdb != only_sdb) continue;
+		memdb_private_t * spriv = sdb->priv;
+		memdb_store_t * sstore = spriv->store;
+
+		db_record_data_t * skeys = NULL;
+		ssize_t num_keys = spriv->associate_func(sdb,
+			&(db_record_data_t){ .data = record->key, .size = record->key_size },
+			&(db_record_data_t){ .data = record->value, .size = record->value_size },
+			&skeys);
+		if(num_keys < 1 || NULL == skeys) return -1;
+
+		for(ssize_t ii = 0; ii < num_keys; ++ii)
+		{
+			memdb_node_t * node = memdb_store_find_exact(sstore, skeys[ii].data, skeys[ii].size, record->key, record->key_size);
+			if(is_del) {
+				if(node && 0 == memdb_compare_bytes(node->value, node->value_size, record->key, record->key_size)) {
+					memdb_log_remove(log, sstore, node);
+				}
+				continue;
+			}
+			if(node) {
+				if(sstore->dup_sort) continue;	// already indexed
+				memdb_log_remove(log, sstore, node);
+			}
+			memdb_log_insert(log, sstore, skeys[ii].data, skeys[ii].size, record->key, record->key_size);
+		}
+		free(skeys);
+	}
+	return 0;
+}
+
+/* delete the records of the key and their secondary keys, the caller holds the write lock */
+static int memdb_primary_del(struct db_handle * db, memdb_txn_private_t * log, const void * key, size_t key_size)
+{
+	memdb_private_t * priv = db->priv;
+	memdb_store_t * store = priv->store;
+
+	memdb_node_t * node = memdb_store_lookup(store, key, key_size);
+	if(NULL == node) return MEMDB_NOTFOUND;
+
+	while(node) {
+		memdb_node_t * next = node->next[0];
+		if(!memdb_same_key(store, next, node)) next = NULL;
+
+		if(priv->num_secondaries > 0) {
+			int rc = memdb_index_update(db, log, node, 1, NULL);
+			if(rc) return rc;
+		}
+		memdb_log_remove(log, store, node);
+		node = next;
+	}
+	return 0;
+}
+
+/* the caller holds the write lock */
+static int memdb_put(struct db_handle * db, memdb_txn_private_t * log,
+	const void * key, size_t key_size,
+	const void * value, size_t value_size,
+	int is_update)
+{
+	int rc = 0;
+	memdb_private_t * priv = db->priv;
+	memdb_store_t * store = priv->store;
+
+	memdb_node_t * old_node = memdb_store_lookup(store, key, key_size);
+	if(is_update && NULL == old_node) return MEMDB_NOTFOUND;	// update an existing record only
+	if(old_node && (db->record_flags & db_record_flags_no_overwrite)) return MEMDB_KEYEXIST;
+
+	if(store->dup_sort) {
+		if(is_update) {	// replace the first record
+			memdb_log_remove(log, store, old_node);
+		}else if(old_node && memdb_store_find_exact(store, key, key_size, value, value_size)) {
+			return (db->record_flags & db_record_flags_no_dup)?MEMDB_KEYEXIST:0;
+		}
+		memdb_log_insert(log, store, key, key_size, value, value_size);
+		return 0;
+	}
+
+	if(old_node) {
+		if(priv->num_secondaries > 0) rc = memdb_index_update(db, log, old_node, 1, NULL);
+		if(rc) return rc;
+		memdb_log_remove(log, store, old_node);
+	}
+	memdb_node_t * node = memdb_log_insert(log, store, key, key_size, value, value_size);
+	if(priv->num_secondaries > 0) rc = memdb_index_update(db, log, node, 0, NULL);
+	return rc;
+}
+
+static int memdb_associate(struct db_handle * primary, db_engine_txn_t * txn,
+	struct db_handle * secondary, db_associate_callback associated_by)
+{
+	memdb_private_t * priv = memdb_get_private(primary);
+	memdb_private_t * spriv = memdb_get_private(secondary);
+	assert(NULL == spriv->primary);
+	assert(!priv->store->dup_sort);
+	if(priv->num_secondaries >= MEMDB_MAX_SECONDARIES) return -1;
+
+	memdb_store_t * store = priv->store;
+	memdb_store_t * sstore = spriv->store;
+
+	pthread_rwlock_wrlock(store->lock);
+	spriv->associate_func = associated_by;
+	spriv->primary = primary;
+	sstore->lock = store->lock;		// the indexes are always updated with the primary records
+	priv->secondaries[priv->num_secondaries++] = secondary;
+
+	// (DB_CREATE) build the index if the secondary db is empty
+	int rc = 0;
+	if(0 == sstore->count) {
+		memdb_txn_private_t * log = memdb_txn_log(txn);
+		for(memdb_node_t * node = store->head->next[0]; node && (0 == rc); node = node->next[0]) {
+			rc = memdb_index_update(primary, log, node, 0, secondary);
+		}
+	}
+	pthread_rwlock_unlock(store->lock);
+	memdb_check_error(rc, "build index: ");
+	return rc;
+}
+
+/* copy a record to the result, the same rules as the BDB backend */
+static db_record_data_t * memdb_record_data_set(db_record_data_t * result, const void * data, size_t size)
+{
+	if(NULL == result) result = calloc(1, sizeof(*result));
+	assert(result);
+
+	if(0 == result->size) result->size = size;
+	assert(result->size == (ssize_t)size);
+
+	if(NULL == result->data) {
+		result->data = malloc(size?size:1);
+		assert(result->data);
+		result->flags = 1;
+	}
+	if(size) memcpy(result->data, data, size);
+	return result;
+}
+
+/* resolve a {skey -> pkey} record to the primary record */
+static inline memdb_node_t * memdb_primary_get(memdb_private_t * spriv, const memdb_node_t * snode)
+{
+	memdb_node_t * node = memdb_store_lookup(memdb_get_store(spriv->primary), snode->value, snode->value_size);
+	if(NULL == node) fprintf(stderr, "[ERROR]::%s(): index is out of sync.\n", __FUNCTION__);
+	return node;
+}
+
+/**
+ * find_records:
+ *   the duplicated records of the key,
+ *   for a secondary db, the keys and values of the primary db are returned (the same as BDB).
+ *   the caller holds the read lock
+ */
+static ssize_t memdb_find_records(struct db_handle * db,
+	const db_record_data_t * key,
+	db_record_data_t ** p_keys,
+	db_record_data_t ** p_values)
+{
+	memdb_private_t * priv = db->priv;
+	memdb_store_t * store = priv->store;
+
+	memdb_node_t * first = memdb_store_lookup(store, key->data, key->size);
+	if(NULL == first) return 0;
+
+	ssize_t count = 1;
+	for(memdb_node_t * node = first->next[0]; memdb_same_key(store, node, first); node = node->next[0]) ++count;
+
+	if(!store->dup_sort) {	// use the caller's buffers if provided
+		const memdb_node_t * record = first;
+		if(priv->primary) {
+			record = memdb_primary_get(priv, first);
+			if(NULL == record) return -1;
+			if(p_keys) *p_keys = memdb_record_data_set(*p_keys, record->key, record->key_size);
+		}
+		*p_values = memdb_record_data_set(*p_values, record->value, record->value_size);
+		return 1;
+	}
+
+	db_record_data_t * keys = NULL;
+	db_record_data_t * values = calloc(count, sizeof(*values));
+	assert(values);
+	if(p_keys) {
+		keys = calloc(count, sizeof(*keys));
+		assert(keys);
+	}
+
+	ssize_t i = 0;
+	for(memdb_node_t * node = first; i < count; node = node->next[0], ++i) {
+		const memdb_node_t * record = node;
+		if(priv->primary) {
+			record = memdb_primary_get(priv, node);
+			if(NULL == record) break;
+		}
+		if(keys) memdb_record_data_set(&keys[i], record->key, record->key_size);
+		memdb_record_data_set(&values[i], record->value, record->value_size);
+	}
+	if(i < count) {
+		for(ssize_t ii = 0; ii < i; ++ii) {
+			if(keys) db_record_data_cleanup(&keys[ii]);
+			db_record_data_cleanup(&values[ii]);
+		}
+		free(keys);
+		free(values);
+		return -1;
+	}
+
+	if(p_keys) *p_keys = keys;
+	*p_values = values;
+	return count;
+}
+
+static ssize_t memdb_find(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * key,
+	db_record_data_t ** p_values)
+{
+	assert(db && key);
+	memdb_private_t * priv = memdb_get_private(db);
+	if(NULL == p_values) return 1;
+
+	pthread_rwlock_rdlock(priv->store->lock);
+	ssize_t count = memdb_find_records(db, key, NULL, p_values);
+	pthread_rwlock_unlock(priv->store->lock);
+	return count;
+}
+
+static ssize_t memdb_find_secondary(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * skey,
+	db_record_data_t ** p_keys,
+	db_record_data_t ** p_values)
+{
+	assert(db && skey);
+	memdb_private_t * priv = memdb_get_private(db);
+	if(NULL == priv->primary) return -1;
+	if(NULL == p_values) return 1;
+
+	pthread_rwlock_rdlock(priv->store->lock);
+	ssize_t count = memdb_find_records(db, skey, p_keys, p_values);
+	pthread_rwlock_unlock(priv->store->lock);
+	return count;
+}
+
+static int memdb_get_record(struct db_handle * db,
+	const db_record_data_t * _key,
+	db_record_data_t * key,		// nullable, the key of the primary db
+	db_record_data_t * value)
+{
+	memdb_private_t * priv = db->priv;
+	memdb_scratch_t * scratch = memdb_scratch_get(priv);
+	int rc = 0;
+
+	pthread_rwlock_rdlock(priv->store->lock);
+	const memdb_node_t * record = memdb_store_lookup(priv->store, _key->data, _key->size);
+	if(record && priv->primary) {
+		record = memdb_primary_get(priv, record);
+		if(NULL == record) rc = -1;
+		else if(key) {
+			memdb_buffer_set(&scratch->key, record->key, record->key_size);
+			*key = (db_record_data_t){ .data = scratch->key.data, .size = record->key_size };
+		}
+	}
+	if(record) {
+		memdb_buffer_set(&scratch->value, record->value, record->value_size);
+		*value = (db_record_data_t){ .data = scratch->value.data, .size = record->value_size };
+		rc = 1;
+	}
+	pthread_rwlock_unlock(priv->store->lock);
+	return rc;
+}
+
+static int memdb_get(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * key,
+	db_record_data_t * value)
+{
+	assert(db && key && value);
+	memdb_get_private(db);
+	return memdb_get_record(db, key, NULL, value);
+}
+
+static int memdb_get_secondary(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * skey,
+	db_record_data_t * key,
+	db_record_data_t * value)
+{
+	assert(db && skey && value);
+	memdb_private_t * priv = memdb_get_private(db);
+	if(NULL == priv->primary) return -1;
+	return memdb_get_record(db, skey, key, value);
+}
+
+static ssize_t memdb_find_many(struct db_handle * db, db_engine_txn_t * txn,
+	ssize_t count, const db_record_data_t keys[],
+	db_record_data_t results[],
+	void * buffer, size_t buffer_size)
+{
+	assert(db && (count >= 0) && results);
+	if(count <= 0) return 0;
+	assert(keys);
+	memdb_private_t * priv = memdb_get_private(db);
+
+	memset(results, 0, count * sizeof(*results));
+
+	unsigned char * p_buf = buffer;
+	size_t buf_used = 0;
+	ssize_t num_found = 0;
+
+	pthread_rwlock_rdlock(priv->store->lock);
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		const memdb_node_t * node = memdb_store_lookup(priv->store, keys[i].data, keys[i].size);
+		if(NULL == node) continue;
+
+		db_record_data_t * result = &results[i];
+		if(p_buf && (buf_used + node->value_size) <= buffer_size) {
+			result->data = p_buf + buf_used;
+			if(node->value_size) memcpy(result->data, node->value, node->value_size);
+			buf_used += MEMDB_ALIGN(node->value_size);
+			if(buf_used > buffer_size) buf_used = buffer_size;
+			result->size = node->value_size;
+		}else {
+			memdb_record_data_set(result, node->value, node->value_size);
+		}
+		++num_found;
+	}
+	pthread_rwlock_unlock(priv->store->lock);
+	return num_found;
+}
+
+static int memdb_insert(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * key,
+	const db_record_data_t * value)
+{
+	assert(db && key && value);
+	memdb_private_t * priv = memdb_get_private(db);
+	assert(NULL == priv->primary);	// a secondary db is updated by its primary db
+
+	pthread_rwlock_wrlock(priv->store->lock);
+	int rc = memdb_put(db, memdb_txn_log(txn), key->data, key->size, value->data, value->size, 0);
+	pthread_rwlock_unlock(priv->store->lock);
+	return rc;
+}
+
+static int memdb_update(struct db_handle * db, db_engine_txn_t * txn,
+	const db_record_data_t * key,
+	const db_record_data_t * value)
+{
+	assert(db && key && value);
+	memdb_private_t * priv = memdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	pthread_rwlock_wrlock(priv->store->lock);
+	int rc = memdb_put(db, memdb_txn_log(txn), key->data, key->size, value->data, value->size, 1);
+	pthread_rwlock_unlock(priv->store->lock);
+	return rc;
+}
+
+static int memdb_del(struct db_handle * db, db_engine_txn_t * txn, const db_record_data_t * key)
+{
+	assert(db && key);
+	memdb_private_t * priv = memdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	pthread_rwlock_wrlock(priv->store->lock);
+	int rc = memdb_primary_del(db, memdb_txn_log(txn), key->data, key->size);
+	pthread_rwlock_unlock(priv->store->lock);
+	return rc;
+}
+
+/**
+ * insert_many / del_many:
+ *   all records are written under a single write lock.
+ */
+static int memdb_insert_many(struct db_handle * db, db_engine_txn_t * txn,
+	ssize_t count, const db_record_data_t keys[], const db_record_data_t values[])
+{
+	assert(db && (count >= 0));
+	if(count <= 0) return 0;
+	assert(keys && values);
+	memdb_private_t * priv = memdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	int rc = 0;
+	memdb_txn_private_t * log = memdb_txn_log(txn);
+	pthread_rwlock_wrlock(priv->store->lock);
+	for(ssize_t i = 0; (0 == rc) && i < count; ++i) {
+		rc = memdb_put(db, log, keys[i].data, keys[i].size, values[i].data, values[i].size, 0);
+	}
+	pthread_rwlock_unlock(priv->store->lock);
+	return rc;
+}
+
+static int memdb_del_many(struct db_handle * db, db_engine_txn_t * txn,
+	ssize_t count, const db_record_data_t keys[])
+{
+	assert(db && (count >= 0));
+	if(count <= 0) return 0;
+	assert(keys);
+	memdb_private_t * priv = memdb_get_private(db);
+	assert(NULL == priv->primary);
+
+	int rc = 0;
+	memdb_txn_private_t * log = memdb_txn_log(txn);
+	pthread_rwlock_wrlock(priv->store->lock);
+	for(ssize_t i = 0; (0 == rc) && i < count; ++i) {
+		rc = memdb_primary_del(db, log, keys[i].data, keys[i].size);
+		if(rc == MEMDB_NOTFOUND) rc = 0;
+	}
+	pthread_rwlock_unlock(priv->store->lock);
+	return rc;
+}
+
+static memdb_private_t * memdb_private_new(db_handle_t * db)
+{
+	memdb_private_t * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->db = db;
+
+	int rc = pthread_mutex_init(&priv->mutex, NULL);
+	assert(0 == rc);
+	rc = pthread_key_create(&priv->scratch_key, memdb_scratch_destroy);
+	assert(0 == rc);
+
+	db->priv = priv;
+	return priv;
+}
+
+static void memdb_private_free(memdb_private_t * priv)
+{
+	if(NULL == priv) return;
+	memdb_close(priv->db);
+
+	// the destructor will not be called once the key is deleted, release the states of all threads here
+	pthread_key_delete(priv->scratch_key);
+	memdb_scratch_t * scratch = priv->scratches;
+	while(scratch) {
+		memdb_scratch_t * next = scratch->next;
+		memdb_scratch_free(scratch);
+		scratch = next;
+	}
+	priv->scratches = NULL;
+
+	pthread_mutex_destroy(&priv->mutex);
+	free(priv);
+}
+
+static db_handle_t * memdb_handle_init(db_handle_t * db, db_engine_t * engine, void * user_data)
+{
+	if(NULL == db) db = calloc(1, sizeof(*db));
+	assert(db);
+	db->user_data = user_data;
+	db->engine = engine;
+
+	db->open = memdb_open;
+	db->associate = memdb_associate;
+	db->close = memdb_close;
+	db->find = memdb_find;
+	db->find_secondary = memdb_find_secondary;
+	db->get = memdb_get;
+	db->get_secondary = memdb_get_secondary;
+	db->find_many = memdb_find_many;
+	db->insert = memdb_insert;
+	db->update = memdb_update;
+	db->del = memdb_del;
+	db->insert_many = memdb_insert_many;
+	db->del_many = memdb_del_many;
+
+	memdb_private_t * priv = memdb_private_new(db);
+	assert(priv && db->priv == priv);
+	return db;
+}
+
+static void memdb_handle_cleanup(db_handle_t * db)
+{
+	if(NULL == db) return;
+	memdb_private_free(db->priv);
+	db->priv = NULL;
+}
+
+/***************************************************************
+ * struct db_cursor
+ *   the records are borrowed from the nodes (zero-copy),
+ *   unless the caller preset its own buffers.
+ *   the nodes are not freed while any cursor of the db is open.
+****************************************************************/
+typedef struct memdb_cursor_private
+{
+	memdb_node_t * node;		// the current position, it may have been deleted since
+	memdb_txn_private_t * log;
+	const void * borrowed[3];	// skey, key, value which point to the nodes
+}memdb_cursor_private_t;
+
+/* set a cursor record, copy to the caller's buffer if it was preset */
+static int memdb_cursor_record_set(db_record_data_t * record, const void * data, size_t size, const void ** p_borrowed)
+{
+	if(NULL == record->data || record->size <= 0 || record->data == *p_borrowed) {
+		record->data = (void *)data;
+		record->size = size;
+		record->flags = 0;
+		*p_borrowed = data;
+		return 0;
+	}
+	if(record->size < (ssize_t)size) return MEMDB_BUFFER_SMALL;
+	if(size) memcpy(record->data, data, size);
+	return 0;
+}
+
+/* move to the node (NULL: not found, the position is unchanged), the caller holds the lock */
+static int memdb_cursor_move(struct db_cursor * cursor, memdb_node_t * node)
+{
+	memdb_cursor_private_t * cpriv = cursor->priv;
+	memdb_private_t * priv = cursor->db->priv;
+	if(NULL == node) return MEMDB_NOTFOUND;
+
+	int rc = 0;
+	const memdb_node_t * record = node;
+	if(priv->primary) {	// {skey, pkey, primary value}, the same as BDB's pget
+		record = memdb_primary_get(priv, node);
+		if(NULL == record) return -1;
+
+		rc = memdb_cursor_record_set(cursor->skey, node->key, node->key_size, &cpriv->borrowed[0]);
+	}
+	if(0 == rc) rc = memdb_cursor_record_set(cursor->key, record->key, record->key_size, &cpriv->borrowed[1]);
+	if(0 == rc) rc = memdb_cursor_record_set(cursor->value, record->value, record->value_size, &cpriv->borrowed[2]);
+	if(0 == rc) cpriv->node = node;
+	return rc;
+}
+
+static inline memdb_node_t * memdb_node_next(memdb_node_t * node)
+{
+	do { node = node->next[0]; } while(node && (node->flags & memdb_node_flags_deleted));
+	return node;
+}
+static inline memdb_node_t * memdb_node_prev(memdb_node_t * node)
+{
+	do { node = node->prev; } while(node && (node->flags & memdb_node_flags_deleted));
+	return node;
+}
+
+enum memdb_cursor_op
+{
+	memdb_cursor_op_first,
+	memdb_cursor_op_last,
+	memdb_cursor_op_next,
+	memdb_cursor_op_prev,
+	memdb_cursor_op_next_dup,
+	memdb_cursor_op_prev_dup,
+};
+
+static int memdb_cursor_op(struct db_cursor * cursor, enum memdb_cursor_op op)
+{
+	assert(cursor && cursor->priv);
+	memdb_cursor_private_t * cpriv = cursor->priv;
+	memdb_store_t * store = memdb_get_store(cursor->db);
+
+	pthread_rwlock_rdlock(store->lock);
+	memdb_node_t * current = cpriv->node;
+	memdb_node_t * node = NULL;
+
+	// next / prev on an unpositioned cursor are the same as first / last (BDB)
+	if(NULL == current && op == memdb_cursor_op_next) op = memdb_cursor_op_first;
+	if(NULL == current && op == memdb_cursor_op_prev) op = memdb_cursor_op_last;
+
+	switch(op) {
+	case memdb_cursor_op_first: node = store->head->next[0]; break;
+	case memdb_cursor_op_last: node = store->tail; break;
+	case memdb_cursor_op_next: node = memdb_node_next(current); break;
+	case memdb_cursor_op_prev: node = memdb_node_prev(current); break;
+	case memdb_cursor_op_next_dup:
+		if(current) node = memdb_node_next(current);
+		if(!memdb_same_key(store, node, current)) node = NULL;
+		break;
+	case memdb_cursor_op_prev_dup:
+		if(current) node = memdb_node_prev(current);
+		if(!memdb_same_key(store, node, current)) node = NULL;
+		break;
+	}
+	int rc = memdb_cursor_move(cursor, node);
+	pthread_rwlock_unlock(store->lock);
+	return rc;
+}
+
+static int memdb_cursor_first(struct db_cursor * cursor)
+{
+	return memdb_cursor_op(cursor, memdb_cursor_op_first);
+}
+static int memdb_cursor_last(struct db_cursor * cursor)
+{
+	return memdb_cursor_op(cursor, memdb_cursor_op_last);
+}
+static int memdb_cursor_next(struct db_cursor * cursor)
+{
+	return memdb_cursor_op(cursor, memdb_cursor_op_next);
+}
+static int memdb_cursor_prev(struct db_cursor * cursor)
+{
+	return memdb_cursor_op(cursor, memdb_cursor_op_prev);
+}
+static int memdb_cursor_next_dup(struct db_cursor * cursor)
+{
+	return memdb_cursor_op(cursor, memdb_cursor_op_next_dup);
+}
+static int memdb_cursor_prev_dup(struct db_cursor * cursor)
+{
+	return memdb_cursor_op(cursor, memdb_cursor_op_prev_dup);
+}
+
+static int memdb_cursor_move_to(struct db_cursor * cursor, const db_record_data_t * key)
+{
+	assert(cursor && cursor->priv && key && key->data && key->size > 0);
+	memdb_store_t * store = memdb_get_store(cursor->db);
+
+	pthread_rwlock_rdlock(store->lock);
+	int rc = memdb_cursor_move(cursor, memdb_store_lookup(store, key->data, key->size));
+	pthread_rwlock_unlock(store->lock);
+	return rc;
+}
+
+static int memdb_cursor_set(struct db_cursor * cursor)
+{
+	assert(cursor && cursor->priv);
+	memdb_cursor_private_t * cpriv = cursor->priv;
+	db_handle_t * db = cursor->db;
+	memdb_private_t * priv = db->priv;
+	memdb_store_t * store = priv->store;
+	if(priv->primary) return -1;	// a secondary db is read-only
+
+	int rc = 0;
+	pthread_rwlock_wrlock(store->lock);
+	memdb_node_t * node = cpriv->node;
+	if(NULL == node || (node->flags & memdb_node_flags_deleted)) rc = MEMDB_KEYEMPTY;
+	else if(store->dup_sort) {	// replace the current record
+		memdb_log_remove(cpriv->log, store, node);
+		cpriv->node = memdb_log_insert(cpriv->log, store, node->key, node->key_size, cursor->value->data, cursor->value->size);
+	}else {
+		// the old node is kept in the garbage list while the cursor is open
+		rc = memdb_put(db, cpriv->log, node->key, node->key_size, cursor->value->data, cursor->value->size, 1);
+		if(0 == rc) cpriv->node = memdb_store_lookup(store, node->key, node->key_size);
+	}
+	pthread_rwlock_unlock(store->lock);
+	return rc;
+}
+
+static int memdb_cursor_del(struct db_cursor * cursor)
+{
+	assert(cursor && cursor->priv);
+	memdb_cursor_private_t * cpriv = cursor->priv;
+	db_handle_t * db = cursor->db;
+	memdb_private_t * priv = db->priv;
+	memdb_store_t * store = priv->store;
+
+	int rc = 0;
+	pthread_rwlock_wrlock(store->lock);
+	memdb_node_t * node = cpriv->node;
+	if(NULL == node || (node->flags & memdb_node_flags_deleted)) rc = MEMDB_KEYEMPTY;
+	else if(priv->primary) {
+		// delete the primary record (and all its secondary keys), the same as BDB
+		rc = memdb_primary_del(priv->primary, cpriv->log, node->value, node->value_size);
+	}else {
+		if(priv->num_secondaries > 0) rc = memdb_index_update(db, cpriv->log, node, 1, NULL);
+		if(0 == rc) memdb_log_remove(cpriv->log, store, node);
+	}
+	pthread_rwlock_unlock(store->lock);
+	return rc;
+}
+
+/* pin (or unpin) the nodes of the db, and of its primary db */
+static void memdb_cursor_pin(db_handle_t * db, int pin)
+{
+	memdb_private_t * priv = db->priv;
+	memdb_store_t * stores[2] = { priv->store, priv->primary?memdb_get_store(priv->primary):NULL };
+
+	pthread_rwlock_wrlock(priv->store->lock);
+	for(int i = 0; i < 2 && stores[i]; ++i) {
+		if(pin) ++stores[i]->cursors_count;
+		else if(0 == --stores[i]->cursors_count) memdb_store_free_garbage(stores[i]);
+	}
+	pthread_rwlock_unlock(priv->store->lock);
+}
+
+static db_cursor_t * memdb_cursor_init(db_cursor_t * cursor, db_handle_t * db, db_engine_txn_t * txn, int flags)
+{
+	memdb_get_private(db);
+	memdb_cursor_private_t * cpriv = calloc(1, sizeof(*cpriv));
+	assert(cpriv);
+	cpriv->log = memdb_txn_log(txn);
+
+	if(NULL == cursor) cursor = calloc(1, sizeof(*cursor));
+	assert(cursor);
+
+	cursor->priv = cpriv;
+	cursor->db = db;
+
+	cursor->first = memdb_cursor_first;
+	cursor->last = memdb_cursor_last;
+	cursor->next = memdb_cursor_next;
+	cursor->prev = memdb_cursor_prev;
+	cursor->next_dup = memdb_cursor_next_dup;
+	cursor->prev_dup = memdb_cursor_prev_dup;
+
+	cursor->move_to = memdb_cursor_move_to;
+	cursor->set = memdb_cursor_set;
+	cursor->del = memdb_cursor_del;
+
+	memdb_cursor_pin(db, 1);
+	return cursor;
+}
+
+static void memdb_cursor_cleanup(db_cursor_t * cursor)
+{
+	if(NULL == cursor || NULL == cursor->priv) return;
+	memdb_cursor_private_t * cpriv = cursor->priv;
+
+	// drop the references to the nodes
+	if(cpriv->borrowed[0] && cursor->skey->data == cpriv->borrowed[0]) memset(cursor->skey, 0, sizeof(cursor->skey));
+	if(cpriv->borrowed[1] && cursor->key->data == cpriv->borrowed[1]) memset(cursor->key, 0, sizeof(cursor->key));
+	if(cpriv->borrowed[2] && cursor->value->data == cpriv->borrowed[2]) memset(cursor->value, 0, sizeof(cursor->value));
+
+	memdb_cursor_pin(cursor->db, 0);
+	free(cpriv);
+	cursor->priv = NULL;
+}
+
+/*****************************************************************
+ * struct db_engine
+****************************************************************/
+#define MEMDB_ENGINE_ALLOC_SIZE	(64)
+static int memdb_engine_resize(memdb_engine_private_t * priv, ssize_t new_size)
+{
+	if(new_size <= 0) new_size = MEMDB_ENGINE_ALLOC_SIZE;
+	else new_size = (new_size + MEMDB_ENGINE_ALLOC_SIZE - 1) / MEMDB_ENGINE_ALLOC_SIZE * MEMDB_ENGINE_ALLOC_SIZE;
+	if(new_size <= priv->max_size) return 0;
+
+	db_handle_t ** dbs = realloc(priv->databases, new_size * sizeof(*dbs));
+	assert(dbs);
+	memset(dbs + priv->max_size, 0, (new_size - priv->max_size) * sizeof(*dbs));
+	priv->databases = dbs;
+	priv->max_size = new_size;
+	return 0;
+}
+#undef MEMDB_ENGINE_ALLOC_SIZE
+
+static int memdb_engine_set_home(struct db_engine * engine, const char * home_dir)
+{
+	memdb_engine_private_t * priv = engine->priv;
+	assert(priv);
+	if(home_dir) strncpy(priv->home_dir, home_dir, sizeof(priv->home_dir) - 1);
+	return 0;
+}
+
+/* nothing to tune: there is no cache, no log and nothing is written to disk */
+static int memdb_engine_set_config(struct db_engine * engine, const db_engine_config_t * config)
+{
+	return 0;
+}
+static int memdb_engine_set_durability(struct db_engine * engine, enum db_engine_durability durability)
+{
+	return 0;
+}
+
+static int memdb_engine_list_add(db_engine_t * engine, db_handle_t * db)
+{
+	int rc = -1;
+	memdb_engine_private_t * priv = engine->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	ssize_t index = 0;
+	for(; index < priv->count; ++index) if(priv->databases[index] == db) break;
+	if(index == priv->count) {
+		rc = memdb_engine_resize(priv, priv->count + 1);
+		if(0 == rc) priv->databases[priv->count++] = db;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	return rc;
+}
+
+static int memdb_engine_list_remove(db_engine_t * engine, db_handle_t * db)
+{
+	int rc = -1;
+	memdb_engine_private_t * priv = engine->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	for(ssize_t index = 0; index < priv->count; ++index) {
+		if(priv->databases[index] != db) continue;
+		priv->databases[index] = priv->databases[--priv->count];
+		priv->databases[priv->count] = NULL;
+		rc = 0;
+		break;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	return rc;
+}
+
+static db_handle_t * memdb_engine_open_db(struct db_engine * engine, const char * db_name, enum db_format_type db_type, int flags)
+{
+	db_handle_t * db = memdb_handle_init(NULL, engine, engine->user_data);
+	assert(db);
+
+	int rc = db->open(db, NULL, db_name, db_type, flags);
+	assert(0 == rc);
+
+	rc = memdb_engine_list_add(engine, db);
+	assert(0 == rc);
+	return db;
+}
+
+static int memdb_engine_close_db(db_engine_t * engine, db_handle_t * db)
+{
+	if(NULL == db) return -1;
+	int rc = db->close(db);
+	memdb_engine_list_remove(engine, db);
+	return rc;
+}
+
+static db_engine_txn_t * memdb_engine_txn_new(struct db_engine * engine, struct db_engine_txn * parent_txn)
+{
+	db_engine_txn_t * txn = memdb_txn_init(NULL, engine);
+	assert(txn);
+
+	int rc = txn->begin(txn, parent_txn);
+	if(rc) {
+		memdb_txn_cleanup(txn);
+		free(txn);
+		txn = NULL;
+	}
+	return txn;
+}
+
+static void memdb_engine_txn_free(struct db_engine * engine, db_engine_txn_t * txn)
+{
+	if(txn) {
+		memdb_txn_cleanup(txn);
+		free(txn);
+	}
+}
+
+static int memdb_engine_init(db_engine_t * engine)
+{
+	memdb_engine_private_t * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->engine = engine;
+
+	int rc = pthread_mutex_init(&priv->mutex, NULL);
+	assert(0 == rc);
+	memdb_engine_resize(priv, 0);
+
+	engine->priv = priv;
+	engine->set_home = memdb_engine_set_home;
+	engine->open_db = memdb_engine_open_db;
+	engine->close_db = memdb_engine_close_db;
+	engine->list_add = memdb_engine_list_add;
+	engine->list_remove = memdb_engine_list_remove;
+	engine->txn_new = memdb_engine_txn_new;
+	engine->txn_free = memdb_engine_txn_free;
+	engine->set_config = memdb_engine_set_config;
+	engine->set_durability = memdb_engine_set_durability;
+	return 0;
+}
+
+static void memdb_engine_cleanup(db_engine_t * engine)
+{
+	memdb_engine_private_t * priv = engine->priv;
+	if(NULL == priv) return;
+
+	for(ssize_t i = 0; i < priv->count; ++i) {
+		db_handle_t * db = priv->databases[i];
+		if(db) {
+			memdb_handle_cleanup(db);
+			free(db);
+			priv->databases[i] = NULL;
+		}
+	}
+	priv->count = 0;
+	free(priv->databases);
+
+	memdb_store_t * store = priv->stores;
+	while(store) {
+		memdb_store_t * next = store->next;
+		memdb_store_free(store);
+		store = next;
+	}
+	priv->stores = NULL;
+
+	pthread_mutex_destroy(&priv->mutex);
+	free(priv);
+	engine->priv = NULL;
+}
+
+const db_engine_backend_t db_engine_backend_mem[1] = {{
+	.name = "memory",
+	.engine_init = memdb_engine_init,
+	.engine_cleanup = memdb_engine_cleanup,
+	.txn_init = memdb_txn_init,
+	.txn_cleanup = memdb_txn_cleanup,
+	.handle_init = memdb_handle_init,
+	.handle_cleanup = memdb_handle_cleanup,
+	.cursor_init = memdb_cursor_init,
+	.cursor_cleanup = memdb_cursor_cleanup,
+}};
+
+#if defined(_TEST_DB_ENGINE_MEM) && defined(_STAND_ALONE)
+struct test_record
+{
+	int32_t id;
+	int32_t height;		// key of the secondary db
+	char payload[24];
+};
+
+static ssize_t associate_by_height(db_handle_t * sdb, 
+	const db_record_data_t * key, const db_record_data_t * value, 
+	db_record_data_t ** p_result)
+{
+	if(NULL == p_result) return 1;
+	db_record_data_t * result = *p_result;
+	if(NULL == result) {
+		result = calloc(1, sizeof(*result));
+		*p_result = result;
+	}
+	struct test_record * record = value->data;
+	result->data = &record->height;
+	result->size = sizeof(record->height);
+	return 1;
+}
+
+static ssize_t count_by_height(db_handle_t * sdb, int32_t height)
+{
+	db_record_data_t * values = NULL;
+	ssize_t count = sdb->find_secondary(sdb, NULL, 
+		&(db_record_data_t){ .data = &height, .size = sizeof(height) }, 
+		NULL, &values);
+	for(ssize_t i = 0; i < count; ++i) db_record_data_cleanup(&values[i]);
+	free(values);
+	return count;
+}
+
+static int insert_record(db_handle_t * db, db_engine_txn_t * txn, int32_t id, int32_t height)
+{
+	struct test_record record = { .id = id, .height = height };
+	return db->insert(db, txn, 
+		&(db_record_data_t){ .data = &record.id, .size = sizeof(record.id) },
+		&(db_record_data_t){ .data = &record, .size = sizeof(record) });
+}
+
+int main(int argc, char **argv)
+{
+	db_engine_t * engine = db_engine_init_with_backend(NULL, db_engine_backend_find("memory"), NULL, NULL);
+	assert(engine);
+	
+	db_handle_t * db = engine->open_db(engine, "records.db", db_format_type_btree, 0);
+	db_handle_t * sdb = engine->open_db(engine, "records_height.db", db_format_type_btree, db_flags_dup_sort | db_flags_int32_keys);
+	assert(db && sdb);
+	int rc = db->associate(db, NULL, sdb, associate_by_height);
+	assert(0 == rc);
+	
+	for(int i = 0; i < 1000; ++i) {
+		rc = insert_record(db, NULL, i, i % 10);
+		assert(0 == rc);
+	}
+	assert(100 == count_by_height(sdb, 3));
+	
+	db->record_flags |= db_record_flags_no_overwrite;
+	rc = insert_record(db, NULL, 5, 5);
+	assert(rc == MEMDB_KEYEXIST);
+	db->record_flags &= ~db_record_flags_no_overwrite;
+	
+	// get / get_secondary
+	int32_t id = 42;
+	db_record_data_t key = { .data = &id, .size = sizeof(id) };
+	db_record_data_t value = { NULL };
+	rc = db->get(db, NULL, &key, &value);
+	assert(1 == rc && value.size == sizeof(struct test_record) && ((struct test_record *)value.data)->height == 2);
+	
+	int32_t height = 3;
+	db_record_data_t pkey = { NULL };
+	rc = sdb->get_secondary(sdb, NULL, &(db_record_data_t){ .data = &height, .size = sizeof(height) }, &pkey, &value);
+	assert(1 == rc && ((struct test_record *)value.data)->height == 3 && *(int32_t *)pkey.data == ((struct test_record *)value.data)->id);
+	
+	// update and del maintain the secondary db
+	struct test_record record = { .id = 13, .height = 7 };
+	rc = db->update(db, NULL, &(db_record_data_t){ .data = &record.id, .size = sizeof(record.id) }, 
+		&(db_record_data_t){ .data = &record, .size = sizeof(record) });
+	assert(0 == rc);
+	assert(99 == count_by_height(sdb, 3) && 101 == count_by_height(sdb, 7));
+	
+	id = 23;
+	rc = db->del(db, NULL, &key);
+	assert(0 == rc);
+	rc = db->del(db, NULL, &key);
+	assert(rc == MEMDB_NOTFOUND);
+	assert(98 == count_by_height(sdb, 3));
+	
+	// find_many
+	int32_t ids[4] = { 77, 23, 5, 1000 };
+	db_record_data_t keys[4], results[4];
+	char buffer[64];
+	for(int i = 0; i < 4; ++i) keys[i] = (db_record_data_t){ .data = &ids[i], .size = sizeof(int32_t) };
+	ssize_t count = db->find_many(db, NULL, 4, keys, results, buffer, sizeof(buffer));
+	assert(2 == count);
+	assert(NULL == results[1].data && NULL == results[3].data);
+	assert(77 == ((struct test_record *)results[0].data)->id && 5 == ((struct test_record *)results[2].data)->id);
+	for(int i = 0; i < 4; ++i) db_record_data_cleanup(&results[i]);
+	
+	// txn: abort rolls back the primary and the secondary records
+	db_engine_txn_t * txn = engine->txn_new(engine, NULL);
+	assert(txn);
+	for(int i = 1000; i < 1010; ++i) insert_record(db, txn, i, 50);
+	id = 42;
+	rc = db->del(db, txn, &key);
+	assert(0 == rc);
+	
+	db_engine_txn_t * child = engine->txn_new(engine, txn);
+	insert_record(db, child, 2000, 50);
+	rc = child->commit(child, 0);
+	assert(0 == rc);
+	engine->txn_free(engine, child);
+	assert(11 == count_by_height(sdb, 50) && 0 == db->get(db, NULL, &key, &value));
+	
+	rc = txn->abort(txn);
+	assert(0 == rc);
+	engine->txn_free(engine, txn);
+	assert(0 == count_by_height(sdb, 50) && 1 == db->get(db, NULL, &key, &value));
+	assert(100 == count_by_height(sdb, 2));
+	
+	// iterate the secondary db (numeric order of the heights)
+	db_cursor_t cursor[1];
+	memset(cursor, 0, sizeof(cursor));
+	db_cursor_init(cursor, sdb, NULL, 0);
+	int32_t last_height = -1;
+	count = 0;
+	for(rc = cursor->first(cursor); 0 == rc; rc = cursor->next(cursor), ++count) {
+		struct test_record * record = cursor->value->data;
+		assert(*(int32_t *)cursor->skey->data == record->height);
+		assert(*(int32_t *)cursor->key->data == record->id);
+		assert(record->height >= last_height);
+		last_height = record->height;
+	}
+	db_cursor_cleanup(cursor);
+	printf("secondary cursor: %ld records\n", (long)count);
+	assert(999 == count && rc == MEMDB_NOTFOUND);
+	
+	// delete by a cursor of the secondary db
+	memset(cursor, 0, sizeof(cursor));
+	db_cursor_init(cursor, sdb, NULL, 0);
+	height = 0;
+	count = 0;
+	for(rc = cursor->move_to(cursor, &(db_record_data_t){ .data = &height, .size = sizeof(height) }); 
+		0 == rc; 
+		rc = cursor->next_dup(cursor), ++count)
+	{
+		rc = cursor->del(cursor);
+		assert(0 == rc);
+	}
+	db_cursor_cleanup(cursor);
+	assert(100 == count && 0 == count_by_height(sdb, 0));
+	id = 10;
+	assert(0 == db->get(db, NULL, &key, &value));
+	
+	// update by a cursor, iterate backward
+	memset(cursor, 0, sizeof(cursor));
+	db_cursor_init(cursor, db, NULL, 0);
+	count = 0;
+	for(rc = cursor->last(cursor); 0 == rc; rc = cursor->prev(cursor), ++count) {
+		struct test_record * record = cursor->value->data;
+		if(record->height != 9) continue;
+		struct test_record new_record = *record;
+		new_record.height = 90;
+		cursor->value->data = &new_record;
+		rc = cursor->set(cursor);
+		assert(0 == rc);
+		memset(cursor->value, 0, sizeof(cursor->value));	// borrow the records again
+	}
+	db_cursor_cleanup(cursor);
+	assert(899 == count && 0 == count_by_height(sdb, 9) && 100 == count_by_height(sdb, 90));
+	
+	// a named db keeps its records after it is closed
+	engine->close_db(engine, sdb);
+	engine->close_db(engine, db);
+	db_handle_cleanup(sdb); free(sdb);
+	db_handle_cleanup(db); free(db);
+	
+	db = engine->open_db(engine, "records.db", db_format_type_btree, 0);
+	id = 999;
+	assert(1 == db->get(db, NULL, &key, &value) && ((struct test_record *)value.data)->height == 90);
+	
+	// a temp db is dropped
+	db_handle_t * temp_db = engine->open_db(engine, NULL, db_format_type_btree, 0);
+	rc = insert_record(temp_db, NULL, 1, 1);
+	assert(0 == rc);
+	engine->close_db(engine, temp_db);
+	db_handle_cleanup(temp_db); free(temp_db);
+	
+	db_engine_cleanup(engine);
+	printf("all tests passed.\n");
+	return 0;
+}
+#endif
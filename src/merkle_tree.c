@@ -36,8 +36,12 @@
 #include "crypto.h"
 #include "utils.h"
 
+#include <unistd.h>
+
 #include "satoshi-types.h"
+#include "bitcoin-consensus.h"
 #define MERKLE_TREE_MAX_LAYERS (32)
+#define MERKLE_TREE_MIN_PAIRS_PER_CHUNK (256)
 typedef struct merkle_tree_layer
 {
 	int max_size;
@@ -59,16 +63,117 @@ int merkle_tree_layer_resize(merkle_tree_layer_t * layer, int size)
 	return 0;
 }
 
+/**
+ * merkle_tree_thread_pool:
+ * 	persistent workers which hash a wide layer in chunks together with the calling thread.
+ * 	A pool can be shared by many trees (and threads), the jobs are posted one at a time.
+ */
+struct merkle_tree_job
+{
+	struct uint256_merkle_tree * mtree;
+	uint256_t * dst;
+	const uint256_t * items;
+	ssize_t num_pairs;
+	ssize_t chunk_size;
+	ssize_t num_chunks;
+	int max_workers;	// the number of workers allowed to join this job
+};
+
+typedef struct merkle_tree_thread_pool
+{
+	int num_workers;
+	pthread_t * workers;
+	ssize_t serial_threshold;
+	
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;	// a new job is posted or quit
+	pthread_cond_t idle_cond;	// all workers have left the current job, or the pool is no longer busy
+	int quit;
+	int busy;					// a job is in progress
+	unsigned int job_id;
+	int active_workers;
+	
+	struct merkle_tree_job job;
+	volatile ssize_t next_chunk;
+}merkle_tree_thread_pool_t;
+
 typedef struct merkle_tree_private
 {
 	uint256_merkle_tree_t * mtree;
 	int layers_count;	// mtree->levels
 	merkle_tree_layer_t layers[MERKLE_TREE_MAX_LAYERS];
+	
+	int leaves_count;	// mtree->count at the last recalc, 0: the layers have not been built
+	
+	// indexes of the built leaves (< leaves_count) changed since the last recalc, 
+	// sorted and deduplicated on recalc, then turned into the parents' indexes layer by layer (in place).
+	int * dirty;
+	int dirty_count;
+	int dirty_max;
+	
+	merkle_tree_thread_pool_t * pool;	// NULL: serial mode
+	int owns_pool;						// the pool was created by uint256_merkle_tree_set_threads()
+	int max_threads;					// 0: all workers of the pool
 }merkle_tree_private_t;
 
+static void merkle_tree_dirty_reserve(merkle_tree_private_t * priv, int size)
+{
+	if(size <= priv->dirty_max) return;
+	int new_size = (size + 255) / 256 * 256;
+	int * dirty = realloc(priv->dirty, new_size * sizeof(*dirty));
+	assert(dirty);
+	priv->dirty = dirty;
+	priv->dirty_max = new_size;
+}
+
+static int merkle_tree_compare_index(const void * a, const void * b)
+{
+	int lhs = *(const int *)a;
+	int rhs = *(const int *)b;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+/* sort the dirty indexes and drop duplicates */
+static void merkle_tree_dirty_compact(merkle_tree_private_t * priv)
+{
+	int * dirty = priv->dirty;
+	if(priv->dirty_count <= 1) return;
+	qsort(dirty, priv->dirty_count, sizeof(*dirty), merkle_tree_compare_index);
+	
+	int count = 1;
+	for(int i = 1; i < priv->dirty_count; ++i)
+	{
+		if(dirty[i] != dirty[count - 1]) dirty[count++] = dirty[i];
+	}
+	priv->dirty_count = count;
+}
+
+static inline void merkle_tree_mark_dirty(merkle_tree_private_t * priv, int start_index, int count)
+{
+	// nothing has been built yet, or the leaves were appended after the last recalc: 
+	// they are covered by the (re)building of the tails.
+	int end_index = start_index + count;
+	if(end_index > priv->leaves_count) end_index = priv->leaves_count;
+	if(priv->leaves_count <= 1 || start_index >= end_index) return;
+	
+	// the same leaves may be set many times between two recalcs
+	if((priv->dirty_count + (end_index - start_index)) > (priv->leaves_count * 2)) merkle_tree_dirty_compact(priv);
+	
+	merkle_tree_dirty_reserve(priv, priv->dirty_count + (end_index - start_index));
+	for(int i = start_index; i < end_index; ++i) priv->dirty[priv->dirty_count++] = i;
+}
+
+static void merkle_tree_thread_pool_free(merkle_tree_thread_pool_t * pool);
 static void merkle_tree_private_free(merkle_tree_private_t * priv)
 {
 	if(NULL == priv) return;
+	if(priv->owns_pool) merkle_tree_thread_pool_free(priv->pool);
+	priv->pool = NULL;
+	
+	free(priv->dirty);
+	priv->dirty = NULL;
+	priv->dirty_count = priv->dirty_max = 0;
+	
 	for(int i = 0; i < MERKLE_TREE_MAX_LAYERS; ++i)
 	{
 		merkle_tree_layer_t * layer = &priv->layers[i];
@@ -94,50 +199,273 @@ static merkle_tree_private_t * merkle_tree_private_new(uint256_merkle_tree_t * m
 	return priv;
 }
 
-static int merkle_tree_recalc(struct uint256_merkle_tree * mtree, int start_index, int count)
+static inline void merkle_tree_hash_pairs(struct uint256_merkle_tree * mtree, 
+	uint256_t * dst, const uint256_t * items, ssize_t num_pairs)
 {
-	if(NULL == mtree->hash_func) mtree->hash_func = hash256;	// default hash function
+	if(num_pairs <= 0) return;
+	if(mtree->hash_func == hash256) {	// hash all pairs in one batch
+		sha256d64_batch((unsigned char *)dst, (const unsigned char *)items, num_pairs);
+		return;
+	}
+	for(ssize_t i = 0; i < num_pairs; ++i)
+	{
+		mtree->hash_func(&items[i * 2], 64, dst[i].val);
+	}
+}
+
+static void merkle_tree_job_run(merkle_tree_thread_pool_t * pool, const struct merkle_tree_job * job)
+{
+	while(1)
+	{
+		ssize_t chunk = __sync_fetch_and_add(&pool->next_chunk, 1);
+		if(chunk >= job->num_chunks) break;
+		
+		ssize_t start = chunk * job->chunk_size;
+		ssize_t num_pairs = job->num_pairs - start;
+		if(num_pairs > job->chunk_size) num_pairs = job->chunk_size;
+		merkle_tree_hash_pairs(job->mtree, &job->dst[start], &job->items[start * 2], num_pairs);
+	}
+}
+
+static void * merkle_tree_worker(void * user_data)
+{
+	merkle_tree_thread_pool_t * pool = user_data;
+	unsigned int last_job_id = 0;
+	struct merkle_tree_job job;
 	
-	if(count < 0) count = (mtree->count - start_index);
+	pthread_mutex_lock(&pool->mutex);
+	while(1)
+	{
+		while(!pool->quit && pool->job_id == last_job_id) pthread_cond_wait(&pool->job_cond, &pool->mutex);
+		if(pool->quit) break;
+		
+		last_job_id = pool->job_id;
+		if(pool->active_workers >= pool->job.max_workers) continue;	// enough workers for this job
+		job = pool->job;
+		++pool->active_workers;
+		pthread_mutex_unlock(&pool->mutex);
+		
+		merkle_tree_job_run(pool, &job);
+		
+		pthread_mutex_lock(&pool->mutex);
+		if(0 == --pool->active_workers) pthread_cond_broadcast(&pool->idle_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+void uint256_merkle_tree_thread_pool_free(uint256_merkle_tree_thread_pool_t * pool)
+{
+	merkle_tree_thread_pool_free(pool);
+}
+
+static void merkle_tree_thread_pool_free(merkle_tree_thread_pool_t * pool)
+{
+	if(NULL == pool) return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
 	
-	if(mtree->count <= 1) {
-		if(mtree->count == 1) memcpy(&mtree->merkle_root, &mtree->items[0], 32);
-		return 0;	// no need to recalc
+	for(int i = 0; i < pool->num_workers; ++i) pthread_join(pool->workers[i], NULL);
+	free(pool->workers);
+	
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_cond_destroy(&pool->idle_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+/**
+ * uint256_merkle_tree_thread_pool_new:
+ * 	num_threads: 0 = number of online cpus
+ * 	serial_threshold: layers with fewer pairs are hashed by the calling thread only, 0 = default
+ * @return NULL if no worker could be created (serial mode).
+ */
+uint256_merkle_tree_thread_pool_t * uint256_merkle_tree_thread_pool_new(int num_threads, ssize_t serial_threshold)
+{
+	if(num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(serial_threshold <= 0) serial_threshold = UINT256_MERKLE_TREE_PARALLEL_THRESHOLD;
+	if(num_threads <= 1) return NULL;
+	
+	merkle_tree_thread_pool_t * pool = calloc(1, sizeof(*pool));
+	assert(pool);
+	
+	pool->serial_threshold = serial_threshold;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+	
+	pool->workers = calloc(num_threads, sizeof(*pool->workers));
+	assert(pool->workers);
+	for(int i = 1; i < num_threads; ++i)	// the calling thread is also a worker
+	{
+		if(0 == pthread_create(&pool->workers[pool->num_workers], NULL, merkle_tree_worker, pool)) ++pool->num_workers;
 	}
-	assert(start_index >= 0 && start_index < mtree->count);
+	if(pool->num_workers == 0) {	// unable to create any worker
+		merkle_tree_thread_pool_free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+/**
+ * uint256_merkle_tree_set_threads:
+ * 	num_threads: 0 = number of online cpus, 1 = serial mode
+ * 	serial_threshold: layers with fewer pairs are hashed by the calling thread only, 0 = default
+ */
+int uint256_merkle_tree_set_threads(uint256_merkle_tree_t * mtree, int num_threads, ssize_t serial_threshold)
+{
+	assert(mtree && mtree->priv);
+	if(num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	
+	uint256_merkle_tree_set_thread_pool(mtree, NULL, 0);
+	if(num_threads <= 1) return 0;
+	
+	merkle_tree_thread_pool_t * pool = uint256_merkle_tree_thread_pool_new(num_threads, serial_threshold);
+	if(NULL == pool) return -1;
 	
-	if(count <= 0) count = mtree->count - start_index;
 	merkle_tree_private_t * priv = mtree->priv;
-	assert(priv);
+	priv->pool = pool;
+	priv->owns_pool = 1;
+	return 0;
+}
+
+/**
+ * uint256_merkle_tree_set_thread_pool:
+ * 	use a shared pool (not owned by the tree), NULL = serial mode
+ * 	max_threads: the number of threads (including the calling thread) used per layer, 0 = all
+ */
+int uint256_merkle_tree_set_thread_pool(uint256_merkle_tree_t * mtree, uint256_merkle_tree_thread_pool_t * pool, int max_threads)
+{
+	assert(mtree && mtree->priv);
+	merkle_tree_private_t * priv = mtree->priv;
 	
+	if(priv->owns_pool) merkle_tree_thread_pool_free(priv->pool);
+	priv->pool = pool;
+	priv->owns_pool = 0;
+	priv->max_threads = max_threads;
+	return 0;
+}
+
+static void merkle_tree_hash_layer(struct uint256_merkle_tree * mtree, 
+	uint256_t * dst, const uint256_t * items, ssize_t num_pairs)
+{
+	merkle_tree_private_t * priv = mtree->priv;
+	merkle_tree_thread_pool_t * pool = priv->pool;
+	if(NULL == pool || num_pairs < pool->serial_threshold || priv->max_threads == 1) {
+		merkle_tree_hash_pairs(mtree, dst, items, num_pairs);
+		return;
+	}
+	
+	int max_workers = pool->num_workers;
+	if(priv->max_threads > 1 && max_workers > (priv->max_threads - 1)) max_workers = priv->max_threads - 1;
+	
+	ssize_t chunk_size = num_pairs / ((max_workers + 1) * 4);
+	if(chunk_size < MERKLE_TREE_MIN_PAIRS_PER_CHUNK) chunk_size = MERKLE_TREE_MIN_PAIRS_PER_CHUNK;
+	
+	struct merkle_tree_job job = {
+		.mtree = mtree,
+		.dst = dst,
+		.items = items,
+		.num_pairs = num_pairs,
+		.chunk_size = chunk_size,
+		.num_chunks = (num_pairs + chunk_size - 1) / chunk_size,
+		.max_workers = max_workers,
+	};
+	
+	pthread_mutex_lock(&pool->mutex);
+	// wait for the job of another tree, late workers may still hold the previous job
+	while(pool->busy || pool->active_workers > 0) pthread_cond_wait(&pool->idle_cond, &pool->mutex);
+	pool->busy = 1;
+	pool->job = job;
+	pool->next_chunk = 0;
+	++pool->job_id;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	merkle_tree_job_run(pool, &job);
+	
+	// wait for the chunks taken by the workers
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->active_workers > 0) pthread_cond_wait(&pool->idle_cond, &pool->mutex);
+	pool->busy = 0;
+	pthread_cond_broadcast(&pool->idle_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * merkle_tree_update:
+ * 	rehash the parents of the dirty leaves, layer by layer.
+ * 	The dirty indexes of each layer are a sorted and deduplicated list, 
+ * 	so k scattered updates cost O(k log n) hashes; consecutive parents are hashed in one batch.
+ */
+static int merkle_tree_update(struct uint256_merkle_tree * mtree)
+{
+	if(NULL == mtree->hash_func) mtree->hash_func = hash256;	// default hash function
+	merkle_tree_private_t * priv = mtree->priv;
 	int rc = 0;
 	int layer_index;
+	int n = mtree->count;
+	assert(n > 1);
+	
+	// the leaves beyond the tail of the last build
+	int tail = 0;	// not built yet, all leaves are dirty
+	if(priv->leaves_count > 1) {
+		if(priv->leaves_count == n) tail = n;
+		else tail = ((priv->leaves_count < n)?priv->leaves_count:n) - 1;	// the shape of the tree has changed
+	}
+	merkle_tree_dirty_reserve(priv, priv->dirty_count + (n - tail));
+	for(int i = tail; i < n; ++i) priv->dirty[priv->dirty_count++] = i;
+	merkle_tree_dirty_compact(priv);
+	
+	// the leaves removed since the last recalc
+	int * dirty = priv->dirty;
+	int dirty_count = priv->dirty_count;
+	while(dirty_count > 0 && dirty[dirty_count - 1] >= n) --dirty_count;
 	
 	uint256_t * items = mtree->items;
 	uint256_t data[2];	// if count is an odd number, take the last_hash twice
 	
-	assert(start_index == 0);	///< @todo: update dirty hashes only ( update from start_index)
 	for(layer_index = 0; layer_index < MERKLE_TREE_MAX_LAYERS; ++layer_index)
 	{
 		merkle_tree_layer_t * layer = &priv->layers[layer_index];
-		int layer_size = (count + 1) / 2;
+		int layer_size = (n + 1) / 2;
 		rc = merkle_tree_layer_resize(layer, layer_size);
 		assert(0 == rc);
-		int i;
-		for(i = 0; i < count / 2; ++i)
+		
+		// parents of the dirty nodes (still sorted)
+		int parents_count = 0;
+		for(int i = 0; i < dirty_count; ++i)
 		{
-			mtree->hash_func(&items[i * 2], 64, layer->items[i].val);
+			int parent = dirty[i] / 2;
+			if(parents_count == 0 || dirty[parents_count - 1] != parent) dirty[parents_count++] = parent;
 		}
-		if(count & 0x01)
+		dirty_count = parents_count;
+		
+		// hash each run of consecutive parents in one batch
+		for(int i = 0; i < dirty_count; )
 		{
-			data[0] = items[count - 1];
-			data[1] = data[0];
-			mtree->hash_func(data, 64, layer->items[i].val);
+			int p_lo = dirty[i];
+			int p_hi = p_lo + 1;
+			for(++i; i < dirty_count && dirty[i] == p_hi; ++i) ++p_hi;
+			
+			int pairs_end = (p_hi < (n / 2))?p_hi:(n / 2);
+			if(pairs_end > p_lo) merkle_tree_hash_layer(mtree, &layer->items[p_lo], &items[p_lo * 2], pairs_end - p_lo);
+			
+			if((n & 0x01) && p_hi == layer_size)
+			{
+				int index = layer_size - 1;
+				data[0] = items[n - 1];
+				data[1] = data[0];
+				if(mtree->hash_func == hash256) hash256_64(data, layer->items[index].val);
+				else mtree->hash_func(data, 64, layer->items[index].val);
+			}
 		}
 		
 		layer->count = layer_size;
 		items = layer->items;
-		count = layer_size;
+		n = layer_size;
 		
 		if(layer_size == 1)
 		{
@@ -146,9 +474,38 @@ static int merkle_tree_recalc(struct uint256_merkle_tree * mtree, int start_inde
 		}
 	}
 	priv->layers_count = layer_index;
+	priv->leaves_count = mtree->count;
+	priv->dirty_count = 0;
 	return 0;
 }
 
+/**
+ * merkle_tree_recalc:
+ * 	rehash the paths from the dirty leaves [start_index, start_index + count) to the root.
+ * 	
+ * 	The leaves changed by add / set / remove since the last recalc are also tracked, 
+ * 	and the tail of each layer is rehashed when the number of leaves has changed.
+ * 	The first call always builds all layers.
+ */
+static int merkle_tree_recalc(struct uint256_merkle_tree * mtree, int start_index, int count)
+{
+	if(count < 0) count = (mtree->count - start_index);
+	merkle_tree_private_t * priv = mtree->priv;
+	assert(priv);
+	
+	if(mtree->count <= 1) {
+		if(mtree->count == 1) memcpy(&mtree->merkle_root, &mtree->items[0], 32);
+		priv->leaves_count = 0;
+		priv->dirty_count = 0;
+		return 0;	// no need to recalc
+	}
+	assert(start_index >= 0 && start_index < mtree->count);
+	
+	if(count <= 0) count = mtree->count - start_index;
+	merkle_tree_mark_dirty(priv, start_index, count);
+	return merkle_tree_update(mtree);
+}
+
 #define MERKLE_TREE_ALLOC_SIZE (4096)
 static int merkle_tree_resize(struct uint256_merkle_tree * mtree, ssize_t size)
 {
@@ -179,6 +536,7 @@ static int merkle_tree_add(struct uint256_merkle_tree * mtree, int count, const
 	{
 		dst[i] = items[i];
 	}
+	merkle_tree_mark_dirty(mtree->priv, mtree->count, count);
 	mtree->count += count;
 	return 0;
 }
@@ -190,6 +548,7 @@ static int merkle_tree_remove(struct uint256_merkle_tree * mtree, int index)
 	if(index < mtree->count)
 	{
 		mtree->items[index] = mtree->items[mtree->count];
+		merkle_tree_mark_dirty(mtree->priv, index, 1);
 	}
 	memset(&mtree->items[mtree->count], 0, sizeof(mtree->items[0]));
 	return 0;
@@ -199,6 +558,7 @@ static int merkle_tree_set(struct uint256_merkle_tree * mtree, int index, const
 {
 	if(mtree->count <= 0 || index < 0 || index >= mtree->count) return -1;
 	mtree->items[index] = item;
+	merkle_tree_mark_dirty(mtree->priv, index, 1);
 	return 0;
 }
 
@@ -224,6 +584,20 @@ uint256_merkle_tree_t * uint256_merkle_tree_new(ssize_t max_size, void * user_da
 	return mtree;
 }
 
+void uint256_merkle_tree_reset(uint256_merkle_tree_t * mtree)
+{
+	if(NULL == mtree) return;
+	merkle_tree_private_t * priv = mtree->priv;
+	mtree->count = 0;
+	mtree->levels = 0;
+	memset(&mtree->merkle_root, 0, sizeof(mtree->merkle_root));
+	
+	priv->layers_count = 0;
+	priv->leaves_count = 0;
+	priv->dirty_count = 0;
+	return;
+}
+
 void uint256_merkle_tree_free(uint256_merkle_tree_t * mtree)
 {
 	if(NULL == mtree) return;
@@ -233,6 +607,403 @@ void uint256_merkle_tree_free(uint256_merkle_tree_t * mtree)
 	return;
 }
 
+/**********************************************************************
+ * merkle branch / partial merkle tree (BIP37)
+**********************************************************************/
+static int merkle_tree_sync(uint256_merkle_tree_t * mtree)
+{
+	merkle_tree_private_t * priv = mtree->priv;
+	assert(priv);
+	if(mtree->count <= 1) return merkle_tree_recalc(mtree, 0, -1);
+	
+	if(priv->leaves_count <= 1 || priv->dirty_count > 0 || priv->leaves_count != mtree->count) {
+		return merkle_tree_update(mtree);
+	}
+	return 0;
+}
+
+/* node at (height, pos), height 0: the leaves */
+static inline const uint256_t * merkle_tree_get_node(uint256_merkle_tree_t * mtree, int height, size_t pos)
+{
+	if(height == 0) return &mtree->items[pos];
+	merkle_tree_private_t * priv = mtree->priv;
+	return &priv->layers[height - 1].items[pos];
+}
+
+/* number of nodes at the given height */
+static inline ssize_t merkle_tree_calc_width(ssize_t count, int height)
+{
+	return (count + ((ssize_t)1 << height) - 1) >> height;
+}
+
+ssize_t uint256_merkle_tree_get_branch(uint256_merkle_tree_t * mtree, int index, 
+	uint256_t branch[static UINT256_MERKLE_BRANCH_MAX_SIZE])
+{
+	assert(mtree && mtree->priv);
+	if(index < 0 || index >= mtree->count) return -1;
+	
+	int rc = merkle_tree_sync(mtree);
+	if(rc) return -1;
+	
+	ssize_t branch_size = 0;
+	int n = mtree->count;
+	for(int height = 0; n > 1; ++height)
+	{
+		assert(branch_size < UINT256_MERKLE_BRANCH_MAX_SIZE);
+		int sibling = index ^ 1;
+		if(sibling >= n) sibling = index;	// the last node of an odd layer pairs with itself
+		branch[branch_size++] = *merkle_tree_get_node(mtree, height, sibling);
+		
+		index >>= 1;
+		n = (n + 1) / 2;
+	}
+	return branch_size;
+}
+
+void uint256_merkle_branch_compute_root(const uint256_t * leaf, uint32_t index, 
+	int branch_size, const uint256_t branch[], uint256_t * merkle_root)
+{
+	uint256_t data[2];
+	data[0] = *leaf;
+	for(int i = 0; i < branch_size; ++i)
+	{
+		if(index & 1) {
+			data[1] = data[0];
+			data[0] = branch[i];
+		}else {
+			data[1] = branch[i];
+		}
+		hash256_64(data, data[0].val);
+		index >>= 1;
+	}
+	*merkle_root = data[0];
+}
+
+int uint256_merkle_proof_verify(const uint256_merkle_proof_t * proof, const uint256_t * merkle_root)
+{
+	if(proof->branch_size < 0 || proof->branch_size > UINT256_MERKLE_BRANCH_MAX_SIZE) return 0;
+	if(proof->branch_size < 32 && (proof->index >> proof->branch_size)) return 0;	// index out of range
+	
+	uint256_t root;
+	uint256_merkle_branch_compute_root(&proof->leaf, proof->index, proof->branch_size, proof->branch, &root);
+	return (0 == memcmp(&root, merkle_root, sizeof(root)));
+}
+
+ssize_t uint256_merkle_proofs_verify_batch(ssize_t count, const uint256_merkle_proof_t proofs[], 
+	const uint256_t * merkle_root, int * results)
+{
+	if(count <= 0) return 0;
+	assert(proofs && merkle_root);
+	
+	uint256_t * nodes = calloc(count, sizeof(*nodes));	// current node of each proof
+	uint256_t * pairs = calloc(count * 2, sizeof(*pairs));
+	uint256_t * parents = calloc(count, sizeof(*parents));
+	ssize_t * active = calloc(count, sizeof(*active));
+	assert(nodes && pairs && parents && active);
+	
+	int max_branch_size = 0;
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		nodes[i] = proofs[i].leaf;
+		if(proofs[i].branch_size > max_branch_size) max_branch_size = proofs[i].branch_size;
+	}
+	if(max_branch_size > UINT256_MERKLE_BRANCH_MAX_SIZE) max_branch_size = UINT256_MERKLE_BRANCH_MAX_SIZE;
+	
+	for(int height = 0; height < max_branch_size; ++height)
+	{
+		ssize_t num_active = 0;
+		for(ssize_t i = 0; i < count; ++i)
+		{
+			const uint256_merkle_proof_t * proof = &proofs[i];
+			if(height >= proof->branch_size) continue;
+			
+			uint256_t * pair = &pairs[num_active * 2];
+			if((proof->index >> height) & 1) {
+				pair[0] = proof->branch[height];
+				pair[1] = nodes[i];
+			}else {
+				pair[0] = nodes[i];
+				pair[1] = proof->branch[height];
+			}
+			active[num_active++] = i;
+		}
+		
+		// hash all pairs of this layer at once
+		sha256d64_batch((unsigned char *)parents, (const unsigned char *)pairs, num_active);
+		for(ssize_t k = 0; k < num_active; ++k) nodes[active[k]] = parents[k];
+	}
+	
+	ssize_t num_valid = 0;
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		const uint256_merkle_proof_t * proof = &proofs[i];
+		int ok = (proof->branch_size >= 0 && proof->branch_size <= UINT256_MERKLE_BRANCH_MAX_SIZE)
+			&& (proof->branch_size >= 32 || 0 == (proof->index >> proof->branch_size))
+			&& (0 == memcmp(&nodes[i], merkle_root, sizeof(nodes[i])));
+		if(results) results[i] = ok;
+		num_valid += ok;
+	}
+	
+	free(nodes);
+	free(pairs);
+	free(parents);
+	free(active);
+	return num_valid;
+}
+
+void uint256_partial_merkle_tree_cleanup(uint256_partial_merkle_tree_t * pmt)
+{
+	if(NULL == pmt) return;
+	free(pmt->hashes);
+	free(pmt->flags);
+	memset(pmt, 0, sizeof(*pmt));
+}
+
+static int partial_merkle_tree_push_bit(uint256_partial_merkle_tree_t * pmt, int bit, ssize_t max_bits)
+{
+	assert(pmt->bits_count < max_bits);
+	if(bit) pmt->flags[pmt->bits_count / 8] |= (uint8_t)(1 << (pmt->bits_count % 8));
+	++pmt->bits_count;
+	return 0;
+}
+
+static void partial_merkle_tree_build(uint256_merkle_tree_t * mtree, uint256_partial_merkle_tree_t * pmt, 
+	const uint8_t * match_flags, int height, size_t pos, ssize_t max_bits)
+{
+	// does this node contain at least one matched leaf
+	int parent_of_match = 0;
+	ssize_t end = (ssize_t)(pos + 1) << height;
+	if(end > mtree->count) end = mtree->count;
+	for(ssize_t i = (ssize_t)pos << height; i < end; ++i)
+	{
+		if(match_flags[i]) { parent_of_match = 1; break; }
+	}
+	partial_merkle_tree_push_bit(pmt, parent_of_match, max_bits);
+	
+	if(height == 0 || !parent_of_match) {
+		pmt->hashes[pmt->hashes_count++] = *merkle_tree_get_node(mtree, height, pos);
+		return;
+	}
+	
+	partial_merkle_tree_build(mtree, pmt, match_flags, height - 1, pos * 2, max_bits);
+	if((ssize_t)(pos * 2 + 1) < merkle_tree_calc_width(mtree->count, height - 1)) {
+		partial_merkle_tree_build(mtree, pmt, match_flags, height - 1, pos * 2 + 1, max_bits);
+	}
+}
+
+int uint256_merkle_tree_get_partial(uint256_merkle_tree_t * mtree, 
+	ssize_t num_matches, const int match_indexes[], 
+	uint256_partial_merkle_tree_t * pmt)
+{
+	assert(mtree && pmt);
+	if(mtree->count <= 0 || mtree->count > UINT32_MAX) return -1;
+	
+	int rc = merkle_tree_sync(mtree);
+	if(rc) return -1;
+	
+	uint8_t * match_flags = calloc(mtree->count, 1);
+	assert(match_flags);
+	for(ssize_t i = 0; i < num_matches; ++i)
+	{
+		int index = match_indexes[i];
+		if(index < 0 || index >= mtree->count) {
+			free(match_flags);
+			return -1;
+		}
+		match_flags[index] = 1;
+	}
+	
+	int height = 0;
+	while(merkle_tree_calc_width(mtree->count, height) > 1) ++height;
+	
+	// each node of the tree is visited at most once
+	ssize_t max_nodes = mtree->count * 2 + height;
+	
+	memset(pmt, 0, sizeof(*pmt));
+	pmt->total_txns = (uint32_t)mtree->count;
+	pmt->hashes = calloc(max_nodes, sizeof(*pmt->hashes));
+	pmt->flags = calloc((max_nodes + 7) / 8, 1);
+	assert(pmt->hashes && pmt->flags);
+	
+	partial_merkle_tree_build(mtree, pmt, match_flags, height, 0, max_nodes);
+	free(match_flags);
+	return 0;
+}
+
+// a block can never contain more txns than this (60 is a lower bound of the tx size)
+#define PARTIAL_MERKLE_TREE_MAX_TXNS	(MAX_BLOCK_WEIGHT / 60)
+
+struct partial_merkle_tree_extract_ctx
+{
+	const uint256_partial_merkle_tree_t * pmt;
+	ssize_t bits_used;
+	ssize_t hashes_used;
+	int bad;
+	
+	ssize_t num_matches;
+	ssize_t max_matches;
+	uint256_t * matches;
+	int * indexes;
+};
+
+static void partial_merkle_tree_traverse(struct partial_merkle_tree_extract_ctx * ctx, 
+	int height, size_t pos, uint256_t * hash)
+{
+	const uint256_partial_merkle_tree_t * pmt = ctx->pmt;
+	if(ctx->bits_used >= pmt->bits_count) {	// overflowed the bits array
+		ctx->bad = 1;
+		return;
+	}
+	int parent_of_match = (pmt->flags[ctx->bits_used / 8] >> (ctx->bits_used % 8)) & 1;
+	++ctx->bits_used;
+	
+	if(height == 0 || !parent_of_match) {
+		if(ctx->hashes_used >= pmt->hashes_count) {	// overflowed the hashes array
+			ctx->bad = 1;
+			return;
+		}
+		*hash = pmt->hashes[ctx->hashes_used++];
+		if(height == 0 && parent_of_match) {
+			if(ctx->num_matches < ctx->max_matches) {
+				if(ctx->matches) ctx->matches[ctx->num_matches] = *hash;
+				if(ctx->indexes) ctx->indexes[ctx->num_matches] = (int)pos;	// pos < total_txns <= PARTIAL_MERKLE_TREE_MAX_TXNS
+			}
+			++ctx->num_matches;
+		}
+		return;
+	}
+	
+	uint256_t data[2];
+	partial_merkle_tree_traverse(ctx, height - 1, pos * 2, &data[0]);
+	if(ctx->bad) return;
+	
+	if((ssize_t)(pos * 2 + 1) < merkle_tree_calc_width(pmt->total_txns, height - 1)) {
+		partial_merkle_tree_traverse(ctx, height - 1, pos * 2 + 1, &data[1]);
+		if(ctx->bad) return;
+		
+		// CVE-2012-2459: the right branch must not be identical to the left one
+		if(0 == memcmp(&data[0], &data[1], sizeof(data[0]))) {
+			ctx->bad = 1;
+			return;
+		}
+	}else {
+		data[1] = data[0];
+	}
+	hash256_64(data, hash->val);
+}
+
+/**
+ * uint256_partial_merkle_tree_extract:
+ * @return the number of matched leaves, or -1 if the partial merkle tree is malformed.
+ * 	at most max_matches leaves (and their indexes) are written to matches[] and indexes[].
+ */
+ssize_t uint256_partial_merkle_tree_extract(const uint256_partial_merkle_tree_t * pmt, 
+	uint256_t * merkle_root,
+	ssize_t max_matches, uint256_t matches[], int indexes[])
+{
+	assert(pmt && merkle_root);
+	if(pmt->total_txns == 0) return -1;
+	if(pmt->total_txns > PARTIAL_MERKLE_TREE_MAX_TXNS) return -1;	// total_txns is untrusted (from the wire)
+	if(pmt->hashes_count > pmt->total_txns) return -1;	// there can never be more hashes than txns
+	if(pmt->bits_count < pmt->hashes_count) return -1;	// there must be at least one bit per hash
+	
+	int height = 0;
+	while(merkle_tree_calc_width(pmt->total_txns, height) > 1) ++height;
+	
+	struct partial_merkle_tree_extract_ctx ctx = {
+		.pmt = pmt,
+		.max_matches = max_matches,
+		.matches = matches,
+		.indexes = indexes,
+	};
+	partial_merkle_tree_traverse(&ctx, height, 0, merkle_root);
+	if(ctx.bad) return -1;
+	
+	// all bits (except the padding of the last byte) and all hashes should be consumed
+	if((ctx.bits_used + 7) / 8 != (pmt->bits_count + 7) / 8) return -1;
+	if(ctx.hashes_used != pmt->hashes_count) return -1;
+	return ctx.num_matches;
+}
+
+ssize_t uint256_partial_merkle_tree_serialize(const uint256_partial_merkle_tree_t * pmt, unsigned char ** p_data)
+{
+	assert(pmt);
+	ssize_t flag_bytes = (pmt->bits_count + 7) / 8;
+	ssize_t size = sizeof(uint32_t)
+		+ varint_calc_size(pmt->hashes_count) + pmt->hashes_count * sizeof(uint256_t)
+		+ varint_calc_size(flag_bytes) + flag_bytes;
+	if(NULL == p_data) return size;
+	
+	unsigned char * payload = *p_data;
+	if(NULL == payload) {
+		payload = malloc(size);
+		assert(payload);
+		*p_data = payload;
+	}
+	
+	unsigned char * p = payload;
+	memcpy(p, &pmt->total_txns, sizeof(uint32_t)); p += sizeof(uint32_t);
+	
+	varint_set((varint_t *)p, pmt->hashes_count); p += varint_size((varint_t *)p);
+	if(pmt->hashes_count > 0) {
+		memcpy(p, pmt->hashes, pmt->hashes_count * sizeof(uint256_t));
+		p += pmt->hashes_count * sizeof(uint256_t);
+	}
+	
+	varint_set((varint_t *)p, flag_bytes); p += varint_size((varint_t *)p);
+	if(flag_bytes > 0) {
+		memcpy(p, pmt->flags, flag_bytes);
+		p += flag_bytes;
+	}
+	assert((p - payload) == size);
+	return size;
+}
+
+ssize_t uint256_partial_merkle_tree_parse(uint256_partial_merkle_tree_t * pmt, ssize_t length, const void * payload)
+{
+	assert(pmt && payload);
+	const unsigned char * p = payload;
+	const unsigned char * p_end = p + length;
+	ssize_t vint_size;
+	
+	memset(pmt, 0, sizeof(*pmt));
+	if((p + sizeof(uint32_t)) > p_end) return -1;
+	memcpy(&pmt->total_txns, p, sizeof(uint32_t)); p += sizeof(uint32_t);
+	
+	if(p >= p_end) return -1;
+	vint_size = varint_size((varint_t *)p);
+	if(vint_size <= 0 || (p + vint_size) > p_end) return -1;
+	uint64_t hashes_count = varint_get((varint_t *)p); p += vint_size;
+	if(hashes_count > (uint64_t)(p_end - p) / sizeof(uint256_t)) return -1;
+	
+	pmt->hashes_count = hashes_count;
+	if(hashes_count > 0) {
+		pmt->hashes = malloc(hashes_count * sizeof(uint256_t));
+		assert(pmt->hashes);
+		memcpy(pmt->hashes, p, hashes_count * sizeof(uint256_t));
+		p += hashes_count * sizeof(uint256_t);
+	}
+	
+	if(p >= p_end) goto label_error;
+	vint_size = varint_size((varint_t *)p);
+	if(vint_size <= 0 || (p + vint_size) > p_end) goto label_error;
+	uint64_t flag_bytes = varint_get((varint_t *)p); p += vint_size;
+	if(flag_bytes > (uint64_t)(p_end - p)) goto label_error;
+	
+	pmt->bits_count = flag_bytes * 8;
+	if(flag_bytes > 0) {
+		pmt->flags = malloc(flag_bytes);
+		assert(pmt->flags);
+		memcpy(pmt->flags, p, flag_bytes);
+		p += flag_bytes;
+	}
+	return (p - (const unsigned char *)payload);
+	
+label_error:
+	uint256_partial_merkle_tree_cleanup(pmt);
+	return -1;
+}
+
 /**********************************************************************
  * TEST MODULE
  * 	build and test: 
@@ -254,8 +1025,289 @@ void uint256_merkle_tree_free(uint256_merkle_tree_t * mtree)
 
 #include "utils.h"
 void recalc(const uint256_t * txes, ssize_t count, uint256_t * merkle_root);
+static void test_incremental_recalc(void)
+{
+	uint256_t * leaves = calloc(100, sizeof(*leaves));
+	assert(leaves);
+	for(int i = 0; i < 100; ++i) leaves[i].val[0] = i + 1;
+	
+	uint256_t truth[1];
+	uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(0, NULL);
+	mtree->add(mtree, 1, &leaves[0]);
+	mtree->recalc(mtree, 0, -1);
+	assert(0 == memcmp(&leaves[0], &mtree->merkle_root, 32));
+	
+	for(int n = 2; n < 70; ++n)
+	{
+		mtree->add(mtree, 1, &leaves[n - 1]);	// grow the tree by one leaf
+		mtree->recalc(mtree, n - 1, 1);
+		recalc(leaves, n, truth);
+		assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+		
+		// update single leaves
+		for(int i = 0; i < n; i += 3)
+		{
+			leaves[i].val[1] ^= 0xff;
+			mtree->set(mtree, i, leaves[i]);
+			mtree->recalc(mtree, i, 1);
+			recalc(leaves, n, truth);
+			assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+		}
+	}
+	
+	// remove: the last leaf is moved to the removed position
+	while(mtree->count > 2)
+	{
+		int index = mtree->count / 3;
+		mtree->remove(mtree, index);
+		leaves[index] = leaves[mtree->count];
+		mtree->recalc(mtree, index, 1);
+		recalc(leaves, mtree->count, truth);
+		assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+	}
+	uint256_merkle_tree_free(mtree);
+	free(leaves);
+	printf("%s() passed.\n", __FUNCTION__);
+}
+
+static ssize_t s_num_hashes;
+static void counting_hash256(const void * data, size_t size, uint8_t hash[])
+{
+	++s_num_hashes;
+	hash256(data, size, hash);
+}
+
+static void test_scattered_updates(void)
+{
+	const int num_leaves = 1000;
+	uint256_t * leaves = calloc(num_leaves, sizeof(*leaves));
+	assert(leaves);
+	for(int i = 0; i < num_leaves; ++i) leaves[i].val[0] = i + 1, leaves[i].val[1] = i >> 8;
+	
+	uint256_t truth[1];
+	uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(0, NULL);
+	mtree->hash_func = counting_hash256;	// hash the pairs one by one
+	mtree->add(mtree, num_leaves, leaves);
+	mtree->recalc(mtree, 0, -1);
+	recalc(leaves, num_leaves, truth);
+	assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+	
+	// scattered leaves, out of order and repeated, with a single recalc
+	static const int indexes[] = { 999, 3, 517, 3, 64, 998, 0, 517, 250 };
+	const int k = sizeof(indexes) / sizeof(indexes[0]);
+	for(int round = 0; round < 3; ++round)
+	{
+		for(int i = 0; i < k; ++i)
+		{
+			leaves[indexes[i]].val[2] += 1 + round;
+			mtree->set(mtree, indexes[i], leaves[indexes[i]]);
+		}
+		s_num_hashes = 0;
+		mtree->recalc(mtree, indexes[k - 1], 1);
+		recalc(leaves, num_leaves, truth);
+		assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+		
+		// only the paths of the dirty leaves are rehashed (10 layers)
+		assert(s_num_hashes > 0 && s_num_hashes <= k * 10);
+	}
+	
+	// scattered updates combined with add / remove before one recalc
+	int count = num_leaves;
+	for(int i = 0; i < k; ++i)
+	{
+		leaves[indexes[i]].val[3] ^= 0x5a;
+		mtree->set(mtree, indexes[i], leaves[indexes[i]]);
+	}
+	mtree->remove(mtree, 10);
+	leaves[10] = leaves[--count];
+	mtree->remove(mtree, count - 1);	// the last leaf
+	--count;
+	mtree->recalc(mtree, 10, 1);
+	recalc(leaves, count, truth);
+	assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+	
+	leaves[count].val[4] = 0xaa;
+	mtree->add(mtree, 1, &leaves[count++]);
+	leaves[700].val[4] = 0xbb;
+	mtree->set(mtree, 700, leaves[700]);
+	mtree->recalc(mtree, 700, 1);
+	recalc(leaves, count, truth);
+	assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+	
+	uint256_merkle_tree_free(mtree);
+	free(leaves);
+	printf("%s() passed.\n", __FUNCTION__);
+}
+
+static void test_merkle_proofs(void)
+{
+	uint256_t * leaves = calloc(100, sizeof(*leaves));
+	uint256_t * branches = calloc(100 * UINT256_MERKLE_BRANCH_MAX_SIZE, sizeof(*branches));
+	uint256_merkle_proof_t * proofs = calloc(100, sizeof(*proofs));
+	int results[100];
+	assert(leaves && branches && proofs);
+	for(int i = 0; i < 100; ++i) leaves[i].val[0] = i + 1;
+	
+	for(int n = 1; n <= 100; n += 11)
+	{
+		uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(0, NULL);
+		mtree->add(mtree, n, leaves);
+		mtree->recalc(mtree, 0, -1);
+		
+		for(int i = 0; i < n; ++i)
+		{
+			uint256_t * branch = &branches[i * UINT256_MERKLE_BRANCH_MAX_SIZE];
+			ssize_t branch_size = uint256_merkle_tree_get_branch(mtree, i, branch);
+			assert(branch_size >= 0);
+			proofs[i] = (uint256_merkle_proof_t){
+				.leaf = leaves[i], 
+				.index = i, 
+				.branch_size = branch_size, 
+				.branch = branch,
+			};
+			assert(uint256_merkle_proof_verify(&proofs[i], &mtree->merkle_root));
+		}
+		assert(n == uint256_merkle_proofs_verify_batch(n, proofs, &mtree->merkle_root, results));
+		
+		proofs[n / 2].leaf.val[31] ^= 1;	// tamper one proof
+		assert((n - 1) == uint256_merkle_proofs_verify_batch(n, proofs, &mtree->merkle_root, results));
+		assert(0 == results[n / 2]);
+		
+		// partial merkle tree with every 7th leaf matched
+		int match_indexes[100];
+		int num_matches = 0;
+		for(int i = 0; i < n; i += 7) match_indexes[num_matches++] = i;
+		
+		uint256_partial_merkle_tree_t pmt[1], pmt_copy[1];
+		int rc = uint256_merkle_tree_get_partial(mtree, num_matches, match_indexes, pmt);
+		assert(0 == rc);
+		
+		unsigned char * payload = NULL;
+		ssize_t cb = uint256_partial_merkle_tree_serialize(pmt, &payload);
+		assert(cb > 0 && payload);
+		assert(cb == uint256_partial_merkle_tree_parse(pmt_copy, cb, payload));
+		
+		uint256_t root;
+		uint256_t matches[100];
+		int indexes[100];
+		ssize_t count = uint256_partial_merkle_tree_extract(pmt_copy, &root, 100, matches, indexes);
+		assert(count == num_matches);
+		assert(0 == memcmp(&root, &mtree->merkle_root, 32));
+		for(int i = 0; i < count; ++i)
+		{
+			assert(indexes[i] == match_indexes[i]);
+			assert(0 == memcmp(&matches[i], &leaves[indexes[i]], 32));
+		}
+		
+		// a truncated tree must be rejected
+		pmt_copy->hashes_count--;
+		assert(-1 == uint256_partial_merkle_tree_extract(pmt_copy, &root, 100, matches, indexes));
+		pmt_copy->hashes_count++;
+		
+		// a hostile total_txns must be rejected
+		pmt_copy->total_txns = UINT32_MAX;
+		assert(-1 == uint256_partial_merkle_tree_extract(pmt_copy, &root, 100, matches, indexes));
+		
+		free(payload);
+		uint256_partial_merkle_tree_cleanup(pmt);
+		uint256_partial_merkle_tree_cleanup(pmt_copy);
+		uint256_merkle_tree_free(mtree);
+	}
+	free(proofs);
+	free(branches);
+	free(leaves);
+	printf("%s() passed.\n", __FUNCTION__);
+}
+
+static void test_parallel_recalc(void)
+{
+	const int count = 20001;
+	uint256_t * leaves = calloc(count, sizeof(*leaves));
+	assert(leaves);
+	for(int i = 0; i < count; ++i) {
+		leaves[i].val[0] = i & 0xff;
+		leaves[i].val[1] = (i >> 8) & 0xff;
+	}
+	
+	uint256_t truth[1];
+	recalc(leaves, count, truth);
+	
+	uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(0, NULL);
+	int rc = uint256_merkle_tree_set_threads(mtree, 4, 64);
+	assert(0 == rc);
+	mtree->add(mtree, count, leaves);
+	for(int i = 0; i < 3; ++i) {
+		mtree->recalc(mtree, 0, -1);
+		assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+	}
+	
+	// incremental recalc of a wide range
+	for(int i = 100; i < 10000; ++i) leaves[i].val[2] = 1;
+	recalc(leaves, count, truth);
+	for(int i = 100; i < 10000; ++i) mtree->set(mtree, i, leaves[i]);
+	mtree->recalc(mtree, 100, 9900);
+	assert(0 == memcmp(truth, &mtree->merkle_root, 32));
+	
+	uint256_merkle_tree_free(mtree);
+	free(leaves);
+	printf("%s() passed.\n", __FUNCTION__);
+}
+
+struct shared_pool_task
+{
+	uint256_merkle_tree_thread_pool_t * pool;
+	const uint256_t * leaves;
+	int count;
+	const uint256_t * truth;
+};
+static void * shared_pool_thread(void * user_data)
+{
+	struct shared_pool_task * task = user_data;
+	for(int i = 0; i < 20; ++i) {	// a new tree per round, as block_parse() does per block
+		uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(task->count, NULL);
+		uint256_merkle_tree_set_thread_pool(mtree, task->pool, (i % 3) + 1);
+		mtree->add(mtree, task->count, task->leaves);
+		mtree->recalc(mtree, 0, -1);
+		assert(0 == memcmp(task->truth, &mtree->merkle_root, 32));
+		uint256_merkle_tree_free(mtree);
+	}
+	return NULL;
+}
+
+static void test_shared_pool(void)
+{
+	const int count = 5000;
+	uint256_t * leaves = calloc(count, sizeof(*leaves));
+	assert(leaves);
+	for(int i = 0; i < count; ++i) {
+		leaves[i].val[0] = i & 0xff;
+		leaves[i].val[1] = (i >> 8) & 0xff;
+	}
+	uint256_t truth[1];
+	recalc(leaves, count, truth);
+	
+	uint256_merkle_tree_thread_pool_t * pool = uint256_merkle_tree_thread_pool_new(4, 64);
+	assert(pool);
+	
+	// several trees (in different threads) post their layers to the same pool
+	struct shared_pool_task task = { .pool = pool, .leaves = leaves, .count = count, .truth = truth };
+	pthread_t threads[3];
+	for(int i = 0; i < 3; ++i) pthread_create(&threads[i], NULL, shared_pool_thread, &task);
+	for(int i = 0; i < 3; ++i) pthread_join(threads[i], NULL);
+	
+	uint256_merkle_tree_thread_pool_free(pool);
+	free(leaves);
+	printf("%s() passed.\n", __FUNCTION__);
+}
+
 int main(int argc, char ** argv)
 {
+	test_incremental_recalc();
+	test_scattered_updates();
+	test_merkle_proofs();
+	test_parallel_recalc();
+	test_shared_pool();
+	
 	char exe_name[PATH_MAX] = "";
 	readlink("/proc/self/exe", exe_name, sizeof(exe_name));
 	
@@ -0,0 +1,456 @@
+/*
+ * satoshi-block-view.c
+ *
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <stdint.h>
+
+#include "crypto.h"
+#include "utils.h"
+#include "sha.h"
+
+#include "satoshi-types.h"
+#include "satoshi-block-view.h"
+#include "bitcoin-consensus.h"
+
+#ifdef _DEBUG
+#define message_parser_error_handler(fmt, ...) do { \
+		fprintf(stderr, "\e31m[ERROR]::%s@%d::%s(): " fmt "\e[39m" "\n", \
+			__FILE__, __LINE__, __FUNCTION__,	\
+			##__VA_ARGS__);						\
+		if(satoshi_parser_abort_on_error) abort();	\
+		goto label_error;						\
+	} while(0)
+#else
+#define message_parser_error_handler(fmt, ...) do { \
+		fprintf(stderr, "\e31m[ERROR]::%s@%d::%s(): " fmt "\e[39m" "\n", \
+			__FILE__, __LINE__, __FUNCTION__,	\
+			##__VA_ARGS__);						\
+		goto label_error;						\
+	} while(0)
+#endif
+
+static const satoshi_outpoint_t s_coinbase_outpoint[1] = {{
+	.prev_hash = {0},
+	.index = 0xffffffff
+}};
+
+/**
+ * view_parse_varint:
+ * 	@return
+ * 		next offset on success,
+ * 		NULL on error.
+ */
+static inline const unsigned char * view_parse_varint(
+	const unsigned char * p,
+	const unsigned char * p_end,
+	ssize_t * value)
+{
+	if(p >= p_end) return NULL;
+
+	size_t vint_size = varint_size((varint_t *)p);
+	if((p + vint_size) > p_end) return NULL;
+
+	*value = varint_get((varint_t *)p);
+	if(*value < 0) return NULL;
+	return (p + vint_size);
+}
+
+/**
+ * view_parse_span:
+ * 	parse a varstr without copying,
+ * 	the span is set to the data part (without the varint prefix).
+ */
+static inline const unsigned char * view_parse_span(
+	const unsigned char * p,
+	const unsigned char * p_end,
+	const unsigned char * payload,
+	satoshi_data_span_t * span)
+{
+	ssize_t length = 0;
+	p = view_parse_varint(p, p_end, &length);
+	if(NULL == p || length > (p_end - p)) return NULL;
+
+	span->offset = (uint32_t)(p - payload);
+	span->length = (uint32_t)length;
+	return p + length;
+}
+
+/**
+ * minimum serialized sizes:
+ * 	a count read from the payload can not exceed (bytes left / min size), 
+ * 	check it before reserving the arrays, so that a short payload can't force a huge allocation.
+ */
+#define VIEW_MIN_TX_SIZE			(60)	// version(4) + varint(1) + txin(41) + varint(1) + txout(9) + lock_time(4)
+#define VIEW_MIN_TXIN_SIZE			(41)	// outpoint(36) + varint(1) + sequence(4)
+#define VIEW_MIN_TXOUT_SIZE			(9)		// value(8) + varint(1)
+#define VIEW_MIN_WITNESS_ITEM_SIZE	(1)		// varint(1)
+#define view_count_exceeds(count, p, p_end, min_size) ((count) > ((p_end) - (p)) / (min_size))
+
+#define VIEW_ALLOC_SIZE (1024)
+#define view_array_reserve(view, items, max_size, size) ({							\
+		int rc = 0;																\
+		if((size) > (view)->max_size) {											\
+			ssize_t new_size = ((size) + VIEW_ALLOC_SIZE - 1) 					\
+				/ VIEW_ALLOC_SIZE * VIEW_ALLOC_SIZE;							\
+			void * data = realloc((view)->items, new_size * sizeof(*(view)->items));	\
+			if(NULL == data) rc = -1;											\
+			else {																\
+				(view)->items = data;											\
+				(view)->max_size = new_size;									\
+			}																	\
+		}																		\
+		rc;																		\
+	})
+
+static const unsigned char * parse_tx_view(satoshi_block_view_t * view,
+	satoshi_tx_view_t * tx,
+	const unsigned char * p, const unsigned char * p_end)
+{
+	const unsigned char * payload = view->payload;
+	const unsigned char * p_tx = p;
+
+	memset(tx, 0, sizeof(*tx));
+
+	// version
+	if((p + sizeof(int32_t)) > p_end) return NULL;
+	memcpy(&tx->version, p, sizeof(int32_t));
+	p += sizeof(int32_t);
+
+	// witness flag
+	if((p + 2) > p_end) return NULL;
+	if(p[0] == 0) {
+		if(p[1] != 1) return NULL;
+		tx->has_flag = 1;
+		p += 2;
+	}
+
+	// txins
+	const unsigned char * p_txins = p;	// {num_txins, txins_data}
+	p = view_parse_varint(p, p_end, &tx->txin_count);
+	if(NULL == p || tx->txin_count <= 0) return NULL;
+	if(view_count_exceeds(tx->txin_count, p, p_end, VIEW_MIN_TXIN_SIZE)) return NULL;
+
+	tx->txin_start = view->txins_count;
+	if(view_array_reserve(view, txins, max_txins, view->txins_count + tx->txin_count)) return NULL;
+
+	satoshi_txin_view_t * txins = &view->txins[tx->txin_start];
+	for(ssize_t i = 0; i < tx->txin_count; ++i)
+	{
+		satoshi_txin_view_t * txin = &txins[i];
+		memset(txin, 0, sizeof(*txin));
+
+		if((p + sizeof(struct satoshi_outpoint)) > p_end) return NULL;
+		txin->outpoint_offset = (uint32_t)(p - payload);
+		txin->is_coinbase = (0 == memcmp(p, s_coinbase_outpoint, sizeof(struct satoshi_outpoint)));
+		p += sizeof(struct satoshi_outpoint);
+
+		p = view_parse_span(p, p_end, payload, &txin->scripts);
+		if(NULL == p) return NULL;
+
+		if((p + sizeof(uint32_t)) > p_end) return NULL;
+		memcpy(&txin->sequence, p, sizeof(uint32_t));
+		p += sizeof(uint32_t);
+	}
+	view->txins_count += tx->txin_count;
+
+	// txouts
+	p = view_parse_varint(p, p_end, &tx->txout_count);
+	if(NULL == p || tx->txout_count <= 0) return NULL;
+	if(view_count_exceeds(tx->txout_count, p, p_end, VIEW_MIN_TXOUT_SIZE)) return NULL;
+
+	tx->txout_start = view->txouts_count;
+	if(view_array_reserve(view, txouts, max_txouts, view->txouts_count + tx->txout_count)) return NULL;
+
+	satoshi_txout_view_t * txouts = &view->txouts[tx->txout_start];
+	for(ssize_t i = 0; i < tx->txout_count; ++i)
+	{
+		satoshi_txout_view_t * txout = &txouts[i];
+		if((p + sizeof(int64_t)) > p_end) return NULL;
+		memcpy(&txout->value, p, sizeof(int64_t));
+		p += sizeof(int64_t);
+
+		p = view_parse_span(p, p_end, payload, &txout->scripts);
+		if(NULL == p) return NULL;
+	}
+	view->txouts_count += tx->txout_count;
+	const unsigned char * p_txouts_end = p;
+
+	// witnesses
+	if(tx->has_flag && ((p + sizeof(uint32_t)) < p_end))
+	{
+		const unsigned char * p_witnesses = p;
+		for(ssize_t i = 0; i < tx->txin_count; ++i)
+		{
+			satoshi_txin_view_t * txin = &view->txins[tx->txin_start + i];
+
+			p = view_parse_varint(p, p_end, &txin->num_witness_items);
+			if(NULL == p) return NULL;
+			if(view_count_exceeds(txin->num_witness_items, p, p_end, VIEW_MIN_WITNESS_ITEM_SIZE)) return NULL;
+
+			txin->witness_start = view->witness_items_count;
+			if(txin->num_witness_items == 0) continue;
+			if(view_array_reserve(view, witness_items, max_witness_items,
+				view->witness_items_count + txin->num_witness_items)) return NULL;
+
+			satoshi_data_span_t * items = &view->witness_items[txin->witness_start];
+			for(ssize_t item_index = 0; item_index < txin->num_witness_items; ++item_index)
+			{
+				p = view_parse_span(p, p_end, payload, &items[item_index]);
+				if(NULL == p) return NULL;
+			}
+			view->witness_items_count += txin->num_witness_items;
+		}
+		tx->witnesses.offset = (uint32_t)(p_witnesses - payload);
+		tx->witnesses.length = (uint32_t)(p - p_witnesses);
+	}
+
+	// lock_time
+	if((p + sizeof(uint32_t)) > p_end) return NULL;
+	const unsigned char * p_lock_time = p;
+	memcpy(&tx->lock_time, p, sizeof(uint32_t));
+	p += sizeof(uint32_t);
+
+	tx->span.offset = (uint32_t)(p_tx - payload);
+	tx->span.length = (uint32_t)(p - p_tx);
+
+	// txid: hash256([nVersion][txins][txouts][nLockTime]), hashed directly from the payload
+	sha256_ctx_t sha[1];
+	sha256_init(sha);
+	sha256_update(sha, p_tx, sizeof(int32_t));
+	sha256_update(sha, p_txins, (p_txouts_end - p_txins));
+	sha256_update(sha, p_lock_time, sizeof(uint32_t));
+	sha256_final(sha, (unsigned char *)tx->txid);
+	sha256_init(sha);
+	sha256_update(sha, (unsigned char *)tx->txid, 32);
+	sha256_final(sha, (unsigned char *)tx->txid);
+
+	if(tx->has_flag) hash256(p_tx, tx->span.length, (unsigned char *)tx->wtxid);
+	else memcpy(tx->wtxid, tx->txid, sizeof(uint256_t));
+
+	return p;
+}
+
+ssize_t satoshi_block_view_parse(satoshi_block_view_t * view, ssize_t length, const void * payload)
+{
+	assert(view && (length > 0) && payload);
+	const unsigned char * p = payload;
+	const unsigned char * p_end = p + length;
+	satoshi_block_view_reset(view);
+	view->payload = payload;
+	view->length = length;
+
+	// parse block header
+	if((p + sizeof(struct satoshi_block_header)) > p_end) {
+		message_parser_error_handler("parse block header failed: %s", "invalid payload length");
+	}
+	view->hdr = (const struct satoshi_block_header *)p;
+	p += sizeof(struct satoshi_block_header);
+
+	hash256_80(payload, (uint8_t *)&view->hash);
+	if(uint256_compare_with_compact(&view->hash, (compact_uint256_t *)&view->hdr->bits) > 0) {
+		message_parser_error_handler("Difficulty invalid (greater than 0x%.8x).", view->hdr->bits);
+	}
+
+	if(length == sizeof(struct satoshi_block_header)) // block header only
+	{
+		return sizeof(struct satoshi_block_header);
+	}
+
+	// parse txn_count
+	ssize_t txn_count = 0;
+	p = view_parse_varint(p, p_end, &txn_count);
+	if(NULL == p || txn_count <= 0 || view_count_exceeds(txn_count, p, p_end, VIEW_MIN_TX_SIZE)) {
+		message_parser_error_handler("invalid txn_count: %ld", (long)txn_count);
+	}
+	if(view_array_reserve(view, txns, max_txns, txn_count)) {
+		message_parser_error_handler("allocate txns[%ld] failed.", (long)txn_count);
+	}
+	view->txn_count = txn_count;
+
+	uint256_merkle_tree_t * mtree = view->mtree;
+	if(NULL == mtree) {
+		mtree = view->mtree = uint256_merkle_tree_new(txn_count, view);
+		assert(mtree);
+	}
+	uint256_merkle_tree_reset(mtree);
+
+	for(ssize_t i = 0; i < txn_count; ++i)
+	{
+		p = parse_tx_view(view, &view->txns[i], p, p_end);
+		if(NULL == p) {
+			message_parser_error_handler("parse tx[%d] failed: invalid payload data", (int)i);
+		}
+		mtree->add(mtree, 1, view->txns[i].txid);
+	}
+	mtree->recalc(mtree, 0, -1);
+
+	// verify merkle root
+	if(0 != memcmp(view->hdr->merkle_root, &mtree->merkle_root, 32)) {
+		message_parser_error_handler("Verification of merkle-root failed. There's one or more invalid transactions in the block.");
+	}
+
+	assert(p <= p_end);
+	ssize_t block_size = (p - (unsigned char *)payload);
+	assert(block_size <= MAX_BLOCK_SERIALIZED_SIZE);
+	return block_size;
+
+label_error:
+	satoshi_block_view_reset(view);
+	return -1;
+}
+
+/**
+ * satoshi_block_view_reset:
+ * 	clear the parsed results and keep the allocated arrays for the next block.
+ */
+void satoshi_block_view_reset(satoshi_block_view_t * view)
+{
+	if(NULL == view) return;
+	view->payload = NULL;
+	view->length = 0;
+	view->hdr = NULL;
+	memset(&view->hash, 0, sizeof(view->hash));
+
+	view->txn_count = 0;
+	view->txins_count = 0;
+	view->txouts_count = 0;
+	view->witness_items_count = 0;
+	return;
+}
+
+void satoshi_block_view_cleanup(satoshi_block_view_t * view)
+{
+	if(NULL == view) return;
+	free(view->txns);
+	free(view->txins);
+	free(view->txouts);
+	free(view->witness_items);
+	uint256_merkle_tree_free(view->mtree);
+	memset(view, 0, sizeof(*view));
+	return;
+}
+
+
+#if defined(_TEST_SATOSHI_BLOCK_VIEW) && defined(_STAND_ALONE)
+int main(int argc, char ** argv)
+{
+	// block_height: 100000
+	const char * hex =
+	"0100000050120119172a610421a6c3011dd330d9df07b63616c2cc1f1cd00200000000006657a925"
+	"2aacd5c0b2940996ecff952228c3067cc38d4885efb5a4ac4247e9f337221b4d4c86041b0f2b5710"
+	"0401000000010000000000000000000000000000000000000000000000000000000000000000ffff"
+	"ffff08044c86041b020602ffffffff0100f2052a010000004341041b0e8c2567c12536aa13357b79"
+	"a073dc4444acb83c4ec7a0e2f99dd7457516c5817242da796924ca4e99947d087fedf9ce467cb9f7"
+	"c6287078f801df276fdf84ac000000000100000001032e38e9c0a84c6046d687d10556dcacc41d27"
+	"5ec55fc00779ac88fdf357a187000000008c493046022100c352d3dd993a981beba4a63ad15c2092"
+	"75ca9470abfcd57da93b58e4eb5dce82022100840792bc1f456062819f15d33ee7055cf7b5ee1af1"
+	"ebcc6028d9cdb1c3af7748014104f46db5e9d61a9dc27b8d64ad23e7383a4e6ca164593c2527c038"
+	"c0857eb67ee8e825dca65046b82c9331586c82e0fd1f633f25f87c161bc6f8a630121df2b3d3ffff"
+	"ffff0200e32321000000001976a914c398efa9c392ba6013c5e04ee729755ef7f58b3288ac000fe2"
+	"08010000001976a914948c765a6914d43f2a7ac177da2c2f6b52de3d7c88ac000000000100000001"
+	"c33ebff2a709f13d9f9a7569ab16a32786af7d7e2de09265e41c61d078294ecf010000008a473044"
+	"0220032d30df5ee6f57fa46cddb5eb8d0d9fe8de6b342d27942ae90a3231e0ba333e02203deee806"
+	"0fdc70230a7f5b4ad7d7bc3e628cbe219a886b84269eaeb81e26b4fe014104ae31c31bf91278d99b"
+	"8377a35bbce5b27d9fff15456839e919453fc7b3f721f0ba403ff96c9deeb680e5fd341c0fc3a7b9"
+	"0da4631ee39560639db462e9cb850fffffffff0240420f00000000001976a914b0dcbf97eabf4404"
+	"e31d952477ce822dadbe7e1088acc060d211000000001976a9146b1281eec25ab4e1e0793ff4e08a"
+	"b1abb3409cd988ac0000000001000000010b6072b386d4a773235237f64c1126ac3b240c84b917a3"
+	"909ba1c43ded5f51f4000000008c493046022100bb1ad26df930a51cce110cf44f7a48c3c561fd97"
+	"7500b1ae5d6b6fd13d0b3f4a022100c5b42951acedff14abba2736fd574bdb465f3e6f8da12e2c53"
+	"03954aca7f78f3014104a7135bfe824c97ecc01ec7d7e336185c81e2aa2c41ab175407c09484ce96"
+	"94b44953fcb751206564a9c24dd094d42fdbfdd5aad3e063ce6af4cfaaea4ea14fbbffffffff0140"
+	"420f00000000001976a91439aa3d569e06a1d7926dc4be1193c99bf2eb9ee088ac00000000";
+
+	unsigned char * block_data = NULL;
+	ssize_t cb_block = hex2bin(hex, strlen(hex), (void **)&block_data);
+	assert(cb_block > 0 && block_data);
+
+	satoshi_block_view_t view[1];
+	memset(view, 0, sizeof(view));
+
+	// parse twice to verify the view can be reused
+	for(int round = 0; round < 2; ++round)
+	{
+		ssize_t cb = satoshi_block_view_parse(view, cb_block, block_data);
+		assert(cb == cb_block);
+		assert(view->txn_count == 4);
+		assert(view->txins_count == 4 && view->txouts_count == 6);
+	}
+
+	// compare with satoshi_block_parse()
+	satoshi_block_t block[1];
+	memset(block, 0, sizeof(block));
+	ssize_t cb = satoshi_block_parse(block, cb_block, block_data);
+	assert(cb == cb_block);
+	assert(0 == memcmp(&block->hash, &view->hash, 32));
+
+	for(ssize_t i = 0; i < view->txn_count; ++i)
+	{
+		const satoshi_tx_view_t * tx = &view->txns[i];
+		const satoshi_tx_t * ref = &block->txns[i];
+		assert(0 == memcmp(tx->txid, ref->txid, 32));
+		assert(tx->txin_count == ref->txin_count && tx->txout_count == ref->txout_count);
+
+		for(ssize_t ii = 0; ii < tx->txin_count; ++ii) {
+			const satoshi_txin_view_t * txin = &view->txins[tx->txin_start + ii];
+			assert(0 == memcmp(satoshi_block_view_get_outpoint(view, txin), &ref->txins[ii].outpoint, sizeof(satoshi_outpoint_t)));
+			assert(txin->scripts.length == ref->txins[ii].cb_scripts);
+			assert(0 == memcmp(satoshi_block_view_get_data(view, txin->scripts),
+				varstr_getdata_ptr(ref->txins[ii].scripts), txin->scripts.length));
+		}
+		for(ssize_t ii = 0; ii < tx->txout_count; ++ii) {
+			const satoshi_txout_view_t * txout = &view->txouts[tx->txout_start + ii];
+			assert(txout->value == ref->txouts[ii].value);
+			assert(txout->scripts.length == varstr_length(ref->txouts[ii].scripts));
+		}
+		dump_line("txid: ", tx->txid, 32);
+	}
+
+	// a txn_count that can not fit in the payload must be rejected before any allocation
+	satoshi_parser_abort_on_error = 0;
+	unsigned char * bad_data = malloc(cb_block);
+	assert(bad_data);
+	memcpy(bad_data, block_data, cb_block);
+	ssize_t max_txns = view->max_txns;
+	bad_data[80] = 0xfe;	// txn_count: 0xfe + uint32 (overwrites the version of the first tx)
+	bad_data[81] = bad_data[82] = bad_data[83] = bad_data[84] = 0xff;
+	assert(-1 == satoshi_block_view_parse(view, cb_block, bad_data));
+	assert(view->max_txns == max_txns);
+	free(bad_data);
+	satoshi_parser_abort_on_error = 1;
+
+	satoshi_block_cleanup(block);
+	satoshi_block_view_cleanup(view);
+	free(block_data);
+	return 0;
+}
+#endif
@@ -33,6 +33,8 @@
 #include <assert.h>
 
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "crypto.h"
 #include "utils.h"
@@ -331,6 +333,130 @@ ssize_t uint256_from_string(uint256_t * u256, int from_little_endian, const char
 	return cb;
 }
 
+/************************************************************
+ * @ingroup satoshi_arena
+ * 
+ */
+#define SATOSHI_ARENA_DEFAULT_CHUNK_SIZE (1 << 20)
+#define SATOSHI_ARENA_ALIGN (16)
+struct satoshi_arena_chunk
+{
+	struct satoshi_arena_chunk * next;
+	size_t size;
+	size_t used;
+	unsigned char data[] __attribute__((aligned(SATOSHI_ARENA_ALIGN)));
+};
+
+static struct satoshi_arena_chunk * satoshi_arena_chunk_new(size_t size)
+{
+	struct satoshi_arena_chunk * chunk = malloc(sizeof(*chunk) + size);
+	assert(chunk);
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+satoshi_arena_t * satoshi_arena_init(satoshi_arena_t * arena, size_t chunk_size)
+{
+	if(NULL == arena) arena = calloc(1, sizeof(*arena));
+	assert(arena);
+	
+	if(0 == chunk_size) chunk_size = SATOSHI_ARENA_DEFAULT_CHUNK_SIZE;
+	arena->chunk_size = chunk_size;
+	arena->chunks = satoshi_arena_chunk_new(chunk_size);
+	return arena;
+}
+
+void * satoshi_arena_alloc(satoshi_arena_t * arena, size_t size)
+{
+	assert(arena);
+	size = (size + SATOSHI_ARENA_ALIGN - 1) & ~((size_t)SATOSHI_ARENA_ALIGN - 1);
+	
+	struct satoshi_arena_chunk * chunk = arena->chunks;
+	if(NULL == chunk || (chunk->used + size) > chunk->size)
+	{
+		size_t chunk_size = (size > arena->chunk_size)?size:arena->chunk_size;
+		chunk = satoshi_arena_chunk_new(chunk_size);
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	
+	void * data = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(data, 0, size);
+	return data;
+}
+
+/**
+ * satoshi_arena_reset:
+ * 	release all objects allocated from the arena.
+ * 	If the last block needed more than one chunk, 
+ * 	the chunks are merged into a single one, 
+ * 	so that parsing a similar-sized block later will not touch the heap.
+ */
+void satoshi_arena_reset(satoshi_arena_t * arena)
+{
+	if(NULL == arena) return;
+	struct satoshi_arena_chunk * chunk = arena->chunks;
+	if(NULL == chunk) return;
+	
+	if(chunk->next)
+	{
+		size_t total_size = 0;
+		while(chunk)
+		{
+			struct satoshi_arena_chunk * next = chunk->next;
+			total_size += chunk->size;
+			free(chunk);
+			chunk = next;
+		}
+		if(total_size > arena->chunk_size) arena->chunk_size = total_size;
+		arena->chunks = satoshi_arena_chunk_new(arena->chunk_size);
+		return;
+	}
+	chunk->used = 0;
+	return;
+}
+
+void satoshi_arena_cleanup(satoshi_arena_t * arena)
+{
+	if(NULL == arena) return;
+	struct satoshi_arena_chunk * chunk = arena->chunks;
+	while(chunk)
+	{
+		struct satoshi_arena_chunk * next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->chunks = NULL;
+	return;
+}
+
+void satoshi_arena_free(satoshi_arena_t * arena)
+{
+	if(NULL == arena) return;
+	satoshi_arena_cleanup(arena);
+	free(arena);
+	return;
+}
+
+static inline void * arena_calloc(satoshi_arena_t * arena, size_t n, size_t size)
+{
+	if(NULL == arena) return calloc(n, size);
+	return satoshi_arena_alloc(arena, n * size);
+}
+
+static inline varstr_t * arena_varstr_clone(satoshi_arena_t * arena, const varstr_t * vstr)
+{
+	if(NULL == arena) return varstr_clone(vstr);
+	
+	size_t vstr_size = varstr_size(vstr);
+	varstr_t * dst = satoshi_arena_alloc(arena, vstr_size);
+	memcpy(dst, vstr, vstr_size);
+	return dst;
+}
+
 /************************************************************
  * @ingroup satoshi_tx
  * 
@@ -340,7 +466,7 @@ ssize_t uint256_from_string(uint256_t * u256, int from_little_endian, const char
 		fprintf(stderr, "\e31m[ERROR]::%s@%d::%s(): " fmt "\e[39m" "\n", \
 			__FILE__, __LINE__, __FUNCTION__,	\
 			##__VA_ARGS__);						\
-		abort();								\
+		if(satoshi_parser_abort_on_error) abort();	\
 		goto label_error;						\
 	} while(0)
 #else
@@ -352,6 +478,8 @@ ssize_t uint256_from_string(uint256_t * u256, int from_little_endian, const char
 	} while(0)
 #endif
 
+int satoshi_parser_abort_on_error = 1;
+
 static const satoshi_outpoint_t s_coinbase_outpoint[1] = {{
 	.prev_hash = {0},
 	.index = 0xffffffff
@@ -390,7 +518,8 @@ static inline const unsigned char * parse_varint(
 static inline const unsigned char * parse_varstr(
 	const unsigned char * p, 
 	const unsigned char * p_end,
-	varstr_t ** p_dst)
+	varstr_t ** p_dst,
+	satoshi_arena_t * arena)
 {
 	assert(p_dst);
 	if(p >= p_end) return NULL;
@@ -398,7 +527,7 @@ static inline const unsigned char * parse_varstr(
 	size_t vstr_size = varstr_size((varstr_t *)p);
 	if((p + vstr_size) > p_end) return NULL;
 	
-	*p_dst = varstr_clone((varstr_t *)p);
+	*p_dst = arena_varstr_clone(arena, (varstr_t *)p);
 	return (p + vstr_size);
 }
 
@@ -443,7 +572,7 @@ varstr_t * satoshi_txin_set_redeem_scripts(satoshi_txin_t * txin, const unsigned
 }
 
 
-ssize_t satoshi_txin_parse(satoshi_txin_t * txin, ssize_t length, const void * payload)
+static ssize_t txin_parse(satoshi_txin_t * txin, ssize_t length, const void * payload, satoshi_arena_t * arena)
 {
 	assert(txin && (length > 0) && payload);
 
@@ -463,7 +592,7 @@ ssize_t satoshi_txin_parse(satoshi_txin_t * txin, ssize_t length, const void * p
 	ssize_t vstr_size = varstr_size((varstr_t *)p);
 	if((p + vstr_size) > p_end) message_parser_error_handler("parse sig_scripts failed: %s", "invalid payload length.");
 	
-	txin->scripts = varstr_clone((varstr_t *)p);
+	txin->scripts = arena_varstr_clone(arena, (varstr_t *)p);
 	assert(txin->scripts && varstr_size(txin->scripts) == vstr_size);
 	
 	txin->cb_scripts = varstr_length(txin->scripts);
@@ -478,10 +607,16 @@ ssize_t satoshi_txin_parse(satoshi_txin_t * txin, ssize_t length, const void * p
 	
 	return (p - (unsigned char *)payload);
 label_error:
+	if(arena) txin->scripts = NULL;	// owned by the arena
 	satoshi_txin_cleanup(txin);
 	return -1;
 }
 
+ssize_t satoshi_txin_parse(satoshi_txin_t * txin, ssize_t length, const void * payload)
+{
+	return txin_parse(txin, length, payload, NULL);
+}
+
 ssize_t satoshi_txin_serialize(const satoshi_txin_t * txin, unsigned char ** p_data)
 {
 	assert(txin->scripts);
@@ -556,7 +691,7 @@ void satoshi_txin_cleanup(satoshi_txin_t * txin)
 	//~ ssize_t cb_script;
 	//~ unsigned char * scripts;
 //~ }satoshi_txout_t;
-ssize_t satoshi_txout_parse(satoshi_txout_t * txout, ssize_t length, const void * payload)
+static ssize_t txout_parse(satoshi_txout_t * txout, ssize_t length, const void * payload, satoshi_arena_t * arena)
 {
 	assert(txout && (length > 0) && payload);
 	const unsigned char * p = (unsigned char *) payload;
@@ -573,7 +708,7 @@ ssize_t satoshi_txout_parse(satoshi_txout_t * txout, ssize_t length, const void
 	ssize_t vstr_size = varstr_size((varstr_t *)p);
 	if((p + vstr_size) > p_end) message_parser_error_handler("%s", "invalid varstr size or payload length.");
 	
-	txout->scripts = varstr_clone((varstr_t *)p);
+	txout->scripts = arena_varstr_clone(arena, (varstr_t *)p);
 	assert(txout->scripts && varstr_size(txout->scripts) == vstr_size);
 	p += vstr_size;
 	
@@ -590,10 +725,16 @@ ssize_t satoshi_txout_parse(satoshi_txout_t * txout, ssize_t length, const void
 	
 	return (p - (unsigned char *)payload);
 label_error:
+	if(arena) txout->scripts = NULL;	// owned by the arena
 	satoshi_txout_cleanup(txout);
 	return -1;
 }
 
+ssize_t satoshi_txout_parse(satoshi_txout_t * txout, ssize_t length, const void * payload)
+{
+	return txout_parse(txout, length, payload, NULL);
+}
+
 ssize_t satoshi_txout_serialize(const satoshi_txout_t * txout, unsigned char ** p_data)
 {
 	ssize_t	scripts_size = varstr_size(txout->scripts);
@@ -666,6 +807,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 	
 	const unsigned char * p = payload;
 	const unsigned char * p_end = p + length;
+	satoshi_arena_t * arena = tx->arena;
 	
 	sha256_ctx_t sha[1];	// calc tx_hash
 	sha256_init(sha);
@@ -704,7 +846,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 
 	if(tx->txin_count <= 0) message_parser_error_handler("invalid txins count: %d", (int)tx->txin_count);
 	
-	satoshi_txin_t * txins = calloc(tx->txin_count, sizeof(*txins));
+	satoshi_txin_t * txins = arena_calloc(arena, tx->txin_count, sizeof(*txins));
 	assert(txins);
 	tx->txins = txins;
 	
@@ -712,7 +854,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 	for(ssize_t i = 0; i < tx->txin_count; ++i)
 	{
 		if(p >= p_end) message_parser_error_handler("no txins[%d] data.", (int)i);
-		ssize_t cb_payload = satoshi_txin_parse(&txins[i], (p_end - p), p);
+		ssize_t cb_payload = txin_parse(&txins[i], (p_end - p), p, arena);
 		if(cb_payload <= 0) message_parser_error_handler("parse txins[%d] failed.", (int)i);
 		p += cb_payload;
 	}
@@ -727,7 +869,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 	if(NULL == p) message_parser_error_handler("parse txout failed: %s", "invalid payload length");
 	if(tx->txout_count <= 0) message_parser_error_handler("invalid txouts count: %d", (int)tx->txout_count);
 	
-	satoshi_txout_t * txouts = calloc(tx->txout_count, sizeof(*txouts));
+	satoshi_txout_t * txouts = arena_calloc(arena, tx->txout_count, sizeof(*txouts));
 	assert(txouts);
 	tx->txouts = txouts;
 	
@@ -735,7 +877,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 	for(ssize_t i = 0; i < tx->txout_count; ++i)
 	{
 		if(p >= p_end) message_parser_error_handler("no txout[%d] data.", (int)i);
-		ssize_t cb_payload = satoshi_txout_parse(&txouts[i], (p_end - p), p);
+		ssize_t cb_payload = txout_parse(&txouts[i], (p_end - p), p, arena);
 		if(cb_payload <= 0) message_parser_error_handler("parse txout[%d] failed.", (int)i);
 		p += cb_payload;
 	}
@@ -757,7 +899,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 		 * if a txin is non-witness, set witness to 0x00.
 		 */
 		assert(tx->txin_count > 0);
-		bitcoin_tx_witness_t * witnesses = calloc(tx->txin_count, sizeof(*tx->witnesses));
+		bitcoin_tx_witness_t * witnesses = arena_calloc(arena, tx->txin_count, sizeof(*tx->witnesses));
 		assert(witnesses);
 		
 		tx->witnesses = witnesses;
@@ -777,7 +919,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 			
 			if(num_items > 0)
 			{
-				varstr_t ** items = calloc(num_items, sizeof(*items));
+				varstr_t ** items = arena_calloc(arena, num_items, sizeof(*items));
 				assert(items);
 				witnesses[i].items = items;
 				
@@ -788,7 +930,7 @@ ssize_t satoshi_tx_parse(satoshi_tx_t * tx, ssize_t length, const void * payload
 							"invalid payload length");
 					}
 					
-					p = parse_varstr(p, p_end, &items[item_index]);
+					p = parse_varstr(p, p_end, &items[item_index], arena);
 					if(NULL == p) {
 						message_parser_error_handler("parse witness data failed: %s.", 
 							"invalid payload length");
@@ -842,6 +984,25 @@ void satoshi_tx_cleanup(satoshi_tx_t * tx)
 {
 	if(NULL == tx) return;
 	
+	if(tx->arena)	// txins, txouts, scripts and witnesses are owned by the arena
+	{
+		if(tx->txins)
+		{
+			for(ssize_t i = 0; i < tx->txin_count; ++i)
+			{
+				// signatures and redeem_scripts are set by satoshi_script, which are not in the arena
+				tx->txins[i].scripts = NULL;
+				satoshi_txin_cleanup(&tx->txins[i]);
+			}
+		}
+		tx->txins = NULL;
+		tx->txin_count = 0;
+		tx->txouts = NULL;
+		tx->txout_count = 0;
+		tx->witnesses = NULL;
+		return;
+	}
+	
 	if(tx->has_flag && tx->witnesses)
 	{
 		for(ssize_t i = 0; i < tx->txin_count; ++i)
@@ -1002,7 +1163,379 @@ ssize_t satoshi_tx_serialize(const satoshi_tx_t * tx, unsigned char ** p_data)
 	return tx_size;
 }
 
-ssize_t satoshi_block_parse(satoshi_block_t * block, ssize_t length, const void * payload)
+/**
+ * tx_scan_size:
+ * 	find the boundary of a serialized tx, without allocating or hashing.
+ * 	@return the tx size on success, -1 on error.
+ */
+static ssize_t tx_scan_size(const unsigned char * payload, const unsigned char * p_end)
+{
+	const unsigned char * p = payload;
+	ssize_t txin_count = 0;
+	ssize_t txout_count = 0;
+	ssize_t length = 0;
+	int has_flag = 0;
+	
+#define skip_varstr(p) do { \
+		p = parse_varint(p, p_end, &length); \
+		if(NULL == p || length < 0 || length > (p_end - p)) return -1; \
+		p += length; \
+	} while(0)
+	
+	p += sizeof(int32_t);	// version
+	if((p + 2) > p_end) return -1;
+	if(p[0] == 0) {
+		if(p[1] != 1) return -1;
+		has_flag = 1;
+		p += 2;
+	}
+	
+	p = parse_varint(p, p_end, &txin_count);
+	if(NULL == p || txin_count <= 0) return -1;
+	for(ssize_t i = 0; i < txin_count; ++i)
+	{
+		p += sizeof(struct satoshi_outpoint);
+		if(p > p_end) return -1;
+		skip_varstr(p);
+		p += sizeof(uint32_t);	// sequence
+	}
+	
+	p = parse_varint(p, p_end, &txout_count);
+	if(NULL == p || txout_count <= 0) return -1;
+	for(ssize_t i = 0; i < txout_count; ++i)
+	{
+		p += sizeof(int64_t);	// value
+		if(p > p_end) return -1;
+		skip_varstr(p);
+	}
+	
+	if(has_flag && ((p + sizeof(uint32_t)) < p_end))
+	{
+		for(ssize_t i = 0; i < txin_count; ++i)
+		{
+			ssize_t num_items = 0;
+			p = parse_varint(p, p_end, &num_items);
+			if(NULL == p || num_items < 0) return -1;
+			for(ssize_t ii = 0; ii < num_items; ++ii) skip_varstr(p);
+		}
+	}
+#undef skip_varstr
+	
+	p += sizeof(uint32_t);	// lock_time
+	if(p > p_end) return -1;
+	return (p - payload);
+}
+
+/**
+ * parse txns in parallel:
+ * 	step 1. scan the tx boundaries (cheap, single thread),
+ * 	step 2. the workers pick up txns by index, then do deep parsing and calc txid / wtxid.
+ */
+struct block_parse_task
+{
+	satoshi_tx_t * txns;
+	ssize_t txn_count;
+	const unsigned char * payload;
+	const uint32_t * offsets;
+	const uint32_t * sizes;
+	
+	volatile ssize_t next_index;
+	volatile int err_code;
+};
+
+static void * block_parse_worker(void * user_data)
+{
+	struct block_parse_task * task = user_data;
+	while(!task->err_code)
+	{
+		ssize_t index = __sync_fetch_and_add(&task->next_index, 1);
+		if(index >= task->txn_count) break;
+		
+		ssize_t cb = satoshi_tx_parse(&task->txns[index], task->sizes[index], task->payload + task->offsets[index]);
+		if(cb != task->sizes[index]) __sync_bool_compare_and_swap(&task->err_code, 0, 1);
+	}
+	return NULL;
+}
+
+/**
+ * s_parse_pool:
+ * 	persistent workers for block_parse_txns_parallel() (one worker per online cpu),
+ * 	which are created on first use and released at exit.
+ * 	The blocks are posted one at a time, the calling thread is also a worker.
+ */
+typedef struct block_parse_pool
+{
+	int num_workers;
+	pthread_t * workers;
+	
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;	// a new block is posted or quit
+	pthread_cond_t idle_cond;	// all workers have left the current block, or the pool is no longer busy
+	int quit;
+	int busy;					// a block is in progress
+	unsigned int job_id;
+	int active_workers;
+	int max_workers;			// the number of workers allowed to join the current block
+	
+	struct block_parse_task task;
+}block_parse_pool_t;
+
+static pthread_once_t s_parse_pool_once = PTHREAD_ONCE_INIT;
+static block_parse_pool_t * s_parse_pool;
+
+static void * parse_pool_worker(void * user_data)
+{
+	block_parse_pool_t * pool = user_data;
+	unsigned int last_job_id = 0;
+	
+	pthread_mutex_lock(&pool->mutex);
+	while(1)
+	{
+		while(!pool->quit && pool->job_id == last_job_id) pthread_cond_wait(&pool->job_cond, &pool->mutex);
+		if(pool->quit) break;
+		
+		last_job_id = pool->job_id;
+		if(pool->active_workers >= pool->max_workers) continue;	// enough workers for this block
+		++pool->active_workers;
+		pthread_mutex_unlock(&pool->mutex);
+		
+		block_parse_worker(&pool->task);
+		
+		pthread_mutex_lock(&pool->mutex);
+		if(0 == --pool->active_workers) pthread_cond_broadcast(&pool->idle_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void parse_pool_free(void)
+{
+	block_parse_pool_t * pool = s_parse_pool;
+	if(NULL == pool) return;
+	s_parse_pool = NULL;
+	
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	for(int i = 0; i < pool->num_workers; ++i) pthread_join(pool->workers[i], NULL);
+	free(pool->workers);
+	
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_cond_destroy(&pool->idle_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+static void parse_pool_init(void)
+{
+	int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(num_threads <= 1) return;
+	
+	block_parse_pool_t * pool = calloc(1, sizeof(*pool));
+	assert(pool);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+	
+	pool->workers = calloc(num_threads, sizeof(*pool->workers));
+	assert(pool->workers);
+	for(int i = 1; i < num_threads; ++i)	// the calling thread is also a worker
+	{
+		if(0 == pthread_create(&pool->workers[pool->num_workers], NULL, parse_pool_worker, pool)) ++pool->num_workers;
+	}
+	
+	s_parse_pool = pool;
+	if(pool->num_workers == 0) {	// unable to create any worker
+		parse_pool_free();
+		return;
+	}
+	atexit(parse_pool_free);
+}
+
+/**
+ * parse_pool_run:
+ * 	parse the txns of one block by the calling thread and up to (max_workers) pooled workers.
+ * @return the err_code of the task
+ */
+static int parse_pool_run(block_parse_pool_t * pool, const struct block_parse_task * task, int max_workers)
+{
+	pthread_mutex_lock(&pool->mutex);
+	// wait for the block of another thread, late workers may still hold the previous task
+	while(pool->busy || pool->active_workers > 0) pthread_cond_wait(&pool->idle_cond, &pool->mutex);
+	pool->busy = 1;
+	pool->task = *task;
+	pool->max_workers = max_workers;
+	++pool->job_id;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	block_parse_worker(&pool->task);
+	
+	// wait for the txns taken by the workers
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->active_workers > 0) pthread_cond_wait(&pool->idle_cond, &pool->mutex);
+	int err_code = pool->task.err_code;
+	pool->busy = 0;
+	pthread_cond_broadcast(&pool->idle_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	return err_code;
+}
+
+#define BLOCK_PARSE_MIN_TXNS_PER_THREAD (16)
+static ssize_t block_parse_txns_parallel(satoshi_block_t * block, 
+	const unsigned char * payload, const unsigned char * p_end,
+	int num_threads)
+{
+	const unsigned char * p = payload;
+	ssize_t txn_count = block->txn_count;
+	
+	uint32_t * offsets = calloc(txn_count * 2, sizeof(*offsets));
+	assert(offsets);
+	uint32_t * sizes = offsets + txn_count;
+	
+	for(ssize_t i = 0; i < txn_count; ++i)
+	{
+		ssize_t tx_size = tx_scan_size(p, p_end);
+		if(tx_size <= 0) {
+			free(offsets);
+			return -1;
+		}
+		offsets[i] = p - payload;
+		sizes[i] = tx_size;
+		p += tx_size;
+	}
+	
+	struct block_parse_task task[1] = {{
+		.txns = block->txns,
+		.txn_count = txn_count,
+		.payload = payload,
+		.offsets = offsets,
+		.sizes = sizes,
+	}};
+	
+	if(num_threads > (txn_count / BLOCK_PARSE_MIN_TXNS_PER_THREAD)) {
+		num_threads = txn_count / BLOCK_PARSE_MIN_TXNS_PER_THREAD;
+	}
+	if(num_threads < 1) num_threads = 1;
+	
+	block_parse_pool_t * pool = NULL;
+	if(num_threads > 1) {
+		pthread_once(&s_parse_pool_once, parse_pool_init);
+		pool = s_parse_pool;
+	}
+	
+	int err_code = 0;
+	if(NULL == pool) {	// serial mode
+		block_parse_worker(task);
+		err_code = task->err_code;
+	}else {
+		int max_workers = num_threads - 1;
+		if(max_workers > pool->num_workers) max_workers = pool->num_workers;
+		err_code = parse_pool_run(pool, task, max_workers);
+	}
+	free(offsets);
+	
+	if(err_code) return -1;
+	return (p - payload);
+}
+#undef BLOCK_PARSE_MIN_TXNS_PER_THREAD
+
+/**
+ * s_merkle_pool:
+ * 	the merkle trees of all blocks share one persistent pool (one worker per online cpu),
+ * 	which is created on first use and released at exit.
+ */
+static pthread_once_t s_merkle_pool_once = PTHREAD_ONCE_INIT;
+static uint256_merkle_tree_thread_pool_t * s_merkle_pool;
+
+static void merkle_pool_free(void)
+{
+	uint256_merkle_tree_thread_pool_free(s_merkle_pool);
+	s_merkle_pool = NULL;
+}
+
+static void merkle_pool_init(void)
+{
+	s_merkle_pool = uint256_merkle_tree_thread_pool_new(0, 0);
+	if(s_merkle_pool) atexit(merkle_pool_free);
+}
+
+static void block_calc_merkle_root(const satoshi_block_t * block, int use_wtxid, int num_threads, uint256_t * merkle_root)
+{
+	uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(block->txn_count, (void *)block);
+	assert(mtree);
+	if(num_threads > 1 && (block->txn_count / 2) >= UINT256_MERKLE_TREE_PARALLEL_THRESHOLD) {
+		pthread_once(&s_merkle_pool_once, merkle_pool_init);
+		uint256_merkle_tree_set_thread_pool(mtree, s_merkle_pool, num_threads);
+	}
+	
+	static const uint256_t s_coinbase_wtxid[1];
+	for(ssize_t i = 0; i < block->txn_count; ++i)
+	{
+		const satoshi_tx_t * tx = &block->txns[i];
+		const uint256_t * txid = tx->txid;
+		if(use_wtxid) {
+			if(i == 0) txid = s_coinbase_wtxid;	// the wtxid of coinbase is assumed to be 0x0000....0000
+			else if(tx->has_flag) txid = tx->wtxid;
+		}
+		mtree->add(mtree, 1, txid);
+	}
+	mtree->recalc(mtree, 0, -1);
+	*merkle_root = mtree->merkle_root;
+	uint256_merkle_tree_free(mtree);
+}
+
+/**
+ * block_verify_witness_commitment: (BIP141)
+ * 	The commitment is recorded in the last coinbase output whose scriptPubKey starts with
+ * 	  {0x6a, 0x24, 0xaa, 0x21, 0xa9, 0xed}, followed by 
+ * 	  hash256(witness_merkle_root || witness_reserved_value).
+ * 	The witness_reserved_value is the only 32-byte witness item of the coinbase input.
+ *  If there's no commitment, none of the txns is allowed to have witness data.
+ */
+static int block_verify_witness_commitment(const satoshi_block_t * block, int num_threads)
+{
+	static const unsigned char s_commitment_header[6] = { 0x6a, 0x24, 0xaa, 0x21, 0xa9, 0xed };
+	const satoshi_tx_t * coinbase = &block->txns[0];
+	
+	const unsigned char * commitment = NULL;
+	for(ssize_t i = coinbase->txout_count - 1; i >= 0; --i)
+	{
+		const varstr_t * scripts = coinbase->txouts[i].scripts;
+		if(NULL == scripts) continue;
+		if(varstr_length(scripts) >= 38 
+			&& 0 == memcmp(varstr_getdata_ptr(scripts), s_commitment_header, sizeof(s_commitment_header)))
+		{
+			commitment = varstr_getdata_ptr(scripts) + sizeof(s_commitment_header);
+			break;
+		}
+	}
+	
+	if(NULL == commitment) {
+		for(ssize_t i = 0; i < block->txn_count; ++i) {
+			if(block->txns[i].has_flag) return -1;	// unexpected witness data
+		}
+		return 0;
+	}
+	
+	// the coinbase's input must have a single 32-byte witness item (the witness reserved value)
+	if(!coinbase->has_flag || coinbase->txin_count < 1 || NULL == coinbase->witnesses) return -1;
+	const bitcoin_tx_witness_t * witness = &coinbase->witnesses[0];
+	if(witness->num_items != 1 || NULL == witness->items || varstr_length(witness->items[0]) != 32) return -1;
+	
+	uint256_t data[2];
+	block_calc_merkle_root(block, 1, num_threads, &data[0]);
+	memcpy(&data[1], varstr_getdata_ptr(witness->items[0]), 32);
+	
+	uint256_t hash;
+	hash256_64(data, hash.val);
+	if(0 != memcmp(&hash, commitment, 32)) return -1;
+	return 0;
+}
+
+static ssize_t block_parse(satoshi_block_t * block, ssize_t length, const void * payload, int num_threads)
 {
 	assert(block && (length > 0) && payload);
 	const unsigned char * p = payload;
@@ -1024,7 +1557,7 @@ ssize_t satoshi_block_parse(satoshi_block_t * block, ssize_t length, const void
 	 * 'hdr.bits' should be checked when building the block_chain,
 	 *  and 'hdr.bits' must match the global difficulty which be recalculated every 2016 blocks.
 	 */
-	hash256(payload, sizeof(struct satoshi_block_header), (uint8_t *)&block->hash);
+	hash256_80(payload, (uint8_t *)&block->hash);
 	int compare_diff = uint256_compare_with_compact(&block->hash, (compact_uint256_t *)&block->hdr.bits);
 	if(compare_diff > 0) {
 		message_parser_error_handler("Difficulty invalid (greater than 0x%.8d).", block->hdr.bits);
@@ -1049,34 +1582,40 @@ ssize_t satoshi_block_parse(satoshi_block_t * block, ssize_t length, const void
 		message_parser_error_handler("invalid txn_count: %ld", (long)block->txn_count);
 	}
 	
-	satoshi_tx_t * txns = calloc(block->txn_count, sizeof(*txns));
+	satoshi_tx_t * txns = arena_calloc(block->arena, block->txn_count, sizeof(*txns));
 	assert(txns);
 	block->txns = txns;
 	
-	/**
-	 * Use merkle_tree to verify all transactions in the block.
-	 * The calculated merkle_root by all txids MUST be equal to 'hdr.merkle_root'
-	 */
-	uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(block->txn_count, block);
-	assert(mtree);
-	
-	for(ssize_t i = 0; i < block->txn_count; ++i)
+	if(num_threads > 1)
 	{
-		if(p >= p_end) {
-			message_parser_error_handler("parse tx[%d] failed: invalid payload length", (int)i);
+		// The arena is not thread-safe, each tx is allocated from the heap in parallel mode.
+		ssize_t cb = block_parse_txns_parallel(block, p, p_end, num_threads);
+		if(cb <= 0) {
+			message_parser_error_handler("parse txns failed: %s", "invalid payload data");
 		}
-		ssize_t tx_size = satoshi_tx_parse(&block->txns[i], (p_end - p), p);
-		if(tx_size <= 0) {
-			message_parser_error_handler("parse tx[%d] failed: invalid payload data", (int)i);
+		p += cb;
+	}else
+	{
+		for(ssize_t i = 0; i < block->txn_count; ++i)
+		{
+			if(p >= p_end) {
+				message_parser_error_handler("parse tx[%d] failed: invalid payload length", (int)i);
+			}
+			block->txns[i].arena = block->arena;
+			ssize_t tx_size = satoshi_tx_parse(&block->txns[i], (p_end - p), p);
+			if(tx_size <= 0) {
+				message_parser_error_handler("parse tx[%d] failed: invalid payload data", (int)i);
+			}
+			p += tx_size;
 		}
-		p += tx_size;
-		
-		mtree->add(mtree, 1, block->txns[i].txid);
 	}
-	mtree->recalc(mtree, 0, -1);
-	uint256_t merkle_root = mtree->merkle_root;
-	uint256_merkle_tree_free(mtree);
-	mtree = NULL;
+	
+	/**
+	 * Use merkle_tree to verify all transactions in the block.
+	 * The calculated merkle_root by all txids MUST be equal to 'hdr.merkle_root'
+	 */
+	uint256_t merkle_root;
+	block_calc_merkle_root(block, 0, num_threads, &merkle_root);
 	
 	// verify merkle root
 	if(0 != memcmp(&block->hdr.merkle_root, &merkle_root, 32))	// not equal
@@ -1084,7 +1623,12 @@ ssize_t satoshi_block_parse(satoshi_block_t * block, ssize_t length, const void
 		message_parser_error_handler("Verification of merkle-root failed. There's one or more invalid transactions in the block.");
 	}
 	
-	
+	if(block->parse_flags & satoshi_block_parse_flags_verify_witness_commitment)
+	{
+		if(block_verify_witness_commitment(block, num_threads) != 0) {
+			message_parser_error_handler("Verification of witness commitment failed.");
+		}
+	}
 	
 	assert(p <= p_end);
 	ssize_t block_size = (p - (unsigned char *)payload);
@@ -1096,6 +1640,23 @@ label_error:
 	satoshi_block_cleanup(block);
 	return -1;
 }
+
+ssize_t satoshi_block_parse(satoshi_block_t * block, ssize_t length, const void * payload)
+{
+	return block_parse(block, length, payload, 1);
+}
+
+/**
+ * satoshi_block_parse_mt:
+ * 	parse txns and calc txid / wtxid by (num_threads) workers.
+ * 	@param num_threads: <= 0 to use the number of online cpus.
+ */
+ssize_t satoshi_block_parse_mt(satoshi_block_t * block, ssize_t length, const void * payload, int num_threads)
+{
+	if(num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	return block_parse(block, length, payload, num_threads);
+}
+
 void satoshi_block_cleanup(satoshi_block_t * block)
 {
 	if(NULL == block) return;
@@ -1105,7 +1666,7 @@ void satoshi_block_cleanup(satoshi_block_t * block)
 		{
 			satoshi_tx_cleanup(&block->txns[i]);
 		}
-		free(block->txns);
+		if(NULL == block->arena) free(block->txns);
 		block->txns = NULL;
 		block->txn_count = 0;
 	}
@@ -36,7 +36,6 @@
 #include <unistd.h>
 #include <limits.h>
 #include <stdint.h>
-#include <db.h>
 #include <endian.h>
 
 
@@ -238,14 +237,14 @@ ssize_t transactions_db_find(struct transactions_db * db, db_engine_txn_t * txn,
 	
 	ssize_t count = -1;
 	transactions_db_private_t * priv = db->priv;
-	db_record_data_t * value = NULL;
+	db_record_data_t value[1];
+	memset(value, 0, sizeof(value));
 	
-	count = priv->txes_db->find(priv->txes_db, txn, 
+	count = priv->txes_db->get(priv->txes_db, txn, 
 		&(db_record_data_t){.data = (void *)txid, .size = sizeof(*txid)},
-		&value); 
-	if(count <= 0) goto label_cleanup;
-	
-	assert(count == 1);
+		value); 
+	if(count <= 0) return count;
+	assert(value->size == sizeof(db_record_tx_t));
 	
 	db_record_tx_t * txes = *p_txes;
 	if(NULL == txes) {
@@ -255,10 +254,6 @@ ssize_t transactions_db_find(struct transactions_db * db, db_engine_txn_t * txn,
 	}
 	
 	memcpy(txes, value->data, value->size);
-	
-label_cleanup:
-	db_record_data_cleanup(value);
-	free(value);
 	return count;
 }
 
@@ -516,6 +511,7 @@ int main(int argc, char ** argv)
 	while(0 == (rc = cursor->next(cursor))) {
 		dump_record(&txid, tx_data);
 	}
+	db_cursor_cleanup(cursor);
 	
 	transactions_db_cleanup(txes_db);
 	free(txes_db);
@@ -0,0 +1,974 @@
+/*
+ * utxoes_cache.c
+ * 
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ * 
+ * The MIT License (MIT)
+ * 
+ * Permission is hereby granted, free of charge, to any person 
+ * obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, 
+ * publish, distribute, sublicense, and/or sell copies of the Software, 
+ * and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR 
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR 
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "db_engine.h"
+#include "utxoes_db.h"
+#include "utxoes_cache.h"
+
+#define UTXOES_CACHE_INLINE_SCRIPT_SIZE (36)	// varint prefix + the longest standard template (P2WSH / P2TR)
+typedef struct utxoes_cache_entry
+{
+	struct utxoes_cache_entry * next;	// hash chain (or free-list)
+	satoshi_outpoint_t outpoint;
+	uint32_t flags;	// enum utxoes_cache_entry_flags
+	db_record_utxo_t utxo;	// utxo.scripts points to 'script_buf' or to a heap copy of a long script
+	unsigned char script_buf[UTXOES_CACHE_INLINE_SCRIPT_SIZE];
+}utxoes_cache_entry_t;
+
+#define UTXOES_CACHE_ENTRIES_PER_SLAB (4096)
+struct utxoes_cache_slab
+{
+	struct utxoes_cache_slab * next;
+	utxoes_cache_entry_t entries[UTXOES_CACHE_ENTRIES_PER_SLAB];
+};
+
+/**
+ * prefetch workers:
+ * 	prefetch() splits the outpoints into chunks and queues them, 
+ * 	the workers look up the missing coins in the db without holding the cache lock, 
+ * 	then insert them as clean entries.
+ */
+#define UTXOES_CACHE_PREFETCH_CHUNK_SIZE (64)
+struct prefetch_chunk
+{
+	struct prefetch_chunk * next;
+	ssize_t count;
+	satoshi_outpoint_t outpoints[UTXOES_CACHE_PREFETCH_CHUNK_SIZE];
+};
+
+typedef struct utxoes_cache_prefetch_pool
+{
+	utxoes_cache_t * cache;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t idle_cond;
+	
+	struct prefetch_chunk * head;
+	struct prefetch_chunk * tail;
+	ssize_t pending;	// queued or running chunks
+	
+	int quit;
+	int num_workers;
+	pthread_t * workers;
+}utxoes_cache_prefetch_pool_t;
+
+typedef struct utxoes_cache_private
+{
+	utxoes_cache_t * cache;
+	pthread_mutex_t mutex;
+	
+	utxoes_cache_prefetch_pool_t * pool;
+	uint64_t generation;	// increased when the entries are dropped by flush(), coins read from the db before that may be stale
+	
+	size_t num_buckets;		// power of 2
+	utxoes_cache_entry_t ** buckets;
+	ssize_t count;
+	
+	// entries are allocated from slabs
+	struct utxoes_cache_slab * slabs;
+	ssize_t num_slabs;
+	utxoes_cache_entry_t * free_list;
+	size_t heap_scripts_size;	// the size of scripts which don't fit in the script_buf
+}utxoes_cache_private_t;
+
+#define UTXOES_CACHE_MIN_BUCKETS (1 << 16)
+
+static inline uint64_t outpoint_hash(const satoshi_outpoint_t * outpoint)
+{
+	// prev_hash is a sha256 digest, the first 8 bytes are evenly distributed
+	uint64_t hash;
+	memcpy(&hash, outpoint->prev_hash, sizeof(hash));
+	return hash ^ ((uint64_t)outpoint->index * 0x9E3779B97F4A7C15ULL);
+}
+
+static inline int outpoint_equals(const satoshi_outpoint_t * a, const satoshi_outpoint_t * b)
+{
+	return (a->index == b->index) && (0 == memcmp(a->prev_hash, b->prev_hash, sizeof(a->prev_hash)));
+}
+
+static utxoes_cache_entry_t * entry_alloc(utxoes_cache_private_t * priv)
+{
+	if(NULL == priv->free_list) {
+		struct utxoes_cache_slab * slab = malloc(sizeof(*slab));
+		assert(slab);
+		slab->next = priv->slabs;
+		priv->slabs = slab;
+		++priv->num_slabs;
+		
+		for(int i = UTXOES_CACHE_ENTRIES_PER_SLAB - 1; i >= 0; --i) {
+			slab->entries[i].next = priv->free_list;
+			priv->free_list = &slab->entries[i];
+		}
+	}
+	utxoes_cache_entry_t * entry = priv->free_list;
+	priv->free_list = entry->next;
+	memset(entry, 0, sizeof(*entry));
+	return entry;
+}
+
+static inline void entry_release_scripts(utxoes_cache_private_t * priv, utxoes_cache_entry_t * entry)
+{
+	varstr_t * scripts = entry->utxo.scripts;
+	if(scripts && (void *)scripts != (void *)entry->script_buf) {
+		priv->heap_scripts_size -= varstr_size(scripts);
+		varstr_free(scripts);
+	}
+	entry->utxo.scripts = NULL;
+}
+
+static void entry_set_utxo(utxoes_cache_private_t * priv, utxoes_cache_entry_t * entry, const db_record_utxo_t * utxo)
+{
+	entry_release_scripts(priv, entry);
+	entry->utxo = *utxo;
+	
+	size_t size = varstr_size(utxo->scripts);
+	if(size <= sizeof(entry->script_buf)) {
+		memcpy(entry->script_buf, utxo->scripts, size);
+		entry->utxo.scripts = (varstr_t *)entry->script_buf;
+	}else {
+		entry->utxo.scripts = varstr_clone(utxo->scripts);
+		assert(entry->utxo.scripts);
+		priv->heap_scripts_size += size;
+	}
+}
+
+/* copy out, the caller owns utxo->scripts */
+static void entry_get_utxo(const utxoes_cache_entry_t * entry, db_record_utxo_t * utxo)
+{
+	db_record_utxo_cleanup(utxo);
+	*utxo = entry->utxo;
+	utxo->scripts = varstr_clone(entry->utxo.scripts);
+	assert(utxo->scripts);
+}
+
+static inline void entry_free(utxoes_cache_private_t * priv, utxoes_cache_entry_t * entry)
+{
+	entry_release_scripts(priv, entry);
+	entry->next = priv->free_list;
+	priv->free_list = entry;
+}
+
+static void buckets_resize(utxoes_cache_private_t * priv, size_t num_buckets)
+{
+	utxoes_cache_entry_t ** buckets = calloc(num_buckets, sizeof(*buckets));
+	assert(buckets);
+	
+	for(size_t i = 0; i < priv->num_buckets; ++i)
+	{
+		utxoes_cache_entry_t * entry = priv->buckets[i];
+		while(entry) {
+			utxoes_cache_entry_t * next = entry->next;
+			size_t index = outpoint_hash(&entry->outpoint) & (num_buckets - 1);
+			entry->next = buckets[index];
+			buckets[index] = entry;
+			entry = next;
+		}
+	}
+	free(priv->buckets);
+	priv->buckets = buckets;
+	priv->num_buckets = num_buckets;
+}
+
+/* @return the address of the link which points to the entry (or to NULL if not found) */
+static utxoes_cache_entry_t ** entry_lookup(utxoes_cache_private_t * priv, const satoshi_outpoint_t * outpoint)
+{
+	size_t index = outpoint_hash(outpoint) & (priv->num_buckets - 1);
+	utxoes_cache_entry_t ** p_entry = &priv->buckets[index];
+	while(*p_entry) {
+		if(outpoint_equals(&(*p_entry)->outpoint, outpoint)) break;
+		p_entry = &(*p_entry)->next;
+	}
+	return p_entry;
+}
+
+static utxoes_cache_entry_t * entry_insert(utxoes_cache_private_t * priv, const satoshi_outpoint_t * outpoint)
+{
+	if(priv->count >= priv->num_buckets) buckets_resize(priv, priv->num_buckets * 2);
+	
+	utxoes_cache_entry_t * entry = entry_alloc(priv);
+	entry->outpoint = *outpoint;
+	
+	size_t index = outpoint_hash(outpoint) & (priv->num_buckets - 1);
+	entry->next = priv->buckets[index];
+	priv->buckets[index] = entry;
+	++priv->count;
+	return entry;
+}
+
+static inline void entry_remove(utxoes_cache_private_t * priv, utxoes_cache_entry_t ** p_entry)
+{
+	utxoes_cache_entry_t * entry = *p_entry;
+	*p_entry = entry->next;
+	entry_free(priv, entry);
+	--priv->count;
+}
+
+/* find in the cache, load from the db on cache-miss. */
+static utxoes_cache_entry_t * fetch_coin(utxoes_cache_t * cache, const satoshi_outpoint_t * outpoint)
+{
+	utxoes_cache_private_t * priv = cache->priv;
+	utxoes_cache_entry_t ** p_entry = entry_lookup(priv, outpoint);
+	if(*p_entry) return *p_entry;
+	
+	db_record_utxo_t utxo[1];
+	db_record_utxo_t * p_utxo = utxo;
+	memset(utxo, 0, sizeof(utxo));
+	
+	utxoes_db_t * db = cache->db;
+	ssize_t count = db?db->find(db, NULL, outpoint, &p_utxo):0;
+	if(count <= 0) return NULL;
+	
+	utxoes_cache_entry_t * entry = entry_insert(priv, outpoint);
+	entry_set_utxo(priv, entry, utxo);	// clean entry
+	db_record_utxo_cleanup(utxo);
+	return entry;
+}
+
+static void release_all_scripts(utxoes_cache_private_t * priv)
+{
+	for(size_t i = 0; i < priv->num_buckets; ++i) {
+		for(utxoes_cache_entry_t * entry = priv->buckets[i]; entry; entry = entry->next) {
+			entry_release_scripts(priv, entry);
+		}
+	}
+	assert(0 == priv->heap_scripts_size);
+}
+
+static void clear_all(utxoes_cache_private_t * priv)
+{
+	release_all_scripts(priv);
+	struct utxoes_cache_slab * slab = priv->slabs;
+	while(slab) {
+		struct utxoes_cache_slab * next = slab->next;
+		free(slab);
+		slab = next;
+	}
+	priv->slabs = NULL;
+	priv->num_slabs = 0;
+	priv->free_list = NULL;
+	priv->count = 0;
+	++priv->generation;
+	
+	free(priv->buckets);
+	priv->buckets = NULL;
+	priv->num_buckets = 0;
+	buckets_resize(priv, UTXOES_CACHE_MIN_BUCKETS);
+}
+
+static int utxoes_cache_add(struct utxoes_cache * cache, 
+	const satoshi_outpoint_t * outpoint,
+	const satoshi_txout_t * txout,
+	int32_t height,
+	int is_coinbase)
+{
+	assert(cache && cache->priv && outpoint && txout && txout->scripts);
+	utxoes_cache_private_t * priv = cache->priv;
+	
+	size_t script_length = varstr_length(txout->scripts);
+	if(script_length > UTXOES_DB_MAX_SCRIPT_LENGTH) return -1;
+	
+	db_record_utxo_t utxo = {
+		.value = txout->value,
+		.height = height,
+		.is_coinbase = is_coinbase?1:0,
+		.is_witness = utxo_script_is_witness(varstr_getdata_ptr(txout->scripts), script_length),
+		.scripts = txout->scripts,
+	};
+	
+	pthread_mutex_lock(&priv->mutex);
+	utxoes_cache_entry_t * entry = *entry_lookup(priv, outpoint);
+	uint32_t flags = utxoes_cache_entry_flags_dirty | utxoes_cache_entry_flags_fresh;
+	if(entry) {
+		// overwrite a spent coin: the db still has the old one unless it's fresh
+		if(!(entry->flags & utxoes_cache_entry_flags_fresh)) flags &= ~utxoes_cache_entry_flags_fresh;
+	}else {
+		entry = entry_insert(priv, outpoint);
+	}
+	
+	entry->flags = flags;
+	entry_set_utxo(priv, entry, &utxo);
+	pthread_mutex_unlock(&priv->mutex);
+	return 0;
+}
+
+static int utxoes_cache_remove(struct utxoes_cache * cache, const satoshi_outpoint_t * outpoint, db_record_utxo_t * spent)
+{
+	assert(cache && cache->priv && outpoint);
+	utxoes_cache_private_t * priv = cache->priv;
+	
+	pthread_mutex_lock(&priv->mutex);
+	utxoes_cache_entry_t * entry = fetch_coin(cache, outpoint);
+	if(NULL == entry || (entry->flags & utxoes_cache_entry_flags_spent)) {
+		pthread_mutex_unlock(&priv->mutex);
+		return -1;
+	}
+	if(spent) entry_get_utxo(entry, spent);
+	
+	if(entry->flags & utxoes_cache_entry_flags_fresh) {
+		// created and spent in the cache, the db never sees it
+		entry_remove(priv, entry_lookup(priv, outpoint));
+	}else {
+		entry->flags |= utxoes_cache_entry_flags_spent | utxoes_cache_entry_flags_dirty;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	return 0;
+}
+
+static ssize_t utxoes_cache_find(struct utxoes_cache * cache, const satoshi_outpoint_t * outpoint, db_record_utxo_t ** p_utxo)
+{
+	assert(cache && cache->priv && outpoint && p_utxo);
+	utxoes_cache_private_t * priv = cache->priv;
+	
+	pthread_mutex_lock(&priv->mutex);
+	utxoes_cache_entry_t * entry = fetch_coin(cache, outpoint);
+	if(NULL == entry || (entry->flags & utxoes_cache_entry_flags_spent)) {
+		pthread_mutex_unlock(&priv->mutex);
+		return 0;
+	}
+	
+	db_record_utxo_t * utxo = *p_utxo;
+	if(NULL == utxo) {
+		utxo = calloc(1, sizeof(*utxo));
+		assert(utxo);
+		*p_utxo = utxo;
+	}
+	entry_get_utxo(entry, utxo);
+	pthread_mutex_unlock(&priv->mutex);
+	return 1;
+}
+
+/* @return the number of coins loaded into the cache */
+static ssize_t prefetch_load(utxoes_cache_t * cache, ssize_t count, const satoshi_outpoint_t outpoints[])
+{
+	utxoes_cache_private_t * priv = cache->priv;
+	utxoes_db_t * db = cache->db;
+	assert(count <= UTXOES_CACHE_PREFETCH_CHUNK_SIZE);
+	if(NULL == db || count <= 0) return 0;
+	
+	satoshi_outpoint_t missing[UTXOES_CACHE_PREFETCH_CHUNK_SIZE];
+	db_record_utxo_t utxoes[UTXOES_CACHE_PREFETCH_CHUNK_SIZE];
+	ssize_t num_missing = 0;
+	
+	pthread_mutex_lock(&priv->mutex);
+	uint64_t generation = priv->generation;
+	for(ssize_t i = 0; i < count; ++i) {
+		if(NULL == *entry_lookup(priv, &outpoints[i])) missing[num_missing++] = outpoints[i];
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	if(0 == num_missing) return 0;
+	
+	memset(utxoes, 0, num_missing * sizeof(*utxoes));
+	if(db->find_many) {
+		db->find_many(db, NULL, num_missing, missing, utxoes);
+	}else {
+		for(ssize_t i = 0; i < num_missing; ++i) {
+			db_record_utxo_t * p_utxo = &utxoes[i];
+			db->find(db, NULL, &missing[i], &p_utxo);
+		}
+	}
+	
+	ssize_t num_loaded = 0;
+	pthread_mutex_lock(&priv->mutex);
+	for(ssize_t i = 0; i < num_missing && priv->generation == generation; ++i) {
+		if(NULL == utxoes[i].scripts) continue;	// not found
+		
+		// added, spent or loaded by others in the meantime, the cache is newer
+		if(*entry_lookup(priv, &missing[i])) continue;
+		
+		entry_set_utxo(priv, entry_insert(priv, &missing[i]), &utxoes[i]);	// clean entry
+		++num_loaded;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	
+	for(ssize_t i = 0; i < num_missing; ++i) db_record_utxo_cleanup(&utxoes[i]);
+	return num_loaded;
+}
+
+static void * prefetch_worker(void * user_data)
+{
+	utxoes_cache_prefetch_pool_t * pool = user_data;
+	
+	pthread_mutex_lock(&pool->mutex);
+	while(1)
+	{
+		while(!pool->quit && NULL == pool->head) pthread_cond_wait(&pool->job_cond, &pool->mutex);
+		if(pool->quit) break;
+		
+		struct prefetch_chunk * chunk = pool->head;
+		pool->head = chunk->next;
+		if(NULL == pool->head) pool->tail = NULL;
+		pthread_mutex_unlock(&pool->mutex);
+		
+		prefetch_load(pool->cache, chunk->count, chunk->outpoints);
+		free(chunk);
+		
+		pthread_mutex_lock(&pool->mutex);
+		if(0 == --pool->pending) pthread_cond_broadcast(&pool->idle_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+/* the queued chunks are dropped */
+static void prefetch_pool_free(utxoes_cache_prefetch_pool_t * pool)
+{
+	if(NULL == pool) return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	for(int i = 0; i < pool->num_workers; ++i) pthread_join(pool->workers[i], NULL);
+	free(pool->workers);
+	
+	struct prefetch_chunk * chunk = pool->head;
+	while(chunk) {
+		struct prefetch_chunk * next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_cond_destroy(&pool->idle_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+static utxoes_cache_prefetch_pool_t * prefetch_pool_new(utxoes_cache_t * cache, int num_threads)
+{
+	utxoes_cache_prefetch_pool_t * pool = calloc(1, sizeof(*pool));
+	assert(pool);
+	
+	pool->cache = cache;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+	
+	pool->workers = calloc(num_threads, sizeof(*pool->workers));
+	assert(pool->workers);
+	for(int i = 0; i < num_threads; ++i)
+	{
+		if(0 == pthread_create(&pool->workers[pool->num_workers], NULL, prefetch_worker, pool)) ++pool->num_workers;
+	}
+	if(0 == pool->num_workers) {
+		prefetch_pool_free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+static ssize_t utxoes_cache_prefetch(struct utxoes_cache * cache, ssize_t count, const satoshi_outpoint_t outpoints[])
+{
+	assert(cache && cache->priv);
+	if(count <= 0) return 0;
+	assert(outpoints);
+	
+	utxoes_cache_private_t * priv = cache->priv;
+	utxoes_cache_prefetch_pool_t * pool = priv->pool;
+	if(NULL == pool) {
+		ssize_t num_loaded = 0;
+		for(ssize_t i = 0; i < count; i += UTXOES_CACHE_PREFETCH_CHUNK_SIZE) {
+			ssize_t size = count - i;
+			if(size > UTXOES_CACHE_PREFETCH_CHUNK_SIZE) size = UTXOES_CACHE_PREFETCH_CHUNK_SIZE;
+			num_loaded += prefetch_load(cache, size, &outpoints[i]);
+		}
+		return num_loaded;
+	}
+	
+	// build the chunks before taking the lock
+	struct prefetch_chunk * head = NULL, * tail = NULL;
+	ssize_t num_chunks = 0;
+	for(ssize_t i = 0; i < count; i += UTXOES_CACHE_PREFETCH_CHUNK_SIZE) {
+		struct prefetch_chunk * chunk = malloc(sizeof(*chunk));
+		assert(chunk);
+		chunk->next = NULL;
+		chunk->count = count - i;
+		if(chunk->count > UTXOES_CACHE_PREFETCH_CHUNK_SIZE) chunk->count = UTXOES_CACHE_PREFETCH_CHUNK_SIZE;
+		memcpy(chunk->outpoints, &outpoints[i], chunk->count * sizeof(*outpoints));
+		
+		if(tail) tail->next = chunk;
+		else head = chunk;
+		tail = chunk;
+		++num_chunks;
+	}
+	
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->tail) pool->tail->next = head;
+	else pool->head = head;
+	pool->tail = tail;
+	pool->pending += num_chunks;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	return count;
+}
+
+static void utxoes_cache_prefetch_wait(struct utxoes_cache * cache)
+{
+	assert(cache && cache->priv);
+	utxoes_cache_private_t * priv = cache->priv;
+	utxoes_cache_prefetch_pool_t * pool = priv->pool;
+	if(NULL == pool) return;
+	
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->pending > 0) pthread_cond_wait(&pool->idle_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * utxoes_cache_set_prefetch_threads:
+ * 	num_threads: the number of prefetch workers, < 0 = number of online cpus, 0 = no workers
+ */
+int utxoes_cache_set_prefetch_threads(utxoes_cache_t * cache, int num_threads)
+{
+	assert(cache && cache->priv);
+	utxoes_cache_private_t * priv = cache->priv;
+	
+	if(num_threads < 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	
+	prefetch_pool_free(priv->pool);
+	priv->pool = NULL;
+	if(num_threads <= 0) return 0;
+	
+	priv->pool = prefetch_pool_new(cache, num_threads);
+	return priv->pool?0:-1;
+}
+
+ssize_t utxoes_cache_prefetch_block(utxoes_cache_t * cache, const satoshi_block_t * block)
+{
+	assert(cache && block);
+	ssize_t count = 0;
+	for(ssize_t i = 0; i < block->txn_count; ++i) {
+		const satoshi_tx_t * tx = &block->txns[i];
+		if(tx->txin_count > 0 && !tx->txins[0].is_coinbase) count += tx->txin_count;
+	}
+	if(0 == count) return 0;
+	
+	satoshi_outpoint_t * outpoints = malloc(count * sizeof(*outpoints));
+	assert(outpoints);
+	count = 0;
+	for(ssize_t i = 0; i < block->txn_count; ++i) {
+		const satoshi_tx_t * tx = &block->txns[i];
+		if(tx->txin_count <= 0 || tx->txins[0].is_coinbase) continue;
+		for(ssize_t ii = 0; ii < tx->txin_count; ++ii) outpoints[count++] = tx->txins[ii].outpoint;
+	}
+	
+	count = cache->prefetch(cache, count, outpoints);
+	free(outpoints);
+	return count;
+}
+
+static int flush_unlocked(struct utxoes_cache * cache)
+{
+	int rc = 0;
+	utxoes_cache_private_t * priv = cache->priv;
+	utxoes_db_t * db = cache->db;
+	assert(db);
+	
+	db_engine_t * engine = cache->engine;
+	db_engine_txn_t * txn = NULL;
+	if(engine) {
+		txn = engine->txn_new(engine, NULL);
+		if(NULL == txn) return -1;
+	}
+	
+	// collect the dirty entries, and write them with bulk operations
+	ssize_t num_spent = 0, num_added = 0;
+	satoshi_outpoint_t * spent_outpoints = NULL;
+	satoshi_outpoint_t * added_outpoints = NULL;
+	db_record_utxo_t * added_utxoes = NULL;	// shallow copies, the scripts are still owned by the entries
+	if(priv->count > 0) {
+		spent_outpoints = malloc(priv->count * sizeof(*spent_outpoints));
+		added_outpoints = malloc(priv->count * sizeof(*added_outpoints));
+		added_utxoes = malloc(priv->count * sizeof(*added_utxoes));
+		assert(spent_outpoints && added_outpoints && added_utxoes);
+	}
+	
+	for(size_t i = 0; i < priv->num_buckets; ++i)
+	{
+		for(utxoes_cache_entry_t * entry = priv->buckets[i]; entry; entry = entry->next)
+		{
+			if(!(entry->flags & utxoes_cache_entry_flags_dirty)) continue;
+			if(entry->flags & utxoes_cache_entry_flags_spent) {
+				spent_outpoints[num_spent++] = entry->outpoint;
+				continue;
+			}
+			added_outpoints[num_added] = entry->outpoint;
+			added_utxoes[num_added++] = entry->utxo;
+		}
+	}
+	
+	rc = db->remove_many(db, txn, num_spent, spent_outpoints);	// not-found is not an error
+	if(0 == rc) rc = db->add_many(db, txn, num_added, added_outpoints, added_utxoes);
+	
+	free(spent_outpoints);
+	free(added_outpoints);
+	free(added_utxoes);
+	
+	if(txn) {
+		if(0 == rc) rc = txn->commit(txn, 0);
+		else txn->abort(txn);
+		engine->txn_free(engine, txn);
+	}
+	if(rc) return -1;
+	
+	clear_all(priv);
+	return 0;
+}
+
+static int utxoes_cache_flush(struct utxoes_cache * cache)
+{
+	assert(cache && cache->priv);
+	utxoes_cache_private_t * priv = cache->priv;
+	
+	pthread_mutex_lock(&priv->mutex);
+	int rc = flush_unlocked(cache);
+	pthread_mutex_unlock(&priv->mutex);
+	return rc;
+}
+
+static inline size_t get_memory_usage(utxoes_cache_private_t * priv)
+{
+	return priv->num_slabs * sizeof(struct utxoes_cache_slab) + priv->num_buckets * sizeof(*priv->buckets)
+		+ priv->heap_scripts_size;
+}
+
+static size_t utxoes_cache_get_memory_usage(struct utxoes_cache * cache)
+{
+	utxoes_cache_private_t * priv = cache->priv;
+	pthread_mutex_lock(&priv->mutex);
+	size_t usage = get_memory_usage(priv);
+	pthread_mutex_unlock(&priv->mutex);
+	return usage;
+}
+
+static int utxoes_cache_check_flush(struct utxoes_cache * cache)
+{
+	assert(cache && cache->priv);
+	utxoes_cache_private_t * priv = cache->priv;
+	
+	int rc = 0;
+	pthread_mutex_lock(&priv->mutex);
+	if(get_memory_usage(priv) > cache->max_memory) {
+		rc = flush_unlocked(cache);
+		if(0 == rc) rc = 1;
+	}
+	pthread_mutex_unlock(&priv->mutex);
+	return rc;
+}
+
+static ssize_t utxoes_cache_get_count(struct utxoes_cache * cache)
+{
+	utxoes_cache_private_t * priv = cache->priv;
+	return priv->count;
+}
+
+utxoes_cache_t * utxoes_cache_init(utxoes_cache_t * cache, utxoes_db_t * db, db_engine_t * engine, 
+	size_t max_memory,
+	void * user_data)
+{
+	if(NULL == cache) cache = calloc(1, sizeof(*cache));
+	assert(cache);
+	
+	if(0 == max_memory) max_memory = UTXOES_CACHE_DEFAULT_MAX_MEMORY;
+	cache->user_data = user_data;
+	cache->db = db;
+	cache->engine = engine;
+	cache->max_memory = max_memory;
+	
+	cache->add = utxoes_cache_add;
+	cache->remove = utxoes_cache_remove;
+	cache->find = utxoes_cache_find;
+	cache->prefetch = utxoes_cache_prefetch;
+	cache->prefetch_wait = utxoes_cache_prefetch_wait;
+	cache->flush = utxoes_cache_flush;
+	cache->check_flush = utxoes_cache_check_flush;
+	cache->get_memory_usage = utxoes_cache_get_memory_usage;
+	cache->get_count = utxoes_cache_get_count;
+	
+	utxoes_cache_private_t * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->cache = cache;
+	pthread_mutex_init(&priv->mutex, NULL);
+	buckets_resize(priv, UTXOES_CACHE_MIN_BUCKETS);
+	cache->priv = priv;
+	
+	return cache;
+}
+
+/**
+ * utxoes_cache_cleanup:
+ * 	unflushed changes are discarded, call flush() before cleanup to keep them.
+ */
+void utxoes_cache_cleanup(utxoes_cache_t * cache)
+{
+	if(NULL == cache) return;
+	utxoes_cache_private_t * priv = cache->priv;
+	if(priv) {
+		prefetch_pool_free(priv->pool);
+		priv->pool = NULL;
+		
+		release_all_scripts(priv);
+		struct utxoes_cache_slab * slab = priv->slabs;
+		while(slab) {
+			struct utxoes_cache_slab * next = slab->next;
+			free(slab);
+			slab = next;
+		}
+		free(priv->buckets);
+		pthread_mutex_destroy(&priv->mutex);
+		free(priv);
+		cache->priv = NULL;
+	}
+	return;
+}
+
+#if defined(_TEST_UTXOES_CACHE) && defined(_STAND_ALONE)
+/* a fake utxoes_db which records the writes */
+#define TEST_MAX_COINS (100)
+struct test_db
+{
+	ssize_t count;
+	satoshi_outpoint_t outpoints[TEST_MAX_COINS];
+	db_record_utxo_t utxoes[TEST_MAX_COINS];
+	
+	ssize_t num_adds;
+	ssize_t num_removes;
+	ssize_t num_bulk_writes;
+	ssize_t num_finds;
+};
+
+static ssize_t test_db_index(struct test_db * tdb, const satoshi_outpoint_t * outpoint)
+{
+	for(ssize_t i = 0; i < tdb->count; ++i) {
+		if(outpoint_equals(&tdb->outpoints[i], outpoint)) return i;
+	}
+	return -1;
+}
+
+static int test_db_add(struct utxoes_db * db, db_engine_txn_t * txn, 
+	const satoshi_outpoint_t * outpoint, const satoshi_txout_t * txout, int32_t height, int is_coinbase)
+{
+	struct test_db * tdb = db->user_data;
+	ssize_t index = test_db_index(tdb, outpoint);
+	if(index < 0) {
+		assert(tdb->count < TEST_MAX_COINS);
+		index = tdb->count++;
+	}
+	tdb->outpoints[index] = *outpoint;
+	db_record_utxo_cleanup(&tdb->utxoes[index]);
+	tdb->utxoes[index].value = txout->value;
+	tdb->utxoes[index].height = height;
+	tdb->utxoes[index].is_coinbase = is_coinbase;
+	tdb->utxoes[index].scripts = varstr_clone(txout->scripts);
+	++tdb->num_adds;
+	return 0;
+}
+
+static int test_db_remove(struct utxoes_db * db, db_engine_txn_t * txn, const satoshi_outpoint_t * outpoint)
+{
+	struct test_db * tdb = db->user_data;
+	ssize_t index = test_db_index(tdb, outpoint);
+	if(index < 0) return -1;
+	
+	--tdb->count;
+	db_record_utxo_cleanup(&tdb->utxoes[index]);
+	tdb->outpoints[index] = tdb->outpoints[tdb->count];
+	tdb->utxoes[index] = tdb->utxoes[tdb->count];
+	tdb->utxoes[tdb->count].scripts = NULL;
+	++tdb->num_removes;
+	return 0;
+}
+
+static int test_db_add_many(struct utxoes_db * db, db_engine_txn_t * txn, 
+	ssize_t count, const satoshi_outpoint_t outpoints[], const db_record_utxo_t utxoes[])
+{
+	struct test_db * tdb = db->user_data;
+	++tdb->num_bulk_writes;
+	for(ssize_t i = 0; i < count; ++i) {
+		satoshi_txout_t txout = { .value = utxoes[i].value, .scripts = utxoes[i].scripts };
+		test_db_add(db, txn, &outpoints[i], &txout, utxoes[i].height, utxoes[i].is_coinbase);
+	}
+	return 0;
+}
+
+static int test_db_remove_many(struct utxoes_db * db, db_engine_txn_t * txn, 
+	ssize_t count, const satoshi_outpoint_t outpoints[])
+{
+	struct test_db * tdb = db->user_data;
+	++tdb->num_bulk_writes;
+	for(ssize_t i = 0; i < count; ++i) test_db_remove(db, txn, &outpoints[i]);
+	return 0;
+}
+
+static ssize_t test_db_find(struct utxoes_db * db, db_engine_txn_t * txn, 
+	const satoshi_outpoint_t * outpoint, db_record_utxo_t ** p_utxo)
+{
+	struct test_db * tdb = db->user_data;
+	__sync_fetch_and_add(&tdb->num_finds, 1);
+	ssize_t index = test_db_index(tdb, outpoint);
+	if(index < 0) return 0;
+	db_record_utxo_t * utxo = *p_utxo;
+	*utxo = tdb->utxoes[index];
+	utxo->scripts = varstr_clone(utxo->scripts);
+	return 1;
+}
+
+int main(int argc, char ** argv)
+{
+	struct test_db tdb[1];
+	memset(tdb, 0, sizeof(tdb));
+	utxoes_db_t db[1] = {{
+		.user_data = tdb,
+		.add = test_db_add,
+		.add_many = test_db_add_many,
+		.remove = test_db_remove,
+		.remove_many = test_db_remove_many,
+		.find = test_db_find,
+	}};
+	
+	utxoes_cache_t * cache = utxoes_cache_init(NULL, db, NULL, 0, NULL);
+	assert(cache);
+	
+	unsigned char p2pkh[26] = { 25, 0x76, 0xa9, 0x14 };
+	satoshi_txout_t txout = { .value = 5000, .scripts = (varstr_t *)p2pkh };
+	const int32_t height = 100;
+	satoshi_outpoint_t outpoints[3];
+	memset(outpoints, 0, sizeof(outpoints));
+	for(int i = 0; i < 3; ++i) outpoints[i].prev_hash[0] = i + 1;
+	
+	db_record_utxo_t utxo[1];
+	db_record_utxo_t * p_utxo = utxo;
+	memset(utxo, 0, sizeof(utxo));
+	
+	// created and spent in the cache: never written
+	int rc = cache->add(cache, &outpoints[0], &txout, height, 0);
+	assert(0 == rc && cache->get_count(cache) == 1);
+	assert(1 == cache->find(cache, &outpoints[0], &p_utxo) && utxo->value == 5000 && utxo->height == height);
+	assert(0 == memcmp(utxo->scripts, p2pkh, sizeof(p2pkh)));
+	rc = cache->remove(cache, &outpoints[0], utxo);
+	assert(0 == rc && utxo->value == 5000);
+	assert(0 == cache->get_count(cache));
+	assert(-1 == cache->remove(cache, &outpoints[0], NULL));
+	
+	rc = cache->add(cache, &outpoints[1], &txout, height, 0);
+	rc = cache->add(cache, &outpoints[2], &txout, height, 0);
+	rc = cache->flush(cache);
+	assert(0 == rc && tdb->num_adds == 2 && tdb->num_removes == 0 && tdb->count == 2);
+	assert(tdb->num_bulk_writes == 2);	// one remove_many() and one add_many() per flush
+	assert(0 == cache->get_count(cache));
+	
+	// load from the db, then spend
+	assert(1 == cache->find(cache, &outpoints[1], &p_utxo) && utxo->value == 5000);
+	rc = cache->remove(cache, &outpoints[1], NULL);
+	assert(0 == rc);
+	assert(0 == cache->find(cache, &outpoints[1], &p_utxo));
+	assert(tdb->count == 2);	// not written yet
+	
+	// clean entries are not written
+	assert(1 == cache->find(cache, &outpoints[2], &p_utxo));
+	rc = cache->flush(cache);
+	assert(0 == rc && tdb->num_adds == 2 && tdb->num_removes == 1 && tdb->count == 1);
+	
+	// memory ceiling
+	cache->max_memory = 1;
+	rc = cache->add(cache, &outpoints[0], &txout, height, 0);
+	assert(1 == cache->check_flush(cache));
+	assert(tdb->num_adds == 3 && tdb->count == 2);
+	
+	// long scripts are kept on the heap
+	rc = cache->add(cache, &outpoints[1], &txout, height, 0);
+	rc = cache->remove(cache, &outpoints[1], NULL);
+	size_t usage = cache->get_memory_usage(cache);
+	
+	unsigned char multisig[72] = { 71, 0x51, 0x21 };
+	multisig[71] = 0xae;
+	satoshi_txout_t txout_long = { .value = 1000, .scripts = (varstr_t *)multisig };
+	rc = cache->add(cache, &outpoints[1], &txout_long, height + 1, 1);
+	assert(0 == rc && cache->get_memory_usage(cache) == usage + sizeof(multisig));
+	assert(1 == cache->find(cache, &outpoints[1], &p_utxo) && utxo->is_coinbase && utxo->height == height + 1);
+	assert(0 == memcmp(utxo->scripts, multisig, sizeof(multisig)));
+	rc = cache->remove(cache, &outpoints[1], utxo);
+	assert(0 == rc && cache->get_memory_usage(cache) == usage);
+	db_record_utxo_cleanup(utxo);
+	
+	// prefetch the prevouts of a block: outpoints[0] and [2] are in the db, [1] is in the cache only
+	rc = cache->flush(cache);
+	assert(0 == rc && tdb->count == 2);
+	rc = cache->add(cache, &outpoints[1], &txout, height, 0);
+	
+	rc = utxoes_cache_set_prefetch_threads(cache, 2);
+	assert(0 == rc);
+	satoshi_txin_t coinbase_in[1] = {{ .is_coinbase = 1 }};
+	satoshi_txin_t txins[3];
+	memset(txins, 0, sizeof(txins));
+	for(int i = 0; i < 3; ++i) txins[i].outpoint = outpoints[i];
+	satoshi_tx_t txns[2];
+	memset(txns, 0, sizeof(txns));
+	txns[0].txin_count = 1;
+	txns[0].txins = coinbase_in;
+	txns[1].txin_count = 3;
+	txns[1].txins = txins;
+	satoshi_block_t block[1];
+	memset(block, 0, sizeof(block));
+	block->txn_count = 2;
+	block->txns = txns;
+	
+	ssize_t num_finds = tdb->num_finds;
+	assert(3 == utxoes_cache_prefetch_block(cache, block));
+	cache->prefetch_wait(cache);
+	assert(tdb->num_finds == num_finds + 2);	// outpoints[1] was not looked up
+	assert(3 == cache->get_count(cache));
+	for(int i = 0; i < 3; ++i) {
+		assert(0 == cache->remove(cache, &outpoints[i], NULL));
+	}
+	assert(tdb->num_finds == num_finds + 2);	// all coins were in memory
+	
+	// without workers, prefetch() loads in the calling thread, and the cache stays authoritative
+	rc = utxoes_cache_set_prefetch_threads(cache, 0);
+	assert(0 == rc);
+	assert(0 == cache->prefetch(cache, 3, outpoints));	// the spent coins are not reloaded
+	rc = cache->flush(cache);
+	assert(0 == rc && tdb->count == 0);
+	
+	utxoes_cache_set_prefetch_threads(cache, 1);	// released by cleanup
+	utxoes_cache_cleanup(cache);
+	free(cache);
+	for(ssize_t i = 0; i < tdb->count; ++i) db_record_utxo_cleanup(&tdb->utxoes[i]);
+	printf("%s: all tests passed.\n", argv[0]);
+	return 0;
+}
+#endif
@@ -34,24 +34,265 @@
 #include "db_engine.h"
 #include "utxoes_db.h"
 
+/**
+ * VARINT: 
+ * 	MSB base-128 encoding, one-to-one mapping, 
+ * 	(compatible with the VARINT() in bitcoin-core's coins db)
+ */
+#define UTXO_VARINT_MAX_SIZE (10)
+static inline size_t utxo_varint_write(unsigned char * p, uint64_t n)
+{
+	unsigned char tmp[UTXO_VARINT_MAX_SIZE];
+	size_t length = 0;
+	while(1) {
+		tmp[length] = (n & 0x7F) | (length?0x80:0x00);
+		if(n <= 0x7F) break;
+		n = (n >> 7) - 1;
+		++length;
+	}
+	
+	size_t size = length + 1;
+	if(p) {
+		for(size_t i = 0; i < size; ++i) p[i] = tmp[length - i];
+	}
+	return size;
+}
+
+static inline const unsigned char * utxo_varint_read(const unsigned char * p, const unsigned char * p_end, uint64_t * value)
+{
+	uint64_t n = 0;
+	while(p < p_end) {
+		if(n > (UINT64_MAX >> 7)) return NULL;	// overflow
+		unsigned char ch = *p++;
+		n = (n << 7) | (ch & 0x7F);
+		if(!(ch & 0x80)) {
+			*value = n;
+			return p;
+		}
+		if(n == UINT64_MAX) return NULL;
+		++n;
+	}
+	return NULL;
+}
+
+uint64_t utxo_compress_amount(uint64_t n)
+{
+	if(0 == n) return 0;
+	int e = 0;
+	while(((n % 10) == 0) && e < 9) {
+		n /= 10;
+		++e;
+	}
+	if(e < 9) {
+		int d = (n % 10);
+		assert(d >= 1 && d <= 9);
+		n /= 10;
+		return 1 + (n * 9 + d - 1) * 10 + e;
+	}
+	return 1 + (n - 1) * 10 + 9;
+}
+
+uint64_t utxo_decompress_amount(uint64_t x)
+{
+	if(0 == x) return 0;
+	--x;
+	int e = x % 10;
+	x /= 10;
+	uint64_t n = 0;
+	if(e < 9) {
+		int d = (x % 9) + 1;
+		x /= 9;
+		n = x * 10 + d;
+	}else {
+		n = x + 1;
+	}
+	while(e) {
+		n *= 10;
+		--e;
+	}
+	return n;
+}
+
+/**
+ * utxo_script_is_witness: (bip141) 
+ * 	a witness program is a 1-byte push opcode (OP_0 .. OP_16) 
+ * 	followed by a data push between 2 and 40 bytes.
+ */
+int utxo_script_is_witness(const unsigned char * script, size_t length)
+{
+	if(length < 4 || length > 42) return 0;
+	if(script[0] != 0x00 && (script[0] < 0x51 || script[0] > 0x60)) return 0;
+	return ((size_t)script[1] + 2) == length;
+}
+
+/**
+ * compressed script templates
+ */
+enum utxo_script_type
+{
+	utxo_script_type_p2pkh = 0,		// OP_DUP OP_HASH160 <20> OP_EQUALVERIFY OP_CHECKSIG
+	utxo_script_type_p2sh = 1,		// OP_HASH160 <20> OP_EQUAL
+	utxo_script_type_p2wpkh = 2,	// OP_0 <20>
+	utxo_script_type_p2wsh = 3,		// OP_0 <32>
+	utxo_script_type_p2tr = 4,		// OP_1 <32>
+	utxo_script_types_count
+};
+#define UTXO_SCRIPT_RAW_TYPE_BASE (6)	// 0x05 is reserved
+
+
+static const struct
+{
+	size_t length;		// full script length
+	size_t offset;		// offset of the hash
+	size_t hash_size;
+	unsigned char prefix[3];
+	unsigned char suffix[2];
+}s_script_templates[utxo_script_types_count] = {
+	[utxo_script_type_p2pkh]  = { 25, 3, 20, {0x76, 0xa9, 0x14}, {0x88, 0xac} },
+	[utxo_script_type_p2sh]   = { 23, 2, 20, {0xa9, 0x14}, {0x87} },
+	[utxo_script_type_p2wpkh] = { 22, 2, 20, {0x00, 0x14}, },
+	[utxo_script_type_p2wsh]  = { 34, 2, 32, {0x00, 0x20}, },
+	[utxo_script_type_p2tr]   = { 34, 2, 32, {0x51, 0x20}, },
+};
+
+static int utxo_script_get_type(const unsigned char * script, size_t length)
+{
+	for(int type = 0; type < utxo_script_types_count; ++type) {
+		if(length != s_script_templates[type].length) continue;
+		size_t offset = s_script_templates[type].offset;
+		size_t suffix_size = length - offset - s_script_templates[type].hash_size;
+		if(memcmp(script, s_script_templates[type].prefix, offset)) continue;
+		if(memcmp(script + length - suffix_size, s_script_templates[type].suffix, suffix_size)) continue;
+		return type;
+	}
+	return -1;
+}
+
+void db_record_utxo_cleanup(db_record_utxo_t * utxo)
+{
+	if(NULL == utxo) return;
+	varstr_free(utxo->scripts);
+	utxo->scripts = NULL;
+	return;
+}
+
+/**
+ * db_record_utxo_serialize(): 
+ * 	@return the size of the compressed record. 
+ * 	if p_data is NULL, only the required buffer size is returned.
+ */
+ssize_t db_record_utxo_serialize(const db_record_utxo_t * utxo, unsigned char ** p_data)
+{
+	assert(utxo && utxo->scripts);
+	const unsigned char * script = varstr_getdata_ptr(utxo->scripts);
+	size_t script_length = varstr_length(utxo->scripts);
+	if(script_length > UTXOES_DB_MAX_SCRIPT_LENGTH) return -1;
+	
+	uint64_t amount = utxo_compress_amount((uint64_t)utxo->value);
+	int type = utxo_script_get_type(script, script_length);
+	
+	ssize_t cb_payload = sizeof(uint32_t) + 1 + utxo_varint_write(NULL, amount);
+	if(type >= 0) cb_payload += 1 + s_script_templates[type].hash_size;
+	else cb_payload += utxo_varint_write(NULL, script_length + UTXO_SCRIPT_RAW_TYPE_BASE) + script_length;
+	
+	if(NULL == p_data) return cb_payload;
+	
+	unsigned char * payload = *p_data;
+	if(NULL == payload) {
+		payload = malloc(cb_payload);
+		assert(payload);
+		*p_data = payload;
+	}
+	unsigned char * p = payload;
+	
+	// height: big-endian, the records can be sorted by height in the secondary db 
+	uint32_t height = (uint32_t)utxo->height;
+	*p++ = (height >> 24) & 0xff;
+	*p++ = (height >> 16) & 0xff;
+	*p++ = (height >> 8) & 0xff;
+	*p++ = height & 0xff;
+	
+	*p++ = utxo->is_coinbase?db_record_utxo_flags_coinbase:0;
+	p += utxo_varint_write(p, amount);
+	
+	if(type >= 0) {
+		*p++ = (unsigned char)type;
+		memcpy(p, script + s_script_templates[type].offset, s_script_templates[type].hash_size);
+		p += s_script_templates[type].hash_size;
+	}else {
+		p += utxo_varint_write(p, script_length + UTXO_SCRIPT_RAW_TYPE_BASE);
+		memcpy(p, script, script_length);
+		p += script_length;
+	}
+	assert((p - payload) == cb_payload);
+	return cb_payload;
+}
+
+ssize_t db_record_utxo_parse(db_record_utxo_t * utxo, ssize_t length, const void * data)
+{
+	assert(utxo && data);
+	const unsigned char * p = data;
+	const unsigned char * p_end = p + length;
+	if(length < (sizeof(uint32_t) + 3)) return -1;
+	
+	db_record_utxo_cleanup(utxo);
+	utxo->height = (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]);
+	p += sizeof(uint32_t);
+	utxo->is_coinbase = (*p++ & db_record_utxo_flags_coinbase)?1:0;
+	
+	uint64_t amount = 0;
+	p = utxo_varint_read(p, p_end, &amount);
+	if(NULL == p) return -1;
+	utxo->value = (int64_t)utxo_decompress_amount(amount);
+	
+	uint64_t type = 0;
+	p = utxo_varint_read(p, p_end, &type);
+	if(NULL == p) return -1;
+	
+	unsigned char script[UTXOES_DB_MAX_SCRIPT_LENGTH];
+	size_t script_length = 0;
+	if(type < utxo_script_types_count) {
+		size_t offset = s_script_templates[type].offset;
+		size_t hash_size = s_script_templates[type].hash_size;
+		script_length = s_script_templates[type].length;
+		if((p + hash_size) > p_end) return -1;
+		
+		memcpy(script, s_script_templates[type].prefix, offset);
+		memcpy(script + offset, p, hash_size);
+		memcpy(script + offset + hash_size, s_script_templates[type].suffix, script_length - offset - hash_size);
+		p += hash_size;
+	}else {
+		if(type < UTXO_SCRIPT_RAW_TYPE_BASE) return -1;	// reserved
+		script_length = type - UTXO_SCRIPT_RAW_TYPE_BASE;
+		if(script_length > UTXOES_DB_MAX_SCRIPT_LENGTH || script_length > (p_end - p)) return -1;
+		memcpy(script, p, script_length);
+		p += script_length;
+	}
+	
+	utxo->scripts = varstr_new(script, script_length);
+	assert(utxo->scripts);
+	utxo->is_witness = utxo_script_is_witness(script, script_length);
+	return (p - (unsigned char *)data);
+}
+
 typedef struct utxoes_db_private
 {
 	utxoes_db_t * db;
 	db_engine_t * engine;
 	
 	db_handle_t * utxoes;	// unspent tx outputs
-	db_handle_t * block_hashes_db;
-	db_handle_t * witness_flag_db;
+	db_handle_t * heights_db;
 	
 	db_handle_t * stxoes;	// spent tx outputs
+	db_handle_t * meta_db;	// format version
 	
 	char db_name[PATH_MAX];
-	char block_hashes_db_name[PATH_MAX];
-	char witness_flag_db_name[PATH_MAX];
+	char heights_db_name[PATH_MAX];
+	char meta_db_name[PATH_MAX];
 
 }utxoes_db_private_t;
 
-static ssize_t associate_block_hashes(db_handle_t * db, 
+static ssize_t associate_heights(db_handle_t * db, 
 	const db_record_data_t * key, 
 	const db_record_data_t * value, 
 	db_record_data_t ** p_result)
@@ -65,42 +306,65 @@ static ssize_t associate_block_hashes(db_handle_t * db,
 		*p_result = results;
 	}
 	
-	db_record_utxo_t * utxo = (db_record_utxo_t *)value->data;
-	assert(sizeof(*utxo) == value->size);
+	assert(value->size > sizeof(uint32_t));
 	
-	results[0].data = &utxo->block_hash;
-	results[0].size = sizeof(utxo->block_hash);
+	// the first 4 bytes of the record: big-endian height
+	results[0].data = value->data;
+	results[0].size = sizeof(uint32_t);
 	
 	return num_results;
 }
 
-static ssize_t associate_witness_flag(db_handle_t * db, 
-	const db_record_data_t * key, 
-	const db_record_data_t * value, 
-	db_record_data_t ** p_result)
+void utxoes_db_private_free(utxoes_db_private_t * priv);
+
+/**
+ * utxoes_db_check_version():
+ * 	the format version is stored in <name>_meta.db.
+ * 	A db without the version is only accepted (and marked as the current version) if it is empty,
+ * 	the records written by an older version can not be decoded by db_record_utxo_parse().
+ * @return 0 if the format is the current version
+ */
+#define UTXOES_DB_VERSION_KEY "format_version"
+static int utxoes_db_check_version(utxoes_db_private_t * priv)
 {
-	static const int num_results = 1;	
-	if(NULL == p_result) return num_results;	// returns the required array size for custom memory allocator
-	
-	db_record_data_t * results = * p_result;
-	if(NULL == results) {
-		results = calloc(num_results, sizeof(*results));
-		*p_result = results;
+	db_handle_t * meta_db = priv->meta_db;
+	db_record_data_t key = { .data = UTXOES_DB_VERSION_KEY, .size = sizeof(UTXOES_DB_VERSION_KEY) - 1 };
+	db_record_data_t value = { NULL };
+	
+	int rc = meta_db->get(meta_db, NULL, &key, &value);
+	if(rc < 0) return -1;
+	if(rc > 0) {
+		uint32_t version = 0;
+		if(value.size == sizeof(version)) memcpy(&version, value.data, sizeof(version));
+		if(version == UTXOES_DB_FORMAT_VERSION) return 0;
+		
+		fprintf(stderr, "[ERROR]::%s(): %s: unsupported format version %u (expected %u), please rebuild the utxoes db.\n", 
+			__FUNCTION__, priv->db_name, (unsigned int)version, UTXOES_DB_FORMAT_VERSION);
+		return -1;
 	}
 	
-	db_record_utxo_t * utxo = (db_record_utxo_t *)value->data;
-	assert(sizeof(*utxo) == value->size);
-	
-	results[0].data = &utxo->is_witness;
-	results[0].size = sizeof(utxo->is_witness) + sizeof(utxo->p2sh_flags);
+	// no version: a new db, or created by a version without the marker
+	db_cursor_t cursor[1];
+	memset(cursor, 0, sizeof(cursor));
+	db_cursor_init(cursor, priv->utxoes, NULL, 0);
+	int is_empty = (0 != cursor->first(cursor));
+	db_cursor_cleanup(cursor);
+	
+	if(!is_empty) {
+		fprintf(stderr, "[ERROR]::%s(): %s: legacy format (no version), please rebuild the utxoes db.\n", 
+			__FUNCTION__, priv->db_name);
+		return -1;
+	}
 	
-	return num_results;
+	uint32_t version = UTXOES_DB_FORMAT_VERSION;
+	return meta_db->insert(meta_db, NULL, &key, &(db_record_data_t){ .data = &version, .size = sizeof(version) });
 }
+#undef UTXOES_DB_VERSION_KEY
 
 utxoes_db_private_t * utxoes_db_private_new(utxoes_db_t * db, db_engine_t * engine, const char * db_name)
 {
-#define BLOCK_HASHES_DB_SUFFIX "_block_hashes.db"
-#define WITNESS_FLAG_DB_SUFFIX "_witness_flag.db"
+#define HEIGHTS_DB_SUFFIX "_heights.db"
+#define META_DB_SUFFIX "_meta.db"
 	int rc = -1;
 	assert(db && engine);
 	if(NULL == db_name) db_name = "utxoes.db";
@@ -113,26 +377,20 @@ utxoes_db_private_t * utxoes_db_private_new(utxoes_db_t * db, db_engine_t * engi
 	db->priv = priv;
 	
 	strncpy(priv->db_name, db_name, sizeof(priv->db_name));
-	strncpy(priv->block_hashes_db_name, db_name, sizeof(priv->block_hashes_db_name) - sizeof(BLOCK_HASHES_DB_SUFFIX));
-	strncpy(priv->witness_flag_db_name, db_name, sizeof(priv->witness_flag_db_name) - sizeof(WITNESS_FLAG_DB_SUFFIX));
+	strncpy(priv->heights_db_name, db_name, sizeof(priv->heights_db_name) - sizeof(HEIGHTS_DB_SUFFIX));
 	
+	char * p_ext = strstr(priv->heights_db_name, ".db");
+	if(NULL == p_ext) p_ext = priv->heights_db_name + strlen(priv->heights_db_name);
+	strcpy(p_ext, HEIGHTS_DB_SUFFIX);
 	
-	char * p_ext = strstr(priv->block_hashes_db_name, ".db");
-	if(NULL == p_ext) p_ext = priv->block_hashes_db_name + strlen(priv->block_hashes_db_name);
-	strcpy(p_ext, BLOCK_HASHES_DB_SUFFIX);
+	strncpy(priv->meta_db_name, db_name, sizeof(priv->meta_db_name) - sizeof(META_DB_SUFFIX));
+	p_ext = strstr(priv->meta_db_name, ".db");
+	if(NULL == p_ext) p_ext = priv->meta_db_name + strlen(priv->meta_db_name);
+	strcpy(p_ext, META_DB_SUFFIX);
 	
-	p_ext = strstr(priv->witness_flag_db_name, ".db");
-	if(NULL == p_ext) p_ext = priv->witness_flag_db_name + strlen(priv->witness_flag_db_name);
-	strcpy(p_ext, WITNESS_FLAG_DB_SUFFIX);
-	
-	
-	// open block_hashes.db
-	priv->block_hashes_db = engine->open_db(engine, priv->block_hashes_db_name, db_format_type_btree, db_flags_dup_sort);
-	assert(priv->block_hashes_db);
-	
-	// open witness_flags.db
-	priv->witness_flag_db = engine->open_db(engine, priv->witness_flag_db_name, db_format_type_btree, db_flags_dup_sort);
-	assert(priv->witness_flag_db);
+	// open heights.db
+	priv->heights_db = engine->open_db(engine, priv->heights_db_name, db_format_type_btree, db_flags_dup_sort);
+	assert(priv->heights_db);
 	
 	/**
 	 * open utxoes.db, 
@@ -143,19 +401,24 @@ utxoes_db_private_t * utxoes_db_private_new(utxoes_db_t * db, db_engine_t * engi
 	priv->utxoes = engine->open_db(engine, db_name, db_format_type_hash, 0); 
 	assert(priv->utxoes);
 
-	// sorted by 'block_hash'
-	rc = priv->utxoes->associate(priv->utxoes, NULL, priv->block_hashes_db, associate_block_hashes);
-	assert(0 == rc);
-	
-	// sorted by 'witness_flags'
-	rc = priv->utxoes->associate(priv->utxoes, NULL, priv->witness_flag_db, associate_witness_flag);
+	// sorted by 'height'
+	rc = priv->utxoes->associate(priv->utxoes, NULL, priv->heights_db, associate_heights);
 	assert(0 == rc);
 
 	priv->stxoes = engine->open_db(engine, "stxoes.db", db_format_type_hash, 0);
 	
+	priv->meta_db = engine->open_db(engine, priv->meta_db_name, db_format_type_btree, 0);
+	assert(priv->meta_db);
+	
+	rc = utxoes_db_check_version(priv);
+	if(rc) {
+		utxoes_db_private_free(priv);
+		db->priv = NULL;
+		return NULL;
+	}
 	return priv;
-#undef BLOCK_HASHES_DB_SUFFIX
-#undef WITNESS_FLAG_DB_SUFFIX
+#undef META_DB_SUFFIX
+#undef HEIGHTS_DB_SUFFIX
 }
 
 #ifndef db_private_close_db
@@ -176,9 +439,10 @@ void utxoes_db_private_free(utxoes_db_private_t * priv)
 	if(NULL == priv) return;
 	db_engine_t * engine = priv->engine;
 	if(engine) {
-		db_private_close_db(block_hashes_db);
-		db_private_close_db(witness_flag_db);
+		db_private_close_db(heights_db);
 		db_private_close_db(utxoes);
+		db_private_close_db(stxoes);
+		db_private_close_db(meta_db);
 	}
 	free(priv);
 	return;
@@ -187,99 +451,191 @@ void utxoes_db_private_free(utxoes_db_private_t * priv)
 static int utxoes_db_add(struct utxoes_db * db, db_engine_txn_t * txn, 
 	const satoshi_outpoint_t * outpoint,
 	const satoshi_txout_t * txout,
-	const uint256_t * block_hash
+	int32_t height,
+	int is_coinbase
 )
 {
 	int rc = -1;
-	assert(db && db->priv && outpoint && txout && block_hash);
+	assert(db && db->priv && outpoint && txout && txout->scripts);
 	utxoes_db_private_t * priv = db->priv;
 	db_handle_t * utxoes = priv->utxoes;
 	db_handle_t * stxoes = priv->stxoes;
 	assert(utxoes && stxoes);
 	
-	db_record_utxo_t utxo[1];
-	memset(utxo, 0, sizeof(utxo));
-	
-	ssize_t script_size = varstr_size(txout->scripts);
-	unsigned char * script_data = varstr_getdata_ptr(txout->scripts);
-	
-	if(script_size <= 0 || script_size > UTXOES_DB_MAX_SCRIPT_LENGTH) return -1;
-	
-	utxo->value = txout->value;
-	memcpy(utxo->scripts, txout->scripts, script_size);
+	db_record_utxo_t utxo[1] = {{
+		.value = txout->value,
+		.height = height,
+		.is_coinbase = is_coinbase?1:0,
+		.scripts = txout->scripts,	// borrowed
+	}};
 	
-	utxo->block_hash = *block_hash;
-	utxo->is_witness = (script_data[0] <= 16);	// bip141
+	ssize_t cb_record = db_record_utxo_serialize(utxo, NULL);
+	if(cb_record <= 0) return -1;
 	
+	unsigned char * record = malloc(cb_record);
+	assert(record);
+	db_record_utxo_serialize(utxo, &record);
 
 	rc = stxoes->del(stxoes, txn, &(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)});
 	rc = utxoes->insert(utxoes, txn, 
 		&(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)},
-		&(db_record_data_t){.data = (void *)utxo, .size = sizeof(utxo)}); 
+		&(db_record_data_t){.data = record, .size = cb_record}); 
+	free(record);
 	return rc;
 }
 
-static int utxoes_db_remove(struct utxoes_db * db, db_engine_txn_t * txn, const satoshi_outpoint_t * outpoint)
+static int utxoes_db_add_many(struct utxoes_db * db, db_engine_txn_t * txn, 
+	ssize_t count,
+	const satoshi_outpoint_t outpoints[],
+	const db_record_utxo_t utxoes[])
 {
 	int rc = -1;
-	assert(db && db->priv && outpoint);
+	assert(db && db->priv && (count >= 0));
+	if(count <= 0) return 0;
+	assert(outpoints && utxoes);
+	
+	utxoes_db_private_t * priv = db->priv;
+	assert(priv->utxoes && priv->stxoes);
+	
+	db_record_data_t * keys = calloc(count * 2, sizeof(*keys));
+	assert(keys);
+	db_record_data_t * values = keys + count;
+	
+	// serialize all records into a single buffer
+	size_t total_size = 0;
+	for(ssize_t i = 0; i < count; ++i) {
+		ssize_t cb = db_record_utxo_serialize(&utxoes[i], NULL);
+		if(cb <= 0) {
+			free(keys);
+			return -1;
+		}
+		values[i].size = cb;
+		total_size += cb;
+	}
+	
+	unsigned char * records = malloc(total_size);
+	assert(records);
+	unsigned char * p = records;
+	for(ssize_t i = 0; i < count; ++i) {
+		keys[i].data = (void *)&outpoints[i];
+		keys[i].size = sizeof(outpoints[i]);
+		values[i].data = p;
+		db_record_utxo_serialize(&utxoes[i], &p);
+		p += values[i].size;
+	}
+	assert(p == records + total_size);
+	
+	rc = priv->stxoes->del_many(priv->stxoes, txn, count, keys);
+	if(0 == rc) rc = priv->utxoes->insert_many(priv->utxoes, txn, count, keys, values);
+	
+	free(records);
+	free(keys);
+	return rc;
+}
+
+/**
+ * remove_many: 
+ * 	move the records from utxoes.db to stxoes.db, the missing outpoints are skipped.
+ */
+static int utxoes_db_remove_many(struct utxoes_db * db, db_engine_txn_t * txn, 
+	ssize_t count,
+	const satoshi_outpoint_t outpoints[])
+{
+	int rc = -1;
+	assert(db && db->priv && (count >= 0));
+	if(count <= 0) return 0;
+	assert(outpoints);
+	
 	utxoes_db_private_t * priv = db->priv;
 	db_handle_t * utxoes = priv->utxoes;
 	db_handle_t * stxoes = priv->stxoes;
 	assert(utxoes && stxoes);
 	
-	db_record_utxo_t * utxo = NULL;
-	db_record_data_t * values = NULL;
-	
+	db_record_data_t * keys = calloc(count * 2, sizeof(*keys));
+	assert(keys);
+	db_record_data_t * values = keys + count;
+	for(ssize_t i = 0; i < count; ++i) {
+		keys[i].data = (void *)&outpoints[i];
+		keys[i].size = sizeof(outpoints[i]);
+	}
 	
-	ssize_t count = utxoes->find(utxoes, txn, 
-		&(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)},
-		&values); 
-	if(count != 1) return -1;
+	ssize_t num_found = utxoes->find_many(utxoes, txn, count, keys, values, NULL, 0);
+	if(num_found < 0) {
+		free(keys);
+		return -1;
+	}
 	
-	assert(values->size == sizeof(*utxo));
-	utxo = values->data;
+	// compact the found records
+	ssize_t n = 0;
+	for(ssize_t i = 0; i < count; ++i) {
+		if(NULL == values[i].data) continue;
+		keys[n] = keys[i];
+		values[n++] = values[i];
+	}
+	assert(n == num_found);
 	
-	rc = utxoes->del(utxoes, txn, &(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)});
-	rc = stxoes->insert(stxoes, txn, 
-		&(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)},
-		&(db_record_data_t){.data = (void *)utxo, .size = sizeof(utxo)}); 
-
-	db_record_data_cleanup(values);
-	free(values);
+	rc = utxoes->del_many(utxoes, txn, n, keys);
+	if(0 == rc) rc = stxoes->insert_many(stxoes, txn, n, keys, values);
 	
+	for(ssize_t i = 0; i < n; ++i) db_record_data_cleanup(&values[i]);
+	free(keys);
 	return rc;
 }
 
-static int utxoes_db_remove_block(struct utxoes_db * db, db_engine_txn_t * txn, const uint256_t * block_hash)
+static int utxoes_db_remove(struct utxoes_db * db, db_engine_txn_t * txn, const satoshi_outpoint_t * outpoint)
 {
 	int rc = -1;
-	assert(db && db->priv && block_hash);
+	assert(db && db->priv && outpoint);
 	utxoes_db_private_t * priv = db->priv;
 	db_handle_t * utxoes = priv->utxoes;
 	db_handle_t * stxoes = priv->stxoes;
 	assert(utxoes && stxoes);
 	
-	satoshi_outpoint_t * outpoints = NULL;
-	db_record_utxo_t * records = NULL;
+	db_record_data_t value[1];
+	memset(value, 0, sizeof(value));
+	rc = utxoes->get(utxoes, txn, 
+		&(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)},
+		value); 
+	if(rc != 1) return -1;
 	
+	// move the (compressed) record to stxoes.db as is
+	rc = utxoes->del(utxoes, txn, &(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)});
+	if(0 == rc) rc = stxoes->insert(stxoes, txn, 
+		&(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)},
+		value); 
+	return rc;
+}
+
+static int utxoes_db_remove_at_height(struct utxoes_db * db, db_engine_txn_t * txn, int32_t height)
+{
+	int rc = -1;
+	assert(db && db->priv);
+	utxoes_db_private_t * priv = db->priv;
+	db_handle_t * utxoes = priv->utxoes;
+	db_handle_t * stxoes = priv->stxoes;
+	db_handle_t * heights_db = priv->heights_db;
+	assert(utxoes && stxoes && heights_db);
 	
-	ssize_t count = db->find_in_block(db, txn, block_hash, &outpoints, &records);
+	unsigned char be_height[4] = { (height >> 24) & 0xff, (height >> 16) & 0xff, (height >> 8) & 0xff, height & 0xff };
+	db_record_data_t * keys = NULL;
+	db_record_data_t * values = NULL;
+	ssize_t count = heights_db->find_secondary(heights_db, txn, 
+		&(db_record_data_t){.data = be_height, .size = sizeof(be_height)},
+		&keys, &values);
 	if(count <= 0) return -1;
 	
-	
 	for(ssize_t i = 0; i < count; ++i) {
-		db_record_utxo_t * utxo = &records[i];
-		satoshi_outpoint_t * outpoint = &outpoints[i];
-		rc = utxoes->del(utxoes, txn, &(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)});
-		rc = stxoes->insert(stxoes, txn, 
-			&(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)},
-			&(db_record_data_t){.data = (void *)utxo, .size = sizeof(utxo)}); 
+		rc = utxoes->del(utxoes, txn, &keys[i]);
+		if(0 == rc) rc = stxoes->insert(stxoes, txn, &keys[i], &values[i]); 
 		if(rc) break;
 	}
 	
-	free(outpoints);
-	free(records);
+	for(ssize_t i = 0; i < count; ++i) {
+		db_record_data_cleanup(&keys[i]);
+		db_record_data_cleanup(&values[i]);
+	}
+	free(keys);
+	free(values);
 	return rc;
 }
 
@@ -291,13 +647,13 @@ static ssize_t utxoes_db_find(struct utxoes_db * db, db_engine_txn_t * txn,
 	db_handle_t * utxoes = priv->utxoes;
 	assert(utxoes);
 	
-	db_record_data_t * value = NULL;
-	ssize_t count = utxoes->find(utxoes, txn, 
+	// the value is borrowed from the db handle and parsed in place
+	db_record_data_t value[1];
+	memset(value, 0, sizeof(value));
+	ssize_t count = utxoes->get(utxoes, txn, 
 		&(db_record_data_t){.data = (void *)outpoint, .size = sizeof(*outpoint)},
-		&value); 
+		value); 
 	if(count <= 0) return count;
-	assert(count == 1);
-	assert(value->size == sizeof(db_record_utxo_t));
 	
 	db_record_utxo_t * utxo = *p_utxo;
 	if(NULL == utxo) {
@@ -306,35 +662,78 @@ static ssize_t utxoes_db_find(struct utxoes_db * db, db_engine_txn_t * txn,
 		*p_utxo = utxo;
 	}
 
-	memcpy(utxo, value->data, value->size);
-	
-	db_record_data_cleanup(value);
-	free(value);
+	ssize_t cb = db_record_utxo_parse(utxo, value->size, value->data);
+	if(cb != value->size) count = -1;
 	return count;
 }
 	
-static ssize_t utxoes_db_find_in_block(struct utxoes_db * db, db_engine_txn_t * txn, 
-	const uint256_t * block_hash, 
+#define UTXOES_DB_AVG_RECORD_SIZE (64)
+static ssize_t utxoes_db_find_many(struct utxoes_db * db, db_engine_txn_t * txn, 
+	ssize_t count, const satoshi_outpoint_t outpoints[],
+	db_record_utxo_t utxoes[])
+{
+	assert(db && db->priv && (count >= 0));
+	if(count <= 0) return 0;
+	assert(outpoints && utxoes);
+	
+	utxoes_db_private_t * priv = db->priv;
+	db_handle_t * utxoes_db = priv->utxoes;
+	assert(utxoes_db);
+	
+	db_record_data_t * keys = calloc(count, sizeof(*keys));
+	db_record_data_t * values = calloc(count, sizeof(*values));
+	size_t buffer_size = count * UTXOES_DB_AVG_RECORD_SIZE;
+	void * buffer = malloc(buffer_size);
+	assert(keys && values && buffer);
+	
+	for(ssize_t i = 0; i < count; ++i) {
+		keys[i].data = (void *)&outpoints[i];
+		keys[i].size = sizeof(outpoints[i]);
+	}
+	
+	ssize_t num_found = utxoes_db->find_many(utxoes_db, txn, count, keys, values, buffer, buffer_size);
+	for(ssize_t i = 0; i < count; ++i) {
+		memset(&utxoes[i], 0, sizeof(utxoes[i]));
+		if(NULL == values[i].data) continue;
+		if(num_found > 0) {
+			ssize_t cb = db_record_utxo_parse(&utxoes[i], values[i].size, values[i].data);
+			if(cb != values[i].size) num_found = -1;
+		}
+		db_record_data_cleanup(&values[i]);
+	}
+	if(num_found < 0) {
+		for(ssize_t i = 0; i < count; ++i) db_record_utxo_cleanup(&utxoes[i]);
+	}
+	
+	free(buffer);
+	free(values);
+	free(keys);
+	return num_found;
+}
+#undef UTXOES_DB_AVG_RECORD_SIZE
+
+static ssize_t utxoes_db_find_at_height(struct utxoes_db * db, db_engine_txn_t * txn, 
+	int32_t height, 
 	satoshi_outpoint_t ** p_outpoints,
 	db_record_utxo_t ** p_utxoes)
 {
 	ssize_t count = 0;
 	utxoes_db_private_t * priv = db->priv;
-	db_handle_t * group_by_block_hashes = priv->block_hashes_db;
-	assert(group_by_block_hashes);
+	db_handle_t * heights_db = priv->heights_db;
+	assert(heights_db);
 	
+	unsigned char be_height[4] = { (height >> 24) & 0xff, (height >> 16) & 0xff, (height >> 8) & 0xff, height & 0xff };
 	db_record_data_t * keys = NULL;
 	db_record_data_t * values = NULL;
-	count = group_by_block_hashes->find_secondary(group_by_block_hashes, txn, 
-		&(db_record_data_t){.data = (void *)block_hash, .size = sizeof(*block_hash)},
+	count = heights_db->find_secondary(heights_db, txn, 
+		&(db_record_data_t){.data = be_height, .size = sizeof(be_height)},
 		&keys, &values);
 	
 	if(count <= 0) goto label_final;
 
-
 	satoshi_outpoint_t * outpoints = *p_outpoints;
 	db_record_utxo_t * records = *p_utxoes;
-	assert(NULL == outpoints && records);
+	assert(NULL == outpoints && NULL == records);
 
 	outpoints = calloc(count, sizeof(*outpoints));
 	records = calloc(count, sizeof(*records));
@@ -344,9 +743,9 @@ static ssize_t utxoes_db_find_in_block(struct utxoes_db * db, db_engine_txn_t *
 	
 	for(ssize_t i = 0; i < count; ++i) {
 		assert(keys[i].size == sizeof(satoshi_outpoint_t));
-		assert(values[i].size == sizeof(db_record_utxo_t));
 		memcpy(&outpoints[i], keys[i].data, keys[i].size); 
-		memcpy(&records[i], values[i].data, values[i].size); 
+		ssize_t cb = db_record_utxo_parse(&records[i], values[i].size, values[i].data);
+		assert(cb == values[i].size);
 	}
 	
 label_final:
@@ -369,21 +768,28 @@ static ssize_t utxoes_db_find_in_tx(struct utxoes_db * db, db_engine_txn_t * txn
 
 utxoes_db_t * utxoes_db_init(utxoes_db_t * db, db_engine_t * engine, const char * db_name, void * user_data)
 {
+	int db_allocated = (NULL == db);
 	if(NULL == db) db = calloc(1, sizeof(*db));
 	assert(db);
 	
 	db->user_data = user_data;
 	
 	db->add = utxoes_db_add;
+	db->add_many = utxoes_db_add_many;
 	db->remove = utxoes_db_remove;
-	db->remove_block = utxoes_db_remove_block;
+	db->remove_many = utxoes_db_remove_many;
+	db->remove_at_height = utxoes_db_remove_at_height;
 	db->find = utxoes_db_find;
-	db->find_in_block = utxoes_db_find_in_block;
+	db->find_many = utxoes_db_find_many;
+	db->find_at_height = utxoes_db_find_at_height;
 	db->find_in_tx = utxoes_db_find_in_tx;
 	
 	utxoes_db_private_t * priv = utxoes_db_private_new(db, engine, db_name);
-	assert(priv && db->priv == priv);
-	
+	if(NULL == priv) {	// unsupported format
+		if(db_allocated) free(db);
+		return NULL;
+	}
+	assert(db->priv == priv);
 	return db;
 }
 void utxoes_db_cleanup(utxoes_db_t * db)
@@ -396,9 +802,140 @@ void utxoes_db_cleanup(utxoes_db_t * db)
 
 
 #if defined(_TEST_UTXOES_DB) && defined(_STAND_ALONE)
+static void test_record_codec(const unsigned char * script, size_t length, int64_t value, ssize_t expected_size)
+{
+	db_record_utxo_t utxo[1] = {{
+		.value = value,
+		.height = 700000,
+		.is_coinbase = 1,
+		.scripts = varstr_new(script, length),
+	}};
+	
+	unsigned char * data = NULL;
+	ssize_t cb = db_record_utxo_serialize(utxo, &data);
+	assert(cb > 0 && data);
+	if(expected_size > 0) assert(cb == expected_size);
+	
+	db_record_utxo_t decoded[1];
+	memset(decoded, 0, sizeof(decoded));
+	assert(cb == db_record_utxo_parse(decoded, cb, data));
+	assert(decoded->value == value && decoded->height == 700000 && decoded->is_coinbase);
+	assert(varstr_size(decoded->scripts) == varstr_size(utxo->scripts));
+	assert(0 == memcmp(decoded->scripts, utxo->scripts, varstr_size(utxo->scripts)));
+	assert(decoded->is_witness == utxo_script_is_witness(script, length));
+	
+	// truncated records
+	for(ssize_t i = 0; i < cb; ++i) assert(db_record_utxo_parse(decoded, i, data) < 0);
+	
+	db_record_utxo_cleanup(decoded);
+	db_record_utxo_cleanup(utxo);
+	free(data);
+}
+
+static void test_format_version(void)
+{
+	db_engine_t * engine = db_engine_init_with_backend(NULL, db_engine_backend_mem, NULL, NULL);
+	assert(engine);
+	
+	// a new db is marked with the current version, and can be opened again
+	utxoes_db_t * db = utxoes_db_init(NULL, engine, "test_utxoes.db", NULL);
+	assert(db);
+	unsigned char script[25] = { 0x76, 0xa9, 0x14, [23] = 0x88, [24] = 0xac };
+	satoshi_txout_t txout[1] = {{ .value = 100, .scripts = varstr_new(script, sizeof(script)) }};
+	satoshi_outpoint_t outpoint = { .index = 1 };
+	assert(0 == db->add(db, NULL, &outpoint, txout, 100, 0));
+	utxoes_db_cleanup(db);
+	free(db);
+	
+	db = utxoes_db_init(NULL, engine, "test_utxoes.db", NULL);
+	assert(db);
+	utxoes_db_cleanup(db);
+	free(db);
+	
+	// another version
+	db_handle_t * meta_db = engine->open_db(engine, "test_utxoes_meta.db", db_format_type_btree, 0);
+	assert(meta_db);
+	uint32_t version = UTXOES_DB_FORMAT_VERSION - 1;
+	assert(0 == meta_db->update(meta_db, NULL, 
+		&(db_record_data_t){ .data = "format_version", .size = sizeof("format_version") - 1 },
+		&(db_record_data_t){ .data = &version, .size = sizeof(version) }));
+	engine->close_db(engine, meta_db);
+	db_handle_cleanup(meta_db);
+	free(meta_db);
+	assert(NULL == utxoes_db_init(NULL, engine, "test_utxoes.db", NULL));
+	
+	// a legacy db (records without the version)
+	db_handle_t * legacy_db = engine->open_db(engine, "legacy_utxoes.db", db_format_type_hash, 0);
+	assert(legacy_db);
+	unsigned char legacy_record[80 + 8 + 32 + 4] = { 0 };
+	assert(0 == legacy_db->insert(legacy_db, NULL, 
+		&(db_record_data_t){ .data = &outpoint, .size = sizeof(outpoint) },
+		&(db_record_data_t){ .data = legacy_record, .size = sizeof(legacy_record) }));
+	engine->close_db(engine, legacy_db);
+	db_handle_cleanup(legacy_db);
+	free(legacy_db);
+	assert(NULL == utxoes_db_init(NULL, engine, "legacy_utxoes.db", NULL));
+	
+	varstr_free(txout->scripts);
+	db_engine_cleanup(engine);
+}
+
 int main(int argc, char **argv)
 {
+	test_format_version();
+	
+	// amount compression
+	static const uint64_t amounts[] = { 0, 1, 10, 546, 50 * 100000000ULL, 21000000 * 100000000ULL, 123456789, 1000000000000ULL };
+	for(size_t i = 0; i < sizeof(amounts) / sizeof(amounts[0]); ++i) {
+		assert(utxo_decompress_amount(utxo_compress_amount(amounts[i])) == amounts[i]);
+	}
+	assert(utxo_compress_amount(50 * 100000000ULL) == 0x32);	// 1 BTC * 50 --> 1 byte VARINT
+	for(uint64_t x = 0; x < 100000; ++x) assert(utxo_compress_amount(utxo_decompress_amount(x)) == x);
+	
+	// VARINT
+	static const uint64_t values[] = { 0, 0x7f, 0x80, 0x407f, 0x4080, UINT32_MAX, UINT64_MAX };
+	for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+		unsigned char buf[UTXO_VARINT_MAX_SIZE];
+		size_t size = utxo_varint_write(buf, values[i]);
+		uint64_t value = 0;
+		assert(utxo_varint_read(buf, buf + size, &value) == buf + size && value == values[i]);
+		assert(NULL == utxo_varint_read(buf, buf + size - 1, &value));
+	}
 	
+	// script templates: [height(4)][flags(1)][amount(1)][type(1)][hash]
+	unsigned char script[100];
+	memset(script, 0x5a, sizeof(script));
+	
+	memcpy(script, (unsigned char []){0x76, 0xa9, 0x14}, 3); script[23] = 0x88; script[24] = 0xac;
+	test_record_codec(script, 25, 5000000000LL, 4 + 1 + 1 + 1 + 20);	// p2pkh
+	memcpy(script, (unsigned char []){0xa9, 0x14}, 2); script[22] = 0x87;
+	test_record_codec(script, 23, 12345, -1);	// p2sh
+	memcpy(script, (unsigned char []){0x00, 0x14}, 2);
+	test_record_codec(script, 22, 1, 4 + 1 + 1 + 1 + 20);	// p2wpkh
+	memcpy(script, (unsigned char []){0x00, 0x20}, 2);
+	test_record_codec(script, 34, 0, 4 + 1 + 1 + 1 + 32);	// p2wsh
+	memcpy(script, (unsigned char []){0x51, 0x20}, 2);
+	test_record_codec(script, 34, 330, -1);	// p2tr
+	
+	// non-standard scripts are stored as is
+	memset(script, 0x5a, sizeof(script));
+	script[0] = 0x6a;
+	test_record_codec(script, 40, 0, 4 + 1 + 1 + 1 + 40);	// op_return
+	test_record_codec(script, 0, 0, 4 + 1 + 1 + 1);
+	memcpy(script, (unsigned char []){0x76, 0xa9, 0x14}, 3); script[23] = 0x88; script[24] = 0xab;
+	test_record_codec(script, 25, 100, 4 + 1 + 1 + 1 + 25);
+	memset(script, 0x5a, sizeof(script));
+	test_record_codec(script, sizeof(script), 100, 4 + 1 + 1 + 1 + sizeof(script));
+	
+	unsigned char * long_script = calloc(1, UTXOES_DB_MAX_SCRIPT_LENGTH + 1);
+	assert(long_script);
+	test_record_codec(long_script, UTXOES_DB_MAX_SCRIPT_LENGTH, 100, 4 + 1 + 1 + 2 + UTXOES_DB_MAX_SCRIPT_LENGTH);
+	db_record_utxo_t utxo[1] = {{ .scripts = varstr_new(long_script, UTXOES_DB_MAX_SCRIPT_LENGTH + 1) }};
+	assert(db_record_utxo_serialize(utxo, NULL) < 0);
+	db_record_utxo_cleanup(utxo);
+	free(long_script);
+	
+	printf("%s: all tests passed.\n", argv[0]);
 	return 0;
 }
 #endif
@@ -78,7 +78,7 @@ void block_info_dump_BFS(block_info_t * root)
 	while(queue->length > 0)
 	{
 		block_info_t * node = queue->leave(queue);
-		printf("\t info.id = %d, cumulative_difficulty = 0x%.8x\n", node->id, node->cumulative_difficulty.bits);
+		printf("\t info.id = %d, cumulative_difficulty = %.0f\n", node->id, uint256_int_to_double(&node->cumulative_difficulty));
 		if(node->id == last_id_of_current_level)
 		{
 			
@@ -101,12 +101,7 @@ void block_info_dump_BFS(block_info_t * root)
 
 #define NUM_BLOCK_INFO	(10)
 static block_info_t * blocks[NUM_BLOCK_INFO];
-static void * s_search_root;
-
-static int search_by_id(const block_info_t * a, const block_info_t * b)
-{
-	return a->id - b->id;
-}
+static block_hash_index_t s_search_index[1];
 static void init_blocks()
 {
 	for(int i = 0; i < NUM_BLOCK_INFO; ++i)
@@ -119,7 +114,7 @@ static void init_blocks()
 	#ifdef _DEBUG
 		blocks[i]->id = i;
 	#endif
-		tsearch(blocks[i], &s_search_root, (int (*)(const void *, const void *))search_by_id); 
+		block_hash_index_add(s_search_index, &blocks[i]->hash, (intptr_t)blocks[i]);
 	}
 	
 	/**
@@ -158,7 +153,7 @@ int test_block_info(void)
 	block_info_t * heir = NULL;
 	
 	block_info_update_cumulative_difficulty(blocks[0], 
-		(compact_uint256_t){.bits = 0 },	// blocks[0] is the genesis block and has no parent 
+		uint256_int_zero,	// blocks[0] is the genesis block and has no parent 
 		&heir
 	);
 	
@@ -189,45 +184,26 @@ int test_block_info(void)
 #undef NUM_BLOCK_INFO
 }
 
-void dump_search_tree(const void * nodep, 
-	const VISIT which,
-	const int depth)
-{
-	static const char white_chars[] = 
-		"                                " "                                "
-		"                                " "                                "
-		"                                " "                                "
-		"                                " "                                ";
-	
-	block_info_t * info;
-	switch(which)
-	{
-	case preorder: case endorder: break;
-	case postorder: case leaf:
-		info = *(block_info_t **)nodep;
-	//	printf("depth: %d, id = %d\n", depth, info->id);
-		printf("%.*s (%d)\n", depth * 4, white_chars, info->id);
-		break; 
-	}
-} 
-
 void test_active_chain(void)
 {
 	active_chain_t * chain = calloc(1, sizeof(*chain));
 	assert(chain);
 	
-	chain->p_search_root = &s_search_root;
+	chain->p_search_index = s_search_index;
 	block_info_add_child(chain->head, blocks[0]);
 	
-	// dump search-tree
-	twalk(s_search_root, dump_search_tree);
+	// dump search-index
+	for(size_t i = 0; i <= s_search_index->mask; ++i) {
+		if(s_search_index->slots[i].value) printf(" (%d)\n", ((block_info_t *)s_search_index->slots[i].value)->id);
+	}
 	
 	active_chain_free(chain);
-	assert(s_search_root == NULL);
+	assert(s_search_index->count == 0);
 }
 
 int main(int argc, char ** argv)
 {
+	block_hash_index_init(s_search_index, NUM_BLOCK_INFO, block_info_get_hash, NULL);
 	init_blocks();
 	test_block_info();
 	test_active_chain();
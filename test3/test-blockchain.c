@@ -410,16 +410,16 @@ void refresh_main_chain(shell_context_t * shell, blockchain_t * main_chain)
 	
 	GtkTreeIter iter;
 	
-	const blockchain_heir_t * heirs = main_chain->heirs;
+	const struct blockchain_heirs * heirs = main_chain->heirs;
 	for(int i = 0; i <= main_chain->height; ++i)
 	{
 		gtk_list_store_append(store, &iter);
 		gtk_list_store_set(store, &iter, 
 			main_chain_column_height, i,
-			main_chain_column_hash, (gpointer)&heirs[i].hash,
-			main_chain_column_bits, heirs[i].bits,
-			main_chain_column_difficulty_accum, heirs[i].cumulative_difficulty.bits,
-			main_chain_column_timestamp, heirs[i].timestamp,
+			main_chain_column_hash, (gpointer)&heirs->hashes[i],
+			main_chain_column_bits, heirs->bits[i],
+			main_chain_column_difficulty_accum, (guint)heirs->cumulative_difficulties[i].limbs[0],
+			main_chain_column_timestamp, heirs->timestamps[i],
 			main_chain_column_nonce, s_block_hdrs[i].nonce,
 			-1);
 	}
@@ -438,9 +438,9 @@ int shell_init(shell_context_t * shell, void * jconfig)
 	}
 	
 	for(int i = 1; i <= main_chain->height; ++i) {
-		printf("-- heirs[%d]: timestamp=%d, diffculty_accum=0x%.8x\n", i, 
-			(int)main_chain->heirs[i].timestamp,
-			main_chain->heirs[i].cumulative_difficulty.bits
+		printf("-- heirs[%d]: timestamp=%d, diffculty_accum=%.0f\n", i, 
+			(int)main_chain->heirs->timestamps[i],
+			uint256_int_to_double(&main_chain->heirs->cumulative_difficulties[i])
 			);
 	}
 	
@@ -484,7 +484,7 @@ static void randomize_indices(int indices[], ssize_t size)
 }
 
 
-block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, blockchain_heir_t * parent);
+block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, ssize_t height);
 
 #include <search.h>
 
@@ -531,10 +531,6 @@ static void dump_block_info(const void * nodep,
 
 void block_info_dump_BFS(block_info_t * root);
 
-static void no_free(void *p)
-{
-	
-}
 static int test_random_adding(shell_context_t * shell, void * user_data)
 {
 	assert(shell && user_data);
@@ -551,8 +547,8 @@ static int test_random_adding(shell_context_t * shell, void * user_data)
 		randomize_indices(indices, MAX_HEIGHT);
 		memset(shell->indices_selected, 0, sizeof(shell->indices_selected));
 		
-		block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, blockchain_heir_t * parent);
-		blockchain_abandon_inheritances(chain, &chain->heirs[0]);
+		block_info_t * blockchain_abandon_inheritances(blockchain_t * chain, ssize_t height);
+		blockchain_abandon_inheritances(chain, 0);
 		assert(0 == chain->height);
 		
 		active_chain_list_t * list = chain->candidates_list;
@@ -560,18 +556,9 @@ static int test_random_adding(shell_context_t * shell, void * user_data)
 		
 		debug_printf("current height: %d\n", (int)chain->height);
 		
-		printf("-- chain->search-root: %p\n", chain->search_root);
-		if(chain->search_root) {
-			//	twalk(chain->search_root, dump_heir_info);
-		}
-		
-		printf("-- list->search-root: %p\n", list->search_root);
-		if(list->search_root) {
-		//	twalk(list->search_root, dump_block_info);
-			tdestroy(list->search_root, no_free);
-		}
-		list->search_root = NULL;
-	//	assert(NULL == list->search_root);
+		printf("-- chain->search-index: count=%d\n", (int)chain->search_index->count);
+		printf("-- list->search-index: count=%d\n", (int)list->search_index->count);
+		assert(0 == list->search_index->count);
 	}
 	
 	shell->indices_selected[indices[last_index]] = 1;
@@ -723,7 +710,12 @@ static void on_summary(shell_context_t * shell, blockchain_t * main_chain)
 	s_action_param.iter = &iter;
 	
 	active_chain_list_t * list = main_chain->candidates_list;
-	twalk(list->search_root, search_tree_node_on_write);
+	block_hash_index_t * index = list->search_index;
+	for(size_t i = 0; index->slots && i <= index->mask; ++i) {
+		if(0 == index->slots[i].value) continue;
+		block_info_t * info = (block_info_t *)index->slots[i].value;
+		search_tree_node_on_write(&info, leaf, 0);
+	}
 	gtk_text_view_set_buffer(GTK_TEXT_VIEW(shell->logview), buffer);
 	
 	s_action_param.buffer = NULL;
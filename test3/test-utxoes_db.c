@@ -130,10 +130,14 @@ void bitcoin_blockchain_cleanup(bitcoin_blockchain_t * bchain);
 // ui
 #include <gtk/gtk.h>
 
+#define UTXO_DATA_MAX_SCRIPT_LENGTH (80)	// longer scripts are truncated (display only)
 struct utxo_data
 {
 	satoshi_outpoint_t outpoint;
-	db_record_utxo_t utxo;
+	db_record_utxo_t utxo;		// utxo.scripts is not used, see scripts[]
+	uint256_t block_hash;
+	size_t scripts_length;
+	unsigned char scripts[UTXO_DATA_MAX_SCRIPT_LENGTH];
 };
 
 typedef struct shell_context
@@ -364,8 +368,8 @@ static void on_set_utxo_cell_data(GtkTreeViewColumn * col,
 			g_object_set(cr, "text", sz_text, NULL);
 			break;
 		case UTXO_TREE_COLUMN_SCRIPTS:
-			cb = bin2hex(&udata->utxo.scripts, udata->utxo.scripts[0], &p_hex);
-			assert(cb >= 0 && cb <= (UTXOES_DB_MAX_SCRIPT_LENGTH * 2));
+			cb = bin2hex(udata->scripts, udata->scripts_length, &p_hex);
+			assert(cb >= 0 && cb <= (UTXO_DATA_MAX_SCRIPT_LENGTH * 2));
 			break;
 		default:
 			return;
@@ -439,8 +443,8 @@ static inline int find_parent(GtkTreeStore * store, GtkTreeIter * parent, uint25
 	
 	if(!ok) {
 		gtk_tree_store_append(store, parent, NULL);
-		gtk_tree_store_set(store, parent, UTXO_TREE_COLUMN_BLOCK_HASH, (void *)&udata->utxo.block_hash, -1);
-		memcpy(prev_hash, &udata->utxo.block_hash, sizeof(*prev_hash));
+		gtk_tree_store_set(store, parent, UTXO_TREE_COLUMN_BLOCK_HASH, (void *)&udata->block_hash, -1);
+		memcpy(prev_hash, &udata->block_hash, sizeof(*prev_hash));
 	}
 	return 0;
 }
@@ -484,7 +488,7 @@ static int shell_add_utxo(shell_context_t * shell, const struct utxo_data * udat
 	debug_printf("add utxo: txid=(0x%.8x...), index=%d, block_hash=(0x%.8x...)",
 		be32toh(*(uint32_t *)udata->outpoint.prev_hash),
 		udata->outpoint.index,
-		be32toh(*(uint32_t *)&udata->utxo.block_hash));
+		be32toh(*(uint32_t *)&udata->block_hash));
 	struct utxo_data * utxoes = shell->utxoes;
 	assert(utxoes);
 	
@@ -666,18 +670,21 @@ static int on_add_block(struct blockchain * chain, const uint256_t * hash, const
 			satoshi_txout_t * txout = &tx->txouts[ii];
 			memcpy(&outpoint.prev_hash, tx->txid, 32);
 			outpoint.index = (int32_t)ii;
-			utxo_db->add(utxo_db, db_txn, &outpoint, txout, hash);
+			utxo_db->add(utxo_db, db_txn, &outpoint, txout, height, (i == 0));
 			
 			struct utxo_data udata = {
 				.outpoint = outpoint, 
 				.utxo = {
 					.value = txout->value,
-					.block_hash = *hash,
-				}
+					.height = height,
+					.is_coinbase = (i == 0),
+				},
+				.block_hash = *hash,
 			};
-			ssize_t cb_scripts = varstr_size(txout->scripts);
-			assert(cb_scripts <= UTXOES_DB_MAX_SCRIPT_LENGTH);
-			memcpy(udata.utxo.scripts, txout->scripts, cb_scripts);
+			size_t cb_scripts = varstr_length(txout->scripts);
+			if(cb_scripts > UTXO_DATA_MAX_SCRIPT_LENGTH) cb_scripts = UTXO_DATA_MAX_SCRIPT_LENGTH;
+			memcpy(udata.scripts, varstr_getdata_ptr(txout->scripts), cb_scripts);
+			udata.scripts_length = cb_scripts;
 			
 			shell_log_printf(shell, "on_add_utxo: (%.8x...) - %.4d\n", 
 				be32toh(*(uint32_t *)outpoint.prev_hash),
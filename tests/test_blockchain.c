@@ -462,7 +462,7 @@ static int on_remove_block(struct blockchain * chain, const uint256_t * block_ha
 	
 	// rollback utxo_db
 	utxoes_db_t * utxo_db = ctx->utxo_db;
-	utxo_db->remove_block(utxo_db, txn, block_hash);
+	utxo_db->remove_at_height(utxo_db, txn, height);
 	
 	return 0;
 }
@@ -526,7 +526,7 @@ static int on_add_block(struct blockchain * chain, const uint256_t * block_hash,
 			
 			satoshi_txout_t * txout = &txouts[ii];
 			outpoint->index = (int32_t)ii;
-			utxo_db->add(utxo_db, txn, outpoint, txout, &block->hash);
+			utxo_db->add(utxo_db, txn, outpoint, txout, height, (i == 0));
 		}
 		
 	}
@@ -42,6 +42,8 @@
 
 void test_uint256(void);
 void test_parse_blocks(void);
+void test_parse_blocks_mt(void);
+void test_witness_commitment(void);
 
 void test_blockchain_load_data();
 
@@ -50,6 +52,8 @@ int main(int argc, char **argv)
 {
 	test_uint256();
 	test_parse_blocks();
+	test_parse_blocks_mt();
+	test_witness_commitment();
 	
 	test_blockchain_load_data(NULL, NULL, 0);
 	return 0;
@@ -183,6 +187,37 @@ void test_parse_blocks(void)
 	
 	dump_line("block_hash(big-endian)", &block->hash, 32); 
 	
+	// parse with a per-block arena, the arena is reused across blocks
+	satoshi_arena_t arena[1];
+	memset(arena, 0, sizeof(arena));
+	satoshi_arena_init(arena, 0);
+	for(int i = 0; i < 3; ++i)
+	{
+		satoshi_block_t arena_block[1];
+		memset(arena_block, 0, sizeof(arena_block));
+		arena_block->arena = arena;
+		
+		cb = satoshi_block_parse(arena_block, cb_block, block_data);
+		assert(cb == cb_block);
+		assert(arena_block->txn_count == block->txn_count);
+		for(ssize_t ii = 0; ii < block->txn_count; ++ii)
+		{
+			assert(0 == memcmp(arena_block->txns[ii].txid, block->txns[ii].txid, 32));
+		}
+		satoshi_block_cleanup(arena_block);
+		satoshi_arena_reset(arena);
+	}
+	satoshi_arena_cleanup(arena);
+	
+	// heap-allocated arena
+	satoshi_arena_t * heap_arena = satoshi_arena_init(NULL, 1024);
+	assert(heap_arena && heap_arena->chunks);
+	void * p = satoshi_arena_alloc(heap_arena, 4096);	// larger than chunk_size
+	assert(p);
+	satoshi_arena_reset(heap_arena);
+	assert(heap_arena->chunk_size >= 4096);
+	satoshi_arena_free(heap_arena);
+	
 	free(block_data);
 	free(output);
 	free(output_hex);
@@ -192,6 +227,186 @@ void test_parse_blocks(void)
 	return;
 }
 
+void test_parse_blocks_mt(void)
+{
+	// build a (low difficulty) block with 1000 copies of a legacy tx
+	const char * tx_hex = 
+		"0100000001032e38e9c0a84c6046d687d10556dcacc41d275ec55fc00779ac88fdf357a187000000008c493046022100c352d3dd993a981beba4a63ad15c2092"
+		"75ca9470abfcd57da93b58e4eb5dce82022100840792bc1f456062819f15d33ee7055cf7b5ee1af1ebcc6028d9cdb1c3af7748014104f46db5e9d61a9dc27b8d"
+		"64ad23e7383a4e6ca164593c2527c038c0857eb67ee8e825dca65046b82c9331586c82e0fd1f633f25f87c161bc6f8a630121df2b3d3ffffffff0200e32321"
+		"000000001976a914c398efa9c392ba6013c5e04ee729755ef7f58b3288ac000fe208010000001976a914948c765a6914d43f2a7ac177da2c2f6b52de3d7c88"
+		"ac00000000";
+	const ssize_t txn_count = 5000;	// wide enough to hash the merkle layers in parallel
+	
+	unsigned char * tx_data = NULL;
+	ssize_t cb_tx = hex2bin(tx_hex, strlen(tx_hex), (void **)&tx_data);
+	assert(cb_tx > 0 && tx_data);
+	
+	ssize_t cb_block = sizeof(struct satoshi_block_header) + varint_calc_size(txn_count) + cb_tx * txn_count;
+	unsigned char * block_data = calloc(1, cb_block);
+	assert(block_data);
+	
+	struct satoshi_block_header * hdr = (struct satoshi_block_header *)block_data;
+	hdr->version = 1;
+	hdr->bits = 0x1f00ffff;
+	
+	unsigned char * p = block_data + sizeof(*hdr);
+	varint_set((varint_t *)p, txn_count);
+	p += varint_calc_size(txn_count);
+	
+	uint256_t txid;
+	hash256(tx_data, cb_tx, (unsigned char *)&txid);
+	uint256_merkle_tree_t * mtree = uint256_merkle_tree_new(txn_count, NULL);
+	for(ssize_t i = 0; i < txn_count; ++i, p += cb_tx) {
+		memcpy(p, tx_data, cb_tx);
+		mtree->add(mtree, 1, &txid);
+	}
+	mtree->recalc(mtree, 0, -1);
+	memcpy(hdr->merkle_root, &mtree->merkle_root, 32);
+	uint256_merkle_tree_free(mtree);
+	
+	uint256_t hash;
+	do {
+		++hdr->nonce;
+		hash256(hdr, sizeof(*hdr), (unsigned char *)&hash);
+	}while(uint256_compare_with_compact(&hash, (compact_uint256_t *)&hdr->bits) > 0);
+	
+	satoshi_block_t block[1];
+	memset(block, 0, sizeof(block));
+	ssize_t cb = 0;
+	for(int round = 0; round < 3; ++round) {	// the parse and merkle thread pools are reused across blocks
+		cb = satoshi_block_parse_mt(block, cb_block, block_data, 4);
+		assert(cb == cb_block);
+		assert(block->txn_count == txn_count);
+		for(ssize_t i = 0; i < txn_count; ++i) {
+			assert(0 == memcmp(block->txns[i].txid, &txid, 32));
+		}
+		satoshi_block_cleanup(block);
+	}
+	
+	// truncated payload
+	satoshi_parser_abort_on_error = 0;
+	cb = satoshi_block_parse_mt(block, cb_block - 1, block_data, 4);
+	assert(cb == -1);
+	satoshi_parser_abort_on_error = 1;
+	
+	free(tx_data);
+	free(block_data);
+	return;
+}
+
+static void update_block_header(struct satoshi_block_header * hdr, const uint256_t * txid0, const uint256_t * txid1)
+{
+	uint256_t data[2] = { *txid0, *txid1 };
+	hash256(data, 64, (unsigned char *)hdr->merkle_root);
+	
+	uint256_t hash;
+	hdr->nonce = 0;
+	do {
+		++hdr->nonce;
+		hash256(hdr, sizeof(*hdr), (unsigned char *)&hash);
+	}while(uint256_compare_with_compact(&hash, (compact_uint256_t *)&hdr->bits) > 0);
+}
+
+void test_witness_commitment(void)
+{
+	// build a (low difficulty) segwit block: { coinbase, segwit_tx }
+	const char * coinbase_hex = 
+		"01000000" "0001"
+		"01"
+			"0000000000000000000000000000000000000000000000000000000000000000ffffffff"
+			"03" "01a086"
+			"ffffffff"
+		"02"
+			"00f2052a01000000" "19" "76a914c398efa9c392ba6013c5e04ee729755ef7f58b3288ac"
+			"0000000000000000" "26" "6a24aa21a9ed" "0000000000000000000000000000000000000000000000000000000000000000"
+		"01" "20" "0000000000000000000000000000000000000000000000000000000000000000"	// witness reserved value
+		"00000000";
+	const char * segwit_tx_hex = 
+		"01000000" "0001"
+		"01"
+			"032e38e9c0a84c6046d687d10556dcacc41d275ec55fc00779ac88fdf357a18700000000"
+			"00"
+			"ffffffff"
+		"01"
+			"00e1f50500000000" "16" "0014948c765a6914d43f2a7ac177da2c2f6b52de3d7c"
+		"02" "02abcd" "03010203"
+		"00000000";
+	
+	unsigned char * coinbase_data = NULL;
+	unsigned char * tx_data = NULL;
+	ssize_t cb_coinbase = hex2bin(coinbase_hex, strlen(coinbase_hex), (void **)&coinbase_data);
+	ssize_t cb_tx = hex2bin(segwit_tx_hex, strlen(segwit_tx_hex), (void **)&tx_data);
+	assert(cb_coinbase > 0 && cb_tx > 0);
+	
+	satoshi_tx_t txns[2];
+	memset(txns, 0, sizeof(txns));
+	assert(cb_tx == satoshi_tx_parse(&txns[1], cb_tx, tx_data));
+	assert(txns[1].has_flag);
+	
+	// commitment = hash256(witness_merkle_root || witness_reserved_value)
+	uint256_t data[2];
+	memset(data, 0, sizeof(data));
+	data[1] = txns[1].wtxid[0];
+	hash256(data, 64, (unsigned char *)&data[0]);	// witness_merkle_root of { 0, wtxid }
+	memset(&data[1], 0, 32);
+	
+	unsigned char * commitment = NULL;
+	for(ssize_t i = 0; i < cb_coinbase - 6; ++i) {
+		if(0 == memcmp(coinbase_data + i, "\x6a\x24\xaa\x21\xa9\xed", 6)) {
+			commitment = coinbase_data + i + 6;
+			break;
+		}
+	}
+	assert(commitment);
+	hash256(data, 64, commitment);
+	assert(cb_coinbase == satoshi_tx_parse(&txns[0], cb_coinbase, coinbase_data));
+	
+	ssize_t cb_block = sizeof(struct satoshi_block_header) + 1 + cb_coinbase + cb_tx;
+	unsigned char * block_data = calloc(1, cb_block);
+	assert(block_data);
+	
+	struct satoshi_block_header * hdr = (struct satoshi_block_header *)block_data;
+	hdr->version = 0x20000000;
+	hdr->bits = 0x1f00ffff;
+	unsigned char * p = block_data + sizeof(*hdr);
+	*p++ = 2;	// txn_count
+	memcpy(p, coinbase_data, cb_coinbase); p += cb_coinbase;
+	memcpy(p, tx_data, cb_tx); p += cb_tx;
+	update_block_header(hdr, txns[0].txid, txns[1].txid);
+	
+	satoshi_block_t block[1];
+	memset(block, 0, sizeof(block));
+	block->parse_flags = satoshi_block_parse_flags_verify_witness_commitment;
+	ssize_t cb = satoshi_block_parse(block, cb_block, block_data);
+	assert(cb == cb_block);
+	satoshi_block_cleanup(block);
+	
+	// a mismatched commitment is only detected when the verification is enabled
+	satoshi_parser_abort_on_error = 0;
+	p = block_data + sizeof(*hdr) + 1;
+	p[commitment - coinbase_data] ^= 0xff;
+	satoshi_tx_cleanup(&txns[0]);
+	assert(cb_coinbase == satoshi_tx_parse(&txns[0], cb_coinbase, p));
+	update_block_header(hdr, txns[0].txid, txns[1].txid);
+	
+	cb = satoshi_block_parse(block, cb_block, block_data);
+	assert(cb == -1);
+	
+	block->parse_flags = 0;
+	cb = satoshi_block_parse(block, cb_block, block_data);
+	assert(cb == cb_block);
+	satoshi_block_cleanup(block);
+	satoshi_parser_abort_on_error = 1;
+	
+	satoshi_tx_cleanup(&txns[0]);
+	satoshi_tx_cleanup(&txns[1]);
+	free(coinbase_data);
+	free(tx_data);
+	free(block_data);
+	return;
+}
+
 static ssize_t load_data(const char * filename, unsigned char ** p_data)
 {
 	ssize_t cb = 0;
@@ -336,17 +551,17 @@ void test_blockchain_load_data(const char * data_dir, const char * file_prefix,
 void blockchain_dump(blockchain_t * main_chain)
 {
 	printf("==== BLOCKCHAIN height: %d ====\n", (int)main_chain->height);
-	printf("max_cumulative_difficulty: 0x%.8x\n", main_chain->heirs[main_chain->height].cumulative_difficulty.bits);
+	const struct blockchain_heirs * heirs = main_chain->heirs;
+	printf("max_cumulative_difficulty: %.0f\n", uint256_int_to_double(&heirs->cumulative_difficulties[main_chain->height]));
 	for(int i = 0; i <= main_chain->height; ++i)
 	{
-		blockchain_heir_t * heir = &main_chain->heirs[i];
 		printf("\t" "heirs[%d]: (0x%.8x...), "
 			"bits=0x%.8x, "
-			"cumulative_difficulty=0x%.8x\n", 
+			"cumulative_difficulty=%.0f\n", 
 			i,
-			be32toh(*(uint32_t *)&heir->hash),
-			heir->bits,
-			heir->cumulative_difficulty.bits
+			be32toh(*(uint32_t *)&heirs->hashes[i]),
+			heirs->bits[i],
+			uint256_int_to_double(&heirs->cumulative_difficulties[i])
 			); 
 	}
 	
@@ -361,9 +576,9 @@ void blockchain_dump(blockchain_t * main_chain)
 		assert(chain);
 	
 		printf("\t" "head: 0x%.8x...\n", be32toh(*(uint32_t *)&chain->head->hash)); 
-		const blockchain_heir_t * parent = main_chain->find(main_chain, &chain->head->hash);
+		ssize_t parent_height = main_chain->find(main_chain, &chain->head->hash, NULL);
 		
-		if(parent) printf("\t" "parent height: %Zd\n", parent - main_chain->heirs);
+		if(parent_height >= 0) printf("\t" "parent height: %Zd\n", parent_height);
 		
 		block_info_t * child = chain->head->first_child;
 		int index = 0;
@@ -371,10 +586,10 @@ void blockchain_dump(blockchain_t * main_chain)
 		{
 			printf("\t" "child %d: "
 				"hash: (0x%.8x...), "
-				"cumulative_difficulty = 0x%.8x\n", 
+				"cumulative_difficulty = %.0f\n", 
 				index++, 
 				be32toh(*(uint32_t *)&child->hash), 
-				child->cumulative_difficulty.bits);
+				uint256_int_to_double(&child->cumulative_difficulty));
 			child = child->first_child;
 		}
 		